@@ -0,0 +1,386 @@
+/*
+ * SEI merge benchmark on synthetic Annex B access units.
+ *
+ * For every codec of the descriptor table, a main access unit (AUD,
+ * parameter sets, slices) and an enhancement payload are generated once,
+ * then merged over and over:
+ *   - "merge":   merge_lcevc_data() called directly
+ *   - "element": lvcompositor driven through GstHarness (caps, pairing,
+ *                aggregator thread included)
+ * Reported per frame: time, bytes written outside the input memories
+ * (SEI header, escaped copies) and memory allocations.
+ */
+#include <gst/gst.h>
+#include <gst/check/gstharness.h>
+#include <string.h>
+
+#include "gstlvcompositor.h"
+#include "codec_desc.h"
+#include "nal_utils.h"
+#include "sei_merge.h"
+
+static gint frames = 20000;
+static gint au_size = 20000;
+static gint payload_size = 2000;
+static gint zero_percent = 0;
+static gchar *codec_filter = NULL;
+static gchar *mode_filter = NULL;
+static gboolean t35 = FALSE;
+
+static GOptionEntry entries[] = {
+    { "frames", 'n', 0, G_OPTION_ARG_INT, &frames, "Access units per run", "N" },
+    { "au-size", 'a', 0, G_OPTION_ARG_INT, &au_size, "Main access unit size in bytes", "BYTES" },
+    { "payload-size", 'p', 0, G_OPTION_ARG_INT, &payload_size, "Enhancement payload size in bytes", "BYTES" },
+    { "zero-percent", 'z', 0, G_OPTION_ARG_INT, &zero_percent,
+      "Share of zero bytes in the payload, > 0 makes emulation prevention kick in", "PERCENT" },
+    { "codec", 'c', 0, G_OPTION_ARG_STRING, &codec_filter, "Only this codec (H264, H265, H266, EVC)", "NAME" },
+    { "mode", 'm', 0, G_OPTION_ARG_STRING, &mode_filter, "Only this mode (merge, element)", "NAME" },
+    { "t35", 't', 0, G_OPTION_ARG_NONE, &t35, "Write T.35 registered SEIs instead of unregistered ones", NULL },
+    { NULL }
+};
+
+/* Default allocator counting the memories it hands out */
+typedef struct {
+    GstAllocator parent;
+} BenchAllocator;
+
+typedef struct {
+    GstAllocatorClass parent_class;
+} BenchAllocatorClass;
+
+static GType bench_allocator_get_type(void);
+G_DEFINE_TYPE(BenchAllocator, bench_allocator, GST_TYPE_ALLOCATOR)
+
+static GstAllocator *sysmem_allocator;
+static gint allocations;
+
+static GstMemory *
+bench_allocator_alloc(GstAllocator *allocator, gsize size, GstAllocationParams *params)
+{
+    g_atomic_int_inc(&allocations);
+    return gst_allocator_alloc(sysmem_allocator, size, params);
+}
+
+static void
+bench_allocator_free(GstAllocator *allocator, GstMemory *memory)
+{
+    /* Memories belong to the system allocator, never reached */
+    g_assert_not_reached();
+}
+
+static void
+bench_allocator_class_init(BenchAllocatorClass *klass)
+{
+    GstAllocatorClass *allocator_class = GST_ALLOCATOR_CLASS(klass);
+
+    allocator_class->alloc = bench_allocator_alloc;
+    allocator_class->free = bench_allocator_free;
+}
+
+static void
+bench_allocator_init(BenchAllocator *self)
+{
+    GST_ALLOCATOR_CAST(self)->mem_type = "BenchMemory";
+}
+
+/* Synthetic bitstream */
+
+static void
+write_nal_header(const GstLvCodecDesc *desc, guint8 type, guint8 *data)
+{
+    switch (desc->codec) {
+        case CODEC_H264:
+            data[0] = 0x60 | type;
+            break;
+        case CODEC_H265:
+            data[0] = type << 1;
+            data[1] = 0x01;
+            break;
+        case CODEC_H266:
+            data[0] = 0x00;
+            data[1] = (type << 3) | 0x01;
+            break;
+        case CODEC_EVC:
+            data[0] = (guint8)((type + 1) << 1);
+            data[1] = 0x00;
+            break;
+        default:
+            break;
+    }
+}
+
+/* Random bytes without any 00 00 0x pattern, except zero_percent zeros */
+static void
+fill_payload(guint8 *data, gsize size, gint zeros, GRand *rand)
+{
+    gsize i;
+
+    for (i = 0; i < size; i++) {
+        data[i] = g_rand_int_range(rand, 0, 100) < zeros ? 0x00 : (guint8)g_rand_int_range(rand, 4, 256);
+    }
+}
+
+static gsize
+append_nal(GByteArray *au, const GstLvCodecDesc *desc, guint8 type, gsize body_size, GRand *rand)
+{
+    guint8 start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
+    guint8 header[2];
+    guint offset;
+
+    write_nal_header(desc, type, header);
+    g_byte_array_append(au, start_code, sizeof(start_code));
+    g_byte_array_append(au, header, desc->nal_header_size);
+
+    offset = au->len;
+    g_byte_array_set_size(au, au->len + body_size);
+    fill_payload(au->data + offset, body_size, 0, rand);
+    if (codec_desc_is_vcl(desc, type) && body_size > 0) {
+        au->data[offset] |= desc->first_slice_mask;
+    }
+
+    return body_size + sizeof(start_code) + desc->nal_header_size;
+}
+
+static GstMemory *
+make_main_au(const GstLvCodecDesc *desc, gsize size, GRand *rand)
+{
+    GByteArray *au = g_byte_array_new();
+    guint8 type;
+    gsize used = 0;
+    guint au_len;
+    guint8 *data;
+
+    if (desc->aud_type != NAL_TYPE_NONE) {
+        used += append_nal(au, desc, desc->aud_type, 1, rand);
+    }
+    for (type = 0; type < 64; type++) {
+        if (codec_desc_is_type(desc->parameter_set_types, type)) {
+            used += append_nal(au, desc, type, 16, rand);
+        }
+    }
+    append_nal(au, desc, desc->vcl_first, size > used + 6 ? size - used - 6 : 1, rand);
+
+    au_len = au->len;
+    data = g_byte_array_free(au, FALSE);
+
+    return gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY, data, au_len, 0, au_len, data, g_free);
+}
+
+static GstMemory *
+make_payload(gsize size, GRand *rand)
+{
+    guint8 *data = g_malloc(size);
+
+    fill_payload(data, size, zero_percent, rand);
+    return gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY, data, size, 0, size, data, g_free);
+}
+
+/* Input buffers share the prebuilt memories, nothing is allocated for them */
+static GstBuffer *
+wrap_memory(GstMemory *memory, gint frame)
+{
+    GstBuffer *buffer = gst_buffer_new();
+
+    gst_buffer_append_memory(buffer, gst_memory_ref(memory));
+    GST_BUFFER_PTS(buffer) = GST_BUFFER_DTS(buffer) = frame * 40 * GST_MSECOND;
+    GST_BUFFER_DURATION(buffer) = 40 * GST_MSECOND;
+
+    return buffer;
+}
+
+static gboolean
+memory_is_shared(GstMemory *memory, GstMemory *main_memory, GstMemory *payload_memory)
+{
+    for (; memory; memory = memory->parent) {
+        if (memory == main_memory || memory == payload_memory) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* Bytes of the output not referencing the input memories */
+static gsize
+written_bytes(GstBuffer *buffer, GstMemory *main_memory, GstMemory *payload_memory)
+{
+    gsize written = 0;
+    guint i;
+
+    for (i = 0; i < gst_buffer_n_memory(buffer); i++) {
+        GstMemory *memory = gst_buffer_peek_memory(buffer, i);
+
+        if (!memory_is_shared(memory, main_memory, payload_memory)) {
+            written += gst_memory_get_sizes(memory, NULL, NULL);
+        }
+    }
+
+    return written;
+}
+
+static void
+report(const GstLvCodecDesc *desc, const gchar *mode, gint64 elapsed_us, guint64 written, gint allocs)
+{
+    gdouble ns_per_frame = (gdouble)elapsed_us * 1000.0 / frames;
+
+    g_print("%-5s %-8s au=%d payload=%d: %10.0f frames/s %9.0f ns/frame %8.1f B written/frame "
+            "%6.2f allocs/frame\n",
+            desc->name, mode, au_size, payload_size,
+            ns_per_frame > 0 ? 1e9 / ns_per_frame : 0.0, ns_per_frame,
+            (gdouble)written / frames, (gdouble)allocs / frames);
+}
+
+static gboolean
+bench_merge(const GstLvCodecDesc *desc, GstMemory *main_memory, GstMemory *payload_memory)
+{
+    GstLvSeiWriter writer;
+    guint8 uuid[SEI_UUID_SIZE];
+    guint64 written = 0;
+    gint64 start;
+    gint i;
+
+    sei_uuid_resolve("lcevc", uuid);
+    if (!sei_writer_init(&writer, desc, t35 ? SEI_TYPE_REGISTERED_T35 : SEI_TYPE_UNREGISTERED,
+                         uuid, SEI_POSITION_PREFIX, 0)) {
+        return FALSE;
+    }
+
+    g_atomic_int_set(&allocations, 0);
+    start = g_get_monotonic_time();
+
+    for (i = 0; i < frames; i++) {
+        GstBuffer *main_buffer = wrap_memory(main_memory, i);
+        GstBuffer *payload = wrap_memory(payload_memory, i);
+        GstBuffer *merged = merge_lcevc_data(&writer, main_buffer, payload);
+
+        if (!merged) {
+            g_printerr("%s: merge failed\n", desc->name);
+            gst_buffer_unref(main_buffer);
+            gst_buffer_unref(payload);
+            sei_writer_clear(&writer);
+            return FALSE;
+        }
+        written += written_bytes(merged, main_memory, payload_memory);
+        gst_buffer_unref(merged);
+        gst_buffer_unref(main_buffer);
+        gst_buffer_unref(payload);
+    }
+
+    report(desc, "merge", g_get_monotonic_time() - start, written, g_atomic_int_get(&allocations));
+    sei_writer_clear(&writer);
+
+    return TRUE;
+}
+
+static gboolean
+bench_element(const GstLvCodecDesc *desc, GstMemory *main_memory, GstMemory *payload_memory)
+{
+    GstHarness *main_harness;
+    GstHarness *secondary_harness;
+    gchar *caps;
+    guint64 written = 0;
+    gint64 start;
+    gint i;
+
+    main_harness = gst_harness_new_with_padnames("lvcompositor", "sink_main", "src");
+    secondary_harness = gst_harness_new_with_element(main_harness->element, "sink_secondary", NULL);
+    gst_util_set_object_arg(G_OBJECT(main_harness->element), "sei-type",
+                            t35 ? "registered-t35" : "unregistered");
+
+    caps = g_strdup_printf("%s, stream-format=(string)byte-stream, alignment=(string)au", desc->caps_name);
+    gst_harness_set_src_caps_str(main_harness, caps);
+    g_free(caps);
+    gst_harness_set_src_caps_str(secondary_harness,
+                                 "video/x-evc, stream-format=(string)byte-stream, alignment=(string)au");
+
+    g_atomic_int_set(&allocations, 0);
+    start = g_get_monotonic_time();
+
+    for (i = 0; i < frames; i++) {
+        GstBuffer *merged;
+
+        if (gst_harness_push(main_harness, wrap_memory(main_memory, i)) != GST_FLOW_OK ||
+            gst_harness_push(secondary_harness, wrap_memory(payload_memory, i)) != GST_FLOW_OK) {
+            g_printerr("%s: push failed\n", desc->name);
+            break;
+        }
+        merged = gst_harness_pull(main_harness);
+        if (!merged) {
+            g_printerr("%s: no output\n", desc->name);
+            break;
+        }
+        written += written_bytes(merged, main_memory, payload_memory);
+        gst_buffer_unref(merged);
+    }
+
+    if (i == frames) {
+        report(desc, "element", g_get_monotonic_time() - start, written, g_atomic_int_get(&allocations));
+    }
+
+    gst_harness_teardown(secondary_harness);
+    gst_harness_teardown(main_harness);
+
+    return i == frames;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const GstLvCompositorCodec codecs[] = { CODEC_H264, CODEC_H265, CODEC_H266, CODEC_EVC };
+    GOptionContext *context;
+    GError *error = NULL;
+    GRand *rand;
+    gboolean ok = TRUE;
+    guint i;
+
+    context = g_option_context_new("- SEI merge benchmark");
+    g_option_context_add_main_entries(context, entries, NULL);
+    g_option_context_add_group(context, gst_init_get_option_group());
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        return 1;
+    }
+    g_option_context_free(context);
+
+    if (frames <= 0 || au_size <= 0 || payload_size < 0) {
+        g_printerr("frames and au-size must be positive\n");
+        return 1;
+    }
+
+    gst_element_register(NULL, "lvcompositor", GST_RANK_NONE, GST_TYPE_LV_COMPOSITOR);
+
+    sysmem_allocator = gst_allocator_find(GST_ALLOCATOR_SYSMEM);
+    gst_allocator_set_default(g_object_new(bench_allocator_get_type(), NULL));
+
+    g_print("start code / escaping implementation: %s\n", nal_simd_impl_name());
+
+    rand = g_rand_new_with_seed(0x5e1);
+
+    for (i = 0; i < G_N_ELEMENTS(codecs); i++) {
+        const GstLvCodecDesc *desc = codec_desc_lookup(codecs[i]);
+        GstMemory *main_memory;
+        GstMemory *payload_memory;
+
+        if (codec_filter && g_ascii_strcasecmp(codec_filter, desc->name) != 0) {
+            continue;
+        }
+
+        main_memory = make_main_au(desc, au_size, rand);
+        payload_memory = make_payload(payload_size, rand);
+
+        if (!mode_filter || g_strcmp0(mode_filter, "merge") == 0) {
+            ok &= bench_merge(desc, main_memory, payload_memory);
+        }
+        if (!mode_filter || g_strcmp0(mode_filter, "element") == 0) {
+            ok &= bench_element(desc, main_memory, payload_memory);
+        }
+
+        gst_memory_unref(main_memory);
+        gst_memory_unref(payload_memory);
+    }
+
+    g_rand_free(rand);
+    gst_object_unref(sysmem_allocator);
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+#include "au_assembler.h"
+#include "nal_utils.h"
+
+/* Start code, NAL unit header and the first slice header byte */
+#define AU_PROBE_SIZE 16
+
+/**
+ * Sets up an assembler, any previous state must have been cleared
+ * @param assembler Assembler
+ * @param desc Codec of the stream, NULL to split on PTS and MARKER only
+ */
+void
+au_assembler_init(GstLvAuAssembler *assembler, const GstLvCodecDesc *desc)
+{
+    assembler->desc = desc;
+    assembler->current = NULL;
+    assembler->current_has_vcl = FALSE;
+    assembler->current_pts = GST_CLOCK_TIME_NONE;
+    assembler->pending = NULL;
+    g_queue_init(&assembler->complete);
+}
+
+/**
+ * Drops the access units in progress or not popped yet
+ * @param assembler Assembler
+ */
+void
+au_assembler_clear(GstLvAuAssembler *assembler)
+{
+    GstBufferList *au;
+
+    while ((au = g_queue_pop_head(&assembler->complete))) {
+        gst_buffer_list_unref(au);
+    }
+    if (assembler->current) {
+        gst_buffer_list_unref(assembler->current);
+        assembler->current = NULL;
+    }
+    if (assembler->pending) {
+        gst_buffer_list_unref(assembler->pending);
+        assembler->pending = NULL;
+    }
+    assembler->current_has_vcl = FALSE;
+    assembler->current_pts = GST_CLOCK_TIME_NONE;
+}
+
+static void
+au_assembler_append(GstLvAuAssembler *assembler, GstBuffer *nal, gboolean is_vcl)
+{
+    if (!assembler->current) {
+        assembler->current = gst_buffer_list_new();
+    }
+    if (!GST_CLOCK_TIME_IS_VALID(assembler->current_pts)) {
+        assembler->current_pts = GST_BUFFER_PTS(nal);
+    }
+    assembler->current_has_vcl |= is_vcl;
+
+    gst_buffer_list_add(assembler->current, nal);
+}
+
+/* The pending units go to the current access unit, pending is emptied */
+static void
+au_assembler_settle(GstLvAuAssembler *assembler)
+{
+    guint i;
+
+    if (!assembler->pending) {
+        return;
+    }
+    for (i = 0; i < gst_buffer_list_length(assembler->pending); i++) {
+        au_assembler_append(assembler, gst_buffer_ref(gst_buffer_list_get(assembler->pending, i)),
+                            FALSE);
+    }
+    gst_buffer_list_unref(assembler->pending);
+    assembler->pending = NULL;
+}
+
+static void
+au_assembler_close(GstLvAuAssembler *assembler)
+{
+    if (assembler->current) {
+        g_queue_push_tail(&assembler->complete, assembler->current);
+        assembler->current = NULL;
+    }
+    assembler->current_has_vcl = FALSE;
+    assembler->current_pts = GST_CLOCK_TIME_NONE;
+}
+
+/*
+ * Reads the type of the first NAL unit of a buffer and whether it is the
+ * first slice of a picture. Only the first bytes are copied.
+ */
+static gboolean
+au_assembler_probe(const GstLvCodecDesc *desc, GstBuffer *nal, guint8 *type, gboolean *first_slice)
+{
+    guint8 probe[AU_PROBE_SIZE];
+    gsize size = gst_buffer_extract(nal, 0, probe, sizeof(probe));
+    gsize sc = nal_find_start_code(probe, size, 0);
+    gsize header = sc + 3;
+
+    if (sc >= size || header + desc->nal_header_size > size) {
+        return FALSE;
+    }
+
+    *type = desc->nal_type(probe + header);
+    *first_slice = codec_desc_is_vcl(desc, *type) && desc->first_slice_mask != 0 &&
+                   header + desc->nal_header_size < size &&
+                   (probe[header + desc->nal_header_size] & desc->first_slice_mask) != 0;
+
+    return TRUE;
+}
+
+/**
+ * Adds one NAL aligned buffer
+ * @param assembler Assembler
+ * @param nal Buffer holding one NAL unit (consumed)
+ */
+void
+au_assembler_push(GstLvAuAssembler *assembler, GstBuffer *nal)
+{
+    const GstLvCodecDesc *desc = assembler->desc;
+    GstClockTime pts = GST_BUFFER_PTS(nal);
+    gboolean marker = GST_BUFFER_FLAG_IS_SET(nal, GST_BUFFER_FLAG_MARKER);
+    gboolean same_pts = FALSE;
+    gboolean first_slice = FALSE;
+    gboolean is_vcl = FALSE;
+    guint8 type = NAL_TYPE_NONE;
+
+    if (desc && au_assembler_probe(desc, nal, &type, &first_slice)) {
+        is_vcl = codec_desc_is_vcl(desc, type);
+    }
+
+    if (assembler->current && GST_CLOCK_TIME_IS_VALID(pts) &&
+        GST_CLOCK_TIME_IS_VALID(assembler->current_pts)) {
+        if (pts != assembler->current_pts) {
+            au_assembler_settle(assembler);
+            au_assembler_close(assembler);
+        } else {
+            same_pts = TRUE;
+        }
+    }
+
+    if (!desc || !assembler->current_has_vcl) {
+        // Nothing to settle before the first VCL NAL unit
+        au_assembler_append(assembler, nal, is_vcl);
+    } else if (is_vcl) {
+        if (first_slice) {
+            au_assembler_close(assembler);
+        }
+        au_assembler_settle(assembler);
+        au_assembler_append(assembler, nal, TRUE);
+    } else if (type == desc->aud_type) {
+        au_assembler_settle(assembler);
+        au_assembler_close(assembler);
+        au_assembler_append(assembler, nal, FALSE);
+    } else if (!same_pts && type == desc->picture_header_type) {
+        // The pending units come first in the new access unit
+        au_assembler_close(assembler);
+        au_assembler_settle(assembler);
+        au_assembler_append(assembler, nal, FALSE);
+    } else if (!same_pts && desc->first_slice_mask == 0 &&
+               desc->picture_header_type == NAL_TYPE_NONE &&
+               codec_desc_is_type(desc->au_start_types, type)) {
+        // Nothing will confirm it later, split now
+        au_assembler_settle(assembler);
+        au_assembler_close(assembler);
+        au_assembler_append(assembler, nal, FALSE);
+    } else if (assembler->pending || codec_desc_is_type(desc->au_start_types, type)) {
+        if (!assembler->pending) {
+            assembler->pending = gst_buffer_list_new();
+        }
+        gst_buffer_list_add(assembler->pending, nal);
+    } else {
+        au_assembler_append(assembler, nal, FALSE);
+    }
+
+    if (marker) {
+        au_assembler_settle(assembler);
+        au_assembler_close(assembler);
+    }
+}
+
+/**
+ * Takes the oldest complete access unit
+ * @param assembler Assembler
+ * @return Access unit (ownership transferred), NULL if none is complete
+ */
+GstBufferList *
+au_assembler_pop(GstLvAuAssembler *assembler)
+{
+    return g_queue_pop_head(&assembler->complete);
+}
+
+/**
+ * Closes the access unit in progress, at the end of the stream
+ * @param assembler Assembler
+ * @return Oldest access unit (ownership transferred), NULL if none is left
+ */
+GstBufferList *
+au_assembler_drain(GstLvAuAssembler *assembler)
+{
+    au_assembler_settle(assembler);
+    au_assembler_close(assembler);
+
+    return au_assembler_pop(assembler);
+}
+
+/**
+ * Turns an access unit into a single buffer sharing the NAL memories.
+ * Timestamps and flags are those of the first NAL unit.
+ * @param au Access unit (consumed)
+ * @return Buffer, NULL if the access unit is empty
+ */
+GstBuffer *
+au_assembler_list_to_buffer(GstBufferList *au)
+{
+    GstBuffer *buffer = NULL;
+    guint i;
+
+    for (i = 0; i < gst_buffer_list_length(au); i++) {
+        GstBuffer *nal = gst_buffer_ref(gst_buffer_list_get(au, i));
+
+        buffer = buffer ? gst_buffer_append(buffer, nal) : nal;
+    }
+    gst_buffer_list_unref(au);
+
+    return buffer;
+}
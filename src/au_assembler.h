@@ -0,0 +1,40 @@
+#ifndef __AU_ASSEMBLER_H__
+#define __AU_ASSEMBLER_H__
+
+#include <gst/gst.h>
+
+#include "codec_desc.h"
+
+/*
+ * Groups the buffers of a NAL aligned stream into access units. The NAL
+ * buffers are only referenced, an access unit is a GstBufferList.
+ * A new access unit starts on a PTS change, on an AUD following a VCL NAL
+ * unit, or on the first slice of a picture; the MARKER flag closes the
+ * current one. The parameter sets, prefix SEI and the other units that may
+ * open an access unit (codec_desc au_start_types) are held in pending when
+ * they follow a VCL NAL unit: H.265 PPS or SEI can sit between two slices
+ * of a picture. The next VCL NAL unit settles it, its first slice flag
+ * opens a new access unit with them. With equal PTS only the first slice
+ * and AUD split. Without PTS, an H.266 picture header opens a new access
+ * unit, and codecs without first slice flag (EVC) split on those units
+ * right away.
+ */
+typedef struct {
+    const GstLvCodecDesc *desc;
+    GstBufferList *current;
+    gboolean current_has_vcl;
+    GstClockTime current_pts;
+    GstBufferList *pending;
+    GQueue complete;
+} GstLvAuAssembler;
+
+void au_assembler_init(GstLvAuAssembler *assembler, const GstLvCodecDesc *desc);
+void au_assembler_clear(GstLvAuAssembler *assembler);
+
+void au_assembler_push(GstLvAuAssembler *assembler, GstBuffer *nal);
+GstBufferList *au_assembler_pop(GstLvAuAssembler *assembler);
+GstBufferList *au_assembler_drain(GstLvAuAssembler *assembler);
+
+GstBuffer *au_assembler_list_to_buffer(GstBufferList *au);
+
+#endif /* __AU_ASSEMBLER_H__ */
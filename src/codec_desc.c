@@ -0,0 +1,211 @@
+#include "codec_desc.h"
+
+// forbidden_zero_bit(1) nal_ref_idc(2) nal_unit_type(5)
+static guint8
+nal_type_h264(const guint8 *header)
+{
+    return header[0] & 0x1F;
+}
+
+// forbidden_zero_bit(1) nal_unit_type(6) nuh_layer_id(6) nuh_temporal_id_plus1(3)
+static guint8
+nal_type_h265(const guint8 *header)
+{
+    return (header[0] >> 1) & 0x3F;
+}
+
+// forbidden_zero_bit(1) nuh_reserved_zero_bit(1) nuh_layer_id(6) nal_unit_type(5) nuh_temporal_id_plus1(3)
+static guint8
+nal_type_h266(const guint8 *header)
+{
+    return (header[1] >> 3) & 0x1F;
+}
+
+// forbidden_zero_bit(1) nal_unit_type_plus1(6) nuh_temporal_id(3) nuh_reserved_zero_5bits(5) nuh_extension_flag(1)
+static guint8
+nal_type_evc(const guint8 *header)
+{
+    return (guint8)(((header[0] >> 1) & 0x3F) - 1);
+}
+
+static const GstLvCodecDesc codec_descs[] = {
+    {
+        // ITU-T H.264
+        .codec = CODEC_H264,
+        .name = "H264",
+        .caps_name = "video/x-h264",
+        .nal_header_size = 1,
+        .nal_type = nal_type_h264,
+        .vcl_first = 1,
+        .vcl_last = 5,
+        .aud_type = 9,
+        .filler_type = 12,
+        // SPS, PPS, SPS extension, subset SPS
+        .parameter_set_types = NAL_TYPE_BIT(7) | NAL_TYPE_BIT(8) | NAL_TYPE_BIT(13) | NAL_TYPE_BIT(15),
+        // prefix NAL unit, coded slice extension
+        .picture_start_types = NAL_TYPE_BIT(14) | NAL_TYPE_BIT(20),
+        // 7.4.1.2.3: SEI, SPS, PPS, 14..18 (not the coded slice extension 20)
+        .au_start_types = NAL_TYPE_BIT(6) | NAL_TYPE_BIT(7) | NAL_TYPE_BIT(8) | NAL_TYPE_BIT(14) |
+                          NAL_TYPE_BIT(15) | NAL_TYPE_BIT(16) | NAL_TYPE_BIT(17) | NAL_TYPE_BIT(18),
+        .picture_header_type = NAL_TYPE_NONE,
+        // first_mb_in_slice == 0 is coded as a single '1' bit
+        .first_slice_mask = 0x80,
+        // nal_ref_idc=0, nal_unit_type=6
+        .prefix_sei_type = 6,
+        .prefix_sei_header = { 0x06, 0x00 },
+        .suffix_sei_type = NAL_TYPE_NONE,
+        // avcC: 6 reserved bits, lengthSizeMinusOne in byte 4
+        .length_size_offset = 4,
+        .length_size_shift = 0,
+    },
+    {
+        // ITU-T H.265
+        .codec = CODEC_H265,
+        .name = "H265",
+        .caps_name = "video/x-h265",
+        .nal_header_size = 2,
+        .nal_type = nal_type_h265,
+        .vcl_first = 0,
+        .vcl_last = 31,
+        .aud_type = 35,
+        .filler_type = 38,
+        // VPS, SPS, PPS
+        .parameter_set_types = NAL_TYPE_BIT(32) | NAL_TYPE_BIT(33) | NAL_TYPE_BIT(34),
+        .picture_start_types = 0,
+        // 7.4.2.4.4: VPS, SPS, PPS, prefix SEI, 41..44, 48..55
+        .au_start_types = NAL_TYPE_BIT(32) | NAL_TYPE_BIT(33) | NAL_TYPE_BIT(34) | NAL_TYPE_BIT(39) |
+                          NAL_TYPE_BIT(41) | NAL_TYPE_BIT(42) | NAL_TYPE_BIT(43) | NAL_TYPE_BIT(44) |
+                          NAL_TYPE_BIT(48) | NAL_TYPE_BIT(49) | NAL_TYPE_BIT(50) | NAL_TYPE_BIT(51) |
+                          NAL_TYPE_BIT(52) | NAL_TYPE_BIT(53) | NAL_TYPE_BIT(54) | NAL_TYPE_BIT(55),
+        .picture_header_type = NAL_TYPE_NONE,
+        // first_slice_segment_in_pic_flag
+        .first_slice_mask = 0x80,
+        // nal_unit_type=39/40, nuh_layer_id=0, nuh_temporal_id_plus1=1
+        .prefix_sei_type = 39,
+        .prefix_sei_header = { 0x4E, 0x01 },
+        .suffix_sei_type = 40,
+        .suffix_sei_header = { 0x50, 0x01 },
+        // hvcC: 6 reserved bits, lengthSizeMinusOne in byte 21
+        .length_size_offset = 21,
+        .length_size_shift = 0,
+    },
+    {
+        // ITU-T H.266
+        .codec = CODEC_H266,
+        .name = "H266",
+        .caps_name = "video/x-h266",
+        .nal_header_size = 2,
+        .nal_type = nal_type_h266,
+        .vcl_first = 0,
+        .vcl_last = 11,
+        .aud_type = 20,
+        .filler_type = 25,
+        // OPI, DCI, VPS, SPS, PPS, prefix APS
+        .parameter_set_types = NAL_TYPE_BIT(12) | NAL_TYPE_BIT(13) | NAL_TYPE_BIT(14) |
+                               NAL_TYPE_BIT(15) | NAL_TYPE_BIT(16) | NAL_TYPE_BIT(17),
+        // picture header
+        .picture_start_types = NAL_TYPE_BIT(19),
+        // 7.4.2.4.4: OPI, DCI, VPS, SPS, PPS, prefix APS, PH, prefix SEI, 26, 28, 29
+        .au_start_types = NAL_TYPE_BIT(12) | NAL_TYPE_BIT(13) | NAL_TYPE_BIT(14) | NAL_TYPE_BIT(15) |
+                          NAL_TYPE_BIT(16) | NAL_TYPE_BIT(17) | NAL_TYPE_BIT(19) | NAL_TYPE_BIT(23) |
+                          NAL_TYPE_BIT(26) | NAL_TYPE_BIT(28) | NAL_TYPE_BIT(29),
+        .picture_header_type = 19,
+        // sh_picture_header_in_slice_header_flag (single slice pictures,
+        // the others start with a picture header NAL unit)
+        .first_slice_mask = 0x80,
+        // nuh_layer_id=0, nal_unit_type=23/24, nuh_temporal_id_plus1=1
+        .prefix_sei_type = 23,
+        .prefix_sei_header = { 0x00, 0xB9 },
+        .suffix_sei_type = 24,
+        .suffix_sei_header = { 0x00, 0xC1 },
+        // vvcC: 5 reserved bits, lengthSizeMinusOne, ptl_present_flag
+        .length_size_offset = 0,
+        .length_size_shift = 1,
+    },
+    {
+        // ISO/IEC 23094-1 (no access unit delimiter, no suffix SEI)
+        .codec = CODEC_EVC,
+        .name = "EVC",
+        .caps_name = "video/x-evc",
+        .nal_header_size = 2,
+        .nal_type = nal_type_evc,
+        .vcl_first = 0,
+        .vcl_last = 23,
+        .aud_type = NAL_TYPE_NONE,
+        .filler_type = 27,
+        // SPS, PPS, APS
+        .parameter_set_types = NAL_TYPE_BIT(24) | NAL_TYPE_BIT(25) | NAL_TYPE_BIT(26),
+        .picture_start_types = 0,
+        // SPS, PPS, APS, SEI
+        .au_start_types = NAL_TYPE_BIT(24) | NAL_TYPE_BIT(25) | NAL_TYPE_BIT(26) | NAL_TYPE_BIT(28),
+        .picture_header_type = NAL_TYPE_NONE,
+        // slice header starts with a PPS id, pictures are split on PTS
+        .first_slice_mask = 0,
+        // nal_unit_type_plus1=29 (SEI), nuh_temporal_id=0
+        .prefix_sei_type = 28,
+        .prefix_sei_header = { 0x3A, 0x00 },
+        .suffix_sei_type = NAL_TYPE_NONE,
+        .length_size_offset = CODEC_DATA_NONE,
+    },
+};
+
+/**
+ * Looks up the descriptor of a codec
+ * @param codec Codec
+ * @return Descriptor, NULL for CODEC_UNKNOWN
+ */
+const GstLvCodecDesc *
+codec_desc_lookup(GstLvCompositorCodec codec)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(codec_descs); i++) {
+        if (codec_descs[i].codec == codec) {
+            return &codec_descs[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Looks up the descriptor matching a caps structure name
+ * @param caps_name Structure name, e.g. "video/x-h265"
+ * @return Descriptor, NULL if the format is not handled
+ */
+const GstLvCodecDesc *
+codec_desc_from_caps_name(const gchar *caps_name)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(codec_descs); i++) {
+        if (g_strcmp0(codec_descs[i].caps_name, caps_name) == 0) {
+            return &codec_descs[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Reads the NAL unit length size of a length-prefixed stream from its
+ * decoder configuration record (caps codec_data)
+ * @param desc Codec of the stream
+ * @param codec_data Decoder configuration record
+ * @param size Size of codec_data
+ * @return 1, 2 or 4, 0 if the record is too short, invalid, or the codec
+ *         has no length-prefixed format
+ */
+guint
+codec_desc_nal_length_size(const GstLvCodecDesc *desc, const guint8 *codec_data, gsize size)
+{
+    guint length_size;
+
+    if (desc->length_size_offset == CODEC_DATA_NONE || size <= desc->length_size_offset) {
+        return 0;
+    }
+
+    length_size = ((codec_data[desc->length_size_offset] >> desc->length_size_shift) & 3) + 1;
+
+    return length_size == 3 ? 0 : length_size;
+}
@@ -0,0 +1,99 @@
+#ifndef __CODEC_DESC_H__
+#define __CODEC_DESC_H__
+
+#include <glib.h>
+
+typedef enum {
+    CODEC_H264,
+    CODEC_H265,
+    CODEC_H266,
+    CODEC_EVC,
+    CODEC_UNKNOWN
+} GstLvCompositorCodec;
+
+/* nal_unit_type value used when a codec has no such NAL unit */
+#define NAL_TYPE_NONE 0xFF
+
+/* length_size_offset of codecs without length-prefixed format */
+#define CODEC_DATA_NONE 0xFF
+
+#define NAL_TYPE_BIT(type) (G_GUINT64_CONSTANT(1) << (type))
+
+/*
+ * NAL unit and SEI layout of a codec. Selected once when the stream is
+ * negotiated, everything downstream of the caps handler reads this table
+ * instead of switching on the codec.
+ */
+typedef struct {
+    GstLvCompositorCodec codec;
+    const gchar *name;
+    const gchar *caps_name;
+
+    /* NAL unit header */
+    guint nal_header_size;
+    guint8 (*nal_type)(const guint8 *header);
+
+    /* VCL nal_unit_type range */
+    guint8 vcl_first;
+    guint8 vcl_last;
+
+    /* Non-VCL NAL units */
+    guint8 aud_type;
+    guint8 filler_type;
+    guint64 parameter_set_types;
+    guint64 picture_start_types;  /* non-VCL units opening the coded picture */
+
+    /* Access unit boundaries: non-VCL units that open a new access unit
+     * when they follow a VCL NAL unit, if the next VCL NAL unit confirms
+     * it (AUD apart, it always opens one), and the picture header type */
+    guint64 au_start_types;
+    guint8 picture_header_type;
+
+    /* Bit of the first byte after the VCL NAL unit header set on the first
+     * slice of a picture, 0 if the codec has none */
+    guint8 first_slice_mask;
+
+    /* SEI NAL units, header bytes for nuh_layer_id 0 / temporal id 0 */
+    guint8 prefix_sei_type;
+    guint8 prefix_sei_header[2];
+    guint8 suffix_sei_type;
+    guint8 suffix_sei_header[2];
+
+    /* Length-prefixed formats (ISO/IEC 14496-15): lengthSizeMinusOne is
+     * (codec_data[offset] >> shift) & 3, offset CODEC_DATA_NONE if the
+     * codec has no such format */
+    guint8 length_size_offset;
+    guint8 length_size_shift;
+} GstLvCodecDesc;
+
+const GstLvCodecDesc *codec_desc_lookup(GstLvCompositorCodec codec);
+const GstLvCodecDesc *codec_desc_from_caps_name(const gchar *caps_name);
+guint codec_desc_nal_length_size(const GstLvCodecDesc *desc, const guint8 *codec_data, gsize size);
+
+static inline gboolean
+codec_desc_is_vcl(const GstLvCodecDesc *desc, guint8 type)
+{
+    return type >= desc->vcl_first && type <= desc->vcl_last;
+}
+
+static inline gboolean
+codec_desc_is_type(guint64 types, guint8 type)
+{
+    return type < 64 && (types & NAL_TYPE_BIT(type)) != 0;
+}
+
+/* NAL units a decoder can do without, left out of embedded payloads */
+static inline gboolean
+codec_desc_is_droppable(const GstLvCodecDesc *desc, guint8 type)
+{
+    return type == desc->aud_type || type == desc->filler_type;
+}
+
+/* NAL units before which a prefix SEI has to be inserted */
+static inline gboolean
+codec_desc_starts_picture(const GstLvCodecDesc *desc, guint8 type)
+{
+    return codec_desc_is_vcl(desc, type) || codec_desc_is_type(desc->picture_start_types, type);
+}
+
+#endif /* __CODEC_DESC_H__ */
@@ -0,0 +1,134 @@
+#include <string.h>
+
+#include "compact_payload.h"
+#include "nal_utils.h"
+
+/* Sizes above 2^56 do not fit in a GStreamer buffer anyway */
+#define LEB128_MAX_BYTES 8
+
+static gsize
+leb128_write(guint8 *dst, guint64 value)
+{
+    gsize pos = 0;
+
+    do {
+        guint8 byte = value & 0x7F;
+
+        value >>= 7;
+        dst[pos++] = value ? (byte | 0x80) : byte;
+    } while (value);
+
+    return pos;
+}
+
+static gboolean
+leb128_read(const guint8 *data, gsize size, gsize *pos, guint64 *value)
+{
+    guint i;
+
+    *value = 0;
+    for (i = 0; i < LEB128_MAX_BYTES && *pos < size; i++) {
+        guint8 byte = data[(*pos)++];
+
+        *value |= (guint64)(byte & 0x7F) << (7 * i);
+        if (!(byte & 0x80)) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * Re-frames an Annex B access unit as a compact payload, in one pass. The
+ * NAL units a decoder does not need (AUD, filler data) are left out.
+ * @param data Annex B access unit
+ * @param size Size of data
+ * @param desc Codec of the access unit, NULL to keep every NAL unit
+ * @param dst Output, at least COMPACT_PAYLOAD_MAX_SIZE(size) bytes
+ * @return Number of bytes written to dst
+ */
+gsize
+compact_payload_encode(const guint8 *data, gsize size, const GstLvCodecDesc *desc, guint8 *dst)
+{
+    gsize offset = 0;
+    gsize pos = 0;
+    gsize start, end;
+
+    dst[pos++] = COMPACT_PAYLOAD_FORMAT;
+
+    while (nal_next_unit(data, size, &offset, &start, &end)) {
+        if (desc && end - start >= desc->nal_header_size &&
+            codec_desc_is_droppable(desc, desc->nal_type(data + start))) {
+            continue;
+        }
+
+        pos += leb128_write(dst + pos, end - start);
+        memcpy(dst + pos, data + start, end - start);
+        pos += end - start;
+    }
+
+    return pos;
+}
+
+/**
+ * Checks a compact payload and sizes its Annex B form (4 bytes start codes)
+ * @param data Payload
+ * @param size Size of data
+ * @return Annex B size, 0 if data does not start with the format byte or
+ *         its NAL unit sizes do not add up to size
+ */
+gsize
+compact_payload_annexb_size(const guint8 *data, gsize size)
+{
+    gsize annexb_size = 0;
+    gsize pos = 1;
+
+    if (size < 2 || data[0] != COMPACT_PAYLOAD_FORMAT) {
+        return 0;
+    }
+
+    while (pos < size) {
+        guint64 nal_size;
+
+        if (!leb128_read(data, size, &pos, &nal_size) || nal_size == 0 ||
+            nal_size > size - pos) {
+            return 0;
+        }
+        pos += nal_size;
+        annexb_size += 4 + nal_size;
+    }
+
+    return annexb_size;
+}
+
+/**
+ * Turns a compact payload back into an Annex B access unit
+ * @param data Payload, checked by compact_payload_annexb_size()
+ * @param size Size of data
+ * @param dst Output, compact_payload_annexb_size() bytes
+ * @return Number of bytes written to dst
+ */
+gsize
+compact_payload_to_annexb(const guint8 *data, gsize size, guint8 *dst)
+{
+    gsize out = 0;
+    gsize pos = 1;
+
+    while (pos < size) {
+        guint64 nal_size;
+
+        if (!leb128_read(data, size, &pos, &nal_size) || nal_size > size - pos) {
+            break;
+        }
+        dst[out++] = 0x00;
+        dst[out++] = 0x00;
+        dst[out++] = 0x00;
+        dst[out++] = 0x01;
+        memcpy(dst + out, data + pos, nal_size);
+        out += nal_size;
+        pos += nal_size;
+    }
+
+    return out;
+}
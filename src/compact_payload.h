@@ -0,0 +1,35 @@
+#ifndef __COMPACT_PAYLOAD_H__
+#define __COMPACT_PAYLOAD_H__
+
+#include <glib.h>
+
+#include "codec_desc.h"
+
+/*
+ * Compact payload, an EVC or LCEVC access unit re-framed without start
+ * codes (compact-payload property of lvcompositor), shared by the writer
+ * and the extractor:
+ *   format           u(8)     0xFE
+ *   then until the end of the payload:
+ *     nal_unit_size  leb128   7 bits per byte, least significant first,
+ *                             bit 7 set on all bytes but the last
+ *     nal_unit       nal_unit_size bytes, NAL unit header included
+ * An Annex B or length-prefixed access unit starts with 0x00 and a
+ * fragment with 0xFF, other payloads starting with 0xFE are escaped
+ * (SEI_RAW_MARKER in sei_merge.h), so the first byte tells them apart.
+ */
+#define COMPACT_PAYLOAD_FORMAT 0xFE
+
+/* Worst-case compact size of an Annex B access unit of size bytes: the
+ * format byte, and leb128 lengths longer than the start codes for NAL units
+ * of 2 MB and more */
+#define COMPACT_PAYLOAD_MAX_SIZE(size) ((size) + 1 + (size) / 65536)
+
+gsize compact_payload_encode(const guint8 *data, gsize size, const GstLvCodecDesc *desc,
+                             guint8 *dst);
+
+/* Annex B size of a compact payload, 0 if data is not a valid one */
+gsize compact_payload_annexb_size(const guint8 *data, gsize size);
+gsize compact_payload_to_annexb(const guint8 *data, gsize size, guint8 *dst);
+
+#endif /* __COMPACT_PAYLOAD_H__ */
@@ -0,0 +1,110 @@
+#include <string.h>
+
+#include "embed_policy.h"
+
+#define HASH_PRIME_1 G_GUINT64_CONSTANT(0x9E3779B97F4A7C15)
+#define HASH_PRIME_2 G_GUINT64_CONSTANT(0xBF58476D1CE4E5B9)
+#define HASH_PRIME_3 G_GUINT64_CONSTANT(0x94D049BB133111EB)
+
+static inline guint64
+hash_round(guint64 hash, guint64 word)
+{
+    hash ^= word * HASH_PRIME_1;
+    hash = (hash << 31) | (hash >> 33);
+    return hash * HASH_PRIME_2;
+}
+
+/* 8 bytes per multiply, the tail is packed into one last word */
+static guint64
+hash_bytes(guint64 hash, const guint8 *data, gsize size)
+{
+    guint64 word;
+
+    for (; size >= 8; data += 8, size -= 8) {
+        memcpy(&word, data, 8);
+        hash = hash_round(hash, word);
+    }
+    if (size > 0) {
+        word = 0;
+        memcpy(&word, data, size);
+        hash = hash_round(hash, word);
+    }
+
+    return hash;
+}
+
+/**
+ * 64-bit hash of a payload, to detect repeated enhancement data. Memories
+ * are hashed one after the other without mapping the buffer as a whole, so
+ * the same bytes split differently may hash differently: that only costs
+ * one extra SEI.
+ * @param buffer Payload
+ * @return Hash, mixed with the payload size
+ */
+guint64
+embed_payload_hash(GstBuffer *buffer)
+{
+    guint64 hash = HASH_PRIME_3;
+    guint i;
+
+    for (i = 0; i < gst_buffer_n_memory(buffer); i++) {
+        GstMemory *memory = gst_buffer_peek_memory(buffer, i);
+        GstMapInfo map;
+
+        if (!gst_memory_map(memory, &map, GST_MAP_READ)) {
+            continue;
+        }
+        hash = hash_bytes(hash, map.data, map.size);
+        gst_memory_unmap(memory, &map);
+    }
+
+    // splitmix64 finalizer
+    hash ^= gst_buffer_get_size(buffer);
+    hash = (hash ^ (hash >> 30)) * HASH_PRIME_2;
+    hash = (hash ^ (hash >> 27)) * HASH_PRIME_3;
+
+    return hash ^ (hash >> 31);
+}
+
+void
+embed_state_reset(GstLvEmbedState *state)
+{
+    state->count = 0;
+    state->last_hash = 0;
+    state->has_hash = FALSE;
+}
+
+/**
+ * Decides whether a paired secondary buffer is embedded
+ * @param state Policy state of the stream
+ * @param policy Policy
+ * @param interval N of the every-N policy
+ * @param keyframe TRUE if the main access unit is a random access point
+ * @param secondary_buffer Payload
+ * @return TRUE to write the SEI, FALSE to drop the payload
+ */
+gboolean
+embed_state_decide(GstLvEmbedState *state, GstLvEmbedPolicy policy, guint interval,
+                   gboolean keyframe, GstBuffer *secondary_buffer)
+{
+    guint64 hash;
+
+    switch (policy) {
+        case EMBED_POLICY_KEYFRAMES_ONLY:
+            return keyframe;
+        case EMBED_POLICY_ON_CHANGE:
+            /* Keyframes always carry it, a decoder joining there needs the data */
+            hash = embed_payload_hash(secondary_buffer);
+            if (!keyframe && state->has_hash && hash == state->last_hash) {
+                return FALSE;
+            }
+            state->last_hash = hash;
+            state->has_hash = TRUE;
+            return TRUE;
+        case EMBED_POLICY_EVERY_N:
+            return state->count++ % MAX(interval, 1) == 0;
+        case EMBED_POLICY_EVERY_FRAME:
+        default:
+            return TRUE;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef __EMBED_POLICY_H__
+#define __EMBED_POLICY_H__
+
+#include <gst/gst.h>
+
+/* Which paired secondary buffers end up in a SEI */
+typedef enum {
+    EMBED_POLICY_EVERY_FRAME,
+    EMBED_POLICY_KEYFRAMES_ONLY,
+    EMBED_POLICY_ON_CHANGE,
+    EMBED_POLICY_EVERY_N
+} GstLvEmbedPolicy;
+
+/*
+ * Per-stream state of the policy, reset on flush and renegotiation so the
+ * first access unit after a seek always gets its SEI.
+ */
+typedef struct {
+    guint64 count;       /* secondary buffers seen, for every-N */
+    guint64 last_hash;   /* payload of the last SEI, for on-change */
+    gboolean has_hash;
+} GstLvEmbedState;
+
+void embed_state_reset(GstLvEmbedState *state);
+gboolean embed_state_decide(GstLvEmbedState *state, GstLvEmbedPolicy policy, guint interval,
+                            gboolean keyframe, GstBuffer *secondary_buffer);
+
+guint64 embed_payload_hash(GstBuffer *buffer);
+
+#endif /* __EMBED_POLICY_H__ */
@@ -3,6 +3,8 @@
 
 #include <gst/video/video.h>
 #include <gst/base/gstaggregator.h>
+#include <stdio.h>
+#include <string.h>
 
 GST_DEBUG_CATEGORY_STATIC (gst_lv_compositor_debug);
 #define GST_CAT_DEFAULT gst_lv_compositor_debug
@@ -11,6 +13,23 @@ GST_DEBUG_CATEGORY_STATIC (gst_lv_compositor_debug);
 #define DEFAULT_HEIGHT 1080
 #define DEFAULT_FPS_N 25
 #define DEFAULT_FPS_D 1
+#define DEFAULT_UUID "lcevc"
+#define DEFAULT_PTS_TOLERANCE GST_MSECOND
+#define DEFAULT_REORDER_WINDOW 16
+#define DEFAULT_SEI_POSITION SEI_POSITION_PREFIX
+#define DEFAULT_SEI_TYPE SEI_TYPE_UNREGISTERED
+#define DEFAULT_EMBED_POLICY EMBED_POLICY_EVERY_FRAME
+#define DEFAULT_EMBED_INTERVAL 1
+#define DEFAULT_SPREAD_BUDGET 0
+#define DEFAULT_SPREAD_AU_COUNT 4
+#define DEFAULT_MAX_SEI_NAL_SIZE 0
+#define DEFAULT_MAX_BATCH 1
+#define DEFAULT_SEI_HEADROOM 4096
+#define DEFAULT_COMPACT_PAYLOAD FALSE
+#define MAX_BATCH_LIMIT 1024
+#define DEFAULT_STATS_INTERVAL 0
+#define DEFAULT_PAD_UUID "random"
+#define STATS_STRUCTURE_NAME "lvcompositor-stats"
 
 static GstStaticPadTemplate sink_template_main = GST_STATIC_PAD_TEMPLATE(
     "sink_main",
@@ -20,27 +39,50 @@ static GstStaticPadTemplate sink_template_main = GST_STATIC_PAD_TEMPLATE(
         "video/x-h264, "
         "stream-format=(string)byte-stream, "
         "alignment=(string){au,nal}; "
+        "video/x-h264, "
+        "stream-format=(string){avc,avc3}, "
+        "alignment=(string)au; "
         "video/x-h265, "
         "stream-format=(string)byte-stream, "
         "alignment=(string){au,nal}; "
+        "video/x-h265, "
+        "stream-format=(string){hvc1,hev1}, "
+        "alignment=(string)au; "
         "video/x-h266, "
         "stream-format=(string)byte-stream, "
         "alignment=(string){au,nal}; "
+        "video/x-h266, "
+        "stream-format=(string){vvc1,vvi1}, "
+        "alignment=(string)au; "
         "video/x-evc, "
         "stream-format=(string)byte-stream, "
         "alignment=(string){au,nal}"
     )
 );
 
+/* Enhancement streams, metadata or opaque data, see sei_payload.h */
+#define SECONDARY_CAPS \
+    "video/x-evc, " \
+    "stream-format=(string)byte-stream, " \
+    "alignment=(string){au,nal}; " \
+    "video/x-lcevc, " \
+    "stream-format=(string)byte-stream, " \
+    "alignment=(string)au; " \
+    "meta/x-klv; " \
+    "application/octet-stream"
+
 static GstStaticPadTemplate sink_template_secondary = GST_STATIC_PAD_TEMPLATE(
     "sink_secondary",
     GST_PAD_SINK,
     GST_PAD_REQUEST,
-    GST_STATIC_CAPS(
-        "video/x-evc, "
-        "stream-format=(string)byte-stream, "
-        "alignment=(string){au,nal}"
-    )
+    GST_STATIC_CAPS(SECONDARY_CAPS)
+);
+
+static GstStaticPadTemplate sink_template_secondary_extra = GST_STATIC_PAD_TEMPLATE(
+    "sink_secondary_%u",
+    GST_PAD_SINK,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS(SECONDARY_CAPS)
 );
 
 #if 0
@@ -68,12 +110,21 @@ static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE(
         "video/x-h264, "
         "stream-format=(string)byte-stream, "
         "alignment=(string){au,nal}; "
+        "video/x-h264, "
+        "stream-format=(string){avc,avc3}, "
+        "alignment=(string)au; "
         "video/x-h265, "
         "stream-format=(string)byte-stream, "
         "alignment=(string){au,nal}; "
+        "video/x-h265, "
+        "stream-format=(string){hvc1,hev1}, "
+        "alignment=(string)au; "
         "video/x-h266, "
         "stream-format=(string)byte-stream, "
         "alignment=(string){au,nal}; "
+        "video/x-h266, "
+        "stream-format=(string){vvc1,vvi1}, "
+        "alignment=(string)au; "
         "video/x-evc, "
         "stream-format=(string)byte-stream, "
         "alignment=(string){au,nal}"
@@ -86,10 +137,244 @@ enum {
     PROP_WIDTH,
     PROP_HEIGHT,
     PROP_FPS_N,
-    PROP_FPS_D
+    PROP_FPS_D,
+    PROP_UUID,
+    PROP_PTS_TOLERANCE,
+    PROP_REORDER_WINDOW,
+    PROP_MISSED_DEADLINES,
+    PROP_SEI_POSITION,
+    PROP_STATS,
+    PROP_STATS_INTERVAL,
+    PROP_SEI_TYPE,
+    PROP_EMBED_POLICY,
+    PROP_EMBED_INTERVAL,
+    PROP_SPREAD_BUDGET,
+    PROP_SPREAD_AU_COUNT,
+    PROP_MAX_SEI_NAL_SIZE,
+    PROP_MAX_BATCH,
+    PROP_SEI_HEADROOM,
+    PROP_COMPACT_PAYLOAD
+};
+
+#define GST_TYPE_LV_EMBED_POLICY (gst_lv_embed_policy_get_type())
+static GType
+gst_lv_embed_policy_get_type(void)
+{
+    static gsize embed_policy_type = 0;
+    static const GEnumValue embed_policies[] = {
+        {EMBED_POLICY_EVERY_FRAME, "SEI in every access unit with secondary data", "every-frame"},
+        {EMBED_POLICY_KEYFRAMES_ONLY, "SEI in keyframes only", "keyframes-only"},
+        {EMBED_POLICY_ON_CHANGE, "SEI when the secondary data differs from the last SEI, "
+                                 "and in keyframes", "on-change"},
+        {EMBED_POLICY_EVERY_N, "SEI in one access unit out of \"embed-interval\"", "every-n"},
+        {0, NULL, NULL},
+    };
+
+    if (g_once_init_enter(&embed_policy_type)) {
+        GType type = g_enum_register_static("GstLvEmbedPolicy", embed_policies);
+        g_once_init_leave(&embed_policy_type, type);
+    }
+    return (GType)embed_policy_type;
+}
+
+enum {
+    PROP_PAD_0,
+    PROP_PAD_UUID
 };
 
 G_DEFINE_TYPE(GstLvCompositor, gst_lv_compositor, GST_TYPE_AGGREGATOR)
+G_DEFINE_TYPE(GstLvCompositorPad, gst_lv_compositor_pad, GST_TYPE_AGGREGATOR_PAD)
+
+static void
+gst_lv_compositor_pad_reset(GstLvCompositorPad *pad)
+{
+    pts_ring_clear(&pad->ring);
+    au_assembler_clear(&pad->assembler);
+    if (pad->pending_au) {
+        gst_buffer_list_unref(pad->pending_au);
+        pad->pending_au = NULL;
+    }
+}
+
+/* Flushes run with the source stream lock held, aggregate() is not running */
+static GstFlowReturn
+gst_lv_compositor_pad_flush(GstAggregatorPad *aggpad, GstAggregator *aggregator)
+{
+    gst_lv_compositor_pad_reset(GST_LV_COMPOSITOR_PAD(aggpad));
+
+    return GST_FLOW_OK;
+}
+
+static void
+gst_lv_compositor_pad_finalize(GObject *object)
+{
+    GstLvCompositorPad *pad = GST_LV_COMPOSITOR_PAD(object);
+
+    gst_lv_compositor_pad_reset(pad);
+    g_free(pad->uuid);
+    pad->uuid = NULL;
+
+    G_OBJECT_CLASS(gst_lv_compositor_pad_parent_class)->finalize(object);
+}
+
+/**
+ * Whether a UUID is the one of the main enhancement data: the LCEVC UUID,
+ * or the uuid of the element. A sink_secondary_%u pad using it would have
+ * its messages taken for the enhancement stream by the extractor.
+ * @param pad sink_secondary_%u pad
+ * @param uuid Binary UUID, SEI_UUID_SIZE bytes
+ * @return TRUE if the pad cannot use it
+ */
+static gboolean
+gst_lv_compositor_pad_uuid_is_main(GstLvCompositorPad *pad, const guint8 *uuid)
+{
+    GstObject *parent = gst_object_get_parent(GST_OBJECT(pad));
+    guint8 main_uuid[SEI_UUID_SIZE];
+    gboolean is_main;
+
+    sei_uuid_resolve("lcevc", main_uuid);
+    is_main = memcmp(uuid, main_uuid, SEI_UUID_SIZE) == 0;
+    if (!is_main && parent) {
+        GstLvCompositor *self = GST_LV_COMPOSITOR(parent);
+
+        /* A "random" element UUID is drawn per stream, it cannot be known here */
+        GST_OBJECT_LOCK(self);
+        is_main = g_ascii_strcasecmp(self->uuid, "random") != 0 &&
+                  sei_uuid_resolve(self->uuid, main_uuid) &&
+                  memcmp(uuid, main_uuid, SEI_UUID_SIZE) == 0;
+        GST_OBJECT_UNLOCK(self);
+    }
+    if (parent) {
+        gst_object_unref(parent);
+    }
+
+    return is_main;
+}
+
+/*
+ * uuid only matters on sink_secondary_%u pads, the header of their
+ * user_data_unregistered messages is resolved when set ("random" draws one
+ * UUID per pad). T.35 registered messages are kept for the enhancement
+ * stream of sink_secondary, whose country and provider codes they carry.
+ */
+static void
+gst_lv_compositor_pad_set_property(GObject *object, guint prop_id,
+                                   const GValue *value, GParamSpec *pspec)
+{
+    GstLvCompositorPad *pad = GST_LV_COMPOSITOR_PAD(object);
+
+    switch (prop_id) {
+        case PROP_PAD_UUID: {
+            const gchar *uuid = g_value_get_string(value);
+            guint8 parsed[SEI_UUID_SIZE];
+
+            if (!sei_uuid_resolve(uuid ? uuid : DEFAULT_PAD_UUID, parsed)) {
+                GST_WARNING_OBJECT(pad, "Invalid UUID '%s', keeping '%s'", uuid, pad->uuid);
+                break;
+            }
+            if (gst_lv_compositor_pad_uuid_is_main(pad, parsed)) {
+                GST_WARNING_OBJECT(pad, "UUID '%s' is the one of the enhancement stream, "
+                                   "keeping '%s'", uuid, pad->uuid);
+                break;
+            }
+            GST_OBJECT_LOCK(pad);
+            g_free(pad->uuid);
+            pad->uuid = g_strdup(uuid ? uuid : DEFAULT_PAD_UUID);
+            memcpy(pad->uuid_data, parsed, SEI_UUID_SIZE);
+            sei_user_data_header_init(&pad->sei_header, SEI_TYPE_UNREGISTERED, pad->uuid_data);
+            GST_OBJECT_UNLOCK(pad);
+            break;
+        }
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+gst_lv_compositor_pad_get_property(GObject *object, guint prop_id,
+                                   GValue *value, GParamSpec *pspec)
+{
+    GstLvCompositorPad *pad = GST_LV_COMPOSITOR_PAD(object);
+
+    switch (prop_id) {
+        case PROP_PAD_UUID:
+            GST_OBJECT_LOCK(pad);
+            g_value_set_string(value, pad->uuid);
+            GST_OBJECT_UNLOCK(pad);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+gst_lv_compositor_pad_class_init(GstLvCompositorPadClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+    GstAggregatorPadClass *aggpad_class = GST_AGGREGATOR_PAD_CLASS(klass);
+
+    gobject_class->set_property = gst_lv_compositor_pad_set_property;
+    gobject_class->get_property = gst_lv_compositor_pad_get_property;
+    gobject_class->finalize = gst_lv_compositor_pad_finalize;
+    aggpad_class->flush = gst_lv_compositor_pad_flush;
+
+    g_object_class_install_property(gobject_class, PROP_PAD_UUID,
+        g_param_spec_string("uuid", "UUID",
+                           "UUID of the user_data_unregistered SEI messages of a "
+                           "sink_secondary_%u pad: \"random\" or 32 hex digits, neither the "
+                           "LCEVC UUID nor the element's uuid",
+                           DEFAULT_PAD_UUID,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_lv_compositor_pad_init(GstLvCompositorPad *pad)
+{
+    pts_ring_init(&pad->ring);
+    au_assembler_init(&pad->assembler, NULL);
+    pad->nal_aligned = FALSE;
+    pad->pending_au = NULL;
+    pad->payload_format = SEI_PAYLOAD_RAW;
+    pad->uuid = g_strdup(DEFAULT_PAD_UUID);
+    sei_uuid_resolve(pad->uuid, pad->uuid_data);
+    sei_user_data_header_init(&pad->sei_header, SEI_TYPE_UNREGISTERED, pad->uuid_data);
+}
+
+/* Next access unit of a NAL aligned pad, NULL until one is complete */
+static GstBufferList *
+gst_lv_compositor_pad_pop_au(GstLvCompositorPad *pad)
+{
+    GstAggregatorPad *aggpad = GST_AGGREGATOR_PAD(pad);
+    GstBufferList *au;
+    GstBuffer *buffer;
+
+    while (!(au = au_assembler_pop(&pad->assembler)) &&
+           (buffer = gst_aggregator_pad_pop_buffer(aggpad))) {
+        au_assembler_push(&pad->assembler, buffer);
+    }
+    if (!au && gst_aggregator_pad_is_eos(aggpad)) {
+        au = au_assembler_drain(&pad->assembler);
+    }
+
+    return au;
+}
+
+/* Next buffer of a pad, a whole access unit on NAL aligned streams */
+static GstBuffer *
+gst_lv_compositor_pad_pop_unit(GstLvCompositorPad *pad)
+{
+    GstBufferList *au;
+
+    if (!pad->nal_aligned) {
+        return gst_aggregator_pad_pop_buffer(GST_AGGREGATOR_PAD(pad));
+    }
+
+    au = gst_lv_compositor_pad_pop_au(pad);
+
+    return au ? au_assembler_list_to_buffer(au) : NULL;
+}
 
 static void gst_lv_compositor_set_property(GObject *object, guint prop_id,
                                           const GValue *value, GParamSpec *pspec);
@@ -110,8 +395,22 @@ static gboolean gst_lv_compositor_src_query(GstAggregator *aggregator,
 static gboolean gst_lv_compositor_sink_query(GstAggregator *aggregator,
                                             GstAggregatorPad *pad,
                                             GstQuery *query);
+static gboolean gst_lv_compositor_propose_allocation(GstAggregator *aggregator,
+                                                    GstAggregatorPad *pad,
+                                                    GstQuery *decide_query,
+                                                    GstQuery *query);
+static gboolean gst_lv_compositor_decide_allocation(GstAggregator *aggregator,
+                                                   GstQuery *query);
 static GstCaps *gst_lv_compositor_fixate_src_caps(GstAggregator *aggregator,
                                                  GstCaps *caps);
+static GstAggregatorPad *gst_lv_compositor_create_new_pad(GstAggregator *aggregator,
+                                                         GstPadTemplate *templ,
+                                                         const gchar *req_name,
+                                                         const GstCaps *caps);
+static void gst_lv_compositor_release_pad(GstElement *element, GstPad *pad);
+static gboolean gst_lv_compositor_stop(GstAggregator *aggregator);
+static GstFlowReturn gst_lv_compositor_flush(GstAggregator *aggregator);
+static GstClockTime gst_lv_compositor_get_next_time(GstAggregator *aggregator);
 
 static void
 gst_lv_compositor_class_init(GstLvCompositorClass *klass)
@@ -147,15 +446,128 @@ gst_lv_compositor_class_init(GstLvCompositorClass *klass)
                         1, G_MAXINT, DEFAULT_FPS_D,
                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+    g_object_class_install_property(gobject_class, PROP_UUID,
+        g_param_spec_string("uuid", "UUID",
+                           "UUID of the user_data_unregistered SEI: \"lcevc\" for the fixed "
+                           "LCEVC UUID, \"random\" for a new UUID per stream, or 32 hex digits",
+                           DEFAULT_UUID,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_PTS_TOLERANCE,
+        g_param_spec_uint64("pts-tolerance", "PTS tolerance",
+                           "Largest PTS difference (ns) between a main and a secondary buffer "
+                           "to pair them",
+                           0, G_MAXUINT64, DEFAULT_PTS_TOLERANCE,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_REORDER_WINDOW,
+        g_param_spec_uint("reorder-window", "Reorder window",
+                         "Number of secondary buffers kept while looking for the main PTS",
+                         1, PTS_RING_MAX_SIZE, DEFAULT_REORDER_WINDOW,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_MISSED_DEADLINES,
+        g_param_spec_uint64("missed-deadlines", "Missed deadlines",
+                           "Main access units pushed without SEI in live mode because the "
+                           "secondary buffer was not there before the deadline",
+                           0, G_MAXUINT64, 0,
+                           G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_SEI_POSITION,
+        g_param_spec_enum("sei-position", "SEI position",
+                         "Where the SEI is written in the access unit, applied when the "
+                         "main stream is negotiated",
+                         GST_TYPE_LV_SEI_POSITION, DEFAULT_SEI_POSITION,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_STATS,
+        g_param_spec_boxed("stats", "Statistics",
+                          "Merge counters, byte counters and latency percentiles (ns)",
+                          GST_TYPE_STRUCTURE,
+                          G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_STATS_INTERVAL,
+        g_param_spec_uint("stats-interval", "Statistics interval",
+                         "Period (ms) of the \"" STATS_STRUCTURE_NAME "\" element message "
+                         "on the bus, 0 to disable",
+                         0, G_MAXUINT, DEFAULT_STATS_INTERVAL,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_SEI_TYPE,
+        g_param_spec_enum("sei-type", "SEI type",
+                         "SEI message carrying the secondary data, applied when the main "
+                         "stream is negotiated",
+                         GST_TYPE_LV_SEI_TYPE, DEFAULT_SEI_TYPE,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_EMBED_POLICY,
+        g_param_spec_enum("embed-policy", "Embed policy",
+                         "Which access units get a SEI when secondary data is paired with them, "
+                         "the other secondary buffers are dropped",
+                         GST_TYPE_LV_EMBED_POLICY, DEFAULT_EMBED_POLICY,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_EMBED_INTERVAL,
+        g_param_spec_uint("embed-interval", "Embed interval",
+                         "N of the every-n embed policy",
+                         1, G_MAXUINT, DEFAULT_EMBED_INTERVAL,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_SPREAD_BUDGET,
+        g_param_spec_uint("spread-budget", "Spread budget",
+                         "Secondary bytes carried per access unit, larger payloads are split "
+                         "in fragments sent over the next access units (0 = disabled), "
+                         "applied when the main stream is negotiated",
+                         0, G_MAXUINT, DEFAULT_SPREAD_BUDGET,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_SPREAD_AU_COUNT,
+        g_param_spec_uint("spread-au-count", "Spread access unit count",
+                         "Access units a payload may be spread over, its last fragment goes out "
+                         "at the latest spread-au-count - 1 access units after its own",
+                         1, SEI_FRAGMENT_MAX_COUNT, DEFAULT_SPREAD_AU_COUNT,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_MAX_SEI_NAL_SIZE,
+        g_param_spec_uint("max-sei-nal-size", "Max SEI NAL size",
+                         "Largest SEI NAL unit (bytes, start code included), larger payloads are "
+                         "cut into several SEI NAL units of the access unit (0 = no limit), "
+                         "applied when the main stream is negotiated",
+                         0, G_MAXUINT, DEFAULT_MAX_SEI_NAL_SIZE,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_MAX_BATCH,
+        g_param_spec_uint("max-batch", "Max batch",
+                         "Access units paired and pushed as one buffer list per aggregate call "
+                         "when both pads have queued data (1 = one buffer per call)",
+                         1, MAX_BATCH_LIMIT, DEFAULT_MAX_BATCH,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_SEI_HEADROOM,
+        g_param_spec_uint("sei-headroom", "SEI headroom",
+                         "Bytes of prefix asked to the main stream allocator, a prefix SEI that "
+                         "fits in it is written in place in front of the access unit (0 = none)",
+                         0, G_MAXUINT, DEFAULT_SEI_HEADROOM,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_COMPACT_PAYLOAD,
+        g_param_spec_boolean("compact-payload", "Compact payload",
+                            "Embed EVC and LCEVC access units as a list of NAL units with "
+                            "leb128 lengths instead of start codes, without AUD and filler data",
+                            DEFAULT_COMPACT_PAYLOAD,
+                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
     gst_element_class_set_static_metadata(gstelement_class,
         "LV Compositor", "Filter/Compositor/Video",
-        "Composites two video streams with internal queues",
+        "Embeds a secondary stream as SEI messages into a main video stream",
         "Le Blond Erwan erwanleblond@gmail.com");
 
     gst_element_class_add_static_pad_template_with_gtype(gstelement_class,
-        &sink_template_main, GST_TYPE_AGGREGATOR_PAD);
+        &sink_template_main, GST_TYPE_LV_COMPOSITOR_PAD);
     gst_element_class_add_static_pad_template_with_gtype(gstelement_class,
-        &sink_template_secondary, GST_TYPE_AGGREGATOR_PAD);
+        &sink_template_secondary, GST_TYPE_LV_COMPOSITOR_PAD);
+    gst_element_class_add_static_pad_template_with_gtype(gstelement_class,
+        &sink_template_secondary_extra, GST_TYPE_LV_COMPOSITOR_PAD);
     gst_element_class_add_static_pad_template(gstelement_class, &src_template);
 
     agg_class->aggregate = gst_lv_compositor_aggregate;
@@ -163,7 +575,15 @@ gst_lv_compositor_class_init(GstLvCompositorClass *klass)
     agg_class->src_event = gst_lv_compositor_src_event;
     agg_class->src_query = gst_lv_compositor_src_query;
     agg_class->sink_query = gst_lv_compositor_sink_query;
+    agg_class->propose_allocation = gst_lv_compositor_propose_allocation;
+    agg_class->decide_allocation = gst_lv_compositor_decide_allocation;
     agg_class->fixate_src_caps = gst_lv_compositor_fixate_src_caps;
+    agg_class->create_new_pad = gst_lv_compositor_create_new_pad;
+    agg_class->stop = gst_lv_compositor_stop;
+    agg_class->flush = gst_lv_compositor_flush;
+    agg_class->get_next_time = gst_lv_compositor_get_next_time;
+
+    gstelement_class->release_pad = gst_lv_compositor_release_pad;
 }
 
 static void
@@ -179,16 +599,33 @@ gst_lv_compositor_init(GstLvCompositor *self)
     self->current_codec = CODEC_UNKNOWN;
     self->codec_negotiated = FALSE;
     self->codec_name = NULL;
-    
-    /* Create internal queues */
-    self->queue_main = gst_element_factory_make("queue", "main_queue");
-    self->queue_secondary = gst_element_factory_make("queue", "secondary_queue");
-    
-    if (self->queue_main && self->queue_secondary) {
-        /* Configure queues */
-        g_object_set(self->queue_main, "max-size-buffers", 10, NULL);
-        g_object_set(self->queue_secondary, "max-size-buffers", 10, NULL);
-    }
+    self->uuid = g_strdup(DEFAULT_UUID);
+    self->pts_tolerance = DEFAULT_PTS_TOLERANCE;
+    self->reorder_window = DEFAULT_REORDER_WINDOW;
+    merge_stats_reset(&self->stats);
+    self->stats_interval = DEFAULT_STATS_INTERVAL;
+    self->stats_last_post = 0;
+    self->wait_start = 0;
+    self->sei_position = DEFAULT_SEI_POSITION;
+    self->sei_type = DEFAULT_SEI_TYPE;
+    self->embed_policy = DEFAULT_EMBED_POLICY;
+    self->embed_interval = DEFAULT_EMBED_INTERVAL;
+    embed_state_reset(&self->embed_state);
+    self->spread_budget = DEFAULT_SPREAD_BUDGET;
+    self->spread_au_count = DEFAULT_SPREAD_AU_COUNT;
+    sei_spreader_init(&self->spreader, 0, DEFAULT_SPREAD_AU_COUNT);
+    self->max_sei_nal_size = DEFAULT_MAX_SEI_NAL_SIZE;
+    self->max_batch = DEFAULT_MAX_BATCH;
+    self->sei_headroom = DEFAULT_SEI_HEADROOM;
+    self->compact_payload = DEFAULT_COMPACT_PAYLOAD;
+    self->allocator = NULL;
+    gst_allocation_params_init(&self->allocation_params);
+    self->au_open = FALSE;
+    self->au_waiting_sei = FALSE;
+    self->au_keyframe = FALSE;
+    self->main_pad = NULL;
+    self->secondary_pad = NULL;
+    memset(self->extra_pads, 0, sizeof(self->extra_pads));
 }
 
 static void
@@ -210,6 +647,86 @@ gst_lv_compositor_set_property(GObject *object, guint prop_id,
         case PROP_FPS_D:
             self->fps_d = g_value_get_int(value);
             break;
+        case PROP_UUID: {
+            const gchar *uuid = g_value_get_string(value);
+            guint8 parsed[SEI_UUID_SIZE];
+
+            if (!sei_uuid_resolve(uuid, parsed)) {
+                GST_WARNING_OBJECT(self, "Invalid UUID '%s', keeping '%s'", uuid, self->uuid);
+                break;
+            }
+            /* Applied when the main stream is (re)negotiated */
+            GST_OBJECT_LOCK(self);
+            g_free(self->uuid);
+            self->uuid = g_strdup(uuid ? uuid : DEFAULT_UUID);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        }
+        case PROP_PTS_TOLERANCE:
+            GST_OBJECT_LOCK(self);
+            self->pts_tolerance = g_value_get_uint64(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_REORDER_WINDOW:
+            GST_OBJECT_LOCK(self);
+            self->reorder_window = g_value_get_uint(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_SEI_POSITION:
+            GST_OBJECT_LOCK(self);
+            self->sei_position = g_value_get_enum(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_SEI_TYPE:
+            GST_OBJECT_LOCK(self);
+            self->sei_type = g_value_get_enum(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_EMBED_POLICY:
+            GST_OBJECT_LOCK(self);
+            self->embed_policy = g_value_get_enum(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_EMBED_INTERVAL:
+            GST_OBJECT_LOCK(self);
+            self->embed_interval = g_value_get_uint(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_SPREAD_BUDGET:
+            GST_OBJECT_LOCK(self);
+            self->spread_budget = g_value_get_uint(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_SPREAD_AU_COUNT:
+            GST_OBJECT_LOCK(self);
+            self->spread_au_count = g_value_get_uint(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_MAX_SEI_NAL_SIZE:
+            GST_OBJECT_LOCK(self);
+            self->max_sei_nal_size = g_value_get_uint(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_MAX_BATCH:
+            GST_OBJECT_LOCK(self);
+            self->max_batch = g_value_get_uint(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_SEI_HEADROOM:
+            GST_OBJECT_LOCK(self);
+            self->sei_headroom = g_value_get_uint(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_COMPACT_PAYLOAD:
+            GST_OBJECT_LOCK(self);
+            self->compact_payload = g_value_get_boolean(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_STATS_INTERVAL:
+            GST_OBJECT_LOCK(self);
+            self->stats_interval = g_value_get_uint(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
             break;
@@ -235,224 +752,1194 @@ gst_lv_compositor_get_property(GObject *object, guint prop_id,
         case PROP_FPS_D:
             g_value_set_int(value, self->fps_d);
             break;
+        case PROP_UUID:
+            GST_OBJECT_LOCK(self);
+            g_value_set_string(value, self->uuid);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_PTS_TOLERANCE:
+            GST_OBJECT_LOCK(self);
+            g_value_set_uint64(value, self->pts_tolerance);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_REORDER_WINDOW:
+            GST_OBJECT_LOCK(self);
+            g_value_set_uint(value, self->reorder_window);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_MISSED_DEADLINES:
+            GST_OBJECT_LOCK(self);
+            g_value_set_uint64(value, self->stats.missed_deadlines);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_SEI_POSITION:
+            GST_OBJECT_LOCK(self);
+            g_value_set_enum(value, self->sei_position);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_SEI_TYPE:
+            GST_OBJECT_LOCK(self);
+            g_value_set_enum(value, self->sei_type);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_EMBED_POLICY:
+            GST_OBJECT_LOCK(self);
+            g_value_set_enum(value, self->embed_policy);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_EMBED_INTERVAL:
+            GST_OBJECT_LOCK(self);
+            g_value_set_uint(value, self->embed_interval);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_SPREAD_BUDGET:
+            GST_OBJECT_LOCK(self);
+            g_value_set_uint(value, self->spread_budget);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_SPREAD_AU_COUNT:
+            GST_OBJECT_LOCK(self);
+            g_value_set_uint(value, self->spread_au_count);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_MAX_SEI_NAL_SIZE:
+            GST_OBJECT_LOCK(self);
+            g_value_set_uint(value, self->max_sei_nal_size);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_MAX_BATCH:
+            GST_OBJECT_LOCK(self);
+            g_value_set_uint(value, self->max_batch);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_SEI_HEADROOM:
+            GST_OBJECT_LOCK(self);
+            g_value_set_uint(value, self->sei_headroom);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_COMPACT_PAYLOAD:
+            GST_OBJECT_LOCK(self);
+            g_value_set_boolean(value, self->compact_payload);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_STATS:
+            GST_OBJECT_LOCK(self);
+            g_value_take_boxed(value, merge_stats_to_structure(&self->stats, STATS_STRUCTURE_NAME));
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_STATS_INTERVAL:
+            GST_OBJECT_LOCK(self);
+            g_value_set_uint(value, self->stats_interval);
+            GST_OBJECT_UNLOCK(self);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
             break;
     }
 }
 
-static GstFlowReturn
-gst_lv_compositor_aggregate(GstAggregator *aggregator, gboolean timeout)
+static GstBuffer *
+gst_lv_compositor_pad_pull(gpointer user_data)
 {
-    GstLvCompositor *self = GST_LV_COMPOSITOR(aggregator);
-    GstAggregatorPad *main_pad = NULL;
-    GstAggregatorPad *secondary_pad = NULL;
-    GstBuffer *main_buffer = NULL;
-    GstBuffer *secondary_buffer = NULL;
-    GstFlowReturn ret = GST_FLOW_OK;
-    GST_INFO_OBJECT(self, "Start Aggregating buffers");
-    GST_INFO_OBJECT(self, "Start Aggregating buffers, codec: %s", 
-                   self->codec_name ? self->codec_name : "unknown");
-
-    /* Get pads */
-    main_pad = GST_AGGREGATOR_PAD(gst_element_get_static_pad(GST_ELEMENT(aggregator), "sink_main"));
-    secondary_pad = GST_AGGREGATOR_PAD(gst_element_get_static_pad(GST_ELEMENT(aggregator), "sink_secondary"));
+    return gst_lv_compositor_pad_pop_unit(user_data);
+}
 
-    if (!main_pad || !secondary_pad) {
-        ret = GST_FLOW_NOT_NEGOTIATED;
-        goto done;
-    }
+/*
+ * Looks for the secondary buffer carrying the PTS of a main access unit.
+ * Secondary buffers are moved from the pad queue into the reorder window
+ * until the match shows up; *give_up is set when the window is full or the
+ * secondary stream ended without it, the access unit then goes out alone.
+ * horizon is the DTS of the access unit (its PTS if unknown).
+ */
+static GstBuffer *
+gst_lv_compositor_pair_secondary(GstLvCompositor *self, GstLvCompositorPad *pad,
+                                 GstClockTime pts, GstClockTime horizon, gboolean *give_up)
+{
+    GstClockTime tolerance;
+    GstBuffer *buffer;
+    guint window;
+    guint dropped;
 
+    GST_OBJECT_LOCK(self);
+    tolerance = self->pts_tolerance;
+    window = self->reorder_window;
+    GST_OBJECT_UNLOCK(self);
 
-    main_buffer = gst_aggregator_pad_pop_buffer(main_pad);
-    secondary_buffer = gst_aggregator_pad_pop_buffer(secondary_pad);
+    buffer = pts_ring_pair(&pad->ring, gst_lv_compositor_pad_pull, pad, pts, horizon,
+                           tolerance, window, &dropped);
 
-    if(!main_buffer) {
-        ret = GST_FLOW_OK;
-        self->main_has_data = FALSE;
-        GST_DEBUG_OBJECT(self, "No data available from main stream");
-        goto done;
-    }
-    if(!secondary_buffer) {
-        ret = GST_FLOW_OK;
-        self->main_has_data = FALSE;
-        GST_DEBUG_OBJECT(self, "No data available from secondary stream");
-        goto done;
+    if (dropped > 0) {
+        GST_OBJECT_LOCK(self);
+        self->stats.secondary_dropped += dropped;
+        GST_OBJECT_UNLOCK(self);
+        GST_DEBUG_OBJECT(self, "Dropped %u stale secondary buffers", dropped);
     }
 
-    /* Composition logic with LCEVC merge */
-    if (main_buffer && secondary_buffer) {
-        /* Case 1: Both buffers available - merge LCEVC */
-        GST_INFO_OBJECT(self,"Case 1: Both buffers available - merge sei");
-        GstBuffer *merged_buffer = NULL;
-
-        switch (self->current_codec) {
-            case CODEC_H264:
-                GST_INFO_OBJECT(self, "Using H.264 SEI merge function");
-                merged_buffer = merge_lcevc_data_h264(main_buffer, secondary_buffer);
-                break;
-            case CODEC_H265:
-                GST_INFO_OBJECT(self, "Using H.265 SEI merge function");
-                merged_buffer = merge_lcevc_data_h265(main_buffer, secondary_buffer);
-                break;
-            case CODEC_H266:
-                GST_INFO_OBJECT(self, "Using H.266 SEI merge function");
-                merged_buffer = merge_lcevc_data_h266(main_buffer, secondary_buffer);
-                break;
-            case CODEC_EVC:
-                GST_INFO_OBJECT(self, "Using EVC SEI merge function");
-                merged_buffer = merge_lcevc_data_evc(main_buffer, secondary_buffer);
-                break;
-            default:
-                GST_ERROR_OBJECT(self, "Unsupported codec for sei merge");
-                merged_buffer = NULL;
-                break;
-        }
-        if (merged_buffer) {
-            /* Emit merged buffer */
-            GST_INFO_OBJECT(self, "Emitting merged buffer for codec: %s", 
-                           self->codec_name ? self->codec_name : "unknown");
-            ret = gst_aggregator_finish_buffer(aggregator, merged_buffer);
-            GST_DEBUG_OBJECT(self, "sei data merged successfully for %s", 
-                           self->codec_name ? self->codec_name : "unknown");
-        } else {
-            /* Fallback: use only main stream */
-            GST_INFO_OBJECT(self, "Fallback: use only main stream");
-            GstBuffer *out_buffer = gst_buffer_copy(main_buffer);
-            ret = gst_aggregator_finish_buffer(aggregator, out_buffer);
-            GST_WARNING_OBJECT(self, "sei merge failed for %s, using main stream only", 
-                             self->codec_name ? self->codec_name : "unknown");
-        }
+    *give_up = !buffer && (pts_ring_length(&pad->ring) >= window ||
+                           gst_aggregator_pad_is_eos(GST_AGGREGATOR_PAD(pad)));
 
-        gst_buffer_unref(main_buffer);
-        gst_buffer_unref(secondary_buffer);
-        self->main_has_data = TRUE;
-        
-    } else if (main_buffer) {
-        /* Case 2: Only main stream available */
-        GST_INFO_OBJECT(self,"Case 2: Only main stream available");
-        GstBuffer *out_buffer = gst_buffer_copy(main_buffer);
-        ret = gst_aggregator_finish_buffer(aggregator, out_buffer);
-        gst_buffer_unref(main_buffer);
-        self->main_has_data = TRUE;
-        GST_DEBUG_OBJECT(self, "Using main stream only (no enhancement data)");
-        
-    } else if (secondary_buffer && !self->main_has_data) {
-        /* Case 3: Fallback to secondary stream if main has no data */
-        GST_INFO_OBJECT(self,"Case 3: Fallback to secondary stream if main has no data");
-        GstBuffer *out_buffer = gst_buffer_copy(secondary_buffer);
-        ret = gst_aggregator_finish_buffer(aggregator, out_buffer);
-        gst_buffer_unref(secondary_buffer);
-        self->main_has_data = FALSE;
-        GST_DEBUG_OBJECT(self, "Using secondary stream as fallback");
-        
-    } else {
-        /* Case 4: No data available */
-        GST_INFO_OBJECT(self,"Case 4: No data available");
-        ret = GST_FLOW_OK;
-        self->main_has_data = FALSE;
-        GST_DEBUG_OBJECT(self, "No data available from either stream");
-    }
+    return buffer;
+}
 
-        GST_INFO_OBJECT(self, "End Aggregating buffers");
-    return ret;
-    
-done:
-    if (main_pad) gst_object_unref(main_pad);
-    if (secondary_pad) gst_object_unref(secondary_pad);
-    return ret;
+static void
+gst_lv_compositor_miss_deadline(GstLvCompositor *self, GstClockTime pts)
+{
+    GST_OBJECT_LOCK(self);
+    self->stats.missed_deadlines++;
+    GST_OBJECT_UNLOCK(self);
+    GST_DEBUG_OBJECT(self, "Deadline missed for PTS %" GST_TIME_FORMAT, GST_TIME_ARGS(pts));
 }
 
+/* Same for a sink_secondary_%u pad, its message is left out of the SEI */
 static void
-gst_lv_compositor_finalize(GObject *object)
+gst_lv_compositor_miss_extra_deadline(GstLvCompositor *self, GstLvCompositorPad *pad,
+                                      GstClockTime pts)
 {
-    GstLvCompositor *self = GST_LV_COMPOSITOR(object);
+    GST_OBJECT_LOCK(self);
+    self->stats.extra_missed_deadlines++;
+    GST_OBJECT_UNLOCK(self);
+    GST_DEBUG_OBJECT(self, "Deadline missed on %s for PTS %" GST_TIME_FORMAT, GST_PAD_NAME(pad),
+                     GST_TIME_ARGS(pts));
+}
 
-    if (self->codec_name) {
-        g_free(self->codec_name);
-        self->codec_name = NULL;
+/* Starts the wait clock of an access unit held for its secondary buffer */
+static void
+gst_lv_compositor_wait_begin(GstLvCompositor *self)
+{
+    if (self->wait_start == 0) {
+        self->wait_start = merge_stats_now();
     }
-
-    G_OBJECT_CLASS(gst_lv_compositor_parent_class)->finalize(object);
 }
 
-static GstLvCompositorCodec 
-detect_codec_from_caps(GstCaps *caps)
+/* sink_secondary_%u pads taken by one aggregate() call, with their SEI headers */
+typedef struct {
+    GstLvCompositorPad *pads[GST_LV_COMPOSITOR_MAX_EXTRA_PADS];
+    GstLvSeiUserDataHeader headers[GST_LV_COMPOSITOR_MAX_EXTRA_PADS];
+    guint n_pads;
+} GstLvExtraPads;
+
+/* Buffers of those pads paired with one access unit */
+typedef struct {
+    GstBuffer *buffers[GST_LV_COMPOSITOR_MAX_EXTRA_PADS];
+    GstLvCompositorPad *pads[GST_LV_COMPOSITOR_MAX_EXTRA_PADS];
+    const GstLvSeiUserDataHeader *headers[GST_LV_COMPOSITOR_MAX_EXTRA_PADS];
+    guint n;
+} GstLvExtraPayloads;
+
+/* Gives back a paired buffer, it is found again by the next pairing */
+static void
+gst_lv_compositor_unpair(GstLvCompositorPad *pad, GstBuffer *buffer)
 {
-    GstStructure *structure;
-    const gchar *mime_type;
-    
-    if (!caps || gst_caps_is_empty(caps))
-        return CODEC_UNKNOWN;
-        
-    structure = gst_caps_get_structure(caps, 0);
-    mime_type = gst_structure_get_name(structure);
-    
-    if (g_strcmp0(mime_type, "video/x-h264") == 0) {
-        return CODEC_H264;
-    } else if (g_strcmp0(mime_type, "video/x-h265") == 0) {
-        return CODEC_H265;
-    } else if (g_strcmp0(mime_type, "video/x-h266") == 0) {
-        return CODEC_H266;
-    }
-    else if (g_strcmp0(mime_type, "video/x-evc") == 0) {
-        return CODEC_EVC;
+    if (!pts_ring_push(&pad->ring, buffer)) {
+        gst_buffer_unref(buffer);
     }
-    
-    return CODEC_UNKNOWN;
 }
 
+/*
+ * Pairs an access unit with sink_secondary and with every sink_secondary_%u
+ * pad. Returns FALSE while one of them may still bring its buffer, what was
+ * taken is then given back and the access unit waits. On timeout (live
+ * mode, deadline of the access unit passed) the missing buffers are given
+ * up, each one counted in the stats. *secondary_buffer is NULL when sink_secondary has none. The buffers
+ * returned went through the payload preparation of their pad.
+ */
 static gboolean
-gst_lv_compositor_sink_event(GstAggregator *aggregator, GstAggregatorPad *pad,
-                            GstEvent *event)
+gst_lv_compositor_pair(GstLvCompositor *self, GstAggregatorPad *secondary_pad,
+                       GstLvExtraPads *extras, GstClockTime pts, GstClockTime horizon,
+                       gboolean timeout, GstBuffer **secondary_buffer,
+                       GstLvExtraPayloads *payloads)
 {
-    GstLvCompositor *self = GST_LV_COMPOSITOR(aggregator);
-    gboolean ret = TRUE;
+    gboolean give_up = FALSE;
+    gboolean compact;
+    guint i;
 
-    switch (GST_EVENT_TYPE(event)) {
-        case GST_EVENT_CAPS: {
-            GstCaps *caps;
-            gst_event_parse_caps(event, &caps);
+    payloads->n = 0;
 
-            GstLvCompositorCodec detected_codec = detect_codec_from_caps(caps);
-            
-            /* If it's the main pad, set output caps */
-            if (g_strcmp0(GST_OBJECT_NAME(pad), "sink_main") == 0) {
-                GstCaps *src_caps = gst_caps_copy(caps);
-                gst_aggregator_set_src_caps(aggregator, src_caps);
-                GST_DEBUG_OBJECT(self, "Setting source caps from main pad");
-                self->current_codec = detected_codec;
-                self->codec_negotiated = TRUE;
-                if (self->codec_name) {
-                    g_free(self->codec_name);
-                }
-                switch (detected_codec) {
-                    case CODEC_H264:
-                        self->codec_name = g_strdup("H264");
-                        break;
-                    case CODEC_H265:
-                        self->codec_name = g_strdup("H265");
-                        break;
-                    case CODEC_H266:
-                        self->codec_name = g_strdup("H266");
-                        break;
-                    default:
-                        self->codec_name = g_strdup("UNKNOWN");
-                        break;
-                }
+    *secondary_buffer = gst_lv_compositor_pair_secondary(self, GST_LV_COMPOSITOR_PAD(secondary_pad),
+                                                         pts, horizon, &give_up);
+    if (!*secondary_buffer && !give_up && timeout) {
+        gst_lv_compositor_miss_deadline(self, pts);
+        give_up = TRUE;
+    }
+    if (!*secondary_buffer && !give_up) {
+        return FALSE;
+    }
+
+    for (i = 0; i < extras->n_pads; i++) {
+        GstBuffer *buffer = gst_lv_compositor_pair_secondary(self, extras->pads[i], pts, horizon,
+                                                             &give_up);
+
+        if (buffer) {
+            payloads->buffers[payloads->n] = buffer;
+            payloads->pads[payloads->n] = extras->pads[i];
+            payloads->headers[payloads->n] = &extras->headers[i];
+            payloads->n++;
+        } else if (!give_up && timeout) {
+            gst_lv_compositor_miss_extra_deadline(self, extras->pads[i], pts);
+        } else if (!give_up) {
+            GST_LOG_OBJECT(self, "Waiting for %s PTS %" GST_TIME_FORMAT,
+                           GST_PAD_NAME(extras->pads[i]), GST_TIME_ARGS(pts));
+            while (payloads->n > 0) {
+                payloads->n--;
+                gst_lv_compositor_unpair(payloads->pads[payloads->n],
+                                         payloads->buffers[payloads->n]);
             }
-            break;
+            if (*secondary_buffer) {
+                gst_lv_compositor_unpair(GST_LV_COMPOSITOR_PAD(secondary_pad), *secondary_buffer);
+                *secondary_buffer = NULL;
+            }
+            return FALSE;
         }
-        case GST_EVENT_SEGMENT:
-            /* Forward segment events */
-            ret = GST_AGGREGATOR_CLASS(gst_lv_compositor_parent_class)->sink_event(aggregator, pad, event);
-            break;
-        default:
-            ret = GST_AGGREGATOR_CLASS(gst_lv_compositor_parent_class)->sink_event(aggregator, pad, event);
-            break;
     }
 
-    return ret;
+    GST_OBJECT_LOCK(self);
+    compact = self->compact_payload;
+    GST_OBJECT_UNLOCK(self);
+
+    if (*secondary_buffer) {
+        *secondary_buffer = sei_payload_prepare(GST_LV_COMPOSITOR_PAD(secondary_pad)->payload_format,
+                                                compact, *secondary_buffer);
+    }
+    for (i = 0; i < payloads->n; i++) {
+        payloads->buffers[i] = sei_payload_prepare(payloads->pads[i]->payload_format, compact,
+                                                   payloads->buffers[i]);
+    }
+
+    return TRUE;
+}
+
+/*
+ * Applies the embed policy to a paired secondary buffer. Returns it when
+ * the SEI is to be written, otherwise drops it and returns NULL.
+ */
+static GstBuffer *
+gst_lv_compositor_embed(GstLvCompositor *self, gboolean keyframe, GstBuffer *secondary_buffer)
+{
+    GstLvEmbedPolicy policy;
+    guint interval;
+
+    GST_OBJECT_LOCK(self);
+    policy = self->embed_policy;
+    interval = self->embed_interval;
+    GST_OBJECT_UNLOCK(self);
+
+    if (embed_state_decide(&self->embed_state, policy, interval, keyframe, secondary_buffer)) {
+        return secondary_buffer;
+    }
+
+    GST_OBJECT_LOCK(self);
+    self->stats.sei_skipped++;
+    GST_OBJECT_UNLOCK(self);
+    GST_LOG_OBJECT(self, "SEI skipped by the embed policy");
+    gst_buffer_unref(secondary_buffer);
+
+    return NULL;
+}
+
+/* An access unit is a keyframe when none of its buffers is a delta unit */
+static gboolean
+gst_lv_compositor_au_is_keyframe(GstBufferList *au)
+{
+    guint i;
+
+    for (i = 0; i < gst_buffer_list_length(au); i++) {
+        if (GST_BUFFER_FLAG_IS_SET(gst_buffer_list_get(au, i), GST_BUFFER_FLAG_DELTA_UNIT)) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+/*
+ * Accounts one output access unit, with the size of the SEI and of the
+ * payload it carries when merged, and posts the periodic stats message.
+ */
+static void
+gst_lv_compositor_account(GstLvCompositor *self, gboolean merged, gsize sei_size,
+                          gsize payload_size, guint64 merge_time)
+{
+    GstStructure *structure = NULL;
+    guint64 now = merge_stats_now();
+
+    GST_OBJECT_LOCK(self);
+    if (merged) {
+        self->stats.frames_merged++;
+        self->stats.payload_bytes += payload_size;
+        self->stats.sei_overhead_bytes += sei_size > payload_size ? sei_size - payload_size : 0;
+        merge_histogram_add(&self->stats.merge_latency, merge_time);
+    } else {
+        self->stats.main_only++;
+    }
+    merge_histogram_add(&self->stats.queue_wait, self->wait_start ? now - self->wait_start : 0);
+    if (self->stats_interval > 0 &&
+        now - self->stats_last_post >= (guint64)self->stats_interval * GST_MSECOND) {
+        self->stats_last_post = now;
+        structure = merge_stats_to_structure(&self->stats, STATS_STRUCTURE_NAME);
+    }
+    GST_OBJECT_UNLOCK(self);
+
+    self->wait_start = 0;
+
+    if (structure) {
+        gst_element_post_message(GST_ELEMENT(self),
+                                 gst_message_new_element(GST_OBJECT(self), structure));
+    }
+}
+
+/*
+ * SEI NAL units of the current access unit: the paired secondary buffer
+ * (consumed, may be NULL), or in spread mode the fragments due now, which
+ * is why it must be called for every main access unit in that mode, then
+ * the buffers of the sink_secondary_%u pads (consumed), one message each in
+ * the same NAL unit. Several units only when max-sei-nal-size is set, the
+ * sink_secondary_%u messages then share a unit of their own, not cut.
+ * payload_size gets the user data bytes carried, sei_size the size of the
+ * units.
+ */
+static guint
+gst_lv_compositor_make_sei(GstLvCompositor *self, GstBuffer *secondary_buffer,
+                           GstLvExtraPayloads *extras, GstBuffer **units,
+                           gsize *payload_size, gsize *sei_size)
+{
+    GstBuffer *fragments[SEI_SPREAD_MAX_PENDING];
+    GstBuffer *messages[SEI_SPREAD_MAX_PENDING + GST_LV_COMPOSITOR_MAX_EXTRA_PADS];
+    const GstLvSeiUserDataHeader *headers[SEI_SPREAD_MAX_PENDING + GST_LV_COMPOSITOR_MAX_EXTRA_PADS];
+    guint n_fragments = 0;
+    guint n_units = 0;
+    guint i;
+
+    *payload_size = 0;
+    *sei_size = 0;
+
+    if (self->spreader.budget == 0) {
+        if (!secondary_buffer && extras->n == 0) {
+            return 0;
+        }
+        if (secondary_buffer) {
+            fragments[n_fragments++] = secondary_buffer;
+            *payload_size = gst_buffer_get_size(secondary_buffer);
+        }
+    } else {
+        if (secondary_buffer && !sei_spreader_push(&self->spreader, secondary_buffer)) {
+            GST_OBJECT_LOCK(self);
+            self->stats.secondary_dropped++;
+            GST_OBJECT_UNLOCK(self);
+        }
+        n_fragments = sei_spreader_next_au(&self->spreader, fragments, payload_size);
+        if (n_fragments == 0 && extras->n == 0) {
+            return 0;
+        }
+    }
+
+    if (self->merge && extras->n > 0 && self->sei_writer.max_nal_size == 0) {
+        /* Single allocation for all the messages of the access unit */
+        for (i = 0; i < n_fragments; i++) {
+            messages[i] = fragments[i];
+            headers[i] = NULL;
+        }
+        for (i = 0; i < extras->n; i++) {
+            messages[n_fragments + i] = extras->buffers[i];
+            headers[n_fragments + i] = extras->headers[i];
+        }
+        units[0] = sei_writer_create_sei_messages(&self->sei_writer, messages, headers,
+                                                  n_fragments + extras->n);
+        n_units = units[0] ? 1 : 0;
+    } else if (self->merge) {
+        if (n_fragments > 0) {
+            n_units = sei_writer_create_sei_units(&self->sei_writer, fragments, n_fragments,
+                                                  units, SEI_MAX_NAL_UNITS);
+        }
+        if (extras->n > 0 && n_units < SEI_MAX_NAL_UNITS) {
+            units[n_units] = sei_writer_create_sei_messages(&self->sei_writer, extras->buffers,
+                                                            extras->headers, extras->n);
+            if (units[n_units]) {
+                n_units++;
+            }
+        }
+    }
+    for (i = 0; i < n_fragments; i++) {
+        gst_buffer_unref(fragments[i]);
+    }
+    for (i = 0; i < extras->n; i++) {
+        *payload_size += gst_buffer_get_size(extras->buffers[i]);
+        gst_buffer_unref(extras->buffers[i]);
+    }
+    extras->n = 0;
+
+    if (n_units == 0) {
+        GST_WARNING_OBJECT(self, "sei creation failed for %s, access unit left without SEI",
+                           self->codec_name ? self->codec_name : "unknown");
+    }
+    for (i = 0; i < n_units; i++) {
+        *sei_size += gst_buffer_get_size(units[i]);
+    }
+
+    return n_units;
+}
+
+/*
+ * Suffix SEI on NAL aligned streams: the NAL units of the main access unit
+ * are pushed as they come, the SEI follows them once the secondary buffer
+ * is there. The next access unit is held until then, or until its own
+ * deadline passes in live mode. The access unit ends on the MARKER flag or
+ * on a PTS change.
+ */
+static GstFlowReturn
+gst_lv_compositor_aggregate_nal_suffix(GstLvCompositor *self, GstAggregatorPad *main_pad,
+                                       GstAggregatorPad *secondary_pad, GstLvExtraPads *extras,
+                                       gboolean timeout)
+{
+    GstAggregator *aggregator = GST_AGGREGATOR(self);
+    GstBuffer *main_buffer;
+    GstBuffer *secondary_buffer;
+    GstBuffer *units[SEI_MAX_NAL_UNITS];
+    GstLvExtraPayloads payloads;
+    GstBufferList *sei_list;
+    guint64 merge_start;
+    gsize payload_size;
+    gsize sei_size;
+    guint n_units;
+    guint i;
+
+    if (self->au_waiting_sei) {
+        if (!gst_lv_compositor_pair(self, secondary_pad, extras, self->au_pts, self->au_dts,
+                                    timeout, &secondary_buffer, &payloads)) {
+            gst_lv_compositor_wait_begin(self);
+            return GST_FLOW_OK;
+        }
+
+        self->au_waiting_sei = FALSE;
+        if (secondary_buffer) {
+            secondary_buffer = gst_lv_compositor_embed(self, self->au_keyframe, secondary_buffer);
+        }
+
+        merge_start = merge_stats_now();
+        n_units = gst_lv_compositor_make_sei(self, secondary_buffer, &payloads, units,
+                                             &payload_size, &sei_size);
+        if (n_units == 0) {
+            GstBuffer *marker;
+
+            GST_LOG_OBJECT(self, "No SEI for PTS %" GST_TIME_FORMAT, GST_TIME_ARGS(self->au_pts));
+            gst_lv_compositor_account(self, FALSE, 0, 0, 0);
+
+            /* The MARKER was taken off the last NAL unit, an empty buffer
+             * still closes the access unit downstream */
+            marker = gst_buffer_new();
+            GST_BUFFER_PTS(marker) = self->au_pts;
+            GST_BUFFER_DTS(marker) = self->au_dts;
+            GST_BUFFER_FLAG_SET(marker, GST_BUFFER_FLAG_MARKER);
+            if (!self->au_keyframe) {
+                GST_BUFFER_FLAG_SET(marker, GST_BUFFER_FLAG_DELTA_UNIT);
+            }
+            return gst_aggregator_finish_buffer(aggregator, marker);
+        }
+        gst_lv_compositor_account(self, TRUE, sei_size, payload_size, merge_stats_now() - merge_start);
+
+        /* The SEI is now the last NAL unit of the access unit */
+        for (i = 0; i < n_units; i++) {
+            units[i] = gst_buffer_make_writable(units[i]);
+            GST_BUFFER_PTS(units[i]) = self->au_pts;
+            GST_BUFFER_DTS(units[i]) = self->au_dts;
+        }
+        GST_BUFFER_FLAG_SET(units[n_units - 1], GST_BUFFER_FLAG_MARKER);
+
+        if (n_units == 1) {
+            return gst_aggregator_finish_buffer(aggregator, units[0]);
+        }
+        sei_list = gst_buffer_list_new_sized(n_units);
+        for (i = 0; i < n_units; i++) {
+            gst_buffer_list_add(sei_list, units[i]);
+        }
+
+        return gst_aggregator_finish_buffer_list(aggregator, sei_list);
+    }
+
+    main_buffer = gst_aggregator_pad_peek_buffer(main_pad);
+    if (!main_buffer) {
+        if (!gst_aggregator_pad_is_eos(main_pad)) {
+            return GST_FLOW_OK;
+        }
+        if (!self->au_open) {
+            return GST_FLOW_EOS;
+        }
+        /* Last access unit of the stream had no MARKER */
+        self->au_open = FALSE;
+        self->au_waiting_sei = TRUE;
+        return GST_FLOW_OK;
+    }
+
+    if (self->au_open && GST_BUFFER_PTS_IS_VALID(main_buffer) &&
+        GST_BUFFER_PTS(main_buffer) != self->au_pts) {
+        /* First NAL unit of the next access unit, the SEI goes first */
+        gst_buffer_unref(main_buffer);
+        self->au_open = FALSE;
+        self->au_waiting_sei = TRUE;
+        return GST_FLOW_OK;
+    }
+
+    gst_aggregator_pad_drop_buffer(main_pad);
+
+    if (!self->au_open) {
+        self->au_open = TRUE;
+        self->au_pts = GST_BUFFER_PTS(main_buffer);
+        self->au_dts = GST_BUFFER_DTS_OR_PTS(main_buffer);
+        self->au_keyframe = TRUE;
+    }
+    if (GST_BUFFER_FLAG_IS_SET(main_buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+        self->au_keyframe = FALSE;
+    }
+
+    if (GST_BUFFER_FLAG_IS_SET(main_buffer, GST_BUFFER_FLAG_MARKER)) {
+        main_buffer = gst_buffer_make_writable(main_buffer);
+        GST_BUFFER_FLAG_UNSET(main_buffer, GST_BUFFER_FLAG_MARKER);
+        self->au_open = FALSE;
+        self->au_waiting_sei = TRUE;
+    }
+
+    return gst_aggregator_finish_buffer(aggregator, main_buffer);
+}
+
+/*
+ * Prefix SEI on NAL aligned streams: NAL units are grouped into access
+ * units, the SEI is inserted once per access unit as its own buffer.
+ * *out_list is left NULL while the access unit waits for its secondary
+ * buffer.
+ */
+static GstFlowReturn
+gst_lv_compositor_merge_nal_au(GstLvCompositor *self, GstAggregatorPad *main_pad,
+                               GstAggregatorPad *secondary_pad, GstLvExtraPads *extras,
+                               gboolean timeout, GstBufferList **out)
+{
+    GstLvCompositorPad *pad = GST_LV_COMPOSITOR_PAD(main_pad);
+    GstBufferList *main_au;
+    GstBufferList *out_list = NULL;
+    GstBuffer *first;
+    GstBuffer *secondary_buffer;
+    GstLvExtraPayloads payloads;
+
+    if (!pad->pending_au) {
+        pad->pending_au = gst_lv_compositor_pad_pop_au(pad);
+        if (!pad->pending_au) {
+            return gst_aggregator_pad_is_eos(main_pad) ? GST_FLOW_EOS : GST_FLOW_OK;
+        }
+    }
+
+    first = gst_buffer_list_get(pad->pending_au, 0);
+    if (!gst_lv_compositor_pair(self, secondary_pad, extras, GST_BUFFER_PTS(first),
+                                GST_BUFFER_DTS_OR_PTS(first), timeout, &secondary_buffer,
+                                &payloads)) {
+        gst_lv_compositor_wait_begin(self);
+        return GST_FLOW_OK;
+    }
+
+    main_au = pad->pending_au;
+    pad->pending_au = NULL;
+
+    if (secondary_buffer) {
+        secondary_buffer = gst_lv_compositor_embed(self, gst_lv_compositor_au_is_keyframe(main_au),
+                                                   secondary_buffer);
+    }
+
+    if (secondary_buffer || self->spreader.budget > 0 || payloads.n > 0) {
+        guint64 merge_start = merge_stats_now();
+        GstBuffer *units[SEI_MAX_NAL_UNITS];
+        gsize payload_size;
+        gsize sei_size;
+        guint n_units;
+
+        n_units = gst_lv_compositor_make_sei(self, secondary_buffer, &payloads, units,
+                                             &payload_size, &sei_size);
+        if (n_units > 0) {
+            out_list = merge_lcevc_sei_list(&self->sei_writer, main_au, units, n_units);
+            if (out_list) {
+                gst_lv_compositor_account(self, TRUE, sei_size, payload_size,
+                                          merge_stats_now() - merge_start);
+            }
+        }
+    }
+
+    if (out_list) {
+        gst_buffer_list_unref(main_au);
+    } else {
+        gst_lv_compositor_account(self, FALSE, 0, 0, 0);
+        out_list = main_au;
+    }
+
+    *out = out_list;
+    return GST_FLOW_OK;
+}
+
+/*
+ * Pushes up to max_batch access units in one buffer list. Only the first
+ * one can be given up on timeout, the deadline of the others is not known
+ * to have passed.
+ */
+static GstFlowReturn
+gst_lv_compositor_aggregate_nal(GstLvCompositor *self, GstAggregatorPad *main_pad,
+                                GstAggregatorPad *secondary_pad, GstLvExtraPads *extras,
+                                gboolean timeout, guint max_batch)
+{
+    GstBufferList *batch = NULL;
+    GstBufferList *au_list;
+    GstFlowReturn ret = GST_FLOW_OK;
+    guint n;
+    guint i;
+
+    for (n = 0; n < max_batch; n++) {
+        au_list = NULL;
+        ret = gst_lv_compositor_merge_nal_au(self, main_pad, secondary_pad, extras,
+                                             timeout && n == 0, &au_list);
+        if (!au_list) {
+            break;
+        }
+        if (!batch) {
+            batch = au_list;
+            continue;
+        }
+        batch = gst_buffer_list_make_writable(batch);
+        for (i = 0; i < gst_buffer_list_length(au_list); i++) {
+            gst_buffer_list_add(batch, gst_buffer_ref(gst_buffer_list_get(au_list, i)));
+        }
+        gst_buffer_list_unref(au_list);
+    }
+
+    if (!batch) {
+        return ret;
+    }
+
+    GST_LOG_OBJECT(self, "Pushing %u access units, %u buffers", n, gst_buffer_list_length(batch));
+
+    /* A pending EOS is reported by the next call */
+    return gst_aggregator_finish_buffer_list(GST_AGGREGATOR(self), batch);
+}
+
+/*
+ * Pairs and merges the main access unit at the head of the pad. *out is
+ * left NULL while it waits for its secondary buffer.
+ */
+static GstFlowReturn
+gst_lv_compositor_merge_au(GstLvCompositor *self, GstAggregatorPad *main_pad,
+                           GstAggregatorPad *secondary_pad, GstLvExtraPads *extras,
+                           gboolean timeout, GstBuffer **out)
+{
+    GstBuffer *main_buffer;
+    GstBuffer *secondary_buffer;
+    GstBuffer *out_buffer = NULL;
+    GstLvExtraPayloads payloads;
+    GstFlowReturn ret = GST_FLOW_OK;
+
+    main_buffer = gst_aggregator_pad_peek_buffer(main_pad);
+    if (!main_buffer) {
+        if (gst_aggregator_pad_is_eos(main_pad)) {
+            ret = GST_FLOW_EOS;
+        }
+        GST_LOG_OBJECT(self, "No data available from main stream");
+        return ret;
+    }
+
+    /* Live mode: past the deadline of main_buffer it is not held any longer */
+    if (!gst_lv_compositor_pair(self, secondary_pad, extras, GST_BUFFER_PTS(main_buffer),
+                                GST_BUFFER_DTS_OR_PTS(main_buffer), timeout, &secondary_buffer,
+                                &payloads)) {
+        /* Keep main_buffer queued until the secondary stream catches up */
+        GST_LOG_OBJECT(self, "Waiting for secondary PTS %" GST_TIME_FORMAT,
+                       GST_TIME_ARGS(GST_BUFFER_PTS(main_buffer)));
+        gst_lv_compositor_wait_begin(self);
+        gst_buffer_unref(main_buffer);
+        return ret;
+    }
+
+    gst_aggregator_pad_drop_buffer(main_pad);
+
+    if (secondary_buffer) {
+        secondary_buffer = gst_lv_compositor_embed(self,
+            !GST_BUFFER_FLAG_IS_SET(main_buffer, GST_BUFFER_FLAG_DELTA_UNIT), secondary_buffer);
+    }
+
+    if (self->spreader.budget > 0 || self->sei_writer.max_nal_size > 0 || payloads.n > 0) {
+        guint64 merge_start = merge_stats_now();
+        GstBuffer *units[SEI_MAX_NAL_UNITS];
+        gsize payload_size;
+        gsize sei_size;
+        guint n_units;
+        guint i;
+
+        /* Spread mode, size limit or several secondary pads: the SEI NAL
+         * units follow each other in the access unit */
+        n_units = gst_lv_compositor_make_sei(self, secondary_buffer, &payloads, units,
+                                             &payload_size, &sei_size);
+        if (n_units > 0) {
+            GstBuffer *sei_buffer = units[0];
+
+            for (i = 1; i < n_units; i++) {
+                sei_buffer = gst_buffer_append(sei_buffer, units[i]);
+            }
+            out_buffer = merge_lcevc_sei(&self->sei_writer, main_buffer, sei_buffer);
+            if (out_buffer) {
+                gst_lv_compositor_account(self, TRUE, sei_size, payload_size,
+                                          merge_stats_now() - merge_start);
+            }
+        }
+    } else if (secondary_buffer) {
+        guint64 merge_start = merge_stats_now();
+        gsize main_size = gst_buffer_get_size(main_buffer);
+
+        /* Merge function and codec layout were selected at caps time. The
+         * SEI goes in place when upstream allocated the proposed headroom */
+        if (self->merge && merge_lcevc_sei_in_place(&self->sei_writer, main_buffer, secondary_buffer)) {
+            out_buffer = gst_buffer_ref(main_buffer);
+        } else if (self->merge) {
+            out_buffer = self->merge(&self->sei_writer, main_buffer, secondary_buffer);
+        } else {
+            GST_ERROR_OBJECT(self, "Unsupported codec for sei merge");
+        }
+        if (out_buffer) {
+            gst_lv_compositor_account(self, TRUE, gst_buffer_get_size(out_buffer) - main_size,
+                                      gst_buffer_get_size(secondary_buffer),
+                                      merge_stats_now() - merge_start);
+        } else {
+            GST_WARNING_OBJECT(self, "sei merge failed for %s, using main stream only",
+                               self->codec_name ? self->codec_name : "unknown");
+        }
+        gst_buffer_unref(secondary_buffer);
+    } else {
+        GST_LOG_OBJECT(self, "No secondary buffer for PTS %" GST_TIME_FORMAT
+                       ", using main stream only",
+                       GST_TIME_ARGS(GST_BUFFER_PTS(main_buffer)));
+    }
+
+    if (out_buffer) {
+        gst_buffer_unref(main_buffer);
+    } else {
+        gst_lv_compositor_account(self, FALSE, 0, 0, 0);
+        out_buffer = main_buffer;
+    }
+
+    *out = out_buffer;
+    return ret;
+
+}
+
+static GstFlowReturn
+gst_lv_compositor_aggregate(GstAggregator *aggregator, gboolean timeout)
+{
+    GstLvCompositor *self = GST_LV_COMPOSITOR(aggregator);
+    GstAggregatorPad *main_pad = NULL;
+    GstAggregatorPad *secondary_pad = NULL;
+    GstLvExtraPads extras;
+    GstBufferList *batch = NULL;
+    GstBuffer *out_buffer;
+    GstFlowReturn ret = GST_FLOW_OK;
+    guint max_batch;
+    guint n;
+
+    extras.n_pads = 0;
+    GST_OBJECT_LOCK(self);
+    if (self->main_pad) {
+        main_pad = gst_object_ref(self->main_pad);
+    }
+    if (self->secondary_pad) {
+        secondary_pad = gst_object_ref(self->secondary_pad);
+    }
+    for (n = 0; n < GST_LV_COMPOSITOR_MAX_EXTRA_PADS; n++) {
+        if (self->extra_pads[n]) {
+            extras.pads[extras.n_pads++] = gst_object_ref(self->extra_pads[n]);
+        }
+    }
+    max_batch = self->max_batch;
+    GST_OBJECT_UNLOCK(self);
+
+    /* Message headers as set now, in pad number order */
+    for (n = 0; n < extras.n_pads; n++) {
+        GST_OBJECT_LOCK(extras.pads[n]);
+        extras.headers[n] = extras.pads[n]->sei_header;
+        GST_OBJECT_UNLOCK(extras.pads[n]);
+    }
+
+    if (!main_pad || !secondary_pad) {
+        ret = GST_FLOW_NOT_NEGOTIATED;
+        goto done;
+    }
+
+    if (GST_LV_COMPOSITOR_PAD(main_pad)->nal_aligned) {
+        if (self->sei_writer.position == SEI_POSITION_SUFFIX) {
+            ret = gst_lv_compositor_aggregate_nal_suffix(self, main_pad, secondary_pad, &extras,
+                                                         timeout);
+        } else {
+            ret = gst_lv_compositor_aggregate_nal(self, main_pad, secondary_pad, &extras, timeout,
+                                                  max_batch);
+        }
+        goto done;
+    }
+
+    if (max_batch <= 1) {
+        out_buffer = NULL;
+        ret = gst_lv_compositor_merge_au(self, main_pad, secondary_pad, &extras, timeout,
+                                         &out_buffer);
+        if (out_buffer) {
+            ret = gst_aggregator_finish_buffer(aggregator, out_buffer);
+        }
+        goto done;
+    }
+
+    /* Batch mode: every pair ready now goes out in one buffer list, only
+     * the first access unit can be given up on timeout */
+    for (n = 0; n < max_batch; n++) {
+        out_buffer = NULL;
+        ret = gst_lv_compositor_merge_au(self, main_pad, secondary_pad, &extras,
+                                         timeout && n == 0, &out_buffer);
+        if (!out_buffer) {
+            break;
+        }
+        if (!batch) {
+            batch = gst_buffer_list_new_sized(MIN(max_batch, 64));
+        }
+        gst_buffer_list_add(batch, out_buffer);
+    }
+
+    if (batch) {
+        GST_LOG_OBJECT(self, "Pushing %u access units", n);
+        /* A pending EOS is reported by the next call */
+        ret = gst_aggregator_finish_buffer_list(aggregator, batch);
+    }
+
+done:
+    if (main_pad) gst_object_unref(main_pad);
+    if (secondary_pad) gst_object_unref(secondary_pad);
+    for (n = 0; n < extras.n_pads; n++) {
+        gst_object_unref(extras.pads[n]);
+    }
+    return ret;
+}
+
+/*
+ * sink_main and sink_secondary keep their template name, sink_secondary_%u
+ * pads the requested number or the first free one; aggregate() looks them
+ * up by role
+ */
+static GstAggregatorPad *
+gst_lv_compositor_create_new_pad(GstAggregator *aggregator, GstPadTemplate *templ,
+                                 const gchar *req_name, const GstCaps *caps)
+{
+    GstLvCompositor *self = GST_LV_COMPOSITOR(aggregator);
+    const gchar *name = GST_PAD_TEMPLATE_NAME_TEMPLATE(templ);
+    GstAggregatorPad **slot = NULL;
+    GstAggregatorPad *pad;
+    gchar *pad_name = NULL;
+    guint index;
+
+    if (g_strcmp0(name, "sink_main") == 0) {
+        slot = &self->main_pad;
+    } else if (g_strcmp0(name, "sink_secondary") == 0) {
+        slot = &self->secondary_pad;
+    } else if (g_strcmp0(name, "sink_secondary_%u") != 0) {
+        GST_ERROR_OBJECT(self, "Unexpected pad template %s", name);
+        return NULL;
+    }
+
+    GST_OBJECT_LOCK(self);
+    if (!slot) {
+        if (req_name) {
+            if (sscanf(req_name, "sink_secondary_%u", &index) != 1 ||
+                index >= GST_LV_COMPOSITOR_MAX_EXTRA_PADS || self->extra_pads[index]) {
+                GST_OBJECT_UNLOCK(self);
+                GST_ERROR_OBJECT(self, "Pad %s cannot be requested", req_name);
+                return NULL;
+            }
+        } else {
+            index = 0;
+            while (index < GST_LV_COMPOSITOR_MAX_EXTRA_PADS && self->extra_pads[index]) {
+                index++;
+            }
+            if (index == GST_LV_COMPOSITOR_MAX_EXTRA_PADS) {
+                GST_OBJECT_UNLOCK(self);
+                GST_ERROR_OBJECT(self, "No more than %d sink_secondary_%%u pads",
+                                 GST_LV_COMPOSITOR_MAX_EXTRA_PADS);
+                return NULL;
+            }
+        }
+        slot = &self->extra_pads[index];
+        name = pad_name = g_strdup_printf("sink_secondary_%u", index);
+    } else if (*slot) {
+        GST_OBJECT_UNLOCK(self);
+        GST_ERROR_OBJECT(self, "Pad %s already requested", name);
+        return NULL;
+    }
+    pad = g_object_new(GST_TYPE_LV_COMPOSITOR_PAD,
+                       "name", name,
+                       "direction", GST_PAD_TEMPLATE_DIRECTION(templ),
+                       "template", templ,
+                       NULL);
+    *slot = pad;
+    GST_OBJECT_UNLOCK(self);
+
+    g_free(pad_name);
+
+    return pad;
+}
+
+static void
+gst_lv_compositor_release_pad(GstElement *element, GstPad *pad)
+{
+    GstLvCompositor *self = GST_LV_COMPOSITOR(element);
+    guint i;
+
+    GST_OBJECT_LOCK(self);
+    if (pad == GST_PAD(self->main_pad)) {
+        self->main_pad = NULL;
+    } else if (pad == GST_PAD(self->secondary_pad)) {
+        self->secondary_pad = NULL;
+    } else {
+        for (i = 0; i < GST_LV_COMPOSITOR_MAX_EXTRA_PADS; i++) {
+            if (pad == GST_PAD(self->extra_pads[i])) {
+                self->extra_pads[i] = NULL;
+            }
+        }
+    }
+    GST_OBJECT_UNLOCK(self);
+
+    GST_ELEMENT_CLASS(gst_lv_compositor_parent_class)->release_pad(element, pad);
+}
+
+static gboolean
+gst_lv_compositor_stop(GstAggregator *aggregator)
+{
+    GstLvCompositor *self = GST_LV_COMPOSITOR(aggregator);
+    guint i;
+
+    GST_OBJECT_LOCK(self);
+    if (self->secondary_pad) {
+        pts_ring_clear(&GST_LV_COMPOSITOR_PAD(self->secondary_pad)->ring);
+    }
+    for (i = 0; i < GST_LV_COMPOSITOR_MAX_EXTRA_PADS; i++) {
+        if (self->extra_pads[i]) {
+            pts_ring_clear(&GST_LV_COMPOSITOR_PAD(self->extra_pads[i])->ring);
+        }
+    }
+    merge_stats_reset(&self->stats);
+    self->stats_last_post = 0;
+    GST_OBJECT_UNLOCK(self);
+
+    self->wait_start = 0;
+    embed_state_reset(&self->embed_state);
+    sei_spreader_clear(&self->spreader);
+
+    self->au_open = FALSE;
+    self->au_waiting_sei = FALSE;
+
+    return TRUE;
+}
+
+static GstFlowReturn
+gst_lv_compositor_flush(GstAggregator *aggregator)
+{
+    GstLvCompositor *self = GST_LV_COMPOSITOR(aggregator);
+
+    self->au_open = FALSE;
+    self->au_waiting_sei = FALSE;
+    embed_state_reset(&self->embed_state);
+    sei_spreader_clear(&self->spreader);
+
+    return GST_AGGREGATOR_CLASS(gst_lv_compositor_parent_class)->flush(aggregator);
+}
+
+/*
+ * Deadline of the next output in live mode: the running time of the queued
+ * main access unit. The base class adds the latency property to it and calls
+ * aggregate() with timeout set if the secondary pad is still empty by then.
+ */
+static GstClockTime
+gst_lv_compositor_get_next_time(GstAggregator *aggregator)
+{
+    GstLvCompositor *self = GST_LV_COMPOSITOR(aggregator);
+    GstAggregatorPad *main_pad = NULL;
+    GstClockTime next_time = GST_CLOCK_TIME_NONE;
+    GstBuffer *buffer;
+
+    GST_OBJECT_LOCK(self);
+    if (self->main_pad) {
+        main_pad = gst_object_ref(self->main_pad);
+    }
+    GST_OBJECT_UNLOCK(self);
+
+    if (!main_pad) {
+        return GST_CLOCK_TIME_NONE;
+    }
+
+    if (GST_LV_COMPOSITOR_PAD(main_pad)->pending_au) {
+        buffer = gst_buffer_ref(gst_buffer_list_get(GST_LV_COMPOSITOR_PAD(main_pad)->pending_au, 0));
+    } else {
+        buffer = gst_aggregator_pad_peek_buffer(main_pad);
+    }
+    if (buffer) {
+        GST_OBJECT_LOCK(main_pad);
+        next_time = gst_segment_to_running_time(&main_pad->segment, GST_FORMAT_TIME,
+                                                GST_BUFFER_DTS_OR_PTS(buffer));
+        GST_OBJECT_UNLOCK(main_pad);
+        gst_buffer_unref(buffer);
+    }
+
+    gst_object_unref(main_pad);
+
+    return next_time;
+}
+
+static void
+gst_lv_compositor_finalize(GObject *object)
+{
+    GstLvCompositor *self = GST_LV_COMPOSITOR(object);
+
+    if (self->codec_name) {
+        g_free(self->codec_name);
+        self->codec_name = NULL;
+    }
+
+    g_free(self->uuid);
+    self->uuid = NULL;
+
+    sei_writer_clear(&self->sei_writer);
+    sei_spreader_clear(&self->spreader);
+    gst_clear_object(&self->allocator);
+
+    G_OBJECT_CLASS(gst_lv_compositor_parent_class)->finalize(object);
+}
+
+static const GstLvCodecDesc *
+detect_codec_from_caps(GstCaps *caps)
+{
+    if (!caps || gst_caps_is_empty(caps))
+        return NULL;
+        
+    return codec_desc_from_caps_name(gst_structure_get_name(gst_caps_get_structure(caps, 0)));
+}
+
+/**
+ * Reads the NAL unit length size of a length-prefixed main stream (avc,
+ * hvc1, vvc1...) from the codec_data of its caps
+ * @param caps Main stream caps
+ * @param desc Codec of the main stream
+ * @param nal_length_size Out: 1, 2 or 4, 0 for byte-stream
+ * @return FALSE if the stream is length-prefixed without usable codec_data
+ */
+static gboolean
+nal_length_size_from_caps(GstCaps *caps, const GstLvCodecDesc *desc, guint *nal_length_size)
+{
+    GstStructure *structure;
+    const gchar *stream_format;
+    const GValue *value;
+    GstBuffer *codec_data;
+    GstMapInfo map;
+
+    *nal_length_size = 0;
+    if (!desc || !caps || gst_caps_is_empty(caps))
+        return TRUE;
+
+    structure = gst_caps_get_structure(caps, 0);
+    stream_format = gst_structure_get_string(structure, "stream-format");
+    if (!stream_format || g_strcmp0(stream_format, "byte-stream") == 0)
+        return TRUE;
+
+    value = gst_structure_get_value(structure, "codec_data");
+    if (!value || !GST_VALUE_HOLDS_BUFFER(value))
+        return FALSE;
+
+    codec_data = gst_value_get_buffer(value);
+    if (!gst_buffer_map(codec_data, &map, GST_MAP_READ))
+        return FALSE;
+    *nal_length_size = codec_desc_nal_length_size(desc, map.data, map.size);
+    gst_buffer_unmap(codec_data, &map);
+
+    return *nal_length_size != 0;
+}
+
+static gboolean
+gst_lv_compositor_sink_event(GstAggregator *aggregator, GstAggregatorPad *pad,
+                            GstEvent *event)
+{
+    GstLvCompositor *self = GST_LV_COMPOSITOR(aggregator);
+    gboolean ret = TRUE;
+
+    switch (GST_EVENT_TYPE(event)) {
+        case GST_EVENT_CAPS: {
+            GstCaps *caps;
+            gst_event_parse_caps(event, &caps);
+
+            const GstLvCodecDesc *desc = detect_codec_from_caps(caps);
+            GstLvCompositorPad *lv_pad = GST_LV_COMPOSITOR_PAD(pad);
+
+            /* NAL aligned input is grouped into access units before pairing */
+            lv_pad->nal_aligned = !gst_caps_is_empty(caps) &&
+                g_strcmp0(gst_structure_get_string(gst_caps_get_structure(caps, 0), "alignment"),
+                          "nal") == 0;
+            au_assembler_clear(&lv_pad->assembler);
+            au_assembler_init(&lv_pad->assembler, desc);
+            lv_pad->payload_format = sei_payload_format_from_caps(caps);
+            
+            /* If it's the main pad, set output caps */
+            if (g_strcmp0(GST_OBJECT_NAME(pad), "sink_main") == 0) {
+                GstCaps *src_caps = gst_caps_copy(caps);
+                gst_aggregator_set_src_caps(aggregator, src_caps);
+                gst_caps_unref(src_caps);
+                GST_DEBUG_OBJECT(self, "Setting source caps from main pad");
+                self->codec_desc = desc;
+                self->current_codec = desc ? desc->codec : CODEC_UNKNOWN;
+                self->codec_negotiated = TRUE;
+
+                /* UUID, SEI prefix and SEI pools are built once per stream */
+                guint8 uuid[SEI_UUID_SIZE];
+                GstLvSeiPosition position;
+                GstLvSeiType sei_type;
+                guint spread_budget;
+                guint spread_au_count;
+                guint max_sei_nal_size;
+                guint nal_length_size;
+
+                if (!nal_length_size_from_caps(caps, desc, &nal_length_size)) {
+                    GST_WARNING_OBJECT(self, "%s stream-format %s without usable codec_data, "
+                                       "data will not be embedded", desc->name,
+                                       gst_structure_get_string(gst_caps_get_structure(caps, 0),
+                                                                "stream-format"));
+                    desc = NULL;
+                }
+
+                GST_OBJECT_LOCK(self);
+                sei_uuid_resolve(self->uuid, uuid);
+                position = self->sei_position;
+                sei_type = self->sei_type;
+                spread_budget = self->spread_budget;
+                spread_au_count = self->spread_au_count;
+                max_sei_nal_size = self->max_sei_nal_size;
+                GST_OBJECT_UNLOCK(self);
+
+                embed_state_reset(&self->embed_state);
+                sei_spreader_clear(&self->spreader);
+                sei_spreader_init(&self->spreader, spread_budget, spread_au_count);
+                sei_writer_clear(&self->sei_writer);
+                self->merge = sei_writer_init(&self->sei_writer, desc, sei_type, uuid, position,
+                                              nal_length_size) ?
+                              merge_lcevc_data : NULL;
+                sei_writer_set_max_nal_size(&self->sei_writer, max_sei_nal_size);
+                sei_writer_set_allocator(&self->sei_writer, self->allocator,
+                                         &self->allocation_params);
+
+                g_free(self->codec_name);
+                self->codec_name = g_strdup(desc ? desc->name : "UNKNOWN");
+            }
+            /* Let the base class release the event */
+            ret = GST_AGGREGATOR_CLASS(gst_lv_compositor_parent_class)->sink_event(aggregator, pad, event);
+            break;
+        }
+        case GST_EVENT_SEGMENT:
+            /* Forward segment events */
+            ret = GST_AGGREGATOR_CLASS(gst_lv_compositor_parent_class)->sink_event(aggregator, pad, event);
+            break;
+        default:
+            ret = GST_AGGREGATOR_CLASS(gst_lv_compositor_parent_class)->sink_event(aggregator, pad, event);
+            break;
+    }
+
+    return ret;
 }
 
 static gboolean
@@ -475,6 +1962,70 @@ gst_lv_compositor_sink_query(GstAggregator *aggregator, GstAggregatorPad *pad,
     return GST_AGGREGATOR_CLASS(gst_lv_compositor_parent_class)->sink_query(aggregator, pad, query);
 }
 
+/*
+ * Asks the main stream allocator for a prefix in front of every access
+ * unit, so the SEI can be written in place instead of spliced in. The
+ * secondary stream has nothing to propose.
+ */
+static gboolean
+gst_lv_compositor_propose_allocation(GstAggregator *aggregator, GstAggregatorPad *pad,
+                                     GstQuery *decide_query, GstQuery *query)
+{
+    GstLvCompositor *self = GST_LV_COMPOSITOR(aggregator);
+    GstAllocationParams params;
+    gboolean is_main;
+    guint headroom;
+
+    GST_OBJECT_LOCK(self);
+    is_main = pad == self->main_pad;
+    headroom = self->sei_headroom;
+    GST_OBJECT_UNLOCK(self);
+
+    if (!is_main || headroom == 0) {
+        return TRUE;
+    }
+
+    gst_allocation_params_init(&params);
+    params.prefix = headroom;
+    gst_query_add_allocation_param(query, NULL, &params);
+
+    GST_DEBUG_OBJECT(self, "Proposed %u bytes of SEI headroom", headroom);
+
+    return TRUE;
+}
+
+/*
+ * Output access units are upstream memories plus SEI memories, only the
+ * latter are allocated here: the SEI pools take the allocator and
+ * parameters downstream asked for. The pools of the query are left to the
+ * base class.
+ */
+static gboolean
+gst_lv_compositor_decide_allocation(GstAggregator *aggregator, GstQuery *query)
+{
+    GstLvCompositor *self = GST_LV_COMPOSITOR(aggregator);
+    GstAllocator *allocator = NULL;
+    GstAllocationParams params;
+
+    gst_allocation_params_init(&params);
+    if (gst_query_get_n_allocation_params(query) > 0) {
+        gst_query_parse_nth_allocation_param(query, 0, &allocator, &params);
+    }
+
+    gst_clear_object(&self->allocator);
+    self->allocator = allocator;
+    self->allocation_params = params;
+
+    GST_DEBUG_OBJECT(self, "SEI buffers allocated with %" GST_PTR_FORMAT ", align %" G_GSIZE_FORMAT
+                     ", prefix %" G_GSIZE_FORMAT, allocator, params.align, params.prefix);
+
+    if (self->sei_writer.desc) {
+        sei_writer_set_allocator(&self->sei_writer, self->allocator, &self->allocation_params);
+    }
+
+    return TRUE;
+}
+
 static GstCaps *
 gst_lv_compositor_fixate_src_caps(GstAggregator *aggregator, GstCaps *caps)
 {
@@ -497,42 +2048,3 @@ gst_lv_compositor_fixate_src_caps(GstAggregator *aggregator, GstCaps *caps)
 
     return result;
 }
-
-static gboolean
-plugin_init(GstPlugin *plugin)
-{
-    return gst_element_register(plugin, "lvcompositor", GST_RANK_NONE,
-                               GST_TYPE_LV_COMPOSITOR);
-}
-
-#ifndef PACKAGE
-#define PACKAGE "lvcompositor"
-#endif
-
-#ifndef PACKAGE_NAME
-#define PACKAGE_NAME "LV Compositor Plugin"
-#endif
-
-#ifndef PACKAGE_VERSION
-#define PACKAGE_VERSION "1.0"
-#endif
-
-#ifndef GST_PACKAGE_NAME
-#define GST_PACKAGE_NAME "GStreamer"
-#endif
-
-#ifndef GST_PACKAGE_ORIGIN
-#define GST_PACKAGE_ORIGIN "http://gstreamer.net/"
-#endif
-
-GST_PLUGIN_DEFINE(
-    GST_VERSION_MAJOR,
-    GST_VERSION_MINOR,
-    lvcompositor,
-    "LV Compositor plugin",
-    plugin_init,
-    PACKAGE_VERSION,
-    "LGPL",
-    GST_PACKAGE_NAME,
-    GST_PACKAGE_ORIGIN
-)
\ No newline at end of file
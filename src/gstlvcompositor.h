@@ -4,17 +4,57 @@
 #include <gst/gst.h>
 #include <gst/base/gstaggregator.h>
 #include "sei_merge.h"
+#include "pts_ring.h"
+#include "au_assembler.h"
+#include "merge_stats.h"
+#include "embed_policy.h"
+#include "sei_spread.h"
+#include "sei_payload.h"
 
 G_BEGIN_DECLS
 
+/* Nombre maximal de pads sink_secondary_%u */
+#define GST_LV_COMPOSITOR_MAX_EXTRA_PADS 16
+
 #define GST_TYPE_LV_COMPOSITOR (gst_lv_compositor_get_type())
 #define GST_LV_COMPOSITOR(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_LV_COMPOSITOR, GstLvCompositor))
 #define GST_LV_COMPOSITOR_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST((klass), GST_TYPE_LV_COMPOSITOR, GstLvCompositorClass))
 #define GST_IS_LV_COMPOSITOR(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_LV_COMPOSITOR))
 #define GST_IS_LV_COMPOSITOR_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass), GST_TYPE_LV_COMPOSITOR))
 
+#define GST_TYPE_LV_COMPOSITOR_PAD (gst_lv_compositor_pad_get_type())
+#define GST_LV_COMPOSITOR_PAD(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_LV_COMPOSITOR_PAD, GstLvCompositorPad))
+#define GST_IS_LV_COMPOSITOR_PAD(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_LV_COMPOSITOR_PAD))
+
 typedef struct _GstLvCompositor GstLvCompositor;
 typedef struct _GstLvCompositorClass GstLvCompositorClass;
+typedef struct _GstLvCompositorPad GstLvCompositorPad;
+typedef struct _GstLvCompositorPadClass GstLvCompositorPadClass;
+
+struct _GstLvCompositorPad {
+    GstAggregatorPad parent;
+
+    /* Buffers sortis de la file du pad, en attente d'appariement par PTS */
+    GstLvPtsRing ring;
+
+    /* Flux alignment=nal : regroupement des NAL en unités d'accès */
+    gboolean nal_aligned;
+    GstLvAuAssembler assembler;
+    GstBufferList *pending_au;
+
+    /* Pads secondaires : préparation des données selon leurs caps */
+    GstLvSeiPayloadFormat payload_format;
+
+    /* Pads sink_secondary_%u : UUID de leurs messages SEI, toujours
+     * user_data_unregistered, protégé par le verrou du pad */
+    gchar *uuid;
+    guint8 uuid_data[SEI_UUID_SIZE];
+    GstLvSeiUserDataHeader sei_header;
+};
+
+struct _GstLvCompositorPadClass {
+    GstAggregatorPadClass parent_class;
+};
 
 
 struct _GstLvCompositor {
@@ -27,14 +67,66 @@ struct _GstLvCompositor {
     /* Pads de sortie */
     GstPad *srcpad;
     
-    /* Queues internes */
-    GstElement *queue_main;
-    GstElement *queue_secondary;
-
     GstLvCompositorCodec current_codec;
+    const GstLvCodecDesc *codec_desc;
     gboolean codec_negotiated;
     gchar *codec_name;
+
+    /* Fonction de fusion choisie à la négociation */
+    GstLvSeiMergeFunc merge;
+
+    /* UUID des SEI user_data_unregistered */
+    gchar *uuid;
+
+    /* Écriture des SEI (gabarits et pools), préparée à la négociation */
+    GstLvSeiWriter sei_writer;
     
+    /* Appariement par PTS */
+    GstClockTime pts_tolerance;
+    guint reorder_window;
+
+    /* Type de SEI (non enregistré + UUID ou T.35), appliqué à la négociation */
+    GstLvSeiType sei_type;
+
+    /* Politique d'insertion des SEI */
+    GstLvEmbedPolicy embed_policy;
+    guint embed_interval;
+    GstLvEmbedState embed_state;
+
+    /* Étalement des gros SEI sur plusieurs unités d'accès (budget 0 : désactivé),
+     * propriétés appliquées à la négociation */
+    guint spread_budget;
+    guint spread_au_count;
+    GstLvSeiSpreader spreader;
+
+    /* Taille maximale d'une NAL SEI (0 : pas de limite), appliquée à la négociation */
+    guint max_sei_nal_size;
+
+    /* Unités d'accès poussées en une liste par appel à aggregate() */
+    guint max_batch;
+
+    /* Données EVC / LCEVC en liste de NAL à longueurs leb128 (compact_payload.h) */
+    gboolean compact_payload;
+
+    /* Allocation : marge proposée au flux principal, allocateur choisi en aval */
+    guint sei_headroom;
+    GstAllocator *allocator;
+    GstAllocationParams allocation_params;
+
+    /* Statistiques, protégées par le verrou de l'objet */
+    GstLvStats stats;
+    guint stats_interval;
+    guint64 stats_last_post;
+    guint64 wait_start;
+
+    /* SEI suffixe : unité d'accès dont les NAL sont déjà sorties */
+    GstLvSeiPosition sei_position;
+    gboolean au_open;
+    gboolean au_waiting_sei;
+    GstClockTime au_pts;
+    GstClockTime au_dts;
+    gboolean au_keyframe;
+
     /* États */
     gboolean main_has_data;
     gboolean secondary_has_data;
@@ -42,6 +134,10 @@ struct _GstLvCompositor {
     /* Pads d'entrée */
     GstAggregatorPad *main_pad;
     GstAggregatorPad *secondary_pad;
+
+    /* Pads sink_secondary_%u, indexés par leur numéro : un message SEI
+     * chacun, dans la même NAL que celui de sink_secondary */
+    GstAggregatorPad *extra_pads[GST_LV_COMPOSITOR_MAX_EXTRA_PADS];
 };
 
 struct _GstLvCompositorClass {
@@ -49,6 +145,7 @@ struct _GstLvCompositorClass {
 };
 
 GType gst_lv_compositor_get_type(void);
+GType gst_lv_compositor_pad_get_type(void);
 
 G_END_DECLS
 
@@ -0,0 +1,657 @@
+#include "gstlvextractor.h"
+#include "compact_payload.h"
+#include "nal_utils.h"
+#include "sei_parse.h"
+
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC (gst_lv_extractor_debug);
+#define GST_CAT_DEFAULT gst_lv_extractor_debug
+
+#define DEFAULT_UUID "lcevc"
+#define DEFAULT_SEI_TYPE SEI_TYPE_UNREGISTERED
+#define DEFAULT_SECONDARY_CAPS \
+    "video/x-evc, " \
+    "stream-format=(string)byte-stream, " \
+    "alignment=(string)au"
+
+/* NAL units indexed per input buffer, the bytes after the last one are kept as is */
+#define EXTRACTOR_MAX_NAL_UNITS 256
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE(
+    "sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS(
+        "video/x-h264, "
+        "stream-format=(string)byte-stream, "
+        "alignment=(string){au,nal}; "
+        "video/x-h265, "
+        "stream-format=(string)byte-stream, "
+        "alignment=(string){au,nal}; "
+        "video/x-h266, "
+        "stream-format=(string)byte-stream, "
+        "alignment=(string){au,nal}; "
+        "video/x-evc, "
+        "stream-format=(string)byte-stream, "
+        "alignment=(string){au,nal}"
+    )
+);
+
+static GstStaticPadTemplate src_template_main = GST_STATIC_PAD_TEMPLATE(
+    "src_main",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS(
+        "video/x-h264, "
+        "stream-format=(string)byte-stream, "
+        "alignment=(string){au,nal}; "
+        "video/x-h265, "
+        "stream-format=(string)byte-stream, "
+        "alignment=(string){au,nal}; "
+        "video/x-h266, "
+        "stream-format=(string)byte-stream, "
+        "alignment=(string){au,nal}; "
+        "video/x-evc, "
+        "stream-format=(string)byte-stream, "
+        "alignment=(string){au,nal}"
+    )
+);
+
+static GstStaticPadTemplate src_template_secondary = GST_STATIC_PAD_TEMPLATE(
+    "src_secondary",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS(
+        DEFAULT_SECONDARY_CAPS "; "
+        "video/x-lcevc, "
+        "stream-format=(string)byte-stream, "
+        "alignment=(string)au; "
+        "meta/x-klv; "
+        "application/octet-stream"
+    )
+);
+
+enum {
+    PROP_0,
+    PROP_UUID,
+    PROP_SEI_TYPE,
+    PROP_SECONDARY_CAPS
+};
+
+G_DEFINE_TYPE(GstLvExtractor, gst_lv_extractor, GST_TYPE_ELEMENT)
+
+static void gst_lv_extractor_set_property(GObject *object, guint prop_id,
+                                         const GValue *value, GParamSpec *pspec);
+static void gst_lv_extractor_get_property(GObject *object, guint prop_id,
+                                         GValue *value, GParamSpec *pspec);
+static void gst_lv_extractor_finalize(GObject *object);
+
+static gboolean gst_lv_extractor_sink_event(GstPad *pad, GstObject *parent, GstEvent *event);
+static GstFlowReturn gst_lv_extractor_chain(GstPad *pad, GstObject *parent, GstBuffer *buffer);
+
+static void
+gst_lv_extractor_class_init(GstLvExtractorClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+    GstElementClass *gstelement_class = GST_ELEMENT_CLASS(klass);
+
+    GST_DEBUG_CATEGORY_INIT(gst_lv_extractor_debug, "lvextractor", 0,
+                           "LV Extractor element");
+
+    gobject_class->set_property = gst_lv_extractor_set_property;
+    gobject_class->get_property = gst_lv_extractor_get_property;
+    gobject_class->finalize = gst_lv_extractor_finalize;
+
+    g_object_class_install_property(gobject_class, PROP_UUID,
+        g_param_spec_string("uuid", "UUID",
+                           "UUID of the user_data_unregistered SEIs to extract: \"lcevc\" for "
+                           "the fixed LCEVC UUID, or 32 hex digits",
+                           DEFAULT_UUID,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_SEI_TYPE,
+        g_param_spec_enum("sei-type", "SEI type",
+                         "SEI message carrying the secondary data, the compositor's sei-type: "
+                         "only those are extracted. Applied when the input stream is "
+                         "(re)negotiated",
+                         GST_TYPE_LV_SEI_TYPE, DEFAULT_SEI_TYPE,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_SECONDARY_CAPS,
+        g_param_spec_boxed("secondary-caps", "Secondary caps",
+                           "Caps of src_secondary, those of the compositor's secondary pad: "
+                           "the SEIs do not say what they carry. Fixed caps of the src_secondary "
+                           "template, applied when the input stream is (re)negotiated",
+                           GST_TYPE_CAPS,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    gst_element_class_set_static_metadata(gstelement_class,
+        "LV Extractor", "Codec/Demuxer/Video",
+        "Recovers the enhancement stream carried in SEIs by lvcompositor",
+        "Le Blond Erwan erwanleblond@gmail.com");
+
+    gst_element_class_add_static_pad_template(gstelement_class, &sink_template);
+    gst_element_class_add_static_pad_template(gstelement_class, &src_template_main);
+    gst_element_class_add_static_pad_template(gstelement_class, &src_template_secondary);
+}
+
+/* Header the SEIs of the stream start with, from uuid and sei-type. Called
+ * with the object lock once the element runs */
+static void
+gst_lv_extractor_setup_header(GstLvExtractor *self)
+{
+    guint8 uuid[SEI_UUID_SIZE];
+
+    sei_uuid_resolve(self->uuid, uuid);
+    sei_user_data_header_init(&self->sei_header, self->sei_type, uuid);
+}
+
+static void
+gst_lv_extractor_init(GstLvExtractor *self)
+{
+    self->sinkpad = gst_pad_new_from_static_template(&sink_template, "sink");
+    gst_pad_set_event_function(self->sinkpad, gst_lv_extractor_sink_event);
+    gst_pad_set_chain_function(self->sinkpad, gst_lv_extractor_chain);
+    gst_element_add_pad(GST_ELEMENT(self), self->sinkpad);
+
+    self->src_main = gst_pad_new_from_static_template(&src_template_main, "src_main");
+    gst_pad_use_fixed_caps(self->src_main);
+    gst_element_add_pad(GST_ELEMENT(self), self->src_main);
+
+    self->src_secondary = gst_pad_new_from_static_template(&src_template_secondary,
+                                                           "src_secondary");
+    gst_pad_use_fixed_caps(self->src_secondary);
+    gst_element_add_pad(GST_ELEMENT(self), self->src_secondary);
+
+    self->flow_combiner = gst_flow_combiner_new();
+    gst_flow_combiner_add_pad(self->flow_combiner, self->src_main);
+    gst_flow_combiner_add_pad(self->flow_combiner, self->src_secondary);
+
+    self->uuid = g_strdup(DEFAULT_UUID);
+    self->sei_type = DEFAULT_SEI_TYPE;
+    gst_lv_extractor_setup_header(self);
+    self->secondary_caps = gst_caps_from_string(DEFAULT_SECONDARY_CAPS);
+    self->codec_desc = NULL;
+    self->nal_aligned = FALSE;
+    self->au_count = 0;
+    self->fragment_data = NULL;
+    self->fragment_next = 0;
+    self->fragment_count = 0;
+}
+
+static void
+gst_lv_extractor_set_property(GObject *object, guint prop_id,
+                             const GValue *value, GParamSpec *pspec)
+{
+    GstLvExtractor *self = GST_LV_EXTRACTOR(object);
+
+    switch (prop_id) {
+        case PROP_UUID: {
+            const gchar *uuid = g_value_get_string(value);
+            guint8 parsed[SEI_UUID_SIZE];
+
+            /* A random UUID could never match what the compositor wrote */
+            if ((uuid && g_ascii_strcasecmp(uuid, "random") == 0) ||
+                !sei_uuid_resolve(uuid, parsed)) {
+                GST_WARNING_OBJECT(self, "Invalid UUID '%s', keeping '%s'", uuid, self->uuid);
+                break;
+            }
+            /* Applied when the input stream is (re)negotiated */
+            GST_OBJECT_LOCK(self);
+            g_free(self->uuid);
+            self->uuid = g_strdup(uuid ? uuid : DEFAULT_UUID);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        }
+        case PROP_SEI_TYPE:
+            GST_OBJECT_LOCK(self);
+            self->sei_type = g_value_get_enum(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_SECONDARY_CAPS: {
+            const GstCaps *caps = gst_value_get_caps(value);
+            GstCaps *template_caps = gst_static_pad_template_get_caps(&src_template_secondary);
+            gboolean valid = caps && gst_caps_is_fixed(caps) &&
+                             gst_caps_is_subset(caps, template_caps);
+
+            gst_caps_unref(template_caps);
+            if (!valid) {
+                GST_WARNING_OBJECT(self, "Invalid secondary caps %" GST_PTR_FORMAT ", keeping %"
+                                   GST_PTR_FORMAT, caps, self->secondary_caps);
+                break;
+            }
+            /* Applied when the input stream is (re)negotiated */
+            GST_OBJECT_LOCK(self);
+            gst_caps_replace(&self->secondary_caps, (GstCaps *)caps);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        }
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+gst_lv_extractor_get_property(GObject *object, guint prop_id,
+                             GValue *value, GParamSpec *pspec)
+{
+    GstLvExtractor *self = GST_LV_EXTRACTOR(object);
+
+    switch (prop_id) {
+        case PROP_UUID:
+            GST_OBJECT_LOCK(self);
+            g_value_set_string(value, self->uuid);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_SEI_TYPE:
+            GST_OBJECT_LOCK(self);
+            g_value_set_enum(value, self->sei_type);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_SECONDARY_CAPS:
+            GST_OBJECT_LOCK(self);
+            gst_value_set_caps(value, self->secondary_caps);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+gst_lv_extractor_finalize(GObject *object)
+{
+    GstLvExtractor *self = GST_LV_EXTRACTOR(object);
+
+    gst_flow_combiner_free(self->flow_combiner);
+    g_free(self->uuid);
+    gst_caps_unref(self->secondary_caps);
+    gst_clear_buffer(&self->fragment_data);
+
+    G_OBJECT_CLASS(gst_lv_extractor_parent_class)->finalize(object);
+}
+
+/* Drops the fragments of an incomplete payload and forgets the access units seen */
+static void
+gst_lv_extractor_reset(GstLvExtractor *self)
+{
+    gst_clear_buffer(&self->fragment_data);
+    self->fragment_next = 0;
+    self->fragment_count = 0;
+    self->au_count = 0;
+}
+
+/* Each src pad carries its own stream, derived from the upstream one */
+static gboolean
+gst_lv_extractor_push_stream_start(GstLvExtractor *self, GstPad *srcpad, GstEvent *event,
+                                   const gchar *suffix)
+{
+    const gchar *upstream_id;
+    GstStreamFlags flags;
+    GstEvent *stream_start;
+    gchar *stream_id;
+    guint group_id;
+
+    gst_event_parse_stream_start(event, &upstream_id);
+    gst_event_parse_stream_flags(event, &flags);
+
+    stream_id = g_strdup_printf("%s/%s", upstream_id, suffix);
+    stream_start = gst_event_new_stream_start(stream_id);
+    g_free(stream_id);
+
+    gst_event_set_stream_flags(stream_start, flags);
+    if (gst_event_parse_group_id(event, &group_id)) {
+        gst_event_set_group_id(stream_start, group_id);
+    }
+
+    return gst_pad_push_event(srcpad, stream_start);
+}
+
+static gboolean
+gst_lv_extractor_sink_event(GstPad *pad, GstObject *parent, GstEvent *event)
+{
+    GstLvExtractor *self = GST_LV_EXTRACTOR(parent);
+    gboolean ret;
+
+    switch (GST_EVENT_TYPE(event)) {
+        case GST_EVENT_STREAM_START:
+            ret = gst_lv_extractor_push_stream_start(self, self->src_main, event, "main");
+            ret &= gst_lv_extractor_push_stream_start(self, self->src_secondary, event, "secondary");
+            gst_event_unref(event);
+            break;
+        case GST_EVENT_CAPS: {
+            GstCaps *caps;
+            GstCaps *secondary_caps;
+            const GstLvCodecDesc *desc;
+
+            gst_event_parse_caps(event, &caps);
+            desc = gst_caps_is_empty(caps) ? NULL :
+                   codec_desc_from_caps_name(gst_structure_get_name(gst_caps_get_structure(caps, 0)));
+            if (!desc) {
+                GST_ERROR_OBJECT(self, "Unsupported caps %" GST_PTR_FORMAT, caps);
+                gst_event_unref(event);
+                return FALSE;
+            }
+            self->codec_desc = desc;
+            self->nal_aligned = g_strcmp0(gst_structure_get_string(gst_caps_get_structure(caps, 0),
+                                                                   "alignment"), "nal") == 0;
+            gst_lv_extractor_reset(self);
+
+            /* The header is resolved once per stream, never per buffer */
+            GST_OBJECT_LOCK(self);
+            gst_lv_extractor_setup_header(self);
+            secondary_caps = gst_caps_ref(self->secondary_caps);
+            GST_OBJECT_UNLOCK(self);
+
+            GST_DEBUG_OBJECT(self, "Extracting SEIs from %s, payloads as %" GST_PTR_FORMAT,
+                             desc->name, secondary_caps);
+
+            ret = gst_pad_push_event(self->src_secondary, gst_event_new_caps(secondary_caps));
+            gst_caps_unref(secondary_caps);
+
+            /* The base stream keeps its caps, only SEI NAL units are removed */
+            ret &= gst_pad_push_event(self->src_main, event);
+            break;
+        }
+        case GST_EVENT_FLUSH_STOP:
+            gst_flow_combiner_reset(self->flow_combiner);
+            gst_lv_extractor_reset(self);
+            ret = gst_pad_event_default(pad, parent, event);
+            break;
+        default:
+            ret = gst_pad_event_default(pad, parent, event);
+            break;
+    }
+
+    return ret;
+}
+
+/*
+ * Compact payloads (compact_payload.h) go out as Annex B access units,
+ * escaped ones (SEI_RAW_MARKER) without their escape byte, any other
+ * payload as it came
+ */
+static GstBuffer *
+gst_lv_extractor_expand(GstLvExtractor *self, GstBuffer *part)
+{
+    GstMapInfo map;
+    GstMapInfo out_map;
+    GstBuffer *out;
+    guint8 format;
+    gsize size;
+
+    if (gst_buffer_extract(part, 0, &format, 1) != 1) {
+        return part;
+    }
+    if (format == SEI_RAW_MARKER) {
+        part = gst_buffer_make_writable(part);
+        gst_buffer_resize(part, 1, -1);
+        return part;
+    }
+    /* Other payloads stay shared, mapping would merge their memories */
+    if (format != COMPACT_PAYLOAD_FORMAT || !gst_buffer_map(part, &map, GST_MAP_READ)) {
+        return part;
+    }
+    size = compact_payload_annexb_size(map.data, map.size);
+    if (size == 0) {
+        gst_buffer_unmap(part, &map);
+        return part;
+    }
+
+    out = gst_buffer_new_allocate(NULL, size, NULL);
+    if (!out || !gst_buffer_map(out, &out_map, GST_MAP_WRITE)) {
+        GST_WARNING_OBJECT(self, "Failed to allocate %" G_GSIZE_FORMAT " bytes, compact payload "
+                           "pushed as is", size);
+        if (out) {
+            gst_buffer_unref(out);
+        }
+        gst_buffer_unmap(part, &map);
+        return part;
+    }
+    compact_payload_to_annexb(map.data, map.size, out_map.data);
+    gst_buffer_unmap(out, &out_map);
+    gst_buffer_unmap(part, &map);
+
+    gst_buffer_copy_into(out, part, GST_BUFFER_COPY_METADATA, 0, -1);
+    gst_buffer_unref(part);
+
+    return out;
+}
+
+/**
+ * Adds the user data of one SEI message to the recovered data. Plain data
+ * belongs to the current access unit; fragments (spread mode, format in
+ * sei_merge.h) are reassembled and the completed payload goes to the access
+ * unit au_delay before the current one. Compact payloads are expanded.
+ * @param self Extractor
+ * @param part User data of the message, consumed
+ * @param payload In/out: data of the current access unit
+ * @param late In/out: completed payloads of earlier access units, timestamped
+ */
+static void
+gst_lv_extractor_collect(GstLvExtractor *self, GstBuffer *part, GstBuffer **payload,
+                         GstBufferList **late)
+{
+    guint8 header[SEI_FRAGMENT_HEADER_SIZE];
+    guint16 sequence;
+    guint index, count, au_delay;
+    guint64 au;
+
+    if (gst_buffer_extract(part, 0, header, SEI_FRAGMENT_HEADER_SIZE) < SEI_FRAGMENT_HEADER_SIZE ||
+        header[0] != SEI_FRAGMENT_MARKER) {
+        part = gst_lv_extractor_expand(self, part);
+        *payload = *payload ? gst_buffer_append(*payload, part) : part;
+        return;
+    }
+
+    sequence = (guint16)((header[1] << 8) | header[2]);
+    index = header[3];
+    count = header[4];
+    au_delay = header[5];
+
+    if (index == 0) {
+        if (self->fragment_data) {
+            GST_WARNING_OBJECT(self, "Payload %u incomplete (%u/%u fragments), dropped",
+                               self->fragment_sequence, self->fragment_next, self->fragment_count);
+            gst_clear_buffer(&self->fragment_data);
+        }
+        self->fragment_sequence = sequence;
+        self->fragment_count = count;
+        self->fragment_next = 0;
+    } else if (!self->fragment_data || sequence != self->fragment_sequence ||
+               index != self->fragment_next || count != self->fragment_count) {
+        GST_WARNING_OBJECT(self, "Unexpected fragment %u/%u of payload %u, dropped",
+                           index, count, sequence);
+        gst_clear_buffer(&self->fragment_data);
+        gst_buffer_unref(part);
+        return;
+    }
+
+    self->fragment_data = gst_buffer_append(self->fragment_data ? self->fragment_data : gst_buffer_new(),
+                                            gst_buffer_copy_region(part, GST_BUFFER_COPY_MEMORY,
+                                                                   SEI_FRAGMENT_HEADER_SIZE, -1));
+    gst_buffer_unref(part);
+    self->fragment_next++;
+    if (self->fragment_next < self->fragment_count) {
+        return;
+    }
+
+    part = gst_lv_extractor_expand(self, self->fragment_data);
+    self->fragment_data = NULL;
+    if (au_delay == 0) {
+        *payload = *payload ? gst_buffer_append(*payload, part) : part;
+        return;
+    }
+    if (au_delay >= self->au_count) {
+        GST_WARNING_OBJECT(self, "Payload %u belongs to an access unit not seen, dropped", sequence);
+        gst_buffer_unref(part);
+        return;
+    }
+
+    au = (self->au_count - 1 - au_delay) % GST_LV_EXTRACTOR_AU_HISTORY;
+    GST_BUFFER_PTS(part) = self->history_pts[au];
+    GST_BUFFER_DTS(part) = self->history_dts[au];
+    GST_LOG_OBJECT(self, "Payload %u completed %u access units late", sequence, au_delay);
+
+    if (!*late) {
+        *late = gst_buffer_list_new();
+    }
+    gst_buffer_list_add(*late, part);
+}
+
+/**
+ * Extracts the user data of our SEI messages (sei-type with the configured
+ * UUID or the LCEVC T.35 codes) from a SEI NAL unit. Messages of another
+ * type, such as those of the compositor's sink_secondary_%u pads, stay in
+ * the base stream.
+ * The RBSP is read in place: payloads are sub-buffers of the input memories,
+ * split around the emulation prevention bytes if there are any.
+ * @param self Extractor
+ * @param buffer Input buffer
+ * @param unit SEI NAL unit
+ * @param payload In/out: recovered data, new parts are appended
+ * @param late In/out: reassembled payloads of earlier access units
+ * @return TRUE if every message of the NAL unit was ours, so it can be removed
+ */
+static gboolean
+gst_lv_extractor_parse_sei(GstLvExtractor *self, GstBuffer *buffer, const GstLvNalUnit *unit,
+                           GstBuffer **payload, GstBufferList **late)
+{
+    gsize rbsp_offset = unit->header_offset + self->codec_desc->nal_header_size;
+    GstLvSeiRbsp rbsp;
+    GstLvSeiMessage message;
+    gsize cursor = 0;
+    guint matched = 0;
+    guint others = 0;
+
+    if (unit->offset + unit->size <= rbsp_offset) {
+        return FALSE;
+    }
+
+    sei_rbsp_init(&rbsp, buffer, rbsp_offset, unit->offset + unit->size - rbsp_offset);
+    while (sei_rbsp_next_message(&rbsp, &cursor, &message)) {
+        if (!sei_message_is_user_data(&rbsp, &message, &self->sei_header)) {
+            others++;
+            continue;
+        }
+        matched++;
+        if (message.size > self->sei_header.size) {
+            GstBuffer *part = sei_rbsp_share(&rbsp, message.offset + self->sei_header.size,
+                                             message.size - self->sei_header.size);
+
+            gst_lv_extractor_collect(self, part, payload, late);
+        }
+    }
+
+    GST_LOG_OBJECT(self, "SEI NAL unit at %" G_GSIZE_FORMAT ": %u matching, %u other messages, "
+                   "%u emulation prevention bytes", unit->offset, matched, others, rbsp.n_epb);
+    sei_rbsp_clear(&rbsp);
+
+    return matched > 0 && others == 0;
+}
+
+static GstFlowReturn
+gst_lv_extractor_chain(GstPad *pad, GstObject *parent, GstBuffer *buffer)
+{
+    GstLvExtractor *self = GST_LV_EXTRACTOR(parent);
+    const GstLvCodecDesc *desc = self->codec_desc;
+    GstLvNalUnit units[EXTRACTOR_MAX_NAL_UNITS];
+    GstBuffer *main_buffer = NULL;
+    GstBuffer *payload = NULL;
+    GstBufferList *late = NULL;
+    GstFlowReturn ret = GST_FLOW_OK;
+    gsize size;
+    gsize kept = 0;
+    guint n_units;
+    guint i;
+
+    if (!desc) {
+        GST_ELEMENT_ERROR(self, CORE, NEGOTIATION, (NULL), ("No caps before the first buffer"));
+        gst_buffer_unref(buffer);
+        return GST_FLOW_NOT_NEGOTIATED;
+    }
+
+    /* Access unit count: every buffer when aligned on access units, a PTS
+     * change otherwise */
+    if (!self->nal_aligned || self->au_count == 0 || !GST_BUFFER_PTS_IS_VALID(buffer) ||
+        GST_BUFFER_PTS(buffer) != self->history_pts[(self->au_count - 1) % GST_LV_EXTRACTOR_AU_HISTORY]) {
+        self->history_pts[self->au_count % GST_LV_EXTRACTOR_AU_HISTORY] = GST_BUFFER_PTS(buffer);
+        self->history_dts[self->au_count % GST_LV_EXTRACTOR_AU_HISTORY] = GST_BUFFER_DTS(buffer);
+        self->au_count++;
+    }
+
+    /* Indexed memory by memory, a multi-memory input is never merged */
+    size = gst_buffer_get_size(buffer);
+    n_units = sei_index_nal_units(buffer, desc, units, EXTRACTOR_MAX_NAL_UNITS);
+    for (i = 0; i < n_units; i++) {
+        gboolean is_sei = units[i].type == desc->prefix_sei_type ||
+                          (desc->suffix_sei_type != NAL_TYPE_NONE &&
+                           units[i].type == desc->suffix_sei_type);
+
+        if (!is_sei) {
+            continue;
+        }
+        if (!gst_lv_extractor_parse_sei(self, buffer, &units[i], &payload, &late)) {
+            continue;
+        }
+
+        /* The base stream is rebuilt from the memories around the removed SEIs */
+        if (!main_buffer) {
+            main_buffer = gst_buffer_new();
+            gst_buffer_copy_into(main_buffer, buffer, GST_BUFFER_COPY_METADATA, 0, -1);
+        }
+        if (units[i].offset > kept) {
+            gst_buffer_copy_into(main_buffer, buffer, GST_BUFFER_COPY_MEMORY, kept,
+                                 units[i].offset - kept);
+        }
+        kept = units[i].offset + units[i].size;
+    }
+
+    if (main_buffer && kept < size) {
+        gst_buffer_copy_into(main_buffer, buffer, GST_BUFFER_COPY_MEMORY, kept, size - kept);
+    }
+
+    if (late) {
+        /* Payloads spread over several access units, older than the current one */
+        ret = gst_flow_combiner_update_pad_flow(self->flow_combiner, self->src_secondary,
+                                                gst_pad_push_list(self->src_secondary, late));
+    }
+
+    if (payload && ret != GST_FLOW_OK) {
+        gst_buffer_unref(payload);
+    } else if (payload) {
+        gst_buffer_copy_into(payload, buffer, GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+        if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+            GST_BUFFER_FLAG_SET(payload, GST_BUFFER_FLAG_DELTA_UNIT);
+        }
+        GST_LOG_OBJECT(self, "Recovered %" G_GSIZE_FORMAT " bytes in %u memories, PTS %"
+                       GST_TIME_FORMAT, gst_buffer_get_size(payload), gst_buffer_n_memory(payload),
+                       GST_TIME_ARGS(GST_BUFFER_PTS(payload)));
+
+        ret = gst_flow_combiner_update_pad_flow(self->flow_combiner, self->src_secondary,
+                                                gst_pad_push(self->src_secondary, payload));
+    }
+
+    if (!main_buffer) {
+        /* Nothing removed, the input goes through untouched */
+        main_buffer = buffer;
+    } else {
+        gst_buffer_unref(buffer);
+        if (gst_buffer_get_size(main_buffer) == 0) {
+            /* NAL aligned input: the buffer was the SEI alone */
+            gst_buffer_unref(main_buffer);
+            return ret;
+        }
+    }
+
+    if (ret != GST_FLOW_OK) {
+        gst_buffer_unref(main_buffer);
+        return ret;
+    }
+
+    return gst_flow_combiner_update_pad_flow(self->flow_combiner, self->src_main,
+                                             gst_pad_push(self->src_main, main_buffer));
+}
@@ -0,0 +1,61 @@
+#ifndef __GST_LV_EXTRACTOR_H__
+#define __GST_LV_EXTRACTOR_H__
+
+#include <gst/gst.h>
+#include <gst/base/gstflowcombiner.h>
+#include "sei_merge.h"
+
+G_BEGIN_DECLS
+
+/* Unités d'accès dont les horodatages sont gardés, au_delay tient sur 8 bits */
+#define GST_LV_EXTRACTOR_AU_HISTORY 256
+
+#define GST_TYPE_LV_EXTRACTOR (gst_lv_extractor_get_type())
+#define GST_LV_EXTRACTOR(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_LV_EXTRACTOR, GstLvExtractor))
+#define GST_LV_EXTRACTOR_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST((klass), GST_TYPE_LV_EXTRACTOR, GstLvExtractorClass))
+#define GST_IS_LV_EXTRACTOR(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_LV_EXTRACTOR))
+#define GST_IS_LV_EXTRACTOR_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass), GST_TYPE_LV_EXTRACTOR))
+
+typedef struct _GstLvExtractor GstLvExtractor;
+typedef struct _GstLvExtractorClass GstLvExtractorClass;
+
+struct _GstLvExtractor {
+    GstElement parent;
+
+    /* Pads */
+    GstPad *sinkpad;
+    GstPad *src_main;       /* flux de base, SEI retirés */
+    GstPad *src_secondary;  /* données récupérées, caps secondary_caps */
+    GstFlowCombiner *flow_combiner;
+
+    /* Propriétés */
+    gchar *uuid;
+    GstLvSeiType sei_type;
+    GstCaps *secondary_caps;
+
+    /* Fixés à la négociation du flux d'entrée */
+    const GstLvCodecDesc *codec_desc;
+    GstLvSeiUserDataHeader sei_header;
+    gboolean nal_aligned;
+
+    /* Unités d'accès vues, horodatages des dernières (SEI étalés) */
+    guint64 au_count;
+    GstClockTime history_pts[GST_LV_EXTRACTOR_AU_HISTORY];
+    GstClockTime history_dts[GST_LV_EXTRACTOR_AU_HISTORY];
+
+    /* Réassemblage des fragments en cours */
+    GstBuffer *fragment_data;
+    guint16 fragment_sequence;
+    guint fragment_next;
+    guint fragment_count;
+};
+
+struct _GstLvExtractorClass {
+    GstElementClass parent_class;
+};
+
+GType gst_lv_extractor_get_type(void);
+
+G_END_DECLS
+
+#endif /* __GST_LV_EXTRACTOR_H__ */
@@ -0,0 +1,860 @@
+#include "gstlvmulticompositor.h"
+#include "sei_payload.h"
+
+#include <stdio.h>
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC (gst_lv_multi_compositor_debug);
+#define GST_CAT_DEFAULT gst_lv_multi_compositor_debug
+
+#define DEFAULT_UUID "lcevc"
+#define DEFAULT_SEI_TYPE SEI_TYPE_UNREGISTERED
+#define DEFAULT_PTS_TOLERANCE GST_MSECOND
+#define DEFAULT_REORDER_WINDOW 16
+
+#define MAIN_CAPS \
+    "video/x-h264, " \
+    "stream-format=(string)byte-stream, " \
+    "alignment=(string)au; " \
+    "video/x-h265, " \
+    "stream-format=(string)byte-stream, " \
+    "alignment=(string)au; " \
+    "video/x-h266, " \
+    "stream-format=(string)byte-stream, " \
+    "alignment=(string)au; " \
+    "video/x-evc, " \
+    "stream-format=(string)byte-stream, " \
+    "alignment=(string)au"
+
+static GstStaticPadTemplate sink_template_main = GST_STATIC_PAD_TEMPLATE(
+    "sink_main_%u",
+    GST_PAD_SINK,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS(MAIN_CAPS)
+);
+
+static GstStaticPadTemplate sink_template_secondary = GST_STATIC_PAD_TEMPLATE(
+    "sink_secondary_%u",
+    GST_PAD_SINK,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS(
+        "video/x-evc, "
+        "stream-format=(string)byte-stream, "
+        "alignment=(string)au"
+    )
+);
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE(
+    "src_%u",
+    GST_PAD_SRC,
+    GST_PAD_SOMETIMES,
+    GST_STATIC_CAPS(MAIN_CAPS)
+);
+
+enum {
+    PROP_0,
+    PROP_UUID,
+    PROP_SEI_TYPE,
+    PROP_PTS_TOLERANCE,
+    PROP_REORDER_WINDOW
+};
+
+G_DEFINE_TYPE(GstLvMultiCompositor, gst_lv_multi_compositor, GST_TYPE_ELEMENT)
+
+static void gst_lv_multi_compositor_set_property(GObject *object, guint prop_id,
+                                                 const GValue *value, GParamSpec *pspec);
+static void gst_lv_multi_compositor_get_property(GObject *object, guint prop_id,
+                                                 GValue *value, GParamSpec *pspec);
+static void gst_lv_multi_compositor_finalize(GObject *object);
+
+static GstPad *gst_lv_multi_compositor_request_new_pad(GstElement *element, GstPadTemplate *templ,
+                                                       const gchar *name, const GstCaps *caps);
+static void gst_lv_multi_compositor_release_pad(GstElement *element, GstPad *pad);
+static GstStateChangeReturn gst_lv_multi_compositor_change_state(GstElement *element,
+                                                                 GstStateChange transition);
+
+static void
+gst_lv_multi_compositor_class_init(GstLvMultiCompositorClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+    GstElementClass *gstelement_class = GST_ELEMENT_CLASS(klass);
+
+    GST_DEBUG_CATEGORY_INIT(gst_lv_multi_compositor_debug, "lvmulticompositor", 0,
+                           "LV Multi-channel Compositor element");
+
+    gobject_class->set_property = gst_lv_multi_compositor_set_property;
+    gobject_class->get_property = gst_lv_multi_compositor_get_property;
+    gobject_class->finalize = gst_lv_multi_compositor_finalize;
+
+    g_object_class_install_property(gobject_class, PROP_UUID,
+        g_param_spec_string("uuid", "UUID",
+                           "UUID of the user_data_unregistered SEI: \"lcevc\" for the fixed "
+                           "LCEVC UUID, \"random\" for a new UUID per stream, or 32 hex digits",
+                           DEFAULT_UUID,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_SEI_TYPE,
+        g_param_spec_enum("sei-type", "SEI type",
+                         "SEI message carrying the secondary data, applied when the main "
+                         "stream of a channel is negotiated",
+                         GST_TYPE_LV_SEI_TYPE, DEFAULT_SEI_TYPE,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_PTS_TOLERANCE,
+        g_param_spec_uint64("pts-tolerance", "PTS tolerance",
+                           "Largest PTS difference (ns) between a main and a secondary buffer "
+                           "to pair them",
+                           0, G_MAXUINT64, DEFAULT_PTS_TOLERANCE,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    g_object_class_install_property(gobject_class, PROP_REORDER_WINDOW,
+        g_param_spec_uint("reorder-window", "Reorder window",
+                         "Number of secondary buffers kept per channel while looking for the "
+                         "main PTS",
+                         1, PTS_RING_MAX_SIZE, DEFAULT_REORDER_WINDOW,
+                         G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+    gst_element_class_set_static_metadata(gstelement_class,
+        "LV Multi-channel Compositor", "Filter/Compositor/Video",
+        "Embeds secondary streams as SEI messages into main video streams, "
+        "many channels in one element",
+        "Le Blond Erwan erwanleblond@gmail.com");
+
+    gst_element_class_add_static_pad_template(gstelement_class, &sink_template_main);
+    gst_element_class_add_static_pad_template(gstelement_class, &sink_template_secondary);
+    gst_element_class_add_static_pad_template(gstelement_class, &src_template);
+
+    gstelement_class->request_new_pad = gst_lv_multi_compositor_request_new_pad;
+    gstelement_class->release_pad = gst_lv_multi_compositor_release_pad;
+    gstelement_class->change_state = gst_lv_multi_compositor_change_state;
+}
+
+static void
+gst_lv_multi_compositor_init(GstLvMultiCompositor *self)
+{
+    guint i;
+
+    self->uuid = g_strdup(DEFAULT_UUID);
+    self->sei_type = DEFAULT_SEI_TYPE;
+    self->pts_tolerance = DEFAULT_PTS_TOLERANCE;
+    self->reorder_window = DEFAULT_REORDER_WINDOW;
+
+    /* Channel state is preallocated, the pads only point into it */
+    self->channels = g_new0(GstLvMultiChannel, GST_LV_MULTI_COMPOSITOR_MAX_CHANNELS);
+    self->n_channels = 0;
+    for (i = 0; i < GST_LV_MULTI_COMPOSITOR_MAX_CHANNELS; i++) {
+        GstLvMultiChannel *channel = &self->channels[i];
+
+        g_mutex_init(&channel->lock);
+        g_cond_init(&channel->cond);
+        g_mutex_init(&channel->stream_lock);
+        channel->index = i;
+        pts_ring_init(&channel->main_ring);
+        pts_ring_init(&channel->secondary_queue);
+        pts_ring_init(&channel->secondary_ring);
+        channel->flow = GST_FLOW_OK;
+    }
+}
+
+static void
+gst_lv_multi_compositor_set_property(GObject *object, guint prop_id,
+                                     const GValue *value, GParamSpec *pspec)
+{
+    GstLvMultiCompositor *self = GST_LV_MULTI_COMPOSITOR(object);
+
+    switch (prop_id) {
+        case PROP_UUID: {
+            const gchar *uuid = g_value_get_string(value);
+            guint8 parsed[SEI_UUID_SIZE];
+
+            if (!sei_uuid_resolve(uuid, parsed)) {
+                GST_WARNING_OBJECT(self, "Invalid UUID '%s', keeping '%s'", uuid, self->uuid);
+                break;
+            }
+            /* Applied when the main stream of a channel is (re)negotiated */
+            GST_OBJECT_LOCK(self);
+            g_free(self->uuid);
+            self->uuid = g_strdup(uuid ? uuid : DEFAULT_UUID);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        }
+        case PROP_SEI_TYPE:
+            GST_OBJECT_LOCK(self);
+            self->sei_type = g_value_get_enum(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_PTS_TOLERANCE:
+            GST_OBJECT_LOCK(self);
+            self->pts_tolerance = g_value_get_uint64(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_REORDER_WINDOW:
+            GST_OBJECT_LOCK(self);
+            self->reorder_window = g_value_get_uint(value);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+gst_lv_multi_compositor_get_property(GObject *object, guint prop_id,
+                                     GValue *value, GParamSpec *pspec)
+{
+    GstLvMultiCompositor *self = GST_LV_MULTI_COMPOSITOR(object);
+
+    switch (prop_id) {
+        case PROP_UUID:
+            GST_OBJECT_LOCK(self);
+            g_value_set_string(value, self->uuid);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_SEI_TYPE:
+            GST_OBJECT_LOCK(self);
+            g_value_set_enum(value, self->sei_type);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_PTS_TOLERANCE:
+            GST_OBJECT_LOCK(self);
+            g_value_set_uint64(value, self->pts_tolerance);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        case PROP_REORDER_WINDOW:
+            GST_OBJECT_LOCK(self);
+            g_value_set_uint(value, self->reorder_window);
+            GST_OBJECT_UNLOCK(self);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+            break;
+    }
+}
+
+static void
+gst_lv_multi_compositor_finalize(GObject *object)
+{
+    GstLvMultiCompositor *self = GST_LV_MULTI_COMPOSITOR(object);
+    guint i;
+
+    for (i = 0; i < GST_LV_MULTI_COMPOSITOR_MAX_CHANNELS; i++) {
+        GstLvMultiChannel *channel = &self->channels[i];
+
+        pts_ring_clear(&channel->main_ring);
+        pts_ring_clear(&channel->secondary_queue);
+        pts_ring_clear(&channel->secondary_ring);
+        sei_writer_clear(&channel->writer);
+        g_mutex_clear(&channel->lock);
+        g_cond_clear(&channel->cond);
+        g_mutex_clear(&channel->stream_lock);
+    }
+    g_free(self->channels);
+    g_free(self->uuid);
+
+    G_OBJECT_CLASS(gst_lv_multi_compositor_parent_class)->finalize(object);
+}
+
+static GstBuffer *
+gst_lv_multi_channel_pull_secondary(gpointer user_data)
+{
+    GstLvMultiChannel *channel = user_data;
+
+    return pts_ring_pop(&channel->secondary_queue);
+}
+
+/**
+ * Decides whether the oldest main access unit of a channel can go out now,
+ * and takes its secondary buffer. Pairs like lvcompositor: queued secondary
+ * buffers move into the reorder window until the match shows up, and the
+ * access unit only goes out alone once the window is full or no more
+ * secondary data can come. Called with the channel lock.
+ * @param channel Channel
+ * @param tolerance Largest PTS difference of a pair
+ * @param window Reorder window of the secondary stream
+ * @param secondary_buffer Out: secondary buffer paired with it, NULL if none
+ * @return TRUE if the access unit can be merged and pushed, FALSE if it has
+ *         to wait for the secondary stream (or there is none)
+ */
+static gboolean
+gst_lv_multi_channel_pair(GstLvMultiChannel *channel, GstClockTime tolerance, guint window,
+                          GstBuffer **secondary_buffer)
+{
+    GstBuffer *main_buffer = pts_ring_peek(&channel->main_ring);
+    GstClockTime horizon;
+    guint dropped;
+
+    *secondary_buffer = NULL;
+    if (!main_buffer) {
+        return FALSE;
+    }
+
+    horizon = GST_BUFFER_DTS_IS_VALID(main_buffer) ? GST_BUFFER_DTS(main_buffer)
+                                                   : GST_BUFFER_PTS(main_buffer);
+    *secondary_buffer = pts_ring_pair(&channel->secondary_ring, gst_lv_multi_channel_pull_secondary,
+                                      channel, GST_BUFFER_PTS(main_buffer), horizon, tolerance,
+                                      window, &dropped);
+    if (dropped > 0) {
+        GST_DEBUG("Channel %u: dropped %u stale secondary buffers", channel->index, dropped);
+    }
+    if (*secondary_buffer) {
+        return TRUE;
+    }
+
+    return channel->draining || channel->secondary_eos || !channel->secondary_pad ||
+           channel->secondary_flushing || pts_ring_length(&channel->secondary_ring) >= window;
+}
+
+/* Same merge as lvcompositor in access unit mode: in place if the main
+ * buffer has headroom, shared memories otherwise. Runs in the streaming
+ * thread pushing for the channel, channels merge in parallel as their
+ * upstream threads do */
+static GstBuffer *
+gst_lv_multi_channel_merge(GstLvMultiChannel *channel, GstBuffer *main_buffer,
+                           GstBuffer *secondary_buffer)
+{
+    GstBuffer *out_buffer = NULL;
+
+    if (!secondary_buffer) {
+        GST_LOG("Channel %u: no secondary buffer for PTS %" GST_TIME_FORMAT, channel->index,
+                GST_TIME_ARGS(GST_BUFFER_PTS(main_buffer)));
+        return main_buffer;
+    }
+
+    /* Embedded as is, escaped if it starts like a fragment or compact payload */
+    secondary_buffer = sei_payload_prepare(SEI_PAYLOAD_RAW, FALSE, secondary_buffer);
+    if (channel->merge && merge_lcevc_sei_in_place(&channel->writer, main_buffer, secondary_buffer)) {
+        out_buffer = main_buffer;
+    } else if (channel->merge) {
+        out_buffer = merge_lcevc_data(&channel->writer, main_buffer, secondary_buffer);
+        if (out_buffer) {
+            gst_buffer_unref(main_buffer);
+        }
+    }
+    gst_buffer_unref(secondary_buffer);
+
+    if (!out_buffer) {
+        GST_WARNING("Channel %u: sei merge failed, using main stream only", channel->index);
+        out_buffer = main_buffer;
+    }
+
+    return out_buffer;
+}
+
+/**
+ * Merges and pushes the access units of a channel that can go out, until
+ * one has to wait for secondary data. Runs in an upstream streaming thread
+ * of the channel, with its stream lock.
+ * @param self Element
+ * @param channel Channel
+ * @return Flow of the channel
+ */
+static GstFlowReturn
+gst_lv_multi_compositor_push_ready(GstLvMultiCompositor *self, GstLvMultiChannel *channel)
+{
+    GstClockTime tolerance;
+    GstFlowReturn ret;
+    guint window;
+
+    GST_OBJECT_LOCK(self);
+    tolerance = self->pts_tolerance;
+    window = self->reorder_window;
+    GST_OBJECT_UNLOCK(self);
+
+    g_mutex_lock(&channel->lock);
+    while (!channel->main_flushing && channel->flow == GST_FLOW_OK) {
+        GstBuffer *main_buffer;
+        GstBuffer *secondary_buffer;
+        GstPad *srcpad;
+
+        if (!gst_lv_multi_channel_pair(channel, tolerance, window, &secondary_buffer)) {
+            break;
+        }
+        main_buffer = pts_ring_pop(&channel->main_ring);
+        srcpad = gst_object_ref(channel->srcpad);
+        /* Room in the rings for a blocked chain function */
+        g_cond_broadcast(&channel->cond);
+        g_mutex_unlock(&channel->lock);
+
+        ret = gst_pad_push(srcpad, gst_lv_multi_channel_merge(channel, main_buffer, secondary_buffer));
+        gst_object_unref(srcpad);
+
+        g_mutex_lock(&channel->lock);
+        if (ret != GST_FLOW_OK) {
+            GST_DEBUG_OBJECT(self, "Channel %u: push returned %s", channel->index,
+                             gst_flow_get_name(ret));
+        }
+        channel->flow = ret;
+    }
+    /* Secondary buffers moved into the reorder window leave room too */
+    g_cond_broadcast(&channel->cond);
+    ret = channel->flow;
+    g_mutex_unlock(&channel->lock);
+
+    return ret;
+}
+
+/* Called by every upstream streaming thread of a channel once its data is
+ * queued; whichever holds the stream lock pushes */
+static GstFlowReturn
+gst_lv_multi_compositor_process(GstLvMultiCompositor *self, GstLvMultiChannel *channel)
+{
+    GstFlowReturn ret;
+
+    g_mutex_lock(&channel->stream_lock);
+    ret = gst_lv_multi_compositor_push_ready(self, channel);
+    g_mutex_unlock(&channel->stream_lock);
+
+    return ret;
+}
+
+/**
+ * Pushes every queued main access unit of a channel, paired or not, so a
+ * serialized event can follow them. Called with the stream lock.
+ * @param self Element
+ * @param channel Channel
+ * @return Flow of the channel
+ */
+static GstFlowReturn
+gst_lv_multi_compositor_drain(GstLvMultiCompositor *self, GstLvMultiChannel *channel)
+{
+    GstFlowReturn ret;
+
+    g_mutex_lock(&channel->lock);
+    channel->draining = TRUE;
+    g_mutex_unlock(&channel->lock);
+
+    ret = gst_lv_multi_compositor_push_ready(self, channel);
+
+    g_mutex_lock(&channel->lock);
+    channel->draining = FALSE;
+    g_mutex_unlock(&channel->lock);
+
+    return ret;
+}
+
+static GstFlowReturn
+gst_lv_multi_compositor_chain_main(GstPad *pad, GstObject *parent, GstBuffer *buffer)
+{
+    GstLvMultiCompositor *self = GST_LV_MULTI_COMPOSITOR(parent);
+    GstLvMultiChannel *channel = gst_pad_get_element_private(pad);
+    GstFlowReturn ret;
+
+    g_mutex_lock(&channel->lock);
+    while (!channel->main_flushing && channel->flow == GST_FLOW_OK &&
+           pts_ring_length(&channel->main_ring) == PTS_RING_MAX_SIZE) {
+        g_cond_wait(&channel->cond, &channel->lock);
+    }
+    if (channel->main_flushing) {
+        ret = GST_FLOW_FLUSHING;
+    } else {
+        ret = channel->flow;
+    }
+    if (ret == GST_FLOW_OK) {
+        pts_ring_push(&channel->main_ring, buffer);
+    }
+    g_mutex_unlock(&channel->lock);
+
+    if (ret != GST_FLOW_OK) {
+        gst_buffer_unref(buffer);
+        return ret;
+    }
+
+    return gst_lv_multi_compositor_process(self, channel);
+}
+
+static GstFlowReturn
+gst_lv_multi_compositor_chain_secondary(GstPad *pad, GstObject *parent, GstBuffer *buffer)
+{
+    GstLvMultiCompositor *self = GST_LV_MULTI_COMPOSITOR(parent);
+    GstLvMultiChannel *channel = gst_pad_get_element_private(pad);
+
+    g_mutex_lock(&channel->lock);
+    while (!channel->secondary_flushing && channel->main_pad &&
+           pts_ring_length(&channel->secondary_queue) == PTS_RING_MAX_SIZE) {
+        g_cond_wait(&channel->cond, &channel->lock);
+    }
+    if (channel->secondary_flushing) {
+        g_mutex_unlock(&channel->lock);
+        gst_buffer_unref(buffer);
+        return GST_FLOW_FLUSHING;
+    }
+    if (pts_ring_length(&channel->secondary_queue) == PTS_RING_MAX_SIZE) {
+        /* No main stream to pair with, keep the newest buffers */
+        gst_buffer_unref(pts_ring_pop(&channel->secondary_queue));
+    }
+    pts_ring_push(&channel->secondary_queue, buffer);
+    g_mutex_unlock(&channel->lock);
+
+    /* Main access units waiting for it go out from this thread, the flow of
+     * the main stream is not the one of this pad */
+    gst_lv_multi_compositor_process(self, channel);
+
+    return GST_FLOW_OK;
+}
+
+/* Sets up the SEI writer of a channel for its main stream caps */
+static void
+gst_lv_multi_compositor_setup_channel(GstLvMultiCompositor *self, GstLvMultiChannel *channel,
+                                      GstCaps *caps)
+{
+    const GstLvCodecDesc *desc = NULL;
+    guint8 uuid[SEI_UUID_SIZE];
+    GstLvSeiType sei_type;
+
+    if (!gst_caps_is_empty(caps)) {
+        desc = codec_desc_from_caps_name(gst_structure_get_name(gst_caps_get_structure(caps, 0)));
+    }
+
+    GST_OBJECT_LOCK(self);
+    sei_uuid_resolve(self->uuid, uuid);
+    sei_type = self->sei_type;
+    GST_OBJECT_UNLOCK(self);
+
+    /* Drained before, under the stream lock: no merge uses the writer */
+    sei_writer_clear(&channel->writer);
+    channel->merge = sei_writer_init(&channel->writer, desc, sei_type, uuid, SEI_POSITION_PREFIX, 0);
+
+    GST_DEBUG_OBJECT(self, "Channel %u: embedding into %s", channel->index,
+                     desc ? desc->name : "UNKNOWN");
+}
+
+static gboolean
+gst_lv_multi_compositor_event_main(GstPad *pad, GstObject *parent, GstEvent *event)
+{
+    GstLvMultiCompositor *self = GST_LV_MULTI_COMPOSITOR(parent);
+    GstLvMultiChannel *channel = gst_pad_get_element_private(pad);
+    GstPad *srcpad;
+    gboolean ret;
+
+    switch (GST_EVENT_TYPE(event)) {
+        case GST_EVENT_FLUSH_START:
+            g_mutex_lock(&channel->lock);
+            channel->main_flushing = TRUE;
+            g_cond_broadcast(&channel->cond);
+            g_mutex_unlock(&channel->lock);
+            break;
+        case GST_EVENT_FLUSH_STOP:
+            /* The secondary thread may still be pushing for the channel */
+            g_mutex_lock(&channel->stream_lock);
+            g_mutex_lock(&channel->lock);
+            pts_ring_clear(&channel->main_ring);
+            channel->main_flushing = FALSE;
+            channel->flow = GST_FLOW_OK;
+            g_mutex_unlock(&channel->lock);
+            g_mutex_unlock(&channel->stream_lock);
+            break;
+        case GST_EVENT_CAPS: {
+            GstCaps *caps;
+
+            gst_event_parse_caps(event, &caps);
+            g_mutex_lock(&channel->stream_lock);
+            gst_lv_multi_compositor_drain(self, channel);
+            gst_lv_multi_compositor_setup_channel(self, channel, caps);
+            g_mutex_unlock(&channel->stream_lock);
+            break;
+        }
+        default:
+            /* Serialized events stay behind the access units already queued */
+            if (GST_EVENT_IS_SERIALIZED(event)) {
+                g_mutex_lock(&channel->stream_lock);
+                gst_lv_multi_compositor_drain(self, channel);
+                g_mutex_unlock(&channel->stream_lock);
+            }
+            break;
+    }
+
+    g_mutex_lock(&channel->lock);
+    srcpad = channel->srcpad ? gst_object_ref(channel->srcpad) : NULL;
+    g_mutex_unlock(&channel->lock);
+
+    if (!srcpad) {
+        gst_event_unref(event);
+        return FALSE;
+    }
+    ret = gst_pad_push_event(srcpad, event);
+    gst_object_unref(srcpad);
+
+    return ret;
+}
+
+/* Secondary events only change the pairing state, nothing goes downstream */
+static gboolean
+gst_lv_multi_compositor_event_secondary(GstPad *pad, GstObject *parent, GstEvent *event)
+{
+    GstLvMultiCompositor *self = GST_LV_MULTI_COMPOSITOR(parent);
+    GstLvMultiChannel *channel = gst_pad_get_element_private(pad);
+    gboolean eos = FALSE;
+
+    g_mutex_lock(&channel->lock);
+    switch (GST_EVENT_TYPE(event)) {
+        case GST_EVENT_FLUSH_START:
+            channel->secondary_flushing = TRUE;
+            g_cond_broadcast(&channel->cond);
+            break;
+        case GST_EVENT_FLUSH_STOP:
+            pts_ring_clear(&channel->secondary_queue);
+            pts_ring_clear(&channel->secondary_ring);
+            channel->secondary_flushing = FALSE;
+            channel->secondary_eos = FALSE;
+            break;
+        case GST_EVENT_STREAM_START:
+            channel->secondary_eos = FALSE;
+            break;
+        case GST_EVENT_EOS:
+            channel->secondary_eos = TRUE;
+            eos = TRUE;
+            break;
+        default:
+            break;
+    }
+    g_mutex_unlock(&channel->lock);
+
+    gst_event_unref(event);
+
+    /* Main access units waiting for it go out without SEI */
+    if (eos) {
+        gst_lv_multi_compositor_process(self, channel);
+    }
+
+    return TRUE;
+}
+
+/* The main pad and the src pad of a channel are linked, for queries and
+ * upstream events; the secondary pad answers from its template */
+static GstIterator *
+gst_lv_multi_compositor_iterate_internal_links(GstPad *pad, GstObject *parent)
+{
+    GstLvMultiChannel *channel = gst_pad_get_element_private(pad);
+    GstIterator *it;
+    GstPad *other = NULL;
+    GValue value = G_VALUE_INIT;
+
+    g_mutex_lock(&channel->lock);
+    if (pad == channel->main_pad) {
+        other = channel->srcpad;
+    } else if (pad == channel->srcpad) {
+        other = channel->main_pad;
+    }
+    if (other) {
+        g_value_init(&value, GST_TYPE_PAD);
+        g_value_set_object(&value, other);
+    }
+    g_mutex_unlock(&channel->lock);
+
+    if (!other) {
+        return NULL;
+    }
+
+    it = gst_iterator_new_single(GST_TYPE_PAD, &value);
+    g_value_unset(&value);
+
+    return it;
+}
+
+/**
+ * Creates a sink pad of a channel, and the src pad of the channel with the
+ * first one. sink_main_N, sink_secondary_N and src_N share channel N.
+ * @param element Element
+ * @param templ sink_main_%u or sink_secondary_%u
+ * @param name Requested name, NULL for the lowest channel without such a pad
+ * @param caps Unused
+ * @return New pad, NULL if the channel already has it or is out of range
+ */
+static GstPad *
+gst_lv_multi_compositor_request_new_pad(GstElement *element, GstPadTemplate *templ,
+                                        const gchar *name, const GstCaps *caps)
+{
+    GstLvMultiCompositor *self = GST_LV_MULTI_COMPOSITOR(element);
+    const gchar *name_template = GST_PAD_TEMPLATE_NAME_TEMPLATE(templ);
+    gboolean is_main = g_strcmp0(name_template, "sink_main_%u") == 0;
+    GstLvMultiChannel *channel;
+    GstPad *srcpad = NULL;
+    GstPad *pad;
+    gchar *pad_name;
+    guint index;
+
+    if (!is_main && g_strcmp0(name_template, "sink_secondary_%u") != 0) {
+        GST_ERROR_OBJECT(self, "Unexpected pad template %s", name_template);
+        return NULL;
+    }
+
+    GST_OBJECT_LOCK(self);
+    if (name) {
+        if (sscanf(name, is_main ? "sink_main_%u" : "sink_secondary_%u", &index) != 1) {
+            GST_OBJECT_UNLOCK(self);
+            GST_ERROR_OBJECT(self, "Invalid pad name %s", name);
+            return NULL;
+        }
+    } else {
+        for (index = 0; index < GST_LV_MULTI_COMPOSITOR_MAX_CHANNELS; index++) {
+            channel = &self->channels[index];
+            if (!(is_main ? channel->main_pad : channel->secondary_pad)) {
+                break;
+            }
+        }
+    }
+    if (index >= GST_LV_MULTI_COMPOSITOR_MAX_CHANNELS ||
+        (is_main ? self->channels[index].main_pad : self->channels[index].secondary_pad)) {
+        GST_OBJECT_UNLOCK(self);
+        GST_ERROR_OBJECT(self, "No channel available for %s", name ? name : name_template);
+        return NULL;
+    }
+    channel = &self->channels[index];
+
+    pad_name = g_strdup_printf(is_main ? "sink_main_%u" : "sink_secondary_%u", index);
+    pad = gst_pad_new_from_template(templ, pad_name);
+    g_free(pad_name);
+    gst_pad_set_element_private(pad, channel);
+    if (is_main) {
+        gst_pad_set_chain_function(pad, gst_lv_multi_compositor_chain_main);
+        gst_pad_set_event_function(pad, gst_lv_multi_compositor_event_main);
+        gst_pad_set_iterate_internal_links_function(pad, gst_lv_multi_compositor_iterate_internal_links);
+        GST_PAD_SET_PROXY_CAPS(pad);
+    } else {
+        gst_pad_set_chain_function(pad, gst_lv_multi_compositor_chain_secondary);
+        gst_pad_set_event_function(pad, gst_lv_multi_compositor_event_secondary);
+        gst_pad_set_iterate_internal_links_function(pad, gst_lv_multi_compositor_iterate_internal_links);
+    }
+
+    g_mutex_lock(&channel->lock);
+    if (!channel->srcpad) {
+        pad_name = g_strdup_printf("src_%u", index);
+        srcpad = gst_pad_new_from_static_template(&src_template, pad_name);
+        g_free(pad_name);
+        gst_pad_set_element_private(srcpad, channel);
+        gst_pad_set_iterate_internal_links_function(srcpad, gst_lv_multi_compositor_iterate_internal_links);
+        GST_PAD_SET_PROXY_CAPS(srcpad);
+        channel->srcpad = srcpad;
+        channel->flow = GST_FLOW_OK;
+    }
+    if (is_main) {
+        channel->main_pad = pad;
+        channel->main_flushing = FALSE;
+    } else {
+        channel->secondary_pad = pad;
+        channel->secondary_flushing = FALSE;
+        channel->secondary_eos = FALSE;
+    }
+    g_mutex_unlock(&channel->lock);
+    self->n_channels = MAX(self->n_channels, index + 1);
+    GST_OBJECT_UNLOCK(self);
+
+    /* Pads are activated by gst_element_add_pad() when the element runs */
+    if (srcpad) {
+        gst_element_add_pad(element, srcpad);
+    }
+    gst_element_add_pad(element, pad);
+
+    return pad;
+}
+
+static void
+gst_lv_multi_compositor_release_pad(GstElement *element, GstPad *pad)
+{
+    GstLvMultiCompositor *self = GST_LV_MULTI_COMPOSITOR(element);
+    GstLvMultiChannel *channel = gst_pad_get_element_private(pad);
+    GstPad *srcpad = NULL;
+
+    /* Unblock the chain function before the pad is deactivated */
+    g_mutex_lock(&channel->lock);
+    if (pad == channel->main_pad) {
+        channel->main_flushing = TRUE;
+    } else {
+        channel->secondary_flushing = TRUE;
+    }
+    g_cond_broadcast(&channel->cond);
+    g_mutex_unlock(&channel->lock);
+
+    gst_element_remove_pad(element, pad);
+
+    /* Wait for a streaming thread still pushing for the channel, it takes
+     * the object lock under the stream lock */
+    g_mutex_lock(&channel->stream_lock);
+    GST_OBJECT_LOCK(self);
+    g_mutex_lock(&channel->lock);
+    if (pad == channel->main_pad) {
+        pts_ring_clear(&channel->main_ring);
+        channel->main_pad = NULL;
+    } else {
+        pts_ring_clear(&channel->secondary_queue);
+        pts_ring_clear(&channel->secondary_ring);
+        channel->secondary_pad = NULL;
+        /* Main access units no longer wait for it, they go out with the
+         * next main buffer or event */
+    }
+    if (!channel->main_pad && !channel->secondary_pad) {
+        srcpad = channel->srcpad;
+        channel->srcpad = NULL;
+        sei_writer_clear(&channel->writer);
+        channel->merge = FALSE;
+    }
+    g_mutex_unlock(&channel->lock);
+    GST_OBJECT_UNLOCK(self);
+    g_mutex_unlock(&channel->stream_lock);
+
+    if (srcpad) {
+        gst_element_remove_pad(element, srcpad);
+    }
+}
+
+static GstStateChangeReturn
+gst_lv_multi_compositor_change_state(GstElement *element, GstStateChange transition)
+{
+    GstLvMultiCompositor *self = GST_LV_MULTI_COMPOSITOR(element);
+    GstStateChangeReturn ret;
+    guint n_channels;
+    guint i;
+
+    GST_OBJECT_LOCK(self);
+    n_channels = self->n_channels;
+    GST_OBJECT_UNLOCK(self);
+
+    switch (transition) {
+        case GST_STATE_CHANGE_READY_TO_PAUSED:
+            for (i = 0; i < n_channels; i++) {
+                GstLvMultiChannel *channel = &self->channels[i];
+
+                g_mutex_lock(&channel->lock);
+                channel->main_flushing = FALSE;
+                channel->secondary_flushing = FALSE;
+                channel->secondary_eos = FALSE;
+                channel->flow = GST_FLOW_OK;
+                g_mutex_unlock(&channel->lock);
+            }
+            break;
+        case GST_STATE_CHANGE_PAUSED_TO_READY:
+            /* Streaming threads blocked on a full ring have to return
+             * before the pads are deactivated */
+            for (i = 0; i < n_channels; i++) {
+                GstLvMultiChannel *channel = &self->channels[i];
+
+                g_mutex_lock(&channel->lock);
+                channel->main_flushing = TRUE;
+                channel->secondary_flushing = TRUE;
+                g_cond_broadcast(&channel->cond);
+                g_mutex_unlock(&channel->lock);
+            }
+            break;
+        default:
+            break;
+    }
+
+    ret = GST_ELEMENT_CLASS(gst_lv_multi_compositor_parent_class)->change_state(element, transition);
+
+    if (transition == GST_STATE_CHANGE_PAUSED_TO_READY) {
+        for (i = 0; i < n_channels; i++) {
+            GstLvMultiChannel *channel = &self->channels[i];
+
+            g_mutex_lock(&channel->stream_lock);
+            g_mutex_lock(&channel->lock);
+            pts_ring_clear(&channel->main_ring);
+            pts_ring_clear(&channel->secondary_queue);
+            pts_ring_clear(&channel->secondary_ring);
+            g_mutex_unlock(&channel->lock);
+            g_mutex_unlock(&channel->stream_lock);
+        }
+    }
+
+    return ret;
+}
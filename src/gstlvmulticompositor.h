@@ -0,0 +1,83 @@
+#ifndef __GST_LV_MULTI_COMPOSITOR_H__
+#define __GST_LV_MULTI_COMPOSITOR_H__
+
+#include <gst/gst.h>
+#include "sei_merge.h"
+#include "pts_ring.h"
+
+G_BEGIN_DECLS
+
+/* Nombre maximal de canaux (paires sink_main_%u / sink_secondary_%u) */
+#define GST_LV_MULTI_COMPOSITOR_MAX_CHANNELS 256
+
+#define GST_TYPE_LV_MULTI_COMPOSITOR (gst_lv_multi_compositor_get_type())
+#define GST_LV_MULTI_COMPOSITOR(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_LV_MULTI_COMPOSITOR, GstLvMultiCompositor))
+#define GST_LV_MULTI_COMPOSITOR_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST((klass), GST_TYPE_LV_MULTI_COMPOSITOR, GstLvMultiCompositorClass))
+#define GST_IS_LV_MULTI_COMPOSITOR(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_LV_MULTI_COMPOSITOR))
+#define GST_IS_LV_MULTI_COMPOSITOR_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE((klass), GST_TYPE_LV_MULTI_COMPOSITOR))
+
+typedef struct _GstLvMultiCompositor GstLvMultiCompositor;
+typedef struct _GstLvMultiCompositorClass GstLvMultiCompositorClass;
+
+/*
+ * État d'un canal. Les canaux sont rangés dans un tableau contigu de
+ * l'élément ; les unités d'accès sont fusionnées et poussées depuis les
+ * threads de streaming amont du canal, l'élément ne crée aucun thread.
+ */
+typedef struct {
+    GMutex lock;
+    GCond cond;
+    guint index;
+
+    /* Tenu par le thread de streaming qui apparie et pousse les unités
+     * d'accès du canal, un seul à la fois : garde l'ordre de sortie */
+    GMutex stream_lock;
+
+    /* Pads, NULL tant qu'ils ne sont pas demandés */
+    GstPad *main_pad;
+    GstPad *secondary_pad;
+    GstPad *srcpad;
+
+    /* Buffers en attente d'appariement, protégés par lock : secondary_queue
+     * dans l'ordre d'arrivée, secondary_ring la fenêtre de réordonnancement
+     * comme pour lvcompositor */
+    GstLvPtsRing main_ring;
+    GstLvPtsRing secondary_queue;
+    GstLvPtsRing secondary_ring;
+    gboolean secondary_eos;
+
+    /* Écriture des SEI, préparée à la négociation du flux principal ;
+     * une seule fusion à la fois par canal y touche */
+    GstLvSeiWriter writer;
+    gboolean merge;
+
+    gboolean draining;
+    gboolean main_flushing;
+    gboolean secondary_flushing;
+    GstFlowReturn flow;
+} GstLvMultiChannel;
+
+struct _GstLvMultiCompositor {
+    GstElement parent;
+
+    /* Propriétés */
+    gchar *uuid;
+    GstLvSeiType sei_type;
+    GstClockTime pts_tolerance;
+    guint reorder_window;
+
+    /* Canaux, indexés par le numéro des pads ; n_channels : plus grand
+     * numéro demandé + 1 */
+    GstLvMultiChannel *channels;
+    guint n_channels;
+};
+
+struct _GstLvMultiCompositorClass {
+    GstElementClass parent_class;
+};
+
+GType gst_lv_multi_compositor_get_type(void);
+
+G_END_DECLS
+
+#endif /* __GST_LV_MULTI_COMPOSITOR_H__ */
@@ -0,0 +1,46 @@
+#include "gstlvcompositor.h"
+#include "gstlvextractor.h"
+#include "gstlvmulticompositor.h"
+
+static gboolean
+plugin_init(GstPlugin *plugin)
+{
+    return gst_element_register(plugin, "lvcompositor", GST_RANK_NONE,
+                               GST_TYPE_LV_COMPOSITOR) &&
+           gst_element_register(plugin, "lvextractor", GST_RANK_NONE,
+                               GST_TYPE_LV_EXTRACTOR) &&
+           gst_element_register(plugin, "lvmulticompositor", GST_RANK_NONE,
+                               GST_TYPE_LV_MULTI_COMPOSITOR);
+}
+
+#ifndef PACKAGE
+#define PACKAGE "lvcompositor"
+#endif
+
+#ifndef PACKAGE_NAME
+#define PACKAGE_NAME "LV Compositor Plugin"
+#endif
+
+#ifndef PACKAGE_VERSION
+#define PACKAGE_VERSION "1.0"
+#endif
+
+#ifndef GST_PACKAGE_NAME
+#define GST_PACKAGE_NAME "GStreamer"
+#endif
+
+#ifndef GST_PACKAGE_ORIGIN
+#define GST_PACKAGE_ORIGIN "http://gstreamer.net/"
+#endif
+
+GST_PLUGIN_DEFINE(
+    GST_VERSION_MAJOR,
+    GST_VERSION_MINOR,
+    lvcompositor,
+    "LV Compositor plugin",
+    plugin_init,
+    PACKAGE_VERSION,
+    "LGPL",
+    GST_PACKAGE_NAME,
+    GST_PACKAGE_ORIGIN
+)
\ No newline at end of file
@@ -0,0 +1,113 @@
+#include <string.h>
+
+#include "merge_stats.h"
+
+/* Values below 4 get a bucket each, then 4 buckets per power of two */
+static guint
+histogram_bucket(guint64 value)
+{
+    guint exponent;
+
+    if (value < MERGE_HISTOGRAM_SUB_BUCKETS) {
+        return (guint)value;
+    }
+
+    exponent = 63 - __builtin_clzll(value);
+    return (exponent - 1) * MERGE_HISTOGRAM_SUB_BUCKETS +
+           (guint)((value >> (exponent - 2)) & (MERGE_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/* Largest value falling in a bucket */
+static guint64
+histogram_bucket_limit(guint bucket)
+{
+    guint exponent;
+    guint64 sub;
+
+    if (bucket < MERGE_HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+
+    exponent = bucket / MERGE_HISTOGRAM_SUB_BUCKETS + 1;
+    sub = bucket % MERGE_HISTOGRAM_SUB_BUCKETS;
+    return ((MERGE_HISTOGRAM_SUB_BUCKETS + sub + 1) << (exponent - 2)) - 1;
+}
+
+/**
+ * Records a sample
+ * @param histogram Histogram
+ * @param value Sample
+ */
+void
+merge_histogram_add(GstLvHistogram *histogram, guint64 value)
+{
+    histogram->buckets[histogram_bucket(value)]++;
+    histogram->count++;
+    if (value > histogram->max) {
+        histogram->max = value;
+    }
+}
+
+/**
+ * Estimates a percentile
+ * @param histogram Histogram
+ * @param percentile Between 0 and 1
+ * @return Upper bound of the bucket holding the percentile, 0 without samples
+ */
+guint64
+merge_histogram_percentile(const GstLvHistogram *histogram, gdouble percentile)
+{
+    guint64 rank;
+    guint64 seen = 0;
+    guint i;
+
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    rank = (guint64)(percentile * (gdouble)histogram->count + 0.5);
+    rank = CLAMP(rank, 1, histogram->count);
+
+    for (i = 0; i < MERGE_HISTOGRAM_N_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            return MIN(histogram_bucket_limit(i), histogram->max);
+        }
+    }
+
+    return histogram->max;
+}
+
+void
+merge_stats_reset(GstLvStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+/**
+ * Snapshot of the counters, as exposed by the "stats" property and the
+ * periodic element message
+ * @param stats Counters
+ * @param name Structure name
+ * @return New structure
+ */
+GstStructure *
+merge_stats_to_structure(const GstLvStats *stats, const gchar *name)
+{
+    return gst_structure_new(name,
+        "frames-merged", G_TYPE_UINT64, stats->frames_merged,
+        "main-only", G_TYPE_UINT64, stats->main_only,
+        "sei-skipped", G_TYPE_UINT64, stats->sei_skipped,
+        "secondary-dropped", G_TYPE_UINT64, stats->secondary_dropped,
+        "missed-deadlines", G_TYPE_UINT64, stats->missed_deadlines,
+        "extra-missed-deadlines", G_TYPE_UINT64, stats->extra_missed_deadlines,
+        "sei-overhead-bytes", G_TYPE_UINT64, stats->sei_overhead_bytes,
+        "payload-bytes", G_TYPE_UINT64, stats->payload_bytes,
+        "merge-latency-p50", G_TYPE_UINT64, merge_histogram_percentile(&stats->merge_latency, 0.50),
+        "merge-latency-p99", G_TYPE_UINT64, merge_histogram_percentile(&stats->merge_latency, 0.99),
+        "merge-latency-max", G_TYPE_UINT64, stats->merge_latency.max,
+        "queue-wait-p50", G_TYPE_UINT64, merge_histogram_percentile(&stats->queue_wait, 0.50),
+        "queue-wait-p99", G_TYPE_UINT64, merge_histogram_percentile(&stats->queue_wait, 0.99),
+        "queue-wait-max", G_TYPE_UINT64, stats->queue_wait.max,
+        NULL);
+}
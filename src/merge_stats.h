@@ -0,0 +1,47 @@
+#ifndef __MERGE_STATS_H__
+#define __MERGE_STATS_H__
+
+#include <gst/gst.h>
+
+/*
+ * Log-linear latency histogram: 4 buckets per power of two, so a reported
+ * percentile is within 25% of the sample. Fixed storage, no allocation.
+ */
+#define MERGE_HISTOGRAM_SUB_BUCKETS 4
+#define MERGE_HISTOGRAM_N_BUCKETS (64 * MERGE_HISTOGRAM_SUB_BUCKETS)
+
+typedef struct {
+    guint64 buckets[MERGE_HISTOGRAM_N_BUCKETS];
+    guint64 count;
+    guint64 max;
+} GstLvHistogram;
+
+typedef struct {
+    guint64 frames_merged;
+    guint64 main_only;
+    guint64 sei_skipped;  /* main_only access units left without SEI by the embed policy */
+    guint64 secondary_dropped;
+    guint64 missed_deadlines;
+    guint64 extra_missed_deadlines;  /* sink_secondary_%u buffers given up on deadline */
+    guint64 sei_overhead_bytes;
+    guint64 payload_bytes;
+
+    /* Nanoseconds, monotonic clock */
+    GstLvHistogram merge_latency;
+    GstLvHistogram queue_wait;
+} GstLvStats;
+
+void merge_histogram_add(GstLvHistogram *histogram, guint64 value);
+guint64 merge_histogram_percentile(const GstLvHistogram *histogram, gdouble percentile);
+
+void merge_stats_reset(GstLvStats *stats);
+GstStructure *merge_stats_to_structure(const GstLvStats *stats, const gchar *name);
+
+/* Monotonic clock with nanosecond resolution, for latency samples */
+static inline guint64
+merge_stats_now(void)
+{
+    return (guint64)gst_util_get_timestamp();
+}
+
+#endif /* __MERGE_STATS_H__ */
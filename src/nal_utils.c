@@ -0,0 +1,604 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "nal_utils.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+typedef gsize (*NalFindStartCodeFunc)(const guint8 *data, gsize size, gsize offset);
+typedef gsize (*NalEpbEscapeFunc)(guint8 *dst, const guint8 *src, gsize size, guint *zero_run);
+typedef gsize (*NalEpbFindFunc)(const guint8 *data, gsize size, guint *zero_run);
+
+static NalFindStartCodeFunc find_start_code_impl = nal_find_start_code_scalar;
+static NalEpbEscapeFunc epb_escape_impl = nal_epb_escape_scalar;
+static NalEpbFindFunc epb_find_impl = nal_epb_find_scalar;
+static const gchar *simd_impl_name = "scalar";
+
+/**
+ * Reference scanner, one byte at a time.
+ * Every vectorized scanner must return exactly what this one returns.
+ * @param data Bitstream
+ * @param size Size of the bitstream
+ * @param offset Position to start searching from
+ * @return Offset of the next 00 00 01 sequence, or size if there is none
+ */
+gsize
+nal_find_start_code_scalar(const guint8 *data, gsize size, gsize offset)
+{
+    gsize i;
+
+    for (i = offset; i + 3 <= size; i++) {
+        if (data[i] == 0x00 && data[i + 1] == 0x00 && data[i + 2] == 0x01) {
+            return i;
+        }
+    }
+
+    return size;
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * Both vector scanners compare three shifted loads against 00/00/01 so a
+ * start code is detected wherever it starts, without any carry between
+ * blocks. The last (width + 1) bytes are left to the scalar reference.
+ */
+__attribute__((target("sse2")))
+static gsize
+nal_find_start_code_sse2(const guint8 *data, gsize size, gsize offset)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    gsize i = offset;
+
+    while (i + 16 + 2 <= size) {
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(data + i + 1));
+        __m128i b2 = _mm_loadu_si128((const __m128i *)(data + i + 2));
+        __m128i hit = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero),
+                                                  _mm_cmpeq_epi8(b1, zero)),
+                                    _mm_cmpeq_epi8(b2, one));
+        guint mask = (guint)_mm_movemask_epi8(hit);
+
+        if (mask) {
+            return i + (gsize)__builtin_ctz(mask);
+        }
+        i += 16;
+    }
+
+    return nal_find_start_code_scalar(data, size, i);
+}
+
+__attribute__((target("avx2")))
+static gsize
+nal_find_start_code_avx2(const guint8 *data, gsize size, gsize offset)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    gsize i = offset;
+
+    while (i + 32 + 2 <= size) {
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(data + i + 1));
+        __m256i b2 = _mm256_loadu_si256((const __m256i *)(data + i + 2));
+        __m256i hit = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero),
+                                                        _mm256_cmpeq_epi8(b1, zero)),
+                                       _mm256_cmpeq_epi8(b2, one));
+        guint mask = (guint)_mm256_movemask_epi8(hit);
+
+        if (mask) {
+            return i + (gsize)__builtin_ctz(mask);
+        }
+        i += 32;
+    }
+
+    return nal_find_start_code_sse2(data, size, i);
+}
+#endif /* HAVE_X86_SIMD */
+
+/**
+ * Reference emulation prevention, one byte at a time.
+ * A 0x03 is inserted whenever two zero bytes are followed by 0x00-0x03.
+ * @param dst Output, at least NAL_EPB_MAX_SIZE(size) bytes
+ * @param src RBSP bytes
+ * @param size Number of RBSP bytes
+ * @param zero_run In: trailing zeros already written, out: trailing zeros now
+ * @return Number of bytes written to dst
+ */
+gsize
+nal_epb_escape_scalar(guint8 *dst, const guint8 *src, gsize size, guint *zero_run)
+{
+    guint zeros = *zero_run;
+    gsize out = 0;
+    gsize i;
+
+    for (i = 0; i < size; i++) {
+        guint8 byte = src[i];
+
+        if (zeros >= 2 && byte <= 0x03) {
+            dst[out++] = 0x03;
+            zeros = 0;
+        }
+        dst[out++] = byte;
+        zeros = (byte == 0x00) ? zeros + 1 : 0;
+    }
+
+    *zero_run = zeros;
+    return out;
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * Vector escapers: a block without any 00 00 pair (including a pair
+ * straddling the previous block) cannot need escaping and is stored as is.
+ * Only blocks near a zero pair go through the scalar reference.
+ */
+__attribute__((target("sse2")))
+static gsize
+nal_epb_escape_sse2(guint8 *dst, const guint8 *src, gsize size, guint *zero_run)
+{
+    const __m128i zero = _mm_setzero_si128();
+    guint zeros = *zero_run;
+    gsize out = 0;
+    gsize i = 0;
+
+    while (i + 16 <= size) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(src + i));
+        guint zmask = (guint)_mm_movemask_epi8(_mm_cmpeq_epi8(block, zero));
+
+        if ((zmask & (zmask >> 1)) == 0 && zeros < 2 && !(zeros && (zmask & 1))) {
+            _mm_storeu_si128((__m128i *)(dst + out), block);
+            zeros = (zmask >> 15) & 1;
+            out += 16;
+        } else {
+            out += nal_epb_escape_scalar(dst + out, src + i, 16, &zeros);
+        }
+        i += 16;
+    }
+
+    out += nal_epb_escape_scalar(dst + out, src + i, size - i, &zeros);
+    *zero_run = zeros;
+    return out;
+}
+
+__attribute__((target("avx2")))
+static gsize
+nal_epb_escape_avx2(guint8 *dst, const guint8 *src, gsize size, guint *zero_run)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    guint zeros = *zero_run;
+    gsize out = 0;
+    gsize i = 0;
+
+    while (i + 32 <= size) {
+        __m256i block = _mm256_loadu_si256((const __m256i *)(src + i));
+        guint zmask = (guint)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zero));
+
+        if ((zmask & (zmask >> 1)) == 0 && zeros < 2 && !(zeros && (zmask & 1))) {
+            _mm256_storeu_si256((__m256i *)(dst + out), block);
+            zeros = (zmask >> 31) & 1;
+            out += 32;
+        } else {
+            out += nal_epb_escape_scalar(dst + out, src + i, 32, &zeros);
+        }
+        i += 32;
+    }
+
+    *zero_run = zeros;
+    return out + nal_epb_escape_sse2(dst + out, src + i, size - i, zero_run);
+}
+#endif /* HAVE_X86_SIMD */
+
+/**
+ * Reference emulation prevention check, one byte at a time.
+ * @param data RBSP bytes
+ * @param size Number of RBSP bytes
+ * @param zero_run In: trailing zeros before data, out: trailing zeros at the
+ *                 returned offset
+ * @return Offset of the first byte needing a 0x03 before it, or size
+ */
+gsize
+nal_epb_find_scalar(const guint8 *data, gsize size, guint *zero_run)
+{
+    guint zeros = *zero_run;
+    gsize i;
+
+    for (i = 0; i < size; i++) {
+        if (zeros >= 2 && data[i] <= 0x03) {
+            break;
+        }
+        zeros = (data[i] == 0x00) ? zeros + 1 : 0;
+    }
+
+    *zero_run = zeros;
+    return i;
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * Vector checks: byte i needs escaping when data[i - 2] and data[i - 1] are
+ * zero and data[i] <= 3. The first two bytes depend on the incoming zero
+ * run and go through the scalar reference, after that the state only
+ * depends on the data.
+ */
+__attribute__((target("sse2")))
+static gsize
+nal_epb_find_sse2(const guint8 *data, gsize size, guint *zero_run)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i three = _mm_set1_epi8(3);
+    gsize i;
+
+    if (size <= 2) {
+        return nal_epb_find_scalar(data, size, zero_run);
+    }
+    i = nal_epb_find_scalar(data, 2, zero_run);
+    if (i < 2) {
+        return i;
+    }
+
+    while (i + 16 <= size) {
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(data + i - 2));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(data + i - 1));
+        __m128i b2 = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i hit = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(b0, zero),
+                                                  _mm_cmpeq_epi8(b1, zero)),
+                                    _mm_cmpeq_epi8(_mm_min_epu8(b2, three), b2));
+        guint mask = (guint)_mm_movemask_epi8(hit);
+
+        if (mask) {
+            *zero_run = 2;
+            return i + (gsize)__builtin_ctz(mask);
+        }
+        i += 16;
+    }
+
+    *zero_run = data[i - 1] != 0x00 ? 0 : (data[i - 2] != 0x00 ? 1 : 2);
+    return i + nal_epb_find_scalar(data + i, size - i, zero_run);
+}
+
+__attribute__((target("avx2")))
+static gsize
+nal_epb_find_avx2(const guint8 *data, gsize size, guint *zero_run)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i three = _mm256_set1_epi8(3);
+    gsize i;
+
+    if (size <= 2) {
+        return nal_epb_find_scalar(data, size, zero_run);
+    }
+    i = nal_epb_find_scalar(data, 2, zero_run);
+    if (i < 2) {
+        return i;
+    }
+
+    while (i + 32 <= size) {
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)(data + i - 2));
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(data + i - 1));
+        __m256i b2 = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i hit = _mm256_and_si256(_mm256_and_si256(_mm256_cmpeq_epi8(b0, zero),
+                                                        _mm256_cmpeq_epi8(b1, zero)),
+                                       _mm256_cmpeq_epi8(_mm256_min_epu8(b2, three), b2));
+        guint mask = (guint)_mm256_movemask_epi8(hit);
+
+        if (mask) {
+            *zero_run = 2;
+            return i + (gsize)__builtin_ctz(mask);
+        }
+        i += 32;
+    }
+
+    *zero_run = data[i - 1] != 0x00 ? 0 : (data[i - 2] != 0x00 ? 1 : 2);
+    return i + nal_epb_find_sse2(data + i, size - i, zero_run);
+}
+#endif /* HAVE_X86_SIMD */
+
+/*
+ * Picks the widest implementation the CPU supports. LV_NAL_SIMD=scalar|sse2|avx2
+ * forces a given implementation, which is handy to compare them.
+ */
+static void
+nal_utils_init(void)
+{
+    static gsize initialized = 0;
+
+    if (g_once_init_enter(&initialized)) {
+        const gchar *forced = g_getenv("LV_NAL_SIMD");
+
+#ifdef HAVE_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") &&
+            (!forced || g_strcmp0(forced, "avx2") == 0)) {
+            find_start_code_impl = nal_find_start_code_avx2;
+            epb_escape_impl = nal_epb_escape_avx2;
+            epb_find_impl = nal_epb_find_avx2;
+            simd_impl_name = "avx2";
+        } else if (__builtin_cpu_supports("sse2") &&
+                   (!forced || g_strcmp0(forced, "avx2") == 0 ||
+                    g_strcmp0(forced, "sse2") == 0)) {
+            find_start_code_impl = nal_find_start_code_sse2;
+            epb_escape_impl = nal_epb_escape_sse2;
+            epb_find_impl = nal_epb_find_sse2;
+            simd_impl_name = "sse2";
+        }
+#else
+        (void)(forced);
+#endif
+
+        g_once_init_leave(&initialized, 1);
+    }
+}
+
+gsize
+nal_find_start_code(const guint8 *data, gsize size, gsize offset)
+{
+    nal_utils_init();
+    return find_start_code_impl(data, size, offset);
+}
+
+gsize
+nal_epb_escape(guint8 *dst, const guint8 *src, gsize size, guint *zero_run)
+{
+    nal_utils_init();
+    return epb_escape_impl(dst, src, size, zero_run);
+}
+
+gsize
+nal_epb_find(const guint8 *data, gsize size, guint *zero_run)
+{
+    nal_utils_init();
+    return epb_find_impl(data, size, zero_run);
+}
+
+const gchar *
+nal_simd_impl_name(void)
+{
+    nal_utils_init();
+    return simd_impl_name;
+}
+
+/**
+ * Finds the next emulation_prevention_three_byte of a NAL unit payload.
+ * @param data Escaped NAL unit payload
+ * @param size Size of data
+ * @param offset Position to start searching from, just past the previous
+ *               emulation prevention byte when resuming
+ * @return Offset of the 0x03 of the next 00 00 03 sequence, or size
+ */
+gsize
+nal_epb_next(const guint8 *data, gsize size, gsize offset)
+{
+    const guint8 *three;
+
+    offset = MAX(offset, 2);
+    while (offset < size && (three = memchr(data + offset, 0x03, size - offset))) {
+        offset = three - data;
+        if (data[offset - 1] == 0x00 && data[offset - 2] == 0x00) {
+            return offset;
+        }
+        offset++;
+    }
+
+    return size;
+}
+
+/**
+ * Removes the emulation prevention bytes of a NAL unit payload.
+ * @param dst Output, at least size bytes
+ * @param src Escaped NAL unit payload
+ * @param size Size of src
+ * @return Number of RBSP bytes written to dst
+ */
+gsize
+nal_epb_unescape(guint8 *dst, const guint8 *src, gsize size)
+{
+    gsize pos = 0;
+    gsize written = 0;
+    gsize epb;
+
+    while ((epb = nal_epb_next(src, size, pos)) < size) {
+        memcpy(dst + written, src + pos, epb - pos);
+        written += epb - pos;
+        pos = epb + 1;
+    }
+    memcpy(dst + written, src + pos, size - pos);
+
+    return written + size - pos;
+}
+
+/*
+ * Moves a start code position back over the zero_byte of a 4-byte start
+ * code so that the NAL unit offset includes it.
+ */
+static inline gsize
+nal_unit_start(const guint8 *data, gsize start_code, gsize floor)
+{
+    return (start_code > floor && data[start_code - 1] == 0x00) ? start_code - 1 : start_code;
+}
+
+/**
+ * Walks the NAL units of an Annex B bitstream, without their start code,
+ * zero_byte or trailing zero bytes. Bytes before the first start code are
+ * skipped.
+ * @param data Bitstream
+ * @param size Size of the bitstream
+ * @param offset In/out: where to look for the next start code, 0 at first
+ * @param start Out: first byte of the NAL unit (its header)
+ * @param end Out: end of the NAL unit
+ * @return FALSE when there is no NAL unit left
+ */
+gboolean
+nal_next_unit(const guint8 *data, gsize size, gsize *offset, gsize *start, gsize *end)
+{
+    gsize sc = nal_find_start_code(data, size, *offset);
+
+    while (sc < size) {
+        gsize header = sc + 3;
+        gsize next = nal_find_start_code(data, size, header);
+        gsize last = next;
+
+        while (last > header && data[last - 1] == 0x00) {
+            last--;
+        }
+        sc = next;
+        if (last > header) {
+            *offset = next;
+            *start = header;
+            *end = last;
+            return TRUE;
+        }
+    }
+
+    *offset = size;
+    return FALSE;
+}
+
+/**
+ * Compacts an Annex B bitstream: each NAL unit gets a 3 bytes start code,
+ * zero_byte and trailing_zero_8bits go, and so do the NAL units of desc a
+ * decoder does not need (AUD, filler data).
+ * @param data Bitstream
+ * @param size Size of the bitstream
+ * @param desc Codec of the bitstream, NULL to keep every NAL unit
+ * @param dst Output, at least size bytes, may not overlap data
+ * @return Number of bytes written to dst
+ */
+gsize
+nal_compact_annexb(const guint8 *data, gsize size, const GstLvCodecDesc *desc, guint8 *dst)
+{
+    gsize offset = 0;
+    gsize pos = 0;
+    gsize start, end;
+
+    while (nal_next_unit(data, size, &offset, &start, &end)) {
+        if (desc && end - start >= desc->nal_header_size &&
+            codec_desc_is_droppable(desc, desc->nal_type(data + start))) {
+            continue;
+        }
+
+        dst[pos++] = 0x00;
+        dst[pos++] = 0x00;
+        dst[pos++] = 0x01;
+        memcpy(dst + pos, data + start, end - start);
+        pos += end - start;
+    }
+
+    return pos;
+}
+
+/**
+ * Indexes the Annex B NAL units of an access unit.
+ * @param data Access unit
+ * @param size Size of the access unit
+ * @param desc Codec of the bitstream
+ * @param units Output array
+ * @param max_units Capacity of units
+ * @return Number of NAL units written to units
+ */
+guint
+nal_index_build(const guint8 *data, gsize size, const GstLvCodecDesc *desc,
+                GstLvNalUnit *units, guint max_units)
+{
+    guint header_size = desc->nal_header_size;
+    guint n_units = 0;
+    gsize sc = nal_find_start_code(data, size, 0);
+
+    while (sc < size && n_units < max_units) {
+        GstLvNalUnit *unit = &units[n_units];
+        gsize next;
+
+        unit->offset = nal_unit_start(data, sc, n_units ? units[n_units - 1].header_offset : 0);
+        unit->header_offset = sc + 3;
+        if (unit->header_offset + header_size > size) {
+            break;
+        }
+        unit->type = desc->nal_type(data + unit->header_offset);
+
+        next = nal_find_start_code(data, size, unit->header_offset + header_size);
+        unit->size = ((next < size) ? nal_unit_start(data, next, unit->header_offset) : size) -
+                     unit->offset;
+
+        n_units++;
+        sc = next;
+    }
+
+    return n_units;
+}
+
+/**
+ * Finds where a prefix SEI goes in an access unit: after the access unit
+ * delimiter and parameter sets, right before the first NAL unit of the
+ * coded picture. Scanning stops there, slice data is never walked.
+ * @param data Access unit (or its leading part)
+ * @param size Size of data
+ * @param desc Codec of the bitstream
+ * @param found Set to TRUE when the first picture NAL unit was seen
+ * @return Insertion offset, size when no picture NAL unit was found
+ */
+gsize
+nal_find_sei_insert_offset(const guint8 *data, gsize size,
+                           const GstLvCodecDesc *desc, gboolean *found)
+{
+    guint header_size = desc->nal_header_size;
+    gsize floor = 0;
+    gsize sc = nal_find_start_code(data, size, 0);
+
+    while (sc < size && sc + 3 + header_size <= size) {
+        if (codec_desc_starts_picture(desc, desc->nal_type(data + sc + 3))) {
+            if (found) {
+                *found = TRUE;
+            }
+            return nal_unit_start(data, sc, floor);
+        }
+        floor = sc + 3;
+        sc = nal_find_start_code(data, size, floor + header_size);
+    }
+
+    if (found) {
+        *found = FALSE;
+    }
+    return size;
+}
+
+/**
+ * Length-prefixed counterpart of nal_find_sei_insert_offset(): the NAL
+ * units are walked through their length fields, nothing is scanned.
+ * @param data Access unit (or its leading part)
+ * @param size Size of data
+ * @param nal_length_size Size of the length fields, 1, 2 or 4
+ * @param desc Codec of the bitstream
+ * @param found Set to TRUE when the first picture NAL unit was seen
+ * @return Offset of the length field of the first picture NAL unit, size
+ *         when it was not found in data
+ */
+gsize
+nal_find_sei_insert_offset_length(const guint8 *data, gsize size, guint nal_length_size,
+                                  const GstLvCodecDesc *desc, gboolean *found)
+{
+    guint header_size = desc->nal_header_size;
+    gsize pos = 0;
+
+    while (pos + nal_length_size + header_size <= size) {
+        gsize length = 0;
+        guint i;
+
+        if (codec_desc_starts_picture(desc, desc->nal_type(data + pos + nal_length_size))) {
+            if (found) {
+                *found = TRUE;
+            }
+            return pos;
+        }
+        for (i = 0; i < nal_length_size; i++) {
+            length = (length << 8) | data[pos + i];
+        }
+        pos += nal_length_size + length;
+    }
+
+    if (found) {
+        *found = FALSE;
+    }
+    return size;
+}
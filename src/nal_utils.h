@@ -0,0 +1,64 @@
+#ifndef __NAL_UTILS_H__
+#define __NAL_UTILS_H__
+
+#include <glib.h>
+#include "codec_desc.h"
+
+/* Annex B NAL unit as found by the indexer */
+typedef struct {
+    gsize offset;        /* first byte of the start code (zero_byte included) */
+    gsize header_offset; /* first byte of the NAL unit header */
+    gsize size;          /* bytes up to the next NAL unit, start code included */
+    guint8 type;         /* nal_unit_type, codec specific */
+} GstLvNalUnit;
+
+/* Start code scanners, all return size when no 00 00 01 is found */
+gsize nal_find_start_code(const guint8 *data, gsize size, gsize offset);
+gsize nal_find_start_code_scalar(const guint8 *data, gsize size, gsize offset);
+
+/*
+ * Emulation prevention: escapes RBSP bytes into a NAL unit payload.
+ * zero_run carries the number of trailing zero bytes already written, so a
+ * payload can be escaped in several pieces. The output needs at most
+ * NAL_EPB_MAX_SIZE(size) bytes (one 0x03 every two input bytes).
+ */
+#define NAL_EPB_MAX_SIZE(size) ((size) + (size) / 2 + 2)
+
+gsize nal_epb_escape(guint8 *dst, const guint8 *src, gsize size, guint *zero_run);
+gsize nal_epb_escape_scalar(guint8 *dst, const guint8 *src, gsize size, guint *zero_run);
+
+/*
+ * Offset of the first byte nal_epb_escape() would prefix with 0x03, or size
+ * if the bytes can be used as they are. zero_run works as for the escaper.
+ */
+gsize nal_epb_find(const guint8 *data, gsize size, guint *zero_run);
+gsize nal_epb_find_scalar(const guint8 *data, gsize size, guint *zero_run);
+
+/* Reverse direction, for SEI parsing: EPB lookup and removal on escaped bytes */
+gsize nal_epb_next(const guint8 *data, gsize size, gsize offset);
+gsize nal_epb_unescape(guint8 *dst, const guint8 *src, gsize size);
+
+/* Name of the implementation selected at runtime ("avx2", "sse2" or "scalar") */
+const gchar *nal_simd_impl_name(void);
+
+/* NAL units of an Annex B bitstream one by one, start codes excluded */
+gboolean nal_next_unit(const guint8 *data, gsize size, gsize *offset, gsize *start, gsize *end);
+
+/*
+ * Rewrites Annex B NAL units with 3 bytes start codes and no trailing zero
+ * bytes, dropping AUD and filler data NAL units when desc is set. dst needs
+ * size bytes, the output is never larger.
+ */
+gsize nal_compact_annexb(const guint8 *data, gsize size, const GstLvCodecDesc *desc, guint8 *dst);
+
+guint nal_index_build(const guint8 *data, gsize size, const GstLvCodecDesc *desc,
+                      GstLvNalUnit *units, guint max_units);
+
+gsize nal_find_sei_insert_offset(const guint8 *data, gsize size,
+                                 const GstLvCodecDesc *desc, gboolean *found);
+
+/* Same for length-prefixed NAL units (avc, hvc1, vvc1...) */
+gsize nal_find_sei_insert_offset_length(const guint8 *data, gsize size, guint nal_length_size,
+                                        const GstLvCodecDesc *desc, gboolean *found);
+
+#endif /* __NAL_UTILS_H__ */
@@ -0,0 +1,196 @@
+#include "pts_ring.h"
+
+#define RING_INDEX(ring, i) (((ring)->head + (i)) % PTS_RING_MAX_SIZE)
+
+void
+pts_ring_init(GstLvPtsRing *ring)
+{
+    ring->head = 0;
+    ring->length = 0;
+}
+
+/**
+ * Releases every buffer held by the ring
+ * @param ring Ring
+ */
+void
+pts_ring_clear(GstLvPtsRing *ring)
+{
+    GstBuffer *buffer;
+
+    while ((buffer = pts_ring_pop(ring))) {
+        gst_buffer_unref(buffer);
+    }
+}
+
+/**
+ * Appends a buffer at the tail
+ * @param ring Ring
+ * @param buffer Buffer, ownership is taken on success
+ * @return FALSE if the ring is full
+ */
+gboolean
+pts_ring_push(GstLvPtsRing *ring, GstBuffer *buffer)
+{
+    if (ring->length == PTS_RING_MAX_SIZE) {
+        return FALSE;
+    }
+
+    ring->buffers[RING_INDEX(ring, ring->length)] = buffer;
+    ring->length++;
+
+    return TRUE;
+}
+
+/**
+ * Removes the oldest buffer
+ * @param ring Ring
+ * @return Buffer (ownership transferred), NULL if the ring is empty
+ */
+GstBuffer *
+pts_ring_pop(GstLvPtsRing *ring)
+{
+    GstBuffer *buffer;
+
+    if (ring->length == 0) {
+        return NULL;
+    }
+
+    buffer = ring->buffers[ring->head];
+    ring->buffers[ring->head] = NULL;
+    ring->head = (ring->head + 1) % PTS_RING_MAX_SIZE;
+    ring->length--;
+
+    return buffer;
+}
+
+/**
+ * Removes the buffer whose PTS is the closest to pts
+ * @param ring Ring
+ * @param pts Timestamp to match
+ * @param tolerance Largest accepted distance
+ * @return Buffer (ownership transferred), NULL if none is within tolerance
+ */
+GstBuffer *
+pts_ring_take_match(GstLvPtsRing *ring, GstClockTime pts, GstClockTime tolerance)
+{
+    GstBuffer *buffer;
+    GstClockTime best_distance = GST_CLOCK_TIME_NONE;
+    guint best = ring->length;
+    guint i;
+
+    for (i = 0; i < ring->length; i++) {
+        GstClockTime buffer_pts = GST_BUFFER_PTS(ring->buffers[RING_INDEX(ring, i)]);
+        GstClockTime distance;
+
+        if (!GST_CLOCK_TIME_IS_VALID(buffer_pts)) {
+            continue;
+        }
+
+        distance = buffer_pts > pts ? buffer_pts - pts : pts - buffer_pts;
+        if (distance <= tolerance && distance < best_distance) {
+            best_distance = distance;
+            best = i;
+            if (distance == 0) {
+                break;
+            }
+        }
+    }
+
+    if (best == ring->length) {
+        return NULL;
+    }
+
+    buffer = ring->buffers[RING_INDEX(ring, best)];
+
+    /* Close the gap, the window is small */
+    for (i = best; i + 1 < ring->length; i++) {
+        ring->buffers[RING_INDEX(ring, i)] = ring->buffers[RING_INDEX(ring, i + 1)];
+    }
+    ring->buffers[RING_INDEX(ring, ring->length - 1)] = NULL;
+    ring->length--;
+
+    return buffer;
+}
+
+/**
+ * Drops the buffers at the head whose PTS is before horizon. Entries are
+ * in arrival order, so the scan stops at the first one still usable.
+ * @param ring Ring
+ * @param horizon Smallest PTS that can still be matched
+ * @return Number of buffers dropped
+ */
+guint
+pts_ring_drop_before(GstLvPtsRing *ring, GstClockTime horizon)
+{
+    guint dropped = 0;
+
+    while (ring->length > 0) {
+        GstClockTime pts = GST_BUFFER_PTS(ring->buffers[ring->head]);
+
+        if (GST_CLOCK_TIME_IS_VALID(pts) && pts >= horizon) {
+            break;
+        }
+
+        gst_buffer_unref(pts_ring_pop(ring));
+        dropped++;
+    }
+
+    return dropped;
+}
+
+/**
+ * Looks for the buffer carrying the PTS of a main access unit. Buffers are
+ * pulled from their stream into the reorder window until the match shows
+ * up or the window is full; the caller gives up when the window is full or
+ * the stream ended.
+ * @param ring Reorder window
+ * @param pull Pulls the next buffer of the stream
+ * @param user_data Passed to pull
+ * @param pts PTS of the access unit, pairs in arrival order if invalid
+ * @param horizon DTS of the access unit (its PTS if unknown). DTS only
+ *        grows and no later access unit has a PTS below it, buffers further
+ *        back than the tolerance can never be paired
+ * @param tolerance Largest PTS difference of a pair
+ * @param window Largest number of buffers kept in the ring
+ * @param dropped Out: stale buffers dropped
+ * @return Buffer (ownership transferred), NULL if not found yet
+ */
+GstBuffer *
+pts_ring_pair(GstLvPtsRing *ring, GstLvPtsRingPull pull, gpointer user_data,
+              GstClockTime pts, GstClockTime horizon, GstClockTime tolerance,
+              guint window, guint *dropped)
+{
+    GstBuffer *buffer;
+
+    *dropped = 0;
+
+    if (!GST_CLOCK_TIME_IS_VALID(pts)) {
+        buffer = pts_ring_pop(ring);
+        return buffer ? buffer : pull(user_data);
+    }
+
+    horizon = horizon > tolerance ? horizon - tolerance : 0;
+    *dropped += pts_ring_drop_before(ring, horizon);
+
+    buffer = pts_ring_take_match(ring, pts, tolerance);
+
+    while (!buffer && ring->length < window && (buffer = pull(user_data))) {
+        GstClockTime buffer_pts = GST_BUFFER_PTS(buffer);
+
+        if (!GST_CLOCK_TIME_IS_VALID(buffer_pts)) {
+            /* Untimestamped data goes with the current access unit */
+            break;
+        }
+        if (buffer_pts < horizon) {
+            gst_buffer_unref(buffer);
+            buffer = NULL;
+            (*dropped)++;
+        } else if ((buffer_pts > pts ? buffer_pts - pts : pts - buffer_pts) > tolerance) {
+            pts_ring_push(ring, buffer);
+            buffer = NULL;
+        }
+    }
+
+    return buffer;
+}
@@ -0,0 +1,47 @@
+#ifndef __PTS_RING_H__
+#define __PTS_RING_H__
+
+#include <gst/gst.h>
+
+/* Upper bound of the reorder window, the ring storage is fixed */
+#define PTS_RING_MAX_SIZE 64
+
+/*
+ * Buffers waiting for their counterpart, in arrival order. Matching is done
+ * on the PTS; stale buffers are evicted from the head.
+ */
+typedef struct {
+    GstBuffer *buffers[PTS_RING_MAX_SIZE];
+    guint head;
+    guint length;
+} GstLvPtsRing;
+
+void pts_ring_init(GstLvPtsRing *ring);
+void pts_ring_clear(GstLvPtsRing *ring);
+
+gboolean pts_ring_push(GstLvPtsRing *ring, GstBuffer *buffer);
+GstBuffer *pts_ring_pop(GstLvPtsRing *ring);
+GstBuffer *pts_ring_take_match(GstLvPtsRing *ring, GstClockTime pts, GstClockTime tolerance);
+guint pts_ring_drop_before(GstLvPtsRing *ring, GstClockTime horizon);
+
+/* Next buffer of the stream feeding a reorder window, NULL if none is queued */
+typedef GstBuffer *(*GstLvPtsRingPull)(gpointer user_data);
+
+GstBuffer *pts_ring_pair(GstLvPtsRing *ring, GstLvPtsRingPull pull, gpointer user_data,
+                         GstClockTime pts, GstClockTime horizon, GstClockTime tolerance,
+                         guint window, guint *dropped);
+
+static inline guint
+pts_ring_length(const GstLvPtsRing *ring)
+{
+    return ring->length;
+}
+
+/* Oldest buffer, left in the ring */
+static inline GstBuffer *
+pts_ring_peek(const GstLvPtsRing *ring)
+{
+    return ring->length > 0 ? ring->buffers[ring->head] : NULL;
+}
+
+#endif /* __PTS_RING_H__ */
@@ -9,16 +9,26 @@
 #include <fcntl.h>
 
 #include "sei_merge.h"
+#include "nal_utils.h"
+#include "sei_pool.h"
 
-// Structure to represent a UUID (only defined here, not in header)
-typedef struct {
-    uint32_t time_low;                  // 32 bits
-    uint16_t time_mid;                  // 16 bits
-    uint16_t time_hi_and_version;       // 16 bits
-    uint8_t  clock_seq_hi_and_reserved; // 8 bits
-    uint8_t  clock_seq_low;             // 8 bits
-    uint8_t  node[6];                   // 48 bits
-} uuid_t;
+// rbsp_stop_one_bit + alignment, shared by every SEI built from shared memory
+static const guint8 sei_rbsp_trailer[1] = { SEI_RBSP_TRAILING_BITS };
+
+// emulation_prevention_three_byte between shared payload regions
+static const guint8 sei_epb[1] = { 0x03 };
+
+// gst_buffer_get_max_memory(), more memories get merged into a copy
+#define SEI_SHARED_MAX_MEMORIES 16
+
+// Header of the user_data_registered_itu_t_t35 SEIs
+static const guint8 sei_t35_lcevc_header[SEI_T35_HEADER_SIZE] = SEI_T35_LCEVC_HEADER;
+
+// UUID carried when the "uuid" property is left to "lcevc"
+static const guint8 sei_lcevc_uuid[SEI_UUID_SIZE] = {
+    0xFF, 0xF9, 0x5B, 0x4E, 0xBF, 0x7B, 0x41, 0x4B,
+    0xAE, 0x74, 0x4E, 0x36, 0x2F, 0x0B, 0x8E, 0xC6
+};
 
 /*
  * Generates cryptographically secure random bytes.
@@ -61,111 +71,574 @@ static void generate_pseudo_random_bytes(void *buffer, size_t size) {
 }
 
 /**
- * Generates a UUID v4 compliant with ISO/IEC 11578
- * @param uuid Pointer to the uuid_t structure to be filled
- * @return 0 on success, -1 on error
+ * Generates a UUID v4 compliant with ISO/IEC 11578, in binary form
+ * @param uuid Output, SEI_UUID_SIZE bytes
  */
-static int generate_uuid_v4(uuid_t *uuid) {
-    if (!uuid) {
-        return -1;
+static void generate_uuid_v4(guint8 *uuid) {
+    if (generate_random_bytes(uuid, SEI_UUID_SIZE) != 0) {
+        // Fallback to pseudo-random generation
+        generate_pseudo_random_bytes(uuid, SEI_UUID_SIZE);
     }
     
-    // Generate 16 random bytes
-    uint8_t random_data[16];
-    if (generate_random_bytes(random_data, 16) != 0) {
-        // Fallback to pseudo-random generation
-        generate_pseudo_random_bytes(random_data, 16);
+    // Set version 4 (high nibble of time_hi_and_version)
+    uuid[6] = (uuid[6] & 0x0F) | 0x40;
+    
+    // Define the RFC 4122 variant (bits 6-7 of clock_seq_hi_and_reserved)
+    uuid[8] = (uuid[8] & 0x3F) | 0x80;
+}
+
+/**
+ * Parses 32 hexadecimal digits, dashes and braces are ignored
+ * @param str Textual UUID
+ * @param uuid Output, SEI_UUID_SIZE bytes
+ * @return TRUE if str is a valid UUID
+ */
+static gboolean parse_uuid_string(const gchar *str, guint8 *uuid) {
+    guint8 parsed[SEI_UUID_SIZE];
+    guint digits = 0;
+    
+    for (; *str; str++) {
+        gint value;
+        
+        if (*str == '-' || *str == '{' || *str == '}') {
+            continue;
+        }
+        value = g_ascii_xdigit_value(*str);
+        if (value < 0 || digits >= SEI_UUID_SIZE * 2) {
+            return FALSE;
+        }
+        if (digits % 2 == 0) {
+            parsed[digits / 2] = (guint8)(value << 4);
+        } else {
+            parsed[digits / 2] |= (guint8)value;
+        }
+        digits++;
     }
     
-    // Fill in the UUID structure
-    uuid->time_low = (uint32_t)random_data[0] << 24 | 
-                     (uint32_t)random_data[1] << 16 | 
-                     (uint32_t)random_data[2] << 8  | 
-                     (uint32_t)random_data[3];
+    if (digits != SEI_UUID_SIZE * 2) {
+        return FALSE;
+    }
+    
+    memcpy(uuid, parsed, SEI_UUID_SIZE);
+    return TRUE;
+}
+
+/**
+ * Builds the binary UUID carried in user_data_unregistered SEIs.
+ * Called when the stream is negotiated, never per frame.
+ * @param setting "lcevc" (or NULL) for the fixed LCEVC UUID, "random" for
+ *                a new UUID v4, or a textual UUID
+ * @param uuid Output, SEI_UUID_SIZE bytes, untouched on error
+ * @return FALSE if setting is not a valid UUID
+ */
+gboolean
+sei_uuid_resolve(const gchar *setting, guint8 *uuid)
+{
+    if (!setting || !*setting || g_ascii_strcasecmp(setting, "lcevc") == 0) {
+        memcpy(uuid, sei_lcevc_uuid, SEI_UUID_SIZE);
+        return TRUE;
+    }
+    
+    if (g_ascii_strcasecmp(setting, "random") == 0) {
+        generate_uuid_v4(uuid);
+        return TRUE;
+    }
+    
+    return parse_uuid_string(setting, uuid);
+}
+
+/* Enum types of the SEI settings, shared by the elements' properties */
+GType
+gst_lv_sei_position_get_type(void)
+{
+    static gsize sei_position_type = 0;
+    static const GEnumValue sei_positions[] = {
+        {SEI_POSITION_PREFIX, "Prefix SEI before the coded picture", "prefix"},
+        {SEI_POSITION_SUFFIX, "Suffix SEI after the coded picture (H.265/H.266), "
+                              "NAL aligned streams are forwarded without waiting for it", "suffix"},
+        {0, NULL, NULL},
+    };
+    
+    // Streaming threads may get here concurrently, register once
+    if (g_once_init_enter(&sei_position_type)) {
+        GType type = g_enum_register_static("GstLvSeiPosition", sei_positions);
+        g_once_init_leave(&sei_position_type, type);
+    }
+    return (GType)sei_position_type;
+}
+
+GType
+gst_lv_sei_type_get_type(void)
+{
+    static gsize sei_type_type = 0;
+    static const GEnumValue sei_types[] = {
+        {SEI_TYPE_UNREGISTERED, "user_data_unregistered SEI with the \"uuid\" property",
+                                "unregistered"},
+        {SEI_TYPE_REGISTERED_T35, "user_data_registered_itu_t_t35 SEI with the LCEVC T.35 "
+                                  "codes, 13 bytes less per frame", "registered-t35"},
+        {0, NULL, NULL},
+    };
     
-    uuid->time_mid = (uint16_t)random_data[4] << 8 | 
-                     (uint16_t)random_data[5];
+    if (g_once_init_enter(&sei_type_type)) {
+        GType type = g_enum_register_static("GstLvSeiType", sei_types);
+        g_once_init_leave(&sei_type_type, type);
+    }
+    return (GType)sei_type_type;
+}
+
+// Total SEI buffer size of each pool size class
+static const gsize sei_pool_sizes[SEI_POOL_N_CLASSES] = { 1024, 8192, 65536, 262144 };
+
+/**
+ * Builds the codec specific SEI prefix, once per stream
+ * @param desc Codec of the main stream
+ * @param position Prefix or suffix SEI NAL unit
+ * @param type SEI message type
+ * @param nal_length_size Length field size, 0 for Annex B
+ * @param data Output, at least SEI_PREFIX_MAX_SIZE bytes
+ * @return Prefix size
+ */
+static guint
+build_sei_prefix(const GstLvCodecDesc *desc, GstLvSeiPosition position, GstLvSeiType type,
+                 guint nal_length_size, guint8 *data)
+{
+    guint pos = 0;
     
-    uuid->time_hi_and_version = (uint16_t)random_data[6] << 8 | 
-                                (uint16_t)random_data[7];
+    // 1. Start code (4 bytes Annex B), or the NAL unit length, written
+    //    once the SEI size is known
+    if (nal_length_size > 0) {
+        memset(data, 0, nal_length_size);
+        pos += nal_length_size;
+    } else {
+        data[pos++] = 0x00;
+        data[pos++] = 0x00;
+        data[pos++] = 0x00;
+        data[pos++] = 0x01;
+    }
     
-    uuid->clock_seq_hi_and_reserved = random_data[8];
-    uuid->clock_seq_low = random_data[9];
+    // 2. Prefix or suffix SEI NAL unit header
+    memcpy(data + pos, position == SEI_POSITION_SUFFIX ? desc->suffix_sei_header : desc->prefix_sei_header,
+           desc->nal_header_size);
+    pos += desc->nal_header_size;
     
-    // Copy the 6 bytes of the node
-    memcpy(uuid->node, &random_data[10], 6);
+    // 3. SEI payload type
+    data[pos++] = type == SEI_TYPE_REGISTERED_T35 ? SEI_PAYLOAD_TYPE_USER_DATA_REGISTERED_ITU_T_T35 :
+                                                    SEI_PAYLOAD_TYPE_USER_DATA_UNREGISTERED;
     
-    // Set version 4 (bits 12-15 of time_hi_and_version)
-    uuid->time_hi_and_version &= 0x0FFF;
-    uuid->time_hi_and_version |= 0x4000;
+    return pos;
+}
+
+/* Active SEI pool of one size class with the allocator of the writer, NULL
+ * if it cannot be set up */
+static GstBufferPool *
+sei_writer_new_pool(GstLvSeiWriter *writer, guint size_class)
+{
+    GstBufferPool *pool = gst_lv_sei_pool_new(writer->prefix, writer->prefix_size);
+    GstStructure *config = gst_buffer_pool_get_config(pool);
     
-    // Define the RFC 4122 variant (bits 6-7 of clock_seq_hi_and_reserved)
-    uuid->clock_seq_hi_and_reserved &= 0x3F;
-    uuid->clock_seq_hi_and_reserved |= 0x80;
+    gst_buffer_pool_config_set_params(config, NULL, sei_pool_sizes[size_class], 0, 0);
+    gst_buffer_pool_config_set_allocator(config, writer->allocator, &writer->allocation_params);
+    if (!gst_buffer_pool_set_config(pool, config) ||
+        !gst_buffer_pool_set_active(pool, TRUE)) {
+        GST_WARNING("Failed to activate %" G_GSIZE_FORMAT " bytes SEI pool",
+                    sei_pool_sizes[size_class]);
+        gst_object_unref(pool);
+        return NULL;
+    }
     
-    return 0;
+    return pool;
 }
 
 /**
- * Converts a UUID to a character string without dashes
- * @param uuid Pointer to the uuid_t structure
- * @param str Output buffer (minimum 33 characters)
+ * Sets up the SEI writer of a stream: prefix template and buffer pools
+ * @param writer Writer to initialize
+ * @param desc Codec of the main stream, NULL if not supported
+ * @param type SEI message type
+ * @param uuid Binary UUID, SEI_UUID_SIZE bytes, only used by user_data_unregistered
+ * @param position SEI position, falls back to prefix if the codec has no suffix SEI
+ * @param nal_length_size NAL unit length field size (1, 2 or 4) of a
+ *                        length-prefixed stream, 0 for Annex B
+ * @return FALSE if the codec is not supported
  */
-static void uuid_to_string(const uuid_t *uuid, char *str) {
-    snprintf(str, 33, "%08x%04x%04x%02x%02x%02x%02x%02x%02x",
-             uuid->time_low,
-             uuid->time_mid,
-             uuid->time_hi_and_version,
-             uuid->clock_seq_hi_and_reserved,
-             uuid->clock_seq_low,
-             uuid->node[0], uuid->node[1], uuid->node[2],
-             uuid->node[3], uuid->node[4], uuid->node[5]);
+gboolean
+sei_writer_init(GstLvSeiWriter *writer, const GstLvCodecDesc *desc, GstLvSeiType type,
+                const guint8 *uuid, GstLvSeiPosition position, guint nal_length_size)
+{
+    guint i;
+    
+    memset(writer, 0, sizeof(*writer));
+    if (!desc) {
+        GST_ERROR("Unsupported codec type for SEI creation");
+        return FALSE;
+    }
+    
+    if (position == SEI_POSITION_SUFFIX && desc->suffix_sei_type == NAL_TYPE_NONE) {
+        GST_WARNING("%s has no suffix SEI, using a prefix SEI", desc->name);
+        position = SEI_POSITION_PREFIX;
+    }
+    
+    writer->desc = desc;
+    writer->position = position;
+    writer->type = type;
+    writer->nal_length_size = nal_length_size;
+    gst_allocation_params_init(&writer->allocation_params);
+    writer->trailer = gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY, (gpointer)sei_rbsp_trailer,
+                                             sizeof(sei_rbsp_trailer), 0, sizeof(sei_rbsp_trailer),
+                                             NULL, NULL);
+    writer->epb = gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY, (gpointer)sei_epb, sizeof(sei_epb),
+                                         0, sizeof(sei_epb), NULL, NULL);
+    if (type == SEI_TYPE_REGISTERED_T35) {
+        memcpy(writer->user_data_header, sei_t35_lcevc_header, SEI_T35_HEADER_SIZE);
+        writer->user_data_header_size = SEI_T35_HEADER_SIZE;
+    } else {
+        memcpy(writer->user_data_header, uuid, SEI_UUID_SIZE);
+        writer->user_data_header_size = SEI_UUID_SIZE;
+    }
+    writer->prefix_size = build_sei_prefix(desc, position, type, nal_length_size, writer->prefix);
+    
+    for (i = 0; i < SEI_POOL_N_CLASSES; i++) {
+        // Not fatal if it fails, this size class is allocated on demand
+        writer->pools[i] = sei_writer_new_pool(writer, i);
+    }
+    
+    return TRUE;
 }
 
-static GstBuffer *
-create_lcevc_user_data_unregistered_sei(const guint8 *sei_data, gsize sei_size, GstLvCompositorCodec codec_type)
+/**
+ * Releases the pools of a SEI writer, safe on a zeroed writer.
+ * Buffers still downstream are freed when they come back.
+ * @param writer Writer to clear
+ */
+void
+sei_writer_clear(GstLvSeiWriter *writer)
 {
-    GstBuffer *sei_buffer;
-    GstMapInfo map;
-    guint8 *data;
-    gsize pos = 0;
+    guint i;
     
-    // Payload = UUID (16 bytes) + LCEVC data
-    gsize payload_size = 16 + sei_size;
+    for (i = 0; i < SEI_POOL_N_CLASSES; i++) {
+        if (writer->pools[i]) {
+            gst_buffer_pool_set_active(writer->pools[i], FALSE);
+            gst_object_unref(writer->pools[i]);
+            writer->pools[i] = NULL;
+        }
+    }
+    if (writer->trailer) {
+        gst_memory_unref(writer->trailer);
+        writer->trailer = NULL;
+    }
+    if (writer->epb) {
+        gst_memory_unref(writer->epb);
+        writer->epb = NULL;
+    }
+    if (writer->allocator) {
+        gst_object_unref(writer->allocator);
+        writer->allocator = NULL;
+    }
+    writer->prefix_size = 0;
+}
+
+/**
+ * Allocates the SEI buffers with the allocator chosen by downstream, so the
+ * SEI memory is of the kind the next element wants (shared memory, aligned
+ * for DMA...). Pooled SEI buffers are the output buffers, downstream nearly
+ * always holds some and a pool then refuses a new configuration: it is
+ * replaced by a new pool, its buffers are freed as they come back.
+ * @param writer SEI writer, set up by sei_writer_init()
+ * @param allocator Allocator, NULL for the default one
+ * @param params Allocation parameters, NULL for the defaults
+ */
+void
+sei_writer_set_allocator(GstLvSeiWriter *writer, GstAllocator *allocator,
+                         const GstAllocationParams *params)
+{
+    GstAllocationParams new_params;
+    guint i;
     
-    // Calculate size field bytes (same for all codecs)
-    gsize size_bytes = 0;
-    gsize temp_size = payload_size;
-    do {
-        size_bytes++;
-        temp_size = (temp_size >= 255) ? (temp_size - 255) : 0;
-    } while (temp_size > 0);
+    if (params) {
+        new_params = *params;
+    } else {
+        gst_allocation_params_init(&new_params);
+    }
     
-    // Calculate total size based on codec
-    gsize total_size;
-    switch (codec_type) {
-        case CODEC_H264:
-            // H.264: start_code(4) + nal_header(1) + type(1) + size(N) + payload + rbsp_trailing(1)
-            total_size = 4 + 1 + 1 + size_bytes + payload_size + 1;
-            break;
-        case CODEC_H265:
-            // HEVC: start_code(4) + nal_header(2) + type(1) + size(N) + payload + rbsp_trailing(1)
-            total_size = 4 + 2 + 1 + size_bytes + payload_size + 1;
-            break;
-        case CODEC_H266:
-            // H.266/VVC: start_code(4) + nal_unit_header(2) + type(1) + size(N) + payload + rbsp_trailing(1)
-            total_size = 4 + 2 + 1 + size_bytes + payload_size + 1;
-            break;
-        case CODEC_EVC:
-            // EVC: similar to H.266
-            total_size = 4 + 2 + 1 + size_bytes + payload_size + 1;
+    // Renegotiation without any change, the pools stay as they are
+    if (allocator == writer->allocator &&
+        new_params.flags == writer->allocation_params.flags &&
+        new_params.align == writer->allocation_params.align &&
+        new_params.prefix == writer->allocation_params.prefix &&
+        new_params.padding == writer->allocation_params.padding) {
+        return;
+    }
+    
+    if (writer->allocator) {
+        gst_object_unref(writer->allocator);
+    }
+    writer->allocator = allocator ? gst_object_ref(allocator) : NULL;
+    writer->allocation_params = new_params;
+    
+    for (i = 0; i < SEI_POOL_N_CLASSES; i++) {
+        GstStructure *config;
+        
+        if (!writer->pools[i]) {
+            continue;
+        }
+        gst_buffer_pool_set_active(writer->pools[i], FALSE);
+        config = gst_buffer_pool_get_config(writer->pools[i]);
+        gst_buffer_pool_config_set_allocator(config, writer->allocator, &writer->allocation_params);
+        if (gst_buffer_pool_set_config(writer->pools[i], config) &&
+            gst_buffer_pool_set_active(writer->pools[i], TRUE)) {
+            continue;
+        }
+        
+        GST_DEBUG("%" G_GSIZE_FORMAT " bytes SEI pool busy, replacing it", sei_pool_sizes[i]);
+        gst_object_unref(writer->pools[i]);
+        writer->pools[i] = sei_writer_new_pool(writer, i);
+    }
+}
+
+/**
+ * Limits the size of the SEI NAL units built by sei_writer_create_sei_units().
+ * With 1 or 2 bytes NAL unit lengths the limit is never above what the
+ * length field can code.
+ * @param writer SEI writer, set up by sei_writer_init()
+ * @param max_nal_size Largest SEI NAL unit, start code (or length field)
+ *                     included, 0 for no limit
+ */
+void
+sei_writer_set_max_nal_size(GstLvSeiWriter *writer, gsize max_nal_size)
+{
+    if (writer->nal_length_size > 0 && writer->nal_length_size < 4) {
+        gsize length_limit = writer->nal_length_size + (G_GSIZE_CONSTANT(1) << (8 * writer->nal_length_size)) - 1;
+        
+        if (max_nal_size == 0 || max_nal_size > length_limit) {
+            max_nal_size = length_limit;
+        }
+    }
+    writer->max_nal_size = max_nal_size;
+}
+
+/* Whether a SEI NAL unit of nal_size bytes can be coded, always for Annex B */
+static gboolean
+nal_length_fits(GstLvSeiWriter *writer, gsize nal_size)
+{
+    if (writer->nal_length_size == 0 || writer->nal_length_size >= 4) {
+        return TRUE;
+    }
+    
+    return (nal_size - writer->nal_length_size) >> (8 * writer->nal_length_size) == 0;
+}
+
+/**
+ * Fills the length field of a length-prefixed SEI NAL unit, a no-op for
+ * Annex B
+ * @param writer SEI writer of the stream
+ * @param data Start of the SEI NAL unit, length field included
+ * @param nal_size Size of the SEI NAL unit, length field included
+ * @return FALSE if the size does not fit in the length field
+ */
+static gboolean
+write_nal_length(GstLvSeiWriter *writer, guint8 *data, gsize nal_size)
+{
+    gsize length = nal_size - writer->nal_length_size;
+    guint i;
+    
+    if (writer->nal_length_size == 0) {
+        return TRUE;
+    }
+    if (!nal_length_fits(writer, nal_size)) {
+        GST_ERROR("%" G_GSIZE_FORMAT " bytes SEI does not fit a %u bytes NAL unit length",
+                  nal_size, writer->nal_length_size);
+        return FALSE;
+    }
+    
+    for (i = writer->nal_length_size; i-- > 0;) {
+        data[i] = (guint8)length;
+        length >>= 8;
+    }
+    
+    return TRUE;
+}
+
+/**
+ * Gets a SEI buffer of at least size bytes whose prefix is already written.
+ * Payloads larger than the biggest size class get a one-off allocation.
+ * @param writer SEI writer of the stream
+ * @param size Worst-case SEI size
+ * @return Buffer or NULL on error
+ */
+static GstBuffer *
+acquire_sei_buffer(GstLvSeiWriter *writer, gsize size)
+{
+    GstBuffer *buffer = NULL;
+    guint i;
+    
+    for (i = 0; i < SEI_POOL_N_CLASSES; i++) {
+        if (size <= sei_pool_sizes[i]) {
+            if (writer->pools[i] &&
+                gst_buffer_pool_acquire_buffer(writer->pools[i], &buffer, NULL) == GST_FLOW_OK) {
+                return buffer;
+            }
             break;
-        default:
-            GST_ERROR("Unsupported codec type for SEI creation");
-            return NULL;
+        }
     }
     
-    sei_buffer = gst_buffer_new_allocate(NULL, total_size, NULL);
+    buffer = gst_buffer_new_allocate(writer->allocator, size, &writer->allocation_params);
+    if (buffer) {
+        gst_buffer_fill(buffer, 0, writer->prefix, writer->prefix_size);
+    }
+    
+    return buffer;
+}
+
+/*
+ * payloadType, payloadSize and escaped user data header of the first
+ * sei_message(), after the prebuilt prefix. payloadType is the last prefix
+ * byte, it is rewritten since a pooled buffer may have carried another
+ * message type.
+ */
+static gsize
+write_first_message_header(GstLvSeiWriter *writer, guint8 *data, guint8 payload_type,
+                           const guint8 *header, guint header_size, gsize payload_size,
+                           guint *zero_run)
+{
+    gsize pos = writer->prefix_size;
+    gsize n_ff = payload_size / 255;
+    
+    // 3. SEI payload type
+    data[pos - 1] = payload_type;
+    
+    // 4. SEI payload size (ff_byte encoding)
+    memset(data + pos, 0xFF, n_ff);
+    pos += n_ff;
+    data[pos++] = (guint8)(payload_size % 255);
+    
+    // 5. Insert the prebuilt UUID or T.35 header
+    // Header and data go through emulation prevention, the escaper state
+    // starts from the last size byte (the only prefix byte that can be 0)
+    *zero_run = (data[pos - 1] == 0x00) ? 1 : 0;
+    pos += nal_epb_escape(data + pos, header, header_size, zero_run);
+    
+    return pos;
+}
+
+/**
+ * Writes the payload size and the escaped user data header (UUID or T.35
+ * codes) of the writer after the prebuilt prefix
+ * @param writer SEI writer of the stream
+ * @param data SEI buffer data, prefix already in place
+ * @param payload_size payloadSize (header + user data, before escaping)
+ * @param zero_run Out: escaper state after the header
+ * @return Number of bytes used in data
+ */
+static gsize
+write_sei_header(GstLvSeiWriter *writer, guint8 *data, gsize payload_size, guint *zero_run)
+{
+    return write_first_message_header(writer, data, writer->prefix[writer->prefix_size - 1],
+                                      writer->user_data_header, writer->user_data_header_size,
+                                      payload_size, zero_run);
+}
+
+/* Size of the header written by write_sei_header(), escaping included */
+static gsize
+sei_header_max_size(GstLvSeiWriter *writer, gsize payload_size)
+{
+    return writer->prefix_size + payload_size / 255 + 1 +
+           NAL_EPB_MAX_SIZE(writer->user_data_header_size);
+}
+
+/**
+ * Appends a region of src to dest by sharing its GstMemory blocks.
+ * No payload bytes are copied, only memory references are taken.
+ * @param dest Buffer receiving the memories
+ * @param src Buffer providing the memories
+ * @param offset Start of the region in src
+ * @param size Size of the region, -1 for everything after offset
+ * @return TRUE on success
+ */
+static gboolean
+append_shared_region(GstBuffer *dest, GstBuffer *src, gsize offset, gssize size)
+{
+    if (size == 0) {
+        return TRUE;
+    }
+
+    return gst_buffer_copy_into(dest, src, GST_BUFFER_COPY_MEMORY, offset, size);
+}
+
+/*
+ * Finds where the secondary payload needs an emulation prevention byte,
+ * memory by memory with the zero run carried from one memory to the next.
+ * Nothing is mapped as a whole. Stops once the payload memories split at
+ * these positions, plus the 0x03 memories, would go past max_memories.
+ * @param buffer Secondary payload
+ * @param zero_run Escaper state after the SEI header
+ * @param positions Out: payload offsets of the bytes to prefix with 0x03
+ * @param max_memories Memories the payload may use in the SEI
+ * @return Number of positions, G_MAXUINT if the payload does not fit
+ */
+static guint
+payload_find_epb(GstBuffer *buffer, guint zero_run, gsize *positions, guint max_memories)
+{
+    guint n_memory = gst_buffer_n_memory(buffer);
+    guint n_memories = n_memory;
+    guint n_positions = 0;
+    gsize base = 0;
+    guint i;
+    
+    if (n_memories > max_memories) {
+        return G_MAXUINT;
+    }
+    
+    for (i = 0; i < n_memory; i++) {
+        GstMemory *memory = gst_buffer_peek_memory(buffer, i);
+        GstMapInfo map;
+        gsize offset = 0;
+        
+        if (!gst_memory_map(memory, &map, GST_MAP_READ)) {
+            return G_MAXUINT;
+        }
+        while ((offset += nal_epb_find(map.data + offset, map.size - offset, &zero_run)) < map.size) {
+            // The 0x03 memory, and the split of this memory unless at its start
+            n_memories += offset > 0 ? 2 : 1;
+            if (n_memories > max_memories) {
+                gst_memory_unmap(memory, &map);
+                return G_MAXUINT;
+            }
+            positions[n_positions++] = base + offset;
+            zero_run = 0;
+        }
+        base += map.size;
+        gst_memory_unmap(memory, &map);
+    }
+    
+    return n_positions;
+}
+
+/*
+ * SEI whose payload is the secondary buffer memory itself: header memory
+ * (from the pool), the secondary memories, and the shared 0x80 trailer.
+ * Where the payload needs emulation prevention, the secondary memory is
+ * split around the shared 0x03 memory. NULL when that takes more than
+ * max_memories, the caller then copies the payload.
+ */
+static GstBuffer *
+create_shared_sei(GstLvSeiWriter *writer, GstBuffer *secondary_buffer, gsize payload_size,
+                  guint max_memories)
+{
+    gsize positions[SEI_SHARED_MAX_MEMORIES];
+    GstBuffer *sei_buffer;
+    GstMapInfo map;
+    guint n_positions;
+    guint zero_run;
+    gsize offset;
+    gsize pos;
+    guint i;
+    
+    // Header and trailer memories
+    if (max_memories < 3) {
+        return NULL;
+    }
+    max_memories = MIN(max_memories - 2, SEI_SHARED_MAX_MEMORIES);
+    
+    sei_buffer = acquire_sei_buffer(writer, sei_header_max_size(writer, payload_size));
     if (!sei_buffer) {
         GST_ERROR("Failed to allocate SEI buffer");
         return NULL;
@@ -176,254 +649,957 @@ create_lcevc_user_data_unregistered_sei(const guint8 *sei_data, gsize sei_size,
         gst_buffer_unref(sei_buffer);
         return NULL;
     }
+    pos = write_sei_header(writer, map.data, payload_size, &zero_run);
     
-    data = map.data;
+    n_positions = payload_find_epb(secondary_buffer, zero_run, positions, max_memories);
+    if (n_positions == G_MAXUINT ||
+        !write_nal_length(writer, map.data,
+                          pos + gst_buffer_get_size(secondary_buffer) + n_positions + 1)) {
+        gst_buffer_unmap(sei_buffer, &map);
+        gst_buffer_unref(sei_buffer);
+        return NULL;
+    }
+    gst_buffer_unmap(sei_buffer, &map);
+    gst_buffer_set_size(sei_buffer, pos);
     
-    // 1. Start code (4 bytes Annex B) - same for all
-    data[pos++] = 0x00;
-    data[pos++] = 0x00;
-    data[pos++] = 0x00;
-    data[pos++] = 0x01;
-    
-    switch (codec_type) {
-        case CODEC_H264:
-            // 2. H.264 NAL unit header (1 byte)
-            // forbidden_zero_bit(1)=0, nal_ref_idc(2)=0, nal_unit_type(5)=6
-            data[pos++] = 0x06;  // SEI NAL unit type
-            
-            // 3. SEI payload type = 5 (user_data_unregistered)
-            data[pos++] = 5;
-            break;
-            
-        case CODEC_H265:
-            // 2. HEVC NAL unit header (2 bytes)
-            // forbidden_zero_bit(1)=0, nal_unit_type(6)=39 or 40, nuh_layer_id(6)=0, nuh_temporal_id_plus1(3)=1
-            data[pos++] = 0x4E;  // 0100 1110 - nal_unit_type=39 (prefix SEI)
-            data[pos++] = 0x01;  // 0000 0001 - nuh_layer_id=0, temporal_id=0
-            
-            // 3. HEVC SEI payload type = 5 (user_data_unregistered)
-            data[pos++] = 5;
-            break;
-            
-        case CODEC_H266:
-            // 2. H.266/VVC NAL unit header (2 bytes)
-            // forbidden_zero_bit(1)=0, nuh_reserved_zero_1bit(1)=0, nal_unit_type(5), nuh_layer_id(6), nuh_temporal_id_plus1(3)
-            // SEI NAL unit types in VVC:
-            // - 21: Prefix SEI NAL unit
-            // - 22: Suffix SEI NAL unit
-            data[pos++] = 0x55;  // 0101 0101 - nal_unit_type=21 (prefix SEI), nuh_layer_id=0
-            data[pos++] = 0x01;  // 0000 0001 - nuh_temporal_id_plus1=1
-            
-            // 3. VVC SEI payload type = 5 (user_data_unregistered)
-            data[pos++] = 5;
-            break;
-            
-        case CODEC_EVC:
-            // 2. EVC NAL unit header (similar to HEVC/VVC)
-            // Using HEVC-like structure for EVC (check EVC spec for exact values)
-            data[pos++] = 0x4E;  // Placeholder - adjust based on EVC spec
-            data[pos++] = 0x01;  // Placeholder
-            
-            // 3. EVC SEI payload type = 5 (user_data_unregistered)
-            data[pos++] = 5;
-            break;
-            
-        default:
-            gst_buffer_unmap(sei_buffer, &map);
+    // 6-7. User data with the 0x03 bytes in between, and RBSP trailing bits, shared
+    offset = 0;
+    for (i = 0; i <= n_positions; i++) {
+        gsize end = i < n_positions ? positions[i] : gst_buffer_get_size(secondary_buffer);
+        
+        if (!append_shared_region(sei_buffer, secondary_buffer, offset, end - offset)) {
             gst_buffer_unref(sei_buffer);
             return NULL;
+        }
+        if (i < n_positions) {
+            gst_buffer_append_memory(sei_buffer, gst_memory_ref(writer->epb));
+        }
+        offset = end;
     }
+    gst_buffer_append_memory(sei_buffer, gst_memory_ref(writer->trailer));
     
-    // 4. SEI payload size (ff_byte encoding) - same for all codecs
-    temp_size = payload_size;
-    while (temp_size >= 255) {
-        data[pos++] = 0xFF;
-        temp_size -= 255;
-    }
-    data[pos++] = (guint8)temp_size;
+    GST_LOG("Created %s user data SEI sharing %" G_GSIZE_FORMAT " bytes of data, %u EPB",
+            writer->desc->name, payload_size - writer->user_data_header_size, n_positions);
     
-    // 5. Generate and insert UUID
-    uuid_t uuid;
-    char uuid_str[33];
+    return sei_buffer;
+}
+
+/*
+ * SEI written in a single memory, the payload is copied through the
+ * emulation prevention escaper.
+ */
+static GstBuffer *
+create_lcevc_user_data_sei(GstLvSeiWriter *writer, const guint8 *sei_data, gsize sei_size)
+{
+    GstBuffer *sei_buffer;
+    GstMapInfo map;
+    guint8 *data;
+    guint zero_run;
+    gsize pos;
     
-    if (generate_uuid_v4(&uuid) == 0) {
-        uuid_to_string(&uuid, uuid_str);
-        memcpy(data + pos, uuid_str, 16);
-    } else {
-        // Fallback: use zeros if UUID generation fails
-        memset(data + pos, 0, 16);
+    // Payload = UUID (16 bytes) or T.35 header (3 bytes) + LCEVC data
+    gsize payload_size = writer->user_data_header_size + sei_size;
+    
+    // header + escaped data + rbsp_trailing(1)
+    gsize total_size = sei_header_max_size(writer, payload_size) + NAL_EPB_MAX_SIZE(sei_size) + 1;
+    
+    sei_buffer = acquire_sei_buffer(writer, total_size);
+    if (!sei_buffer) {
+        GST_ERROR("Failed to allocate SEI buffer");
+        return NULL;
+    }
+    
+    if (!gst_buffer_map(sei_buffer, &map, GST_MAP_WRITE)) {
+        GST_ERROR("Failed to map SEI buffer");
+        gst_buffer_unref(sei_buffer);
+        return NULL;
     }
-    pos += 16;
+    
+    data = map.data;
+    
+    // 1-5. Prebuilt prefix, payload size and UUID / T.35 header
+    pos = write_sei_header(writer, data, payload_size, &zero_run);
     
     // 6. User data payload (LCEVC enhancement data)
     if (sei_data && sei_size > 0) {
-        memcpy(data + pos, sei_data, sei_size);
-        pos += sei_size;
+        pos += nal_epb_escape(data + pos, sei_data, sei_size, &zero_run);
     }
     
-    // 7. RBSP trailing bits - same for all codecs
-    data[pos++] = 0x80;
+    // 7. RBSP trailing bits
+    data[pos++] = SEI_RBSP_TRAILING_BITS;
     
+    if (!write_nal_length(writer, data, pos)) {
+        gst_buffer_unmap(sei_buffer, &map);
+        gst_buffer_unref(sei_buffer);
+        return NULL;
+    }
     gst_buffer_unmap(sei_buffer, &map);
     gst_buffer_set_size(sei_buffer, pos);
     
-    const gchar *codec_name = "UNKNOWN";
-    switch (codec_type) {
-        case CODEC_H264: codec_name = "H264"; break;
-        case CODEC_H265: codec_name = "H265"; break;
-        case CODEC_H266: codec_name = "H266"; break;
-        case CODEC_EVC: codec_name = "EVC"; break;
-        default: break;
-    }
-    
-    GST_DEBUG("Created %s user_data_unregistered SEI: UUID + %zu bytes data, total %zu bytes", 
-              codec_name, sei_size, pos);
+    GST_LOG("Created %s user data SEI: %u header + %zu bytes data, total %zu bytes", 
+              writer->desc->name, writer->user_data_header_size, sei_size, pos);
     
     return sei_buffer;
 }
 
+/*
+ * Builds the SEI of a secondary buffer, sharing its memory when possible.
+ * max_memories is what the SEI may use in the output buffer.
+ */
 static GstBuffer *
-combine_buffers_with_sei(GstBuffer *main_buffer, GstBuffer *sei_buffer, GstLvCompositorCodec codec_type)
+create_sei(GstLvSeiWriter *writer, GstBuffer *secondary_buffer, guint max_memories)
 {
-    (void)(codec_type); // Mark parameter as unused to avoid compiler warnings
+    GstMapInfo secondary_map;
+    GstBuffer *sei_buffer = NULL;
+    gsize payload_size = writer->user_data_header_size + gst_buffer_get_size(secondary_buffer);
     
-    if (!main_buffer || !sei_buffer) {
+    if (!writer->desc || writer->prefix_size == 0) {
+        GST_ERROR("SEI writer not negotiated");
         return NULL;
     }
     
-    // For simplicity, just return the SEI buffer as the result
-    // In a real implementation, you would merge the SEI NAL unit with the main buffer's NAL units
-    GstBuffer *result = gst_buffer_copy(sei_buffer);
+    if (gst_buffer_n_memory(secondary_buffer) + 2 <= max_memories) {
+        sei_buffer = create_shared_sei(writer, secondary_buffer, payload_size, max_memories);
+        if (sei_buffer) {
+            return sei_buffer;
+        }
+    }
+    
+    if (!gst_buffer_map(secondary_buffer, &secondary_map, GST_MAP_READ)) {
+        GST_ERROR("Failed to map secondary buffer for %s", writer->desc->name);
+        return NULL;
+    }
     
-    // Copy timestamps and other metadata from main buffer
-    GST_BUFFER_PTS(result) = GST_BUFFER_PTS(main_buffer);
-    GST_BUFFER_DTS(result) = GST_BUFFER_DTS(main_buffer);
-    GST_BUFFER_DURATION(result) = GST_BUFFER_DURATION(main_buffer);
+    sei_buffer = create_lcevc_user_data_sei(writer, secondary_map.data, secondary_map.size);
     
-    // Copy other metadata as needed
-    gst_buffer_copy_into(result, main_buffer, GST_BUFFER_COPY_METADATA, 0, -1);
+    gst_buffer_unmap(secondary_buffer, &secondary_map);
     
-    gst_buffer_unref(sei_buffer);
+    if (!sei_buffer) {
+        GST_ERROR("Failed to create %s SEI buffer", writer->desc->name);
+    }
     
-    return result;
+    return sei_buffer;
 }
 
-// Public functions that match the declarations in sei_merge.h
+/*
+ * Escapes a payload memory by memory into data, the escaper state is
+ * carried across memories and across messages.
+ */
+static gboolean
+escape_payload(GstBuffer *payload, guint8 *data, gsize *pos, guint *zero_run)
+{
+    guint i;
+    
+    for (i = 0; i < gst_buffer_n_memory(payload); i++) {
+        GstMemory *memory = gst_buffer_peek_memory(payload, i);
+        GstMapInfo map;
+        
+        if (!gst_memory_map(memory, &map, GST_MAP_READ)) {
+            return FALSE;
+        }
+        *pos += nal_epb_escape(data + *pos, map.data, map.size, zero_run);
+        gst_memory_unmap(memory, &map);
+    }
+    
+    return TRUE;
+}
+
+/*
+ * payloadType and payloadSize of the second and later messages of a SEI
+ * NAL unit. They follow user data, so unlike the first message header they
+ * go through emulation prevention.
+ */
+static gsize
+write_message_header(guint8 *data, guint8 payload_type, gsize payload_size, guint *zero_run)
+{
+    guint8 last = (guint8)(payload_size % 255);
+    gsize n_ff = payload_size / 255;
+    gsize pos = 0;
+    
+    pos += nal_epb_escape(data + pos, &payload_type, 1, zero_run);
+    memset(data + pos, 0xFF, n_ff);
+    pos += n_ff;
+    if (n_ff > 0) {
+        *zero_run = 0;
+    }
+    pos += nal_epb_escape(data + pos, &last, 1, zero_run);
+    
+    return pos;
+}
+
+/**
+ * Fills the payloadType and user data header of a SEI message
+ * @param header Header to fill
+ * @param type SEI message type
+ * @param uuid Binary UUID, SEI_UUID_SIZE bytes, only used by user_data_unregistered
+ */
+void
+sei_user_data_header_init(GstLvSeiUserDataHeader *header, GstLvSeiType type, const guint8 *uuid)
+{
+    if (type == SEI_TYPE_REGISTERED_T35) {
+        header->payload_type = SEI_PAYLOAD_TYPE_USER_DATA_REGISTERED_ITU_T_T35;
+        memcpy(header->data, sei_t35_lcevc_header, SEI_T35_HEADER_SIZE);
+        header->size = SEI_T35_HEADER_SIZE;
+    } else {
+        header->payload_type = SEI_PAYLOAD_TYPE_USER_DATA_UNREGISTERED;
+        memcpy(header->data, uuid, SEI_UUID_SIZE);
+        header->size = SEI_UUID_SIZE;
+    }
+}
+
+/**
+ * Builds one SEI NAL unit carrying several payloads, one sei_message()
+ * each, so they share the start code, NAL header and trailing bits. A
+ * single payload goes through sei_writer_create_sei() and may share its
+ * memory, several are copied through the escaper.
+ * @param writer SEI writer of the stream
+ * @param payloads User data of each message (not consumed)
+ * @param n_payloads Number of payloads, at least 1
+ * @return SEI NAL unit with its start code or length, NULL on error
+ */
 GstBuffer *
-merge_lcevc_data_h264(GstBuffer *main_buffer, GstBuffer *secondary_buffer)
+sei_writer_create_sei_list(GstLvSeiWriter *writer, GstBuffer **payloads, guint n_payloads)
 {
-    GstMapInfo secondary_map;
-    guint8 *sei_data = NULL;
-    gsize sei_size = 0;
+    return sei_writer_create_sei_messages(writer, payloads, NULL, n_payloads);
+}
+
+/**
+ * Same as sei_writer_create_sei_list() with a payloadType and user data
+ * header per message, for payloads of several sources (one UUID each).
+ * The NAL unit is written in a single allocation.
+ * @param writer SEI writer of the stream
+ * @param payloads User data of each message (not consumed)
+ * @param headers Header of each message, NULL (or NULL entries) for the
+ *                header of the writer
+ * @param n_payloads Number of payloads, at least 1
+ * @return SEI NAL unit with its start code or length, NULL on error
+ */
+GstBuffer *
+sei_writer_create_sei_messages(GstLvSeiWriter *writer, GstBuffer **payloads,
+                               const GstLvSeiUserDataHeader **headers, guint n_payloads)
+{
+    GstBuffer *sei_buffer;
+    GstMapInfo map;
+    gsize total_size;
+    gsize pos;
+    guint zero_run;
+    guint i;
     
-    if (!gst_buffer_map(secondary_buffer, &secondary_map, GST_MAP_READ)) {
-        GST_ERROR("Failed to map secondary buffer for H.264");
+    g_return_val_if_fail(n_payloads > 0, NULL);
+    
+    if (n_payloads == 1 && (!headers || !headers[0])) {
+        return sei_writer_create_sei(writer, payloads[0]);
+    }
+    
+    if (!writer->desc || writer->prefix_size == 0) {
+        GST_ERROR("SEI writer not negotiated");
         return NULL;
     }
     
-    sei_data = secondary_map.data;
-    sei_size = secondary_map.size;
+    total_size = writer->prefix_size + 1;
+    for (i = 0; i < n_payloads; i++) {
+        guint header_size = headers && headers[i] ? headers[i]->size : writer->user_data_header_size;
+        gsize payload_size = header_size + gst_buffer_get_size(payloads[i]);
+        
+        total_size += NAL_EPB_MAX_SIZE(payload_size / 255 + 2 + payload_size);
+    }
     
-    GstBuffer *sei_buffer = create_lcevc_user_data_unregistered_sei(sei_data, sei_size, CODEC_H264);
+    sei_buffer = acquire_sei_buffer(writer, total_size);
+    if (!sei_buffer) {
+        GST_ERROR("Failed to allocate SEI buffer");
+        return NULL;
+    }
+    if (!gst_buffer_map(sei_buffer, &map, GST_MAP_WRITE)) {
+        GST_ERROR("Failed to map SEI buffer");
+        gst_buffer_unref(sei_buffer);
+        return NULL;
+    }
     
-    gst_buffer_unmap(secondary_buffer, &secondary_map);
+    for (i = 0, pos = 0; i < n_payloads; i++) {
+        guint8 payload_type = writer->prefix[writer->prefix_size - 1];
+        const guint8 *header = writer->user_data_header;
+        guint header_size = writer->user_data_header_size;
+        gsize payload_size;
+        
+        if (headers && headers[i]) {
+            payload_type = headers[i]->payload_type;
+            header = headers[i]->data;
+            header_size = headers[i]->size;
+        }
+        payload_size = header_size + gst_buffer_get_size(payloads[i]);
+        
+        if (i == 0) {
+            pos = write_first_message_header(writer, map.data, payload_type, header, header_size,
+                                             payload_size, &zero_run);
+        } else {
+            pos += write_message_header(map.data + pos, payload_type, payload_size, &zero_run);
+            pos += nal_epb_escape(map.data + pos, header, header_size, &zero_run);
+        }
+        if (!escape_payload(payloads[i], map.data, &pos, &zero_run)) {
+            GST_ERROR("Failed to map SEI payload");
+            gst_buffer_unmap(sei_buffer, &map);
+            gst_buffer_unref(sei_buffer);
+            return NULL;
+        }
+    }
+    map.data[pos++] = SEI_RBSP_TRAILING_BITS;
     
-    if (!sei_buffer) {
-        GST_ERROR("Failed to create H.264 SEI buffer");
+    if (!write_nal_length(writer, map.data, pos)) {
+        gst_buffer_unmap(sei_buffer, &map);
+        gst_buffer_unref(sei_buffer);
         return NULL;
     }
+    gst_buffer_unmap(sei_buffer, &map);
+    gst_buffer_set_size(sei_buffer, pos);
     
-    // Combine main buffer with SEI buffer
-    return combine_buffers_with_sei(main_buffer, sei_buffer, CODEC_H264);
+    GST_LOG("Created %s SEI with %u messages, total %" G_GSIZE_FORMAT " bytes",
+            writer->desc->name, n_payloads, pos);
+    
+    return sei_buffer;
 }
 
-GstBuffer *
-merge_lcevc_data_h265(GstBuffer *main_buffer, GstBuffer *secondary_buffer)
+/*
+ * Size of the payload once escaped, memory by memory. zero_run is the
+ * escaper state before the payload and after it on return.
+ */
+static gsize
+escaped_size(GstBuffer *payload, guint *zero_run)
 {
-    GstMapInfo secondary_map;
-    guint8 *sei_data = NULL;
-    gsize sei_size = 0;
+    gsize size = 0;
+    guint i;
     
-    if (!gst_buffer_map(secondary_buffer, &secondary_map, GST_MAP_READ)) {
-        GST_ERROR("Failed to map secondary buffer for H.265");
-        return NULL;
+    for (i = 0; i < gst_buffer_n_memory(payload); i++) {
+        GstMemory *memory = gst_buffer_peek_memory(payload, i);
+        GstMapInfo map;
+        gsize pos = 0;
+        
+        if (!gst_memory_map(memory, &map, GST_MAP_READ)) {
+            // Worst case, the caller only uses it to pack messages
+            size += NAL_EPB_MAX_SIZE(gst_memory_get_sizes(memory, NULL, NULL));
+            *zero_run = 2;
+            continue;
+        }
+        while ((pos += nal_epb_find(map.data + pos, map.size - pos, zero_run)) < map.size) {
+            // 0x03 then the byte it protects
+            *zero_run = (map.data[pos] == 0x00) ? 1 : 0;
+            pos++;
+            size++;
+        }
+        size += map.size;
+        gst_memory_unmap(memory, &map);
     }
     
-    sei_data = secondary_map.data;
-    sei_size = secondary_map.size;
+    return size;
+}
+
+/*
+ * Largest number of bytes of data whose escaped form fits in room bytes,
+ * starting from the zero_run escaper state.
+ */
+static gsize
+escaped_fit(const guint8 *data, gsize size, gsize room, guint zero_run)
+{
+    gsize pos = 0;
+    gsize out = 0;
     
-    GstBuffer *sei_buffer = create_lcevc_user_data_unregistered_sei(sei_data, sei_size, CODEC_H265);
+    while (pos < size && out < room) {
+        gsize limit = MIN(size - pos, room - out);
+        gsize clean = nal_epb_find(data + pos, limit, &zero_run);
+        
+        pos += clean;
+        out += clean;
+        if (clean == limit || out + 2 > room) {
+            break;
+        }
+        zero_run = (data[pos] == 0x00) ? 1 : 0;
+        pos++;
+        out += 2;
+    }
     
-    gst_buffer_unmap(secondary_buffer, &secondary_map);
+    return pos;
+}
+
+/*
+ * Cuts a payload too large for one SEI NAL unit into fragments, each one
+ * alone in its NAL unit. The room left for the data is computed on the
+ * escaped bytes, so every unit fits whatever the payload content.
+ */
+static guint
+create_fragment_units(GstLvSeiWriter *writer, GstBuffer *payload, GstBuffer **units,
+                      guint max_units)
+{
+    gsize offsets[SEI_FRAGMENT_MAX_COUNT + 1];
+    gsize header_size = writer->user_data_header_size + SEI_FRAGMENT_HEADER_SIZE;
+    gsize overhead;
+    gsize room;
+    GstMapInfo map;
+    guint n = 0;
+    guint i;
     
-    if (!sei_buffer) {
-        GST_ERROR("Failed to create H.265 SEI buffer");
-        return NULL;
+    // Size bytes and header counted for the worst case, and the 0x80
+    // trailer. The data is fitted from the worst escaper state (two zeros).
+    overhead = writer->prefix_size + writer->max_nal_size / 255 + 1 +
+               NAL_EPB_MAX_SIZE(header_size) + 1;
+    if (writer->max_nal_size <= overhead) {
+        return 0;
+    }
+    room = writer->max_nal_size - overhead;
+    
+    if (!gst_buffer_map(payload, &map, GST_MAP_READ)) {
+        GST_ERROR("Failed to map secondary buffer for %s", writer->desc->name);
+        return 0;
+    }
+    
+    offsets[0] = 0;
+    while (offsets[n] < map.size) {
+        gsize length = escaped_fit(map.data + offsets[n], map.size - offsets[n], room, 2);
+        
+        if (length == 0 || n == MIN(max_units, SEI_FRAGMENT_MAX_COUNT)) {
+            gst_buffer_unmap(payload, &map);
+            return 0;
+        }
+        offsets[n + 1] = offsets[n] + length;
+        n++;
+    }
+    gst_buffer_unmap(payload, &map);
+    
+    for (i = 0; i < n; i++) {
+        guint8 header[SEI_FRAGMENT_HEADER_SIZE] = {
+            SEI_FRAGMENT_MARKER,
+            (guint8)(writer->fragment_sequence >> 8),
+            (guint8)writer->fragment_sequence,
+            (guint8)i,
+            (guint8)n,
+            0,  // au_delay, all fragments go in this access unit
+        };
+        GstBuffer *fragment = gst_buffer_new_allocate(NULL, SEI_FRAGMENT_HEADER_SIZE, NULL);
+        
+        gst_buffer_fill(fragment, 0, header, SEI_FRAGMENT_HEADER_SIZE);
+        gst_buffer_copy_into(fragment, payload, GST_BUFFER_COPY_MEMORY, offsets[i],
+                             offsets[i + 1] - offsets[i]);
+        units[i] = sei_writer_create_sei(writer, fragment);
+        gst_buffer_unref(fragment);
+        if (!units[i]) {
+            while (i-- > 0) {
+                gst_buffer_unref(units[i]);
+            }
+            return 0;
+        }
     }
+    writer->fragment_sequence++;
     
-    // Combine main buffer with SEI buffer
-    return combine_buffers_with_sei(main_buffer, sei_buffer, CODEC_H265);
+    GST_LOG("%s SEI of %" G_GSIZE_FORMAT " bytes cut in %u NAL units of at most %" G_GSIZE_FORMAT,
+            writer->desc->name, gst_buffer_get_size(payload), n, writer->max_nal_size);
+    
+    return n;
 }
 
-GstBuffer *
-merge_lcevc_data_h266(GstBuffer *main_buffer, GstBuffer *secondary_buffer)
+/**
+ * Builds the SEI NAL units carrying the payloads, one sei_message() each.
+ * Without size limit they all go in one NAL unit. With max_nal_size set,
+ * consecutive payloads share a NAL unit while it fits, and a payload alone
+ * above the limit is cut into fragments, one NAL unit each. A fragment of
+ * the spreader is never cut again, set the spread budget below the limit.
+ * @param writer SEI writer of the stream
+ * @param payloads User data of each message (not consumed)
+ * @param n_payloads Number of payloads, at least 1
+ * @param units Output, caller unrefs
+ * @param max_units Size of units
+ * @return Number of SEI NAL units, 0 on error
+ */
+guint
+sei_writer_create_sei_units(GstLvSeiWriter *writer, GstBuffer **payloads, guint n_payloads,
+                            GstBuffer **units, guint max_units)
 {
-    GstMapInfo secondary_map;
-    guint8 *sei_data = NULL;
-    gsize sei_size = 0;
+    gsize sizes[SEI_MAX_NAL_UNITS];
+    guint n_units = 0;
+    guint first = 0;
+    gsize nal_size;
+    guint i;
     
-    if (!gst_buffer_map(secondary_buffer, &secondary_map, GST_MAP_READ)) {
-        GST_ERROR("Failed to map secondary buffer for H.266");
-        return NULL;
+    g_return_val_if_fail(n_payloads > 0 && n_payloads <= SEI_MAX_NAL_UNITS && max_units > 0, 0);
+    
+    if (writer->max_nal_size == 0) {
+        units[0] = sei_writer_create_sei_list(writer, payloads, n_payloads);
+        return units[0] ? 1 : 0;
     }
     
-    sei_data = secondary_map.data;
-    sei_size = secondary_map.size;
+    // Escaped message sizes: payloadType, size bytes, header and data,
+    // plus two bytes for the escaper state carried from the previous message
+    for (i = 0; i < n_payloads; i++) {
+        gsize payload_size = writer->user_data_header_size + gst_buffer_get_size(payloads[i]);
+        guint zero_run = 0;
+        
+        sizes[i] = 1 + payload_size / 255 + 1 +
+                   NAL_EPB_MAX_SIZE(writer->user_data_header_size) + 2 +
+                   escaped_size(payloads[i], &zero_run);
+    }
     
-    GstBuffer *sei_buffer = create_lcevc_user_data_unregistered_sei(sei_data, sei_size, CODEC_H266);
+    if (n_payloads == 1 && writer->prefix_size - 1 + sizes[0] + 1 > writer->max_nal_size) {
+        n_units = create_fragment_units(writer, payloads[0], units, max_units);
+        if (n_units > 0) {
+            return n_units;
+        }
+        GST_WARNING("%" G_GSIZE_FORMAT " bytes payload cannot be cut for max-sei-nal-size %"
+                    G_GSIZE_FORMAT ", sent whole", gst_buffer_get_size(payloads[0]),
+                    writer->max_nal_size);
+    }
     
-    gst_buffer_unmap(secondary_buffer, &secondary_map);
+    // Start code, NAL header and trailer, then messages while they fit
+    nal_size = writer->prefix_size - 1 + 1 + sizes[0];
+    for (i = 1; i <= n_payloads; i++) {
+        if (i < n_payloads && (nal_size + sizes[i] <= writer->max_nal_size || n_units == max_units - 1)) {
+            nal_size += sizes[i];
+            continue;
+        }
+        units[n_units] = sei_writer_create_sei_list(writer, payloads + first, i - first);
+        if (!units[n_units]) {
+            while (n_units-- > 0) {
+                gst_buffer_unref(units[n_units]);
+            }
+            return 0;
+        }
+        n_units++;
+        first = i;
+        if (i < n_payloads) {
+            nal_size = writer->prefix_size - 1 + 1 + sizes[i];
+        }
+    }
     
-    if (!sei_buffer) {
-        GST_ERROR("Failed to create H.266 SEI buffer");
+    return n_units;
+}
+
+/**
+ * Splices the SEI NAL unit into the main access unit without copying it.
+ * The SEI buffer (usually from the SEI pool) becomes the output buffer,
+ * the main memories are shared around the SEI memory:
+ *   main[0, split_offset) + SEI + main[split_offset, end)
+ * Timestamps, flags and metas are taken from the main buffer.
+ * @param main_buffer Main access unit (not consumed)
+ * @param sei_buffer SEI NAL unit (consumed)
+ * @param split_offset Byte offset in main_buffer where the SEI is inserted
+ * @return New buffer or NULL on error
+ */
+static GstBuffer *
+combine_buffers_with_sei(GstBuffer *main_buffer, GstBuffer *sei_buffer, gsize split_offset)
+{
+    GstBuffer *result;
+    gsize main_size;
+
+    if (!main_buffer || !sei_buffer) {
+        if (sei_buffer) {
+            gst_buffer_unref(sei_buffer);
+        }
+        return NULL;
+    }
+
+    main_size = gst_buffer_get_size(main_buffer);
+    if (split_offset > main_size) {
+        split_offset = main_size;
+    }
+
+    result = sei_buffer;
+
+    // Timestamps, flags and metas come from the main access unit
+    gst_buffer_copy_into(result, main_buffer, GST_BUFFER_COPY_METADATA, 0, -1);
+
+    if (split_offset > 0) {
+        GstBuffer *head = gst_buffer_copy_region(main_buffer, GST_BUFFER_COPY_MEMORY, 0, split_offset);
+        guint i;
+
+        if (!head) {
+            GST_ERROR("Failed to share main buffer head");
+            gst_buffer_unref(result);
+            return NULL;
+        }
+        for (i = 0; i < gst_buffer_n_memory(head); i++) {
+            gst_buffer_insert_memory(result, i, gst_buffer_get_memory(head, i));
+        }
+        gst_buffer_unref(head);
+    }
+
+    if (!append_shared_region(result, main_buffer, split_offset, -1)) {
+        GST_ERROR("Failed to splice SEI into main buffer");
+        gst_buffer_unref(result);
         return NULL;
     }
+
+    return result;
+}
+
+/* SEI position in a piece of access unit, Annex B or length-prefixed */
+static gsize
+find_sei_insert_offset(GstLvSeiWriter *writer, const guint8 *data, gsize size, gboolean *found)
+{
+    if (writer->nal_length_size > 0) {
+        return nal_find_sei_insert_offset_length(data, size, writer->nal_length_size, writer->desc,
+                                                 found);
+    }
     
-    // Combine main buffer with SEI buffer
-    return combine_buffers_with_sei(main_buffer, sei_buffer, CODEC_H266);
+    return nal_find_sei_insert_offset(data, size, writer->desc, found);
+}
+
+/* Start code, NAL unit header and zero_byte seen across a memory boundary */
+#define SPLIT_WINDOW_SIZE 16
+
+/* Length-prefixed access unit: a few bytes read per NAL unit, nothing mapped */
+static gsize
+find_sei_split_offset_length(GstLvSeiWriter *writer, GstBuffer *main_buffer)
+{
+    guint8 head[SPLIT_WINDOW_SIZE];
+    guint length_size = writer->nal_length_size;
+    guint header_size = writer->desc->nal_header_size;
+    gsize size = gst_buffer_get_size(main_buffer);
+    gsize pos = 0;
+
+    while (pos + length_size + header_size <= size) {
+        gsize length = 0;
+        guint i;
+
+        gst_buffer_extract(main_buffer, pos, head, length_size + header_size);
+        if (codec_desc_starts_picture(writer->desc, writer->desc->nal_type(head + length_size))) {
+            return pos;
+        }
+        for (i = 0; i < length_size; i++) {
+            length = (length << 8) | head[i];
+        }
+        pos += length_size + length;
+    }
+
+    return size;
+}
+
+/**
+ * Finds where the SEI goes in the main access unit.
+ * The memories are scanned one by one, the first one usually holds the
+ * AUD/parameter sets and the start of the first slice so the scan rarely
+ * goes further. A start code cut by a memory boundary is found in a small
+ * window holding the end of the previous memories and the start of the
+ * next one; the buffer is never mapped as a whole.
+ * @param writer SEI writer of the stream
+ * @param main_buffer Main access unit
+ * @return Byte offset of the first NAL unit of the coded picture
+ */
+static gsize
+find_sei_split_offset(GstLvSeiWriter *writer, GstBuffer *main_buffer)
+{
+    const GstLvCodecDesc *desc = writer->desc;
+    guint8 window[SPLIT_WINDOW_SIZE];
+    gsize unit_size = 3 + desc->nal_header_size;
+    gsize carry_max = unit_size + 1;
+    gsize carry = 0;
+    gsize base = 0;
+    guint n_memory = gst_buffer_n_memory(main_buffer);
+    guint i;
+
+    if (writer->nal_length_size > 0) {
+        return find_sei_split_offset_length(writer, main_buffer);
+    }
+
+    for (i = 0; i < n_memory; i++) {
+        GstMemory *memory = gst_buffer_peek_memory(main_buffer, i);
+        GstMapInfo map;
+        gboolean found = FALSE;
+        gsize window_size;
+        gsize offset;
+        gsize keep;
+        gsize sc;
+
+        if (!gst_memory_map(memory, &map, GST_MAP_READ)) {
+            GST_WARNING("Failed to map main memory %u, SEI goes first", i);
+            return 0;
+        }
+
+        // Start codes starting in the previous memories whose NAL unit
+        // header ends in this one, the previous scans could not see them
+        window_size = carry + MIN(map.size, unit_size - 1);
+        memcpy(window + carry, map.data, window_size - carry);
+        for (sc = nal_find_start_code(window, window_size, 0);
+             sc < carry && sc + unit_size <= window_size;
+             sc = nal_find_start_code(window, window_size, sc + 1)) {
+            if (sc + unit_size > carry &&
+                codec_desc_starts_picture(desc, desc->nal_type(window + sc + 3))) {
+                gst_memory_unmap(memory, &map);
+                if (sc > 0 && window[sc - 1] == 0x00) {
+                    sc--;
+                }
+                return base - carry + sc;
+            }
+        }
+
+        offset = find_sei_insert_offset(writer, map.data, map.size, &found);
+        if (found) {
+            gst_memory_unmap(memory, &map);
+            // zero_byte at the end of the previous memory
+            if (offset == 0 && carry > 0 && window[carry - 1] == 0x00) {
+                return base - 1;
+            }
+            return base + offset;
+        }
+
+        // Last bytes of the stream so far, for the next boundary
+        if (map.size >= carry_max) {
+            memcpy(window, map.data + map.size - carry_max, carry_max);
+            carry = carry_max;
+        } else {
+            keep = MIN(carry, carry_max - map.size);
+            memmove(window, window + carry - keep, keep);
+            memcpy(window + keep, map.data, map.size);
+            carry = keep + map.size;
+        }
+        base += map.size;
+        gst_memory_unmap(memory, &map);
+    }
+
+    return base;
 }
 
+/**
+ * Wraps the secondary buffer in a user data SEI NAL unit.
+ * Timestamps are left to the caller.
+ * @param writer SEI writer of the stream
+ * @param secondary_buffer Enhancement data (not consumed, its memory may be shared)
+ * @return SEI NAL unit with its start code or length, NULL on error
+ */
 GstBuffer *
-merge_lcevc_data_evc(GstBuffer *main_buffer, GstBuffer *secondary_buffer)
+sei_writer_create_sei(GstLvSeiWriter *writer, GstBuffer *secondary_buffer)
 {
-    GstMapInfo secondary_map;
-    guint8 *sei_data = NULL;
-    gsize sei_size = 0;
+    return create_sei(writer, secondary_buffer, gst_buffer_get_max_memory());
+}
+
+/**
+ * Embeds the secondary buffer as a user data SEI into the
+ * main access unit. Same code for every codec, the codec specific layout
+ * comes from the writer's descriptor.
+ * @param writer SEI writer of the stream
+ * @param main_buffer Main access unit (not consumed)
+ * @param secondary_buffer Enhancement data (not consumed)
+ * @return Merged buffer or NULL on error
+ */
+GstBuffer *
+merge_lcevc_data(GstLvSeiWriter *writer, GstBuffer *main_buffer, GstBuffer *secondary_buffer)
+{
+    GstBuffer *sei_buffer;
     
-    if (!gst_buffer_map(secondary_buffer, &secondary_map, GST_MAP_READ)) {
-        GST_ERROR("Failed to map secondary buffer for EVC");
+    // The main memories around the SEI (one may be split in two) must not
+    // push the output past the memory limit, GstBuffer would merge them all
+    sei_buffer = create_sei(writer, secondary_buffer,
+                            gst_buffer_get_max_memory() - MIN(gst_buffer_n_memory(main_buffer) + 1,
+                                                              gst_buffer_get_max_memory()));
+    if (!sei_buffer) {
         return NULL;
     }
     
-    sei_data = secondary_map.data;
-    sei_size = secondary_map.size;
+    return merge_lcevc_sei(writer, main_buffer, sei_buffer);
+}
+
+/**
+ * Writes the SEI into the headroom of the main access unit (the memory
+ * offset left by an allocator honouring the proposed prefix). The bytes in
+ * front of the SEI position move back by the SEI size and the payload is
+ * escaped right after them: one memory, one copy of the payload, the coded
+ * picture untouched. The exact SEI size is computed first so the headroom
+ * is used to the byte.
+ * @param writer SEI writer of the stream, prefix SEI only
+ * @param main_buffer Main access unit, modified on success; it must be
+ *                    writable, and so must its first memory, which holds
+ *                    the SEI position
+ * @param secondary_buffer Enhancement data (not consumed)
+ * @return TRUE if the SEI was written, FALSE if main_buffer is untouched
+ */
+gboolean
+merge_lcevc_sei_in_place(GstLvSeiWriter *writer, GstBuffer *main_buffer, GstBuffer *secondary_buffer)
+{
+    guint8 header[NAL_EPB_MAX_SIZE(SEI_USER_DATA_HEADER_MAX_SIZE)];
+    gsize payload_size = writer->user_data_header_size + gst_buffer_get_size(secondary_buffer);
+    GstMemory *memory;
+    GstMapInfo map;
+    gboolean found = FALSE;
+    gsize memory_offset;
+    gsize memory_size;
+    gsize split_offset;
+    gsize sei_size;
+    gsize pos;
+    guint zero_run;
     
-    GstBuffer *sei_buffer = create_lcevc_user_data_unregistered_sei(sei_data, sei_size, CODEC_EVC);
+    if (writer->position != SEI_POSITION_PREFIX || !writer->desc || writer->prefix_size == 0 ||
+        gst_buffer_n_memory(main_buffer) == 0 || !gst_buffer_is_writable(main_buffer) ||
+        !gst_buffer_is_memory_range_writable(main_buffer, 0, 1)) {
+        return FALSE;
+    }
     
-    gst_buffer_unmap(secondary_buffer, &secondary_map);
+    memory = gst_buffer_peek_memory(main_buffer, 0);
+    memory_size = gst_memory_get_sizes(memory, &memory_offset, NULL);
+    if (memory_offset < sei_header_max_size(writer, payload_size)) {
+        return FALSE;
+    }
+    
+    // Exact size: prefix, size bytes, escaped header, escaped payload, trailer
+    zero_run = (payload_size % 255 == 0) ? 1 : 0;
+    sei_size = writer->prefix_size + payload_size / 255 + 1 +
+               nal_epb_escape(header, writer->user_data_header, writer->user_data_header_size,
+                              &zero_run);
+    sei_size += escaped_size(secondary_buffer, &zero_run) + 1;
+    if (memory_offset < sei_size || !nal_length_fits(writer, sei_size)) {
+        return FALSE;
+    }
+    
+    if (!gst_memory_map(memory, &map, GST_MAP_READ)) {
+        return FALSE;
+    }
+    split_offset = find_sei_insert_offset(writer, map.data, map.size, &found);
+    gst_memory_unmap(memory, &map);
+    if (!found && gst_buffer_n_memory(main_buffer) > 1) {
+        return FALSE;
+    }
+    
+    if (!gst_buffer_resize_range(main_buffer, 0, 1, -(gssize)sei_size, memory_size + sei_size)) {
+        return FALSE;
+    }
+    if (!gst_buffer_map_range(main_buffer, 0, 1, &map, GST_MAP_WRITE)) {
+        gst_buffer_resize_range(main_buffer, 0, 1, sei_size, memory_size);
+        return FALSE;
+    }
+    
+    // AUD and parameter sets move into the headroom, the SEI follows them
+    memmove(map.data, map.data + sei_size, split_offset);
+    memcpy(map.data + split_offset, writer->prefix, writer->prefix_size);
+    pos = write_sei_header(writer, map.data + split_offset, payload_size, &zero_run);
+    if (!escape_payload(secondary_buffer, map.data + split_offset, &pos, &zero_run)) {
+        memmove(map.data + sei_size, map.data, split_offset);
+        gst_buffer_unmap(main_buffer, &map);
+        gst_buffer_resize_range(main_buffer, 0, 1, sei_size, memory_size);
+        return FALSE;
+    }
+    map.data[split_offset + pos++] = SEI_RBSP_TRAILING_BITS;
+    write_nal_length(writer, map.data + split_offset, sei_size);
+    gst_buffer_unmap(main_buffer, &map);
+    
+    g_warn_if_fail(pos == sei_size);
     
+    GST_LOG("Wrote %s SEI of %" G_GSIZE_FORMAT " bytes in place, %" G_GSIZE_FORMAT
+            " bytes of headroom left", writer->desc->name, sei_size, memory_offset - sei_size);
+    
+    return TRUE;
+}
+
+/**
+ * Inserts a SEI NAL unit built beforehand into the main access unit
+ * @param writer SEI writer of the stream
+ * @param main_buffer Main access unit (not consumed)
+ * @param sei_buffer SEI NAL unit (consumed)
+ * @return Merged buffer or NULL on error
+ */
+GstBuffer *
+merge_lcevc_sei(GstLvSeiWriter *writer, GstBuffer *main_buffer, GstBuffer *sei_buffer)
+{
+    gsize split_offset;
+    
+    // A prefix SEI goes before the first NAL unit of the coded picture,
+    // a suffix SEI after the last one
+    if (writer->position == SEI_POSITION_SUFFIX) {
+        split_offset = gst_buffer_get_size(main_buffer);
+    } else {
+        split_offset = find_sei_split_offset(writer, main_buffer);
+    }
+    
+    return combine_buffers_with_sei(main_buffer, sei_buffer, split_offset);
+}
+
+/**
+ * Embeds the secondary buffer into a NAL aligned access unit. The SEI is
+ * inserted as its own buffer before the first NAL unit of the coded picture,
+ * the NAL buffers are only referenced.
+ * @param writer SEI writer of the stream
+ * @param main_au Main access unit (not consumed)
+ * @param secondary_buffer Enhancement data (not consumed)
+ * @return New list or NULL on error
+ */
+GstBufferList *
+merge_lcevc_data_list(GstLvSeiWriter *writer, GstBufferList *main_au, GstBuffer *secondary_buffer)
+{
+    GstBuffer *sei_buffer;
+    
+    if (gst_buffer_list_length(main_au) == 0) {
+        return NULL;
+    }
+    
+    sei_buffer = sei_writer_create_sei(writer, secondary_buffer);
     if (!sei_buffer) {
-        GST_ERROR("Failed to create EVC SEI buffer");
         return NULL;
     }
     
-    // Combine main buffer with SEI buffer
-    return combine_buffers_with_sei(main_buffer, sei_buffer, CODEC_EVC);
+    return merge_lcevc_sei_list(writer, main_au, &sei_buffer, 1);
 }
 
-GstBuffer *
-merge_lcevc_data_generic(GstBuffer *main_buffer, GstBuffer *secondary_buffer)
+/**
+ * Inserts SEI NAL units built beforehand into a NAL aligned access unit,
+ * one buffer each, in order
+ * @param writer SEI writer of the stream
+ * @param main_au Main access unit (not consumed)
+ * @param sei_units SEI NAL units (consumed)
+ * @param n_units Number of SEI NAL units, at least 1
+ * @return New list or NULL on error
+ */
+GstBufferList *
+merge_lcevc_sei_list(GstLvSeiWriter *writer, GstBufferList *main_au, GstBuffer **sei_units,
+                     guint n_units)
 {
-    // Fallback to H.265 for generic case
-    return merge_lcevc_data_h265(main_buffer, secondary_buffer);
-}
\ No newline at end of file
+    GstBufferList *result;
+    guint n_nals = gst_buffer_list_length(main_au);
+    guint index = n_nals;
+    gsize split_offset = 0;
+    guint i;
+    
+    if (n_nals == 0) {
+        for (i = 0; i < n_units; i++) {
+            gst_buffer_unref(sei_units[i]);
+        }
+        return NULL;
+    }
+    
+    if (writer->position == SEI_POSITION_PREFIX) {
+        for (i = 0; i < n_nals; i++) {
+            GstBuffer *nal = gst_buffer_list_get(main_au, i);
+            
+            split_offset = find_sei_split_offset(writer, nal);
+            if (split_offset < gst_buffer_get_size(nal)) {
+                index = i;
+                break;
+            }
+        }
+    }
+    
+    for (i = 0; i < n_units; i++) {
+        sei_units[i] = gst_buffer_make_writable(sei_units[i]);
+        gst_buffer_copy_into(sei_units[i], gst_buffer_list_get(main_au, MIN(index, n_nals - 1)),
+                             GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+    }
+    
+    // Shallow copy, the NAL buffers are shared
+    result = gst_buffer_list_copy(main_au);
+    
+    if (index == n_nals) {
+        for (i = 0; i < n_units; i++) {
+            gst_buffer_list_add(result, sei_units[i]);
+        }
+    } else {
+        if (split_offset > 0) {
+            // Several NAL units in one buffer, split it around the SEI
+            GstBuffer *nal = gst_buffer_list_get(main_au, index);
+            GstBuffer *head = gst_buffer_copy_region(nal, GST_BUFFER_COPY_ALL, 0, split_offset);
+            GstBuffer *tail = gst_buffer_copy_region(nal, GST_BUFFER_COPY_ALL, split_offset, -1);
+            
+            GST_BUFFER_FLAG_UNSET(head, GST_BUFFER_FLAG_MARKER);
+            gst_buffer_list_remove(result, index, 1);
+            gst_buffer_list_insert(result, index, head);
+            gst_buffer_list_insert(result, index + 1, tail);
+            index++;
+        }
+        for (i = 0; i < n_units; i++) {
+            gst_buffer_list_insert(result, index + i, sei_units[i]);
+        }
+    }
+    
+    return result;
+}
@@ -4,18 +4,154 @@
 #include <gst/gst.h>
 #include <glib.h>
 
+#include "codec_desc.h"
+
+#define SEI_UUID_SIZE 16
+#define SEI_PREFIX_MAX_SIZE 8
+#define SEI_POOL_N_CLASSES 4
+
+/* SEI message layout, shared by the writer and the extractor */
+#define SEI_PAYLOAD_TYPE_USER_DATA_REGISTERED_ITU_T_T35 4
+#define SEI_PAYLOAD_TYPE_USER_DATA_UNREGISTERED 5
+#define SEI_RBSP_TRAILING_BITS 0x80  /* rbsp_stop_one_bit + alignment */
+
+/* itu_t_t35_country_code (United Kingdom) and terminal_provider_code of LCEVC */
+#define SEI_T35_LCEVC_HEADER { 0xB4, 0x00, 0x50 }
+#define SEI_T35_HEADER_SIZE 3
+
+/* Largest header in front of the user data (the UUID) */
+#define SEI_USER_DATA_HEADER_MAX_SIZE SEI_UUID_SIZE
+
+/*
+ * Fragmented user data (spread mode), right after the UUID / T.35 header:
+ *   fragment_marker  u(8)   0xFF
+ *   sequence_id      u(16)  big endian, one per secondary buffer, wraps
+ *   fragment_index   u(8)   0 .. fragment_count - 1, sent in order
+ *   fragment_count   u(8)   1 .. 255
+ *   au_delay         u(8)   access units (decoding order) between the one
+ *                           the payload belongs to and the one carrying
+ *                           this fragment
+ *   fragment data
+ * The payload is the concatenation of the fragment data. A payload sent
+ * whole in its own access unit has no fragment header.
+ *
+ * The first byte of the user data, and of a reassembled payload, tells
+ * what follows:
+ *   0xFF   fragment header (above, user data only)
+ *   0xFE   compact payload (compact_payload.h)
+ *   0xFD   escape, dropped by the extractor: the payload starts with
+ *          0xFD, 0xFE or 0xFF and would be mistaken for one of these
+ *   other  the payload as is
+ */
+#define SEI_FRAGMENT_MARKER 0xFF
+#define SEI_RAW_MARKER 0xFD
+#define SEI_FRAGMENT_HEADER_SIZE 6
+#define SEI_FRAGMENT_MAX_COUNT 255
+
+/* SEI NAL units built for one access unit */
+#define SEI_MAX_NAL_UNITS 512
+
+/* Where the SEI NAL unit goes in the access unit */
+typedef enum {
+    SEI_POSITION_PREFIX,  /* before the first NAL unit of the coded picture */
+    SEI_POSITION_SUFFIX   /* after the last VCL NAL unit (H.265, H.266) */
+} GstLvSeiPosition;
+
+/* SEI message carrying the secondary data */
 typedef enum {
-    CODEC_H264,
-    CODEC_H265, 
-    CODEC_H266,
-    CODEC_EVC,
-    CODEC_UNKNOWN
-} GstLvCompositorCodec;
-
-GstBuffer *merge_lcevc_data_h264(GstBuffer *main_buffer, GstBuffer *secondary_buffer);
-GstBuffer *merge_lcevc_data_h265(GstBuffer *main_buffer, GstBuffer *secondary_buffer);
-GstBuffer *merge_lcevc_data_h266(GstBuffer *main_buffer, GstBuffer *secondary_buffer);
-GstBuffer *merge_lcevc_data_evc(GstBuffer *main_buffer, GstBuffer *secondary_buffer);
-GstBuffer *merge_lcevc_data_generic(GstBuffer *main_buffer, GstBuffer *secondary_buffer);
+    SEI_TYPE_UNREGISTERED,   /* user_data_unregistered: payloadType 5 + UUID */
+    SEI_TYPE_REGISTERED_T35  /* user_data_registered_itu_t_t35: payloadType 4 + T.35 header */
+} GstLvSeiType;
+
+/* payloadType and user data header (UUID or T.35 codes) of a SEI message */
+typedef struct {
+    guint8 payload_type;
+    guint8 data[SEI_USER_DATA_HEADER_MAX_SIZE];
+    guint size;
+} GstLvSeiUserDataHeader;
+
+#define GST_TYPE_LV_SEI_POSITION (gst_lv_sei_position_get_type())
+#define GST_TYPE_LV_SEI_TYPE (gst_lv_sei_type_get_type())
+
+GType gst_lv_sei_position_get_type(void);
+GType gst_lv_sei_type_get_type(void);
+
+/*
+ * Per-stream SEI writer, set up when the main stream is negotiated.
+ * The prefix (start code or NAL unit length, NAL header, payloadType) and the user data header
+ * (UUID or T.35 codes) are prebuilt for the codec and SEI type, and SEI
+ * buffers come from size-class pools where it is already written. When
+ * the payload needs few emulation prevention bytes the secondary memory is
+ * referenced between the SEI header and the shared trailer memory, split
+ * around a shared 0x03 memory at each emulation prevention byte.
+ * With max_nal_size set, payloads are cut into fragments (format above) so
+ * that no SEI NAL unit, start code included, is larger.
+ * nal_length_size is 0 for Annex B, else the size of the big endian length
+ * field in front of each NAL unit (avc, hvc1, vvc1...), from codec_data.
+ */
+typedef struct {
+    const GstLvCodecDesc *desc;
+    GstLvSeiPosition position;
+    GstLvSeiType type;
+    guint nal_length_size;
+    guint8 user_data_header[SEI_USER_DATA_HEADER_MAX_SIZE];
+    guint user_data_header_size;
+    guint8 prefix[SEI_PREFIX_MAX_SIZE];
+    guint prefix_size;
+    GstBufferPool *pools[SEI_POOL_N_CLASSES];
+    GstMemory *trailer;
+    GstMemory *epb;
+    gsize max_nal_size;
+    guint16 fragment_sequence;
+    GstAllocator *allocator;
+    GstAllocationParams allocation_params;
+} GstLvSeiWriter;
+
+gboolean sei_uuid_resolve(const gchar *setting, guint8 *uuid);
+void sei_user_data_header_init(GstLvSeiUserDataHeader *header, GstLvSeiType type,
+                               const guint8 *uuid);
+
+gboolean sei_writer_init(GstLvSeiWriter *writer, const GstLvCodecDesc *desc, GstLvSeiType type,
+                         const guint8 *uuid, GstLvSeiPosition position, guint nal_length_size);
+void sei_writer_clear(GstLvSeiWriter *writer);
+void sei_writer_set_max_nal_size(GstLvSeiWriter *writer, gsize max_nal_size);
+void sei_writer_set_allocator(GstLvSeiWriter *writer, GstAllocator *allocator,
+                              const GstAllocationParams *params);
+
+/* SEI NAL unit alone, for streams forwarded NAL by NAL */
+GstBuffer *sei_writer_create_sei(GstLvSeiWriter *writer, GstBuffer *secondary_buffer);
+
+/* One SEI NAL unit with one sei_message() per payload */
+GstBuffer *sei_writer_create_sei_list(GstLvSeiWriter *writer, GstBuffer **payloads,
+                                      guint n_payloads);
+
+/* Same with a payloadType and user data header per message (NULL: the writer's) */
+GstBuffer *sei_writer_create_sei_messages(GstLvSeiWriter *writer, GstBuffer **payloads,
+                                          const GstLvSeiUserDataHeader **headers,
+                                          guint n_payloads);
+
+/* SEI NAL units carrying the payloads within max_nal_size, returns how many */
+guint sei_writer_create_sei_units(GstLvSeiWriter *writer, GstBuffer **payloads, guint n_payloads,
+                                  GstBuffer **units, guint max_units);
+
+/* Merges one secondary buffer into one main access unit */
+typedef GstBuffer *(*GstLvSeiMergeFunc)(GstLvSeiWriter *writer, GstBuffer *main_buffer,
+                                        GstBuffer *secondary_buffer);
+
+GstBuffer *merge_lcevc_data(GstLvSeiWriter *writer, GstBuffer *main_buffer,
+                            GstBuffer *secondary_buffer);
+
+/* Same for an access unit given as a list of NAL aligned buffers */
+GstBufferList *merge_lcevc_data_list(GstLvSeiWriter *writer, GstBufferList *main_au,
+                                     GstBuffer *secondary_buffer);
+
+/* Writes the SEI into the headroom of the main access unit, FALSE if it cannot */
+gboolean merge_lcevc_sei_in_place(GstLvSeiWriter *writer, GstBuffer *main_buffer,
+                                  GstBuffer *secondary_buffer);
+
+/* Inserts already built SEI NAL units (consumed) */
+GstBuffer *merge_lcevc_sei(GstLvSeiWriter *writer, GstBuffer *main_buffer, GstBuffer *sei_buffer);
+GstBufferList *merge_lcevc_sei_list(GstLvSeiWriter *writer, GstBufferList *main_au,
+                                    GstBuffer **sei_units, guint n_units);
 
 #endif /* __SEI_MERGE_H__ */
@@ -0,0 +1,408 @@
+#include <string.h>
+
+#include "sei_parse.h"
+
+/* Bytes read at once when the data is not needed as a whole */
+#define SEI_PARSE_CHUNK_SIZE 16
+
+/*
+ * Records a start code found by sei_index_nal_units(). Start codes inside
+ * the NAL unit header of the previous one are skipped like
+ * nal_index_build() does. The header offsets go to units, the one after
+ * the last unit to next.
+ * @return FALSE once max_units + 1 start codes are known, scanning can stop
+ */
+static gboolean
+index_add_start_code(GstLvNalUnit *units, guint max_units, guint header_size, guint *n_found,
+                     gsize *next, gsize start_code)
+{
+    if (*n_found > 0 && start_code < units[*n_found - 1].header_offset + header_size) {
+        return TRUE;
+    }
+    if (*n_found == max_units) {
+        *next = start_code;
+        return FALSE;
+    }
+    units[(*n_found)++].header_offset = start_code + 3;
+
+    return TRUE;
+}
+
+/* Start code position moved back over a zero_byte, see nal_index_build() */
+static gsize
+index_unit_start(GstBuffer *buffer, gsize start_code, gsize floor)
+{
+    guint8 byte;
+
+    if (start_code > floor && gst_buffer_extract(buffer, start_code - 1, &byte, 1) == 1 &&
+        byte == 0x00) {
+        return start_code - 1;
+    }
+
+    return start_code;
+}
+
+/**
+ * Buffer counterpart of nal_index_build(): the memories are scanned one by
+ * one so a multi-memory buffer is never merged into a copy. A start code
+ * cut by a memory boundary is found in a window holding the last bytes of
+ * the previous memories and the first ones of the next memory.
+ * @param buffer Annex B bitstream
+ * @param desc Codec of the bitstream
+ * @param units Output
+ * @param max_units Size of units
+ * @return Number of NAL units found
+ */
+guint
+sei_index_nal_units(GstBuffer *buffer, const GstLvCodecDesc *desc, GstLvNalUnit *units,
+                    guint max_units)
+{
+    guint header_size = desc->nal_header_size;
+    guint n_memory = gst_buffer_n_memory(buffer);
+    gsize size = gst_buffer_get_size(buffer);
+    gsize next = size;
+    gboolean scanning = max_units > 0;
+    guint8 window[4];
+    gsize carry = 0;
+    gsize base = 0;
+    guint n_found = 0;
+    guint n_units;
+    guint i;
+
+    for (i = 0; i < n_memory && scanning; i++) {
+        GstMemory *memory = gst_buffer_peek_memory(buffer, i);
+        GstMapInfo map;
+        gsize window_size;
+        gsize sc;
+
+        if (!gst_memory_map(memory, &map, GST_MAP_READ)) {
+            GST_WARNING("Failed to map memory %u, NAL units after it are not indexed", i);
+            size = base;
+            break;
+        }
+
+        // 00 00 01 starting in the previous memories and ending in this one
+        window_size = carry + MIN(map.size, 2);
+        memcpy(window + carry, map.data, window_size - carry);
+        for (sc = nal_find_start_code(window, window_size, 0); sc < carry && scanning;
+             sc = nal_find_start_code(window, window_size, sc + 1)) {
+            if (sc + 3 > carry) {
+                scanning = index_add_start_code(units, max_units, header_size, &n_found, &next,
+                                                base - carry + sc);
+            }
+        }
+
+        // Start codes can't overlap, the rest of the memory is scanned from 0
+        for (sc = nal_find_start_code(map.data, map.size, 0); sc < map.size && scanning;
+             sc = nal_find_start_code(map.data, map.size, sc + 1)) {
+            scanning = index_add_start_code(units, max_units, header_size, &n_found, &next,
+                                            base + sc);
+        }
+
+        // Last two bytes of the stream so far, for the next boundary
+        if (map.size >= 2) {
+            memcpy(window, map.data + map.size - 2, 2);
+            carry = 2;
+        } else if (map.size == 1) {
+            if (carry == 2) {
+                window[0] = window[1];
+            }
+            window[MIN(carry, 1)] = map.data[0];
+            carry = MIN(carry + 1, 2);
+        }
+        base += map.size;
+        gst_memory_unmap(memory, &map);
+    }
+
+    if (next > size) {
+        next = size;
+    }
+
+    for (n_units = 0; n_units < n_found; n_units++) {
+        GstLvNalUnit *unit = &units[n_units];
+        guint8 header[4];
+        gsize end;
+
+        if (unit->header_offset + header_size > size) {
+            break;
+        }
+        gst_buffer_extract(buffer, unit->header_offset, header, header_size);
+        unit->type = desc->nal_type(header);
+        unit->offset = index_unit_start(buffer, unit->header_offset - 3,
+                                        n_units ? units[n_units - 1].header_offset : 0);
+
+        end = n_units + 1 < n_found ? units[n_units + 1].header_offset - 3 : next;
+        unit->size = ((end < size) ? index_unit_start(buffer, end, unit->header_offset) : size) -
+                     unit->offset;
+    }
+
+    return n_units;
+}
+
+/* RBSP position of the next EPB boundary after pos, as an index in rbsp->epb */
+static guint
+rbsp_epb_index(const GstLvSeiRbsp *rbsp, gsize pos)
+{
+    guint low = 0;
+    guint high = rbsp->n_epb;
+
+    while (low < high) {
+        guint mid = (low + high) / 2;
+
+        if (rbsp->epb[mid] <= pos) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    return low;
+}
+
+static void
+rbsp_add_epb(GstLvSeiRbsp *rbsp, gsize escaped_pos)
+{
+    if (rbsp->n_epb == rbsp->max_epb) {
+        rbsp->max_epb *= 2;
+        if (rbsp->epb == rbsp->epb_static) {
+            rbsp->epb = g_new(gsize, rbsp->max_epb);
+            memcpy(rbsp->epb, rbsp->epb_static, sizeof(rbsp->epb_static));
+        } else {
+            rbsp->epb = g_renew(gsize, rbsp->epb, rbsp->max_epb);
+        }
+    }
+    rbsp->epb[rbsp->n_epb] = escaped_pos - rbsp->n_epb;
+    rbsp->n_epb++;
+}
+
+/**
+ * Prepares reading a SEI RBSP from its NAL unit payload. The trailing zero
+ * bytes are dropped and the emulation prevention bytes located, memory by
+ * memory; nothing is copied.
+ * @param rbsp View to initialize, sei_rbsp_clear() it after use
+ * @param buffer Buffer holding the NAL unit, must outlive the view
+ * @param offset First byte after the NAL unit header
+ * @param size Bytes up to the end of the NAL unit
+ */
+void
+sei_rbsp_init(GstLvSeiRbsp *rbsp, GstBuffer *buffer, gsize offset, gsize size)
+{
+    guint8 chunk[SEI_PARSE_CHUNK_SIZE];
+    guint zeros = 0;
+    gsize pos = 0;
+    gsize skip;
+    guint index;
+    guint length;
+    guint i;
+
+    rbsp->buffer = buffer;
+    rbsp->offset = offset;
+    rbsp->epb = rbsp->epb_static;
+    rbsp->n_epb = 0;
+    rbsp->max_epb = SEI_RBSP_STATIC_EPB;
+
+    // Trailing zero bytes, up to the next start code
+    while (size > 0) {
+        gsize n = MIN(size, sizeof(chunk));
+
+        gst_buffer_extract(buffer, offset + size - n, chunk, n);
+        while (n > 0 && chunk[n - 1] == 0x00) {
+            n--;
+            size--;
+        }
+        if (n > 0) {
+            break;
+        }
+    }
+
+    if (size == 0 || !gst_buffer_find_memory(buffer, offset, size, &index, &length, &skip)) {
+        rbsp->size = 0;
+        return;
+    }
+
+    for (i = index; i < index + length && pos < size; i++) {
+        GstMemory *memory = gst_buffer_peek_memory(buffer, i);
+        const guint8 *data;
+        gsize data_size;
+        gsize epb;
+        GstMapInfo map;
+
+        if (!gst_memory_map(memory, &map, GST_MAP_READ)) {
+            GST_WARNING("Failed to map memory %u, SEI RBSP cut at %" G_GSIZE_FORMAT, i, pos);
+            size = pos;
+            break;
+        }
+        data = map.data + skip;
+        data_size = MIN(map.size - skip, size - pos);
+        skip = 0;
+
+        // The first two bytes follow the zeros at the end of the previous memory
+        for (epb = 0; epb < MIN(data_size, 2); epb++) {
+            if (data[epb] == 0x03 && zeros >= 2) {
+                rbsp_add_epb(rbsp, pos + epb);
+                zeros = 0;
+            } else {
+                zeros = data[epb] == 0x00 ? zeros + 1 : 0;
+            }
+        }
+        for (epb = nal_epb_next(data, data_size, 2); epb < data_size;
+             epb = nal_epb_next(data, data_size, epb + 1)) {
+            rbsp_add_epb(rbsp, pos + epb);
+        }
+        if (data_size >= 2) {
+            zeros = data[data_size - 1] != 0x00 ? 0 : data[data_size - 2] != 0x00 ? 1 : 2;
+        }
+
+        pos += data_size;
+        gst_memory_unmap(memory, &map);
+    }
+
+    rbsp->size = size - rbsp->n_epb;
+}
+
+void
+sei_rbsp_clear(GstLvSeiRbsp *rbsp)
+{
+    if (rbsp->epb != rbsp->epb_static) {
+        g_free(rbsp->epb);
+        rbsp->epb = rbsp->epb_static;
+    }
+    rbsp->n_epb = 0;
+}
+
+/**
+ * Copies RBSP bytes, emulation prevention bytes skipped
+ * @param rbsp View from sei_rbsp_init()
+ * @param pos First RBSP byte
+ * @param dest Output
+ * @param size Bytes wanted
+ * @return Bytes copied, less than size at the end of the RBSP
+ */
+gsize
+sei_rbsp_extract(const GstLvSeiRbsp *rbsp, gsize pos, guint8 *dest, gsize size)
+{
+    guint k = rbsp_epb_index(rbsp, pos);
+    gsize copied = 0;
+
+    if (pos >= rbsp->size) {
+        return 0;
+    }
+    size = MIN(size, rbsp->size - pos);
+
+    while (copied < size) {
+        gsize end = k < rbsp->n_epb ? MIN(pos + size - copied, rbsp->epb[k]) : pos + size - copied;
+
+        copied += gst_buffer_extract(rbsp->buffer, rbsp->offset + pos + k, dest + copied, end - pos);
+        pos = end;
+        k++;
+    }
+
+    return copied;
+}
+
+/**
+ * Shares RBSP bytes: one sub-buffer of the input per run between emulation
+ * prevention bytes
+ * @param rbsp View from sei_rbsp_init()
+ * @param pos First RBSP byte
+ * @param size Number of bytes, pos + size must not go past the RBSP
+ * @return New buffer sharing the input memories
+ */
+GstBuffer *
+sei_rbsp_share(const GstLvSeiRbsp *rbsp, gsize pos, gsize size)
+{
+    guint k = rbsp_epb_index(rbsp, pos);
+    GstBuffer *out;
+
+    g_return_val_if_fail(pos + size <= rbsp->size, NULL);
+
+    out = gst_buffer_new();
+    while (size > 0) {
+        gsize end = k < rbsp->n_epb ? MIN(pos + size, rbsp->epb[k]) : pos + size;
+
+        gst_buffer_copy_into(out, rbsp->buffer, GST_BUFFER_COPY_MEMORY, rbsp->offset + pos + k,
+                             end - pos);
+        size -= end - pos;
+        pos = end;
+        k++;
+    }
+
+    return out;
+}
+
+/* ff_byte coded payloadType / payloadSize */
+static gboolean
+read_ff_coded(const GstLvSeiRbsp *rbsp, gsize *pos, gsize *value)
+{
+    guint8 chunk[SEI_PARSE_CHUNK_SIZE];
+    gsize n;
+    gsize i;
+
+    *value = 0;
+    while ((n = sei_rbsp_extract(rbsp, *pos, chunk, sizeof(chunk))) > 0) {
+        for (i = 0; i < n; i++) {
+            (*pos)++;
+            if (chunk[i] != 0xFF) {
+                *value += chunk[i];
+                return TRUE;
+            }
+            *value += 255;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * Reads the next SEI message, the reverse of what sei_merge.c writes
+ * @param rbsp View from sei_rbsp_init(), the last byte is the
+ *             rbsp_trailing_bits
+ * @param cursor In/out: position of the next sei_message(), 0 to start
+ * @param message Output
+ * @return FALSE when there is no more message or the RBSP is truncated
+ */
+gboolean
+sei_rbsp_next_message(const GstLvSeiRbsp *rbsp, gsize *cursor, GstLvSeiMessage *message)
+{
+    gsize size = rbsp->size;
+    gsize pos = *cursor;
+    gsize type;
+
+    // more_rbsp_data(): anything before the trailing bits
+    if (size == 0 || pos + 1 >= size) {
+        return FALSE;
+    }
+
+    if (!read_ff_coded(rbsp, &pos, &type) ||
+        !read_ff_coded(rbsp, &pos, &message->size) ||
+        pos + message->size > size - 1) {
+        return FALSE;
+    }
+
+    message->type = (guint)type;
+    message->offset = pos;
+    *cursor = pos + message->size;
+
+    return TRUE;
+}
+
+/**
+ * Checks whether a SEI message carries enhancement data: the payloadType
+ * and the user data header (UUID or T.35 codes) of the stream, as written
+ * by sei_user_data_header_init(). Any other message, a T.35 one with the
+ * LCEVC codes included when the stream uses a UUID, is not ours.
+ * @param rbsp View the message was read from
+ * @param message Message returned by sei_rbsp_next_message()
+ * @param header payloadType and user data header to match
+ * @return TRUE if the message matches, its user data follows header->size bytes
+ */
+gboolean
+sei_message_is_user_data(const GstLvSeiRbsp *rbsp, const GstLvSeiMessage *message,
+                         const GstLvSeiUserDataHeader *header)
+{
+    guint8 bytes[SEI_USER_DATA_HEADER_MAX_SIZE];
+
+    return message->type == header->payload_type && message->size >= header->size &&
+           sei_rbsp_extract(rbsp, message->offset, bytes, header->size) == header->size &&
+           memcmp(bytes, header->data, header->size) == 0;
+}
@@ -0,0 +1,47 @@
+#ifndef __SEI_PARSE_H__
+#define __SEI_PARSE_H__
+
+#include <gst/gst.h>
+
+#include "nal_utils.h"
+#include "sei_merge.h"
+
+/* Emulation prevention bytes tracked without allocation */
+#define SEI_RBSP_STATIC_EPB 16
+
+/* One sei_message() of a SEI RBSP */
+typedef struct {
+    guint type;     /* payloadType */
+    gsize offset;   /* first payload byte, from the start of the RBSP */
+    gsize size;     /* payloadSize */
+} GstLvSeiMessage;
+
+/*
+ * SEI RBSP read in place in the input buffer: memories are mapped one at
+ * a time and the emulation prevention bytes are skipped rather than
+ * removed, so payloads are shared spans of the input memories.
+ * Positions are RBSP positions, emulation prevention bytes excluded.
+ */
+typedef struct {
+    GstBuffer *buffer;
+    gsize offset;   /* first escaped byte in buffer, after the NAL unit header */
+    gsize size;     /* RBSP size up to and including the rbsp_trailing_bits */
+    gsize *epb;     /* RBSP position following each emulation prevention byte */
+    guint n_epb;
+    guint max_epb;
+    gsize epb_static[SEI_RBSP_STATIC_EPB];
+} GstLvSeiRbsp;
+
+guint sei_index_nal_units(GstBuffer *buffer, const GstLvCodecDesc *desc, GstLvNalUnit *units,
+                          guint max_units);
+
+void sei_rbsp_init(GstLvSeiRbsp *rbsp, GstBuffer *buffer, gsize offset, gsize size);
+void sei_rbsp_clear(GstLvSeiRbsp *rbsp);
+gsize sei_rbsp_extract(const GstLvSeiRbsp *rbsp, gsize pos, guint8 *dest, gsize size);
+GstBuffer *sei_rbsp_share(const GstLvSeiRbsp *rbsp, gsize pos, gsize size);
+
+gboolean sei_rbsp_next_message(const GstLvSeiRbsp *rbsp, gsize *cursor, GstLvSeiMessage *message);
+gboolean sei_message_is_user_data(const GstLvSeiRbsp *rbsp, const GstLvSeiMessage *message,
+                                  const GstLvSeiUserDataHeader *header);
+
+#endif /* __SEI_PARSE_H__ */
@@ -0,0 +1,154 @@
+#include "sei_payload.h"
+#include "codec_desc.h"
+#include "compact_payload.h"
+#include "nal_utils.h"
+#include "sei_merge.h"
+
+/**
+ * Selects the payload preparation of a secondary pad
+ * @param caps Negotiated caps of the pad
+ * @return Format, SEI_PAYLOAD_RAW for anything not recognized
+ */
+GstLvSeiPayloadFormat
+sei_payload_format_from_caps(GstCaps *caps)
+{
+    const gchar *name;
+
+    if (!caps || gst_caps_is_empty(caps) || gst_caps_is_any(caps)) {
+        return SEI_PAYLOAD_RAW;
+    }
+
+    name = gst_structure_get_name(gst_caps_get_structure(caps, 0));
+    if (g_strcmp0(name, "video/x-evc") == 0) {
+        return SEI_PAYLOAD_EVC;
+    }
+    if (g_strcmp0(name, "video/x-lcevc") == 0) {
+        return SEI_PAYLOAD_LCEVC;
+    }
+    if (g_strcmp0(name, "meta/x-klv") == 0) {
+        return SEI_PAYLOAD_KLV;
+    }
+
+    return SEI_PAYLOAD_RAW;
+}
+
+/* Name of a payload format, for logs */
+const gchar *
+sei_payload_format_name(GstLvSeiPayloadFormat format)
+{
+    switch (format) {
+        case SEI_PAYLOAD_KLV:
+            return "KLV";
+        case SEI_PAYLOAD_EVC:
+            return "EVC";
+        case SEI_PAYLOAD_LCEVC:
+            return "LCEVC";
+        default:
+            return "raw";
+    }
+}
+
+/*
+ * Annex B payloads start with a start code; anything else (length-prefixed
+ * EVC, truncated data) is left alone
+ */
+static gboolean
+starts_with_start_code(const guint8 *data, gsize size)
+{
+    gsize sc = nal_find_start_code(data, MIN(size, 4), 0);
+
+    return sc == 0 || (sc == 1 && data[0] == 0x00);
+}
+
+/*
+ * A payload embedded unchanged whose first byte reads as a fragment,
+ * compact or escape marker gets a SEI_RAW_MARKER in front, a shared
+ * one byte memory; its own memory is left alone
+ */
+static GstBuffer *
+escape_payload(GstBuffer *buffer)
+{
+    static const guint8 marker[1] = { SEI_RAW_MARKER };
+    guint8 first;
+
+    if (gst_buffer_extract(buffer, 0, &first, 1) != 1 || first < SEI_RAW_MARKER) {
+        return buffer;
+    }
+
+    buffer = gst_buffer_make_writable(buffer);
+    gst_buffer_prepend_memory(buffer, gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY,
+                                                             (gpointer)marker, 1, 0, 1,
+                                                             NULL, NULL));
+
+    return buffer;
+}
+
+/**
+ * Prepares a secondary buffer for embedding. Elementary streams are
+ * rewritten once with 3 bytes start codes (one byte less per NAL unit
+ * that had 4) and, for EVC, without AUD and filler data NAL units. In
+ * compact mode the NAL units get leb128 lengths instead of start codes.
+ * The buffer is returned untouched when nothing is saved, so its memory
+ * can still be shared with the SEI, escaped if its first byte is 0xFD
+ * to 0xFF (sei_merge.h).
+ * @param format Format of the secondary pad
+ * @param compact Re-frame elementary streams as compact payloads
+ * @param buffer Secondary buffer, consumed
+ * @return Payload, with the timestamps and flags of buffer
+ */
+GstBuffer *
+sei_payload_prepare(GstLvSeiPayloadFormat format, gboolean compact, GstBuffer *buffer)
+{
+    const GstLvCodecDesc *desc = NULL;
+    GstMapInfo map;
+    GstMapInfo out_map;
+    GstBuffer *out;
+    gsize size;
+
+    if (format != SEI_PAYLOAD_EVC && format != SEI_PAYLOAD_LCEVC) {
+        return escape_payload(buffer);
+    }
+    if (format == SEI_PAYLOAD_EVC) {
+        desc = codec_desc_lookup(CODEC_EVC);
+    }
+
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        return escape_payload(buffer);
+    }
+    if (!starts_with_start_code(map.data, map.size)) {
+        gst_buffer_unmap(buffer, &map);
+        return escape_payload(buffer);
+    }
+
+    out = gst_buffer_new_allocate(NULL, compact ? COMPACT_PAYLOAD_MAX_SIZE(map.size) : map.size,
+                                  NULL);
+    if (!out || !gst_buffer_map(out, &out_map, GST_MAP_WRITE)) {
+        if (out) {
+            gst_buffer_unref(out);
+        }
+        gst_buffer_unmap(buffer, &map);
+        return escape_payload(buffer);
+    }
+    if (compact) {
+        size = compact_payload_encode(map.data, map.size, desc, out_map.data);
+    } else {
+        size = nal_compact_annexb(map.data, map.size, desc, out_map.data);
+    }
+    gst_buffer_unmap(out, &out_map);
+
+    if (size >= map.size) {
+        gst_buffer_unmap(buffer, &map);
+        gst_buffer_unref(out);
+        return escape_payload(buffer);
+    }
+
+    GST_LOG("%s payload %s from %" G_GSIZE_FORMAT " to %" G_GSIZE_FORMAT " bytes",
+            sei_payload_format_name(format), compact ? "re-framed" : "compacted", map.size, size);
+    gst_buffer_unmap(buffer, &map);
+
+    gst_buffer_set_size(out, size);
+    gst_buffer_copy_into(out, buffer, GST_BUFFER_COPY_METADATA, 0, -1);
+    gst_buffer_unref(buffer);
+
+    return out;
+}
@@ -0,0 +1,26 @@
+#ifndef __SEI_PAYLOAD_H__
+#define __SEI_PAYLOAD_H__
+
+#include <gst/gst.h>
+
+/*
+ * Formats accepted on the secondary pads, picked from their caps. Each one
+ * has its own preparation before the data goes into a SEI: elementary
+ * streams lose the bytes a decoder does not need, metadata and opaque data
+ * are embedded as they are.
+ */
+typedef enum {
+    SEI_PAYLOAD_RAW,    /* application/octet-stream, as is */
+    SEI_PAYLOAD_KLV,    /* meta/x-klv (SMPTE ST 336), self-delimiting, as is */
+    SEI_PAYLOAD_EVC,    /* video/x-evc byte-stream: 3 bytes start codes, no AUD or filler data */
+    SEI_PAYLOAD_LCEVC   /* video/x-lcevc byte-stream: 3 bytes start codes */
+} GstLvSeiPayloadFormat;
+
+GstLvSeiPayloadFormat sei_payload_format_from_caps(GstCaps *caps);
+const gchar *sei_payload_format_name(GstLvSeiPayloadFormat format);
+
+/* Secondary buffer (consumed) turned into SEI user data, compact: format of
+ * compact_payload.h for the elementary streams */
+GstBuffer *sei_payload_prepare(GstLvSeiPayloadFormat format, gboolean compact, GstBuffer *buffer);
+
+#endif /* __SEI_PAYLOAD_H__ */
@@ -0,0 +1,125 @@
+#include <string.h>
+
+#include "sei_pool.h"
+
+GST_DEBUG_CATEGORY_STATIC(gst_lv_sei_pool_debug);
+#define GST_CAT_DEFAULT gst_lv_sei_pool_debug
+
+G_DEFINE_TYPE_WITH_CODE(GstLvSeiPool, gst_lv_sei_pool, GST_TYPE_BUFFER_POOL,
+    GST_DEBUG_CATEGORY_INIT(gst_lv_sei_pool_debug, "lvseipool", 0, "LV SEI buffer pool"))
+
+static gboolean
+gst_lv_sei_pool_set_config(GstBufferPool *pool, GstStructure *config)
+{
+    GstLvSeiPool *self = GST_LV_SEI_POOL(pool);
+
+    if (!gst_buffer_pool_config_get_params(config, NULL, &self->size, NULL, NULL) ||
+        self->size < self->prefix_size) {
+        GST_ERROR_OBJECT(self, "Invalid SEI pool configuration");
+        return FALSE;
+    }
+
+    return GST_BUFFER_POOL_CLASS(gst_lv_sei_pool_parent_class)->set_config(pool, config);
+}
+
+/*
+ * Allocates the buffer once and writes the prefix into it; recycling keeps
+ * the memory content. Only the start code and NAL unit header stay as
+ * written: the writer rewrites the last prefix byte (payloadType) for every
+ * SEI, and the leading length field of a length-prefixed stream, written
+ * as zeros here, once the NAL unit size is known.
+ */
+static GstFlowReturn
+gst_lv_sei_pool_alloc_buffer(GstBufferPool *pool, GstBuffer **buffer,
+                             GstBufferPoolAcquireParams *params)
+{
+    GstLvSeiPool *self = GST_LV_SEI_POOL(pool);
+    GstFlowReturn ret;
+
+    ret = GST_BUFFER_POOL_CLASS(gst_lv_sei_pool_parent_class)->alloc_buffer(pool, buffer, params);
+    if (ret != GST_FLOW_OK) {
+        return ret;
+    }
+
+    if (gst_buffer_n_memory(*buffer) != 1 ||
+        gst_buffer_fill(*buffer, 0, self->prefix, self->prefix_size) != self->prefix_size) {
+        GST_ERROR_OBJECT(self, "Unexpected memory layout for SEI buffer");
+        gst_buffer_unref(*buffer);
+        *buffer = NULL;
+        return GST_FLOW_ERROR;
+    }
+
+    GST_MINI_OBJECT_FLAG_SET(gst_buffer_peek_memory(*buffer, 0), GST_LV_SEI_POOL_MEMORY_FLAG);
+
+    return GST_FLOW_OK;
+}
+
+/*
+ * Drops the memories borrowed from the main access unit. If the SEI memory
+ * itself was replaced downstream the buffer no longer has the pool size and
+ * the default release discards it.
+ */
+static void
+gst_lv_sei_pool_reset_buffer(GstBufferPool *pool, GstBuffer *buffer)
+{
+    GstLvSeiPool *self = GST_LV_SEI_POOL(pool);
+    guint i = gst_buffer_n_memory(buffer);
+
+    while (i-- > 0) {
+        GstMemory *memory = gst_buffer_peek_memory(buffer, i);
+
+        if (!GST_MINI_OBJECT_FLAG_IS_SET(memory, GST_LV_SEI_POOL_MEMORY_FLAG)) {
+            gst_buffer_remove_memory(buffer, i);
+        }
+    }
+    GST_BUFFER_FLAG_UNSET(buffer, GST_BUFFER_FLAG_TAG_MEMORY);
+
+    /* The SEI memory was trimmed to the SEI size, give it its full size back */
+    if (gst_buffer_get_max_size(buffer) >= self->size) {
+        gsize offset;
+
+        gst_buffer_get_sizes(buffer, &offset, NULL);
+        gst_buffer_resize(buffer, -(gssize)offset, self->size);
+    }
+
+    GST_BUFFER_POOL_CLASS(gst_lv_sei_pool_parent_class)->reset_buffer(pool, buffer);
+}
+
+static void
+gst_lv_sei_pool_class_init(GstLvSeiPoolClass *klass)
+{
+    GstBufferPoolClass *pool_class = GST_BUFFER_POOL_CLASS(klass);
+
+    pool_class->set_config = gst_lv_sei_pool_set_config;
+    pool_class->alloc_buffer = gst_lv_sei_pool_alloc_buffer;
+    pool_class->reset_buffer = gst_lv_sei_pool_reset_buffer;
+}
+
+static void
+gst_lv_sei_pool_init(GstLvSeiPool *self)
+{
+    self->prefix_size = 0;
+    self->size = 0;
+}
+
+/**
+ * Creates a SEI pool, configure it with gst_buffer_pool_config_set_params()
+ * @param prefix Bytes prewritten at the start of every buffer
+ * @param prefix_size Size of prefix, at most GST_LV_SEI_POOL_PREFIX_MAX
+ * @return New pool
+ */
+GstBufferPool *
+gst_lv_sei_pool_new(const guint8 *prefix, guint prefix_size)
+{
+    GstLvSeiPool *self;
+
+    g_return_val_if_fail(prefix_size <= GST_LV_SEI_POOL_PREFIX_MAX, NULL);
+
+    self = g_object_new(GST_TYPE_LV_SEI_POOL, NULL);
+    gst_object_ref_sink(self);
+
+    memcpy(self->prefix, prefix, prefix_size);
+    self->prefix_size = prefix_size;
+
+    return GST_BUFFER_POOL(self);
+}
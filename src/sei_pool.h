@@ -0,0 +1,48 @@
+#ifndef __SEI_POOL_H__
+#define __SEI_POOL_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_LV_SEI_POOL (gst_lv_sei_pool_get_type())
+#define GST_LV_SEI_POOL(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_LV_SEI_POOL, GstLvSeiPool))
+#define GST_IS_LV_SEI_POOL(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj), GST_TYPE_LV_SEI_POOL))
+
+/* Largest prefix a pool can prewrite (start code + NAL header + payloadType) */
+#define GST_LV_SEI_POOL_PREFIX_MAX 16
+
+/* Marks the SEI memory owned by a pooled buffer */
+#define GST_LV_SEI_POOL_MEMORY_FLAG (GST_MEMORY_FLAG_LAST << 0)
+
+typedef struct _GstLvSeiPool GstLvSeiPool;
+typedef struct _GstLvSeiPoolClass GstLvSeiPoolClass;
+
+/*
+ * Pool of SEI buffers whose memory already holds the codec specific prefix.
+ * The start code and NAL unit header are written once; the payloadType
+ * (last prefix byte) and, on length-prefixed streams, the NAL unit length
+ * (first prefix bytes) are rewritten for every SEI. A pooled buffer is
+ * used as the output buffer itself: the main access unit memories are
+ * inserted around the SEI memory, and they are stripped again when the
+ * buffer comes back to the pool.
+ */
+struct _GstLvSeiPool {
+    GstBufferPool parent;
+
+    guint8 prefix[GST_LV_SEI_POOL_PREFIX_MAX];
+    guint prefix_size;
+    guint size;
+};
+
+struct _GstLvSeiPoolClass {
+    GstBufferPoolClass parent_class;
+};
+
+GType gst_lv_sei_pool_get_type(void);
+
+GstBufferPool *gst_lv_sei_pool_new(const guint8 *prefix, guint prefix_size);
+
+G_END_DECLS
+
+#endif /* __SEI_POOL_H__ */
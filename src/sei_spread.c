@@ -0,0 +1,151 @@
+#include <string.h>
+
+#include "sei_spread.h"
+
+/**
+ * Sets up a spreader, any previous state must have been cleared
+ * @param spreader Spreader
+ * @param budget Payload bytes per access unit, 0 disables spreading
+ * @param au_count Access units a payload may be spread over
+ */
+void
+sei_spreader_init(GstLvSeiSpreader *spreader, gsize budget, guint au_count)
+{
+    spreader->budget = budget;
+    spreader->au_count = MAX(au_count, 1);
+    spreader->n_pending = 0;
+    spreader->sequence_id = 0;
+    spreader->au_index = 0;
+}
+
+/**
+ * Drops the fragments not sent yet
+ * @param spreader Spreader
+ */
+void
+sei_spreader_clear(GstLvSeiSpreader *spreader)
+{
+    guint i;
+
+    for (i = 0; i < spreader->n_pending; i++) {
+        gst_buffer_unref(spreader->pending[i].data);
+    }
+    spreader->n_pending = 0;
+    spreader->au_index = 0;
+}
+
+/**
+ * Queues the payload paired with the current access unit. Fragment i of n
+ * is due (i + 1) * au_count / n - 1 access units later, so the fragments of
+ * a large payload are spread evenly even when the budget is tight, and the
+ * last one is due au_count - 1 access units later.
+ * @param spreader Spreader
+ * @param payload Secondary buffer, consumed; fragments share its memory
+ * @return FALSE if the queue is full, the payload is dropped
+ */
+gboolean
+sei_spreader_push(GstLvSeiSpreader *spreader, GstBuffer *payload)
+{
+    gsize size = gst_buffer_get_size(payload);
+    gsize budget = MAX(spreader->budget, 1);
+    gsize chunk;
+    guint n = 1;
+    guint i;
+
+    if (size > budget) {
+        n = (guint)MIN((size + budget - 1) / budget, SEI_FRAGMENT_MAX_COUNT);
+    }
+    if (spreader->n_pending + n > SEI_SPREAD_MAX_PENDING) {
+        GST_WARNING("SEI spread queue full, dropping a %" G_GSIZE_FORMAT " bytes payload", size);
+        gst_buffer_unref(payload);
+        return FALSE;
+    }
+    chunk = (size + n - 1) / n;
+
+    for (i = 0; i < n; i++) {
+        GstLvSeiFragment *fragment = &spreader->pending[spreader->n_pending++];
+        guint8 header[SEI_FRAGMENT_HEADER_SIZE] = {
+            SEI_FRAGMENT_MARKER,
+            (guint8)(spreader->sequence_id >> 8),
+            (guint8)spreader->sequence_id,
+            (guint8)i,
+            (guint8)n,
+            0,  // au_delay, written when the fragment is sent
+        };
+        gsize offset = i * chunk;
+
+        fragment->data = gst_buffer_new_allocate(NULL, SEI_FRAGMENT_HEADER_SIZE, NULL);
+        gst_buffer_fill(fragment->data, 0, header, SEI_FRAGMENT_HEADER_SIZE);
+        if (offset < size) {
+            gst_buffer_copy_into(fragment->data, payload, GST_BUFFER_COPY_MEMORY, offset,
+                                 MIN(chunk, size - offset));
+        }
+        fragment->au_index = spreader->au_index;
+        fragment->deadline = spreader->au_index +
+                             MAX((guint64)(i + 1) * spreader->au_count / n, 1) - 1;
+        fragment->whole = n == 1;
+    }
+
+    GST_LOG("Payload %u: %" G_GSIZE_FORMAT " bytes in %u fragments", spreader->sequence_id, size, n);
+
+    spreader->sequence_id++;
+    gst_buffer_unref(payload);
+
+    return TRUE;
+}
+
+/**
+ * Takes the fragments to send in the current access unit and moves on to
+ * the next one. Must be called once per main access unit, paired or not.
+ * @param spreader Spreader
+ * @param fragments Output, SEI_SPREAD_MAX_PENDING entries, caller unrefs
+ * @param data_size Out: bytes of the returned fragments
+ * @return Number of fragments
+ */
+guint
+sei_spreader_next_au(GstLvSeiSpreader *spreader, GstBuffer **fragments, gsize *data_size)
+{
+    guint n_due = 0;
+    guint n_out = 0;
+    gsize used = 0;
+    guint i;
+
+    // Everything queued before the last due fragment goes out, order is kept
+    for (i = 0; i < spreader->n_pending; i++) {
+        if (spreader->pending[i].deadline <= spreader->au_index) {
+            n_due = i + 1;
+        }
+    }
+
+    for (i = 0; i < spreader->n_pending; i++) {
+        GstLvSeiFragment *fragment = &spreader->pending[i];
+        gsize size = gst_buffer_get_size(fragment->data);
+        guint8 au_delay;
+
+        if (i >= n_due && used + size > spreader->budget) {
+            break;
+        }
+
+        au_delay = (guint8)MIN(spreader->au_index - fragment->au_index, G_MAXUINT8);
+        if (fragment->whole && au_delay == 0) {
+            // Sent whole and on time, no fragment header needed
+            fragments[n_out] = gst_buffer_copy_region(fragment->data, GST_BUFFER_COPY_MEMORY,
+                                                      SEI_FRAGMENT_HEADER_SIZE, -1);
+            gst_buffer_unref(fragment->data);
+        } else {
+            gst_buffer_fill(fragment->data, SEI_FRAGMENT_HEADER_SIZE - 1, &au_delay, 1);
+            fragments[n_out] = fragment->data;
+        }
+        used += gst_buffer_get_size(fragments[n_out]);
+        n_out++;
+    }
+
+    spreader->n_pending -= n_out;
+    memmove(spreader->pending, spreader->pending + n_out,
+            spreader->n_pending * sizeof(GstLvSeiFragment));
+    spreader->au_index++;
+
+    *data_size = used;
+
+    return n_out;
+}
@@ -0,0 +1,40 @@
+#ifndef __SEI_SPREAD_H__
+#define __SEI_SPREAD_H__
+
+#include <gst/gst.h>
+
+#include "sei_merge.h"
+
+/* Fragments waiting for an access unit, a full queue refuses new payloads */
+#define SEI_SPREAD_MAX_PENDING 512
+
+typedef struct {
+    GstBuffer *data;     /* fragment header memory + shared payload region */
+    guint64 au_index;    /* access unit the payload belongs to */
+    guint64 deadline;    /* last access unit it may be sent in */
+    gboolean whole;      /* payload not fragmented */
+} GstLvSeiFragment;
+
+/*
+ * Spreads large secondary payloads over several access units: a payload
+ * above the per access unit budget is cut into fragments (format in
+ * sei_merge.h) that go out in order, at most budget bytes per access unit,
+ * and all of them within au_count access units. A fragment reaching its
+ * deadline goes out whatever the budget, with everything queued before it.
+ */
+typedef struct {
+    gsize budget;
+    guint au_count;
+    GstLvSeiFragment pending[SEI_SPREAD_MAX_PENDING];
+    guint n_pending;
+    guint16 sequence_id;
+    guint64 au_index;
+} GstLvSeiSpreader;
+
+void sei_spreader_init(GstLvSeiSpreader *spreader, gsize budget, guint au_count);
+void sei_spreader_clear(GstLvSeiSpreader *spreader);
+
+gboolean sei_spreader_push(GstLvSeiSpreader *spreader, GstBuffer *payload);
+guint sei_spreader_next_au(GstLvSeiSpreader *spreader, GstBuffer **fragments, gsize *data_size);
+
+#endif /* __SEI_SPREAD_H__ */
@@ -0,0 +1,142 @@
+/*
+ * Access unit boundaries of NAL aligned streams: units that may open an
+ * access unit are only split off once the next VCL NAL unit confirms it.
+ */
+#include <gst/gst.h>
+#include <string.h>
+
+#include "au_assembler.h"
+
+#define END -1
+
+/* One NAL unit whose last byte is its type, so the output reads back easily */
+static GstBuffer *
+make_nal(const GstLvCodecDesc *desc, guint8 type, gboolean first_slice, GstClockTime pts)
+{
+    guint8 data[8] = { 0x00, 0x00, 0x01 };
+    gsize size = 3;
+    GstBuffer *nal;
+
+    switch (desc->codec) {
+    case CODEC_H264:
+        data[size++] = 0x60 | type;
+        break;
+    case CODEC_H265:
+        data[size++] = type << 1;
+        data[size++] = 0x01;
+        break;
+    case CODEC_H266:
+        data[size++] = 0x00;
+        data[size++] = (type << 3) | 0x01;
+        break;
+    default:
+        data[size++] = (type + 1) << 1;
+        data[size++] = 0x00;
+        break;
+    }
+    data[size++] = first_slice ? 0x80 : 0x40;
+    data[size++] = type;
+
+    nal = gst_buffer_new_memdup(data, size);
+    GST_BUFFER_PTS(nal) = pts;
+
+    return nal;
+}
+
+/*
+ * Pushes (type, first_slice) pairs, all with the same pts, and checks the
+ * access units against expected: types separated by spaces, "|" after
+ * each access unit
+ */
+static void
+check_units(GstLvCompositorCodec codec, const gint *units, GstClockTime pts, const gchar *expected)
+{
+    const GstLvCodecDesc *desc = codec_desc_lookup(codec);
+    GstLvAuAssembler assembler;
+    GString *result = g_string_new(NULL);
+    GstBufferList *au;
+    guint i;
+
+    au_assembler_init(&assembler, desc);
+    for (i = 0; units[i] != END; i += 2) {
+        au_assembler_push(&assembler, make_nal(desc, (guint8)units[i], units[i + 1], pts));
+    }
+
+    while ((au = au_assembler_pop(&assembler)) || (au = au_assembler_drain(&assembler))) {
+        for (i = 0; i < gst_buffer_list_length(au); i++) {
+            GstBuffer *nal = gst_buffer_list_get(au, i);
+            guint8 type;
+
+            gst_buffer_extract(nal, gst_buffer_get_size(nal) - 1, &type, 1);
+            g_string_append_printf(result, "%u ", type);
+        }
+        g_string_append(result, "| ");
+        gst_buffer_list_unref(au);
+    }
+    au_assembler_clear(&assembler);
+
+    g_assert_cmpstr(result->str, ==, expected);
+    g_string_free(result, TRUE);
+}
+
+static void
+test_h265_pps_between_slices(void)
+{
+    // PPS and prefix SEI between the slices of a picture stay in it
+    static const gint units[] = {
+        32, 0, 33, 0, 34, 0, 39, 0, 1, 1, 34, 0, 1, 0, 39, 0, 1, 0,
+        39, 0, 1, 1, 35, 0, 1, 1, END
+    };
+
+    check_units(CODEC_H265, units, GST_CLOCK_TIME_NONE, "32 33 34 39 1 34 1 39 1 | 39 1 | 35 1 | ");
+    check_units(CODEC_H265, units, 0, "32 33 34 39 1 34 1 39 1 | 39 1 | 35 1 | ");
+}
+
+static void
+test_h264_svc(void)
+{
+    // Prefix NAL units before every base slice, coded slice extensions
+    static const gint units[] = {
+        9, 0, 7, 0, 8, 0, 14, 0, 1, 1, 14, 0, 1, 0, 20, 0, 20, 0,
+        6, 0, 14, 0, 5, 1, 20, 0, END
+    };
+
+    check_units(CODEC_H264, units, GST_CLOCK_TIME_NONE, "9 7 8 14 1 14 1 20 20 | 6 14 5 20 | ");
+}
+
+static void
+test_h266_aps_and_picture_header(void)
+{
+    // Prefix APS inside a picture, picture header opening the next one
+    static const gint units[] = {
+        15, 0, 16, 0, 19, 0, 1, 0, 17, 0, 1, 0, 17, 0, 19, 0, 1, 0, 17, 0, 1, 1, END
+    };
+
+    check_units(CODEC_H266, units, GST_CLOCK_TIME_NONE, "15 16 19 1 17 1 | 17 19 1 | 17 1 | ");
+    // Same PTS: only the first slice flag splits
+    check_units(CODEC_H266, units, 0, "15 16 19 1 17 1 17 19 1 | 17 1 | ");
+}
+
+static void
+test_evc(void)
+{
+    // No first slice flag: split right away without PTS, never on equal PTS
+    static const gint units[] = { 24, 0, 25, 0, 1, 0, 25, 0, 1, 0, 28, 0, 1, 0, END };
+
+    check_units(CODEC_EVC, units, GST_CLOCK_TIME_NONE, "24 25 1 | 25 1 | 28 1 | ");
+    check_units(CODEC_EVC, units, 0, "24 25 1 25 1 28 1 | ");
+}
+
+int
+main(int argc, char **argv)
+{
+    gst_init(&argc, &argv);
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/au-assembler/h265-pps-between-slices", test_h265_pps_between_slices);
+    g_test_add_func("/au-assembler/h264-svc", test_h264_svc);
+    g_test_add_func("/au-assembler/h266-aps-and-picture-header", test_h266_aps_and_picture_header);
+    g_test_add_func("/au-assembler/evc", test_evc);
+
+    return g_test_run();
+}
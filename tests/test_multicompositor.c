@@ -0,0 +1,238 @@
+/*
+ * lvmulticompositor with many channels: every channel gets H.265 access
+ * units and its own secondary stream through appsrc, its output goes
+ * through lvextractor into prerolling sinks. A sink blocking must not hold
+ * the other channels, and each channel has to give back its own base
+ * stream and secondary bytes, every access unit and EOS.
+ */
+#include <gst/gst.h>
+
+#include "gstlvmulticompositor.h"
+#include "gstlvextractor.h"
+
+#define N_CHANNELS 8
+#define N_FRAMES 30
+#define FRAME_DURATION (40 * GST_MSECOND)
+
+#define MAIN_CAPS "video/x-h265, stream-format=(string)byte-stream, alignment=(string)au"
+#define SECONDARY_CAPS "video/x-evc, stream-format=(string)byte-stream, alignment=(string)au"
+
+typedef struct {
+    GPtrArray *main_in;
+    GPtrArray *secondary_in;
+    GPtrArray *base_out;
+    GPtrArray *secondary_out;
+} Channel;
+
+/* AUD + IDR slice, the slice body never contains a 00 byte */
+static GBytes *
+make_main_au(guint channel, guint frame)
+{
+    static const guint8 aud[] = { 0x00, 0x00, 0x00, 0x01, 0x46, 0x01, 0x50 };
+    static const guint8 slice_header[] = { 0x00, 0x00, 0x00, 0x01, 0x26, 0x01, 0x80 };
+    GByteArray *au = g_byte_array_new();
+    guint size = 500 + 37 * ((channel + frame) % 16);
+    guint i;
+
+    g_byte_array_append(au, aud, sizeof(aud));
+    g_byte_array_append(au, slice_header, sizeof(slice_header));
+    for (i = 0; i < size; i++) {
+        guint8 byte = (guint8)(1 + (channel * 13 + frame * 7 + i) % 255);
+
+        g_byte_array_append(au, &byte, 1);
+    }
+
+    return g_byte_array_free_to_bytes(au);
+}
+
+/* Tagged with the channel and frame, a payload landing elsewhere shows */
+static GBytes *
+make_secondary(guint channel, guint frame)
+{
+    gchar *tag = g_strdup_printf("channel %u frame %u ", channel, frame);
+    GString *payload = g_string_new(NULL);
+
+    while (payload->len < 60 + 5 * frame) {
+        g_string_append(payload, tag);
+    }
+    g_free(tag);
+
+    return g_string_free_to_bytes(payload);
+}
+
+static GstBuffer *
+wrap_bytes(GBytes *bytes, guint frame)
+{
+    GstBuffer *buffer = gst_buffer_new_wrapped_bytes(bytes);
+
+    GST_BUFFER_PTS(buffer) = GST_BUFFER_DTS(buffer) = frame * FRAME_DURATION;
+    GST_BUFFER_DURATION(buffer) = FRAME_DURATION;
+
+    return buffer;
+}
+
+/* One streaming thread per sink, the arrays are read after EOS */
+static void
+on_handoff(GstElement *sink, GstBuffer *buffer, GstPad *pad, gpointer user_data)
+{
+    GPtrArray *received = user_data;
+
+    g_ptr_array_add(received, gst_buffer_ref(buffer));
+}
+
+static void
+assert_buffer_equals(GstBuffer *buffer, GBytes *expected)
+{
+    GstMapInfo map;
+
+    g_assert_true(gst_buffer_map(buffer, &map, GST_MAP_READ));
+    g_assert_cmpmem(map.data, map.size, g_bytes_get_data(expected, NULL),
+                    g_bytes_get_size(expected));
+    gst_buffer_unmap(buffer, &map);
+}
+
+static void
+connect_sink(GstElement *pipeline, const gchar *format, guint index, GPtrArray *received)
+{
+    gchar *name = g_strdup_printf(format, index);
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), name);
+
+    g_assert_nonnull(sink);
+    g_signal_connect(sink, "handoff", G_CALLBACK(on_handoff), received);
+    gst_object_unref(sink);
+    g_free(name);
+}
+
+/* Queues the whole stream in a started appsrc, then EOS */
+static void
+feed_source(GstElement *pipeline, const gchar *format, guint index, GPtrArray *data)
+{
+    gchar *name = g_strdup_printf(format, index);
+    GstElement *source = gst_bin_get_by_name(GST_BIN(pipeline), name);
+    GstFlowReturn ret;
+    guint i;
+
+    g_assert_nonnull(source);
+    for (i = 0; i < data->len; i++) {
+        GstBuffer *buffer = wrap_bytes(g_bytes_ref(g_ptr_array_index(data, i)), i);
+
+        g_signal_emit_by_name(source, "push-buffer", buffer, &ret);
+        g_assert_cmpint(ret, ==, GST_FLOW_OK);
+        gst_buffer_unref(buffer);
+    }
+    g_signal_emit_by_name(source, "end-of-stream", &ret);
+    g_assert_cmpint(ret, ==, GST_FLOW_OK);
+    gst_object_unref(source);
+    g_free(name);
+}
+
+static void
+test_channels(void)
+{
+    Channel channels[N_CHANNELS];
+    GString *description;
+    GstElement *pipeline;
+    GstMessage *message;
+    GstBus *bus;
+    GError *error = NULL;
+    guint i;
+    guint j;
+
+    // appsrc comes from gst-plugins-base, driven through its action signals
+    if (!gst_registry_check_feature_version(gst_registry_get(), "appsrc", 1, 18, 0)) {
+        g_test_skip("appsrc not available");
+        return;
+    }
+
+    description = g_string_new("lvmulticompositor name=mux ");
+    for (i = 0; i < N_CHANNELS; i++) {
+        g_string_append_printf(description,
+                               "appsrc name=main%u format=time caps=\"" MAIN_CAPS "\" ! "
+                               "mux.sink_main_%u "
+                               "appsrc name=secondary%u format=time caps=\"" SECONDARY_CAPS "\" ! "
+                               "mux.sink_secondary_%u "
+                               "mux.src_%u ! lvextractor name=extractor%u "
+                               "secondary-caps=\"" SECONDARY_CAPS "\" "
+                               "extractor%u.src_main ! fakesink name=base%u signal-handoffs=true "
+                               "extractor%u.src_secondary ! fakesink name=recovered%u "
+                               "signal-handoffs=true ",
+                               i, i, i, i, i, i, i, i, i, i);
+    }
+
+    pipeline = gst_parse_launch(description->str, &error);
+    g_assert_no_error(error);
+    g_string_free(description, TRUE);
+
+    for (i = 0; i < N_CHANNELS; i++) {
+        Channel *channel = &channels[i];
+
+        channel->main_in = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+        channel->secondary_in = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+        channel->base_out = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+        channel->secondary_out = g_ptr_array_new_with_free_func((GDestroyNotify)gst_buffer_unref);
+        for (j = 0; j < N_FRAMES; j++) {
+            g_ptr_array_add(channel->main_in, make_main_au(i, j));
+            g_ptr_array_add(channel->secondary_in, make_secondary(i, j));
+        }
+
+        connect_sink(pipeline, "base%u", i, channel->base_out);
+        connect_sink(pipeline, "recovered%u", i, channel->secondary_out);
+    }
+
+    g_assert_cmpint(gst_element_set_state(pipeline, GST_STATE_PLAYING), !=,
+                    GST_STATE_CHANGE_FAILURE);
+
+    // The sources are started once set_state() returns
+    for (i = 0; i < N_CHANNELS; i++) {
+        feed_source(pipeline, "main%u", i, channels[i].main_in);
+        feed_source(pipeline, "secondary%u", i, channels[i].secondary_in);
+    }
+
+    /* A channel stuck in a sink preroll must not keep the others from prerolling */
+    bus = gst_element_get_bus(pipeline);
+    message = gst_bus_timed_pop_filtered(bus, 30 * GST_SECOND, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+    g_assert_nonnull(message);
+    g_assert_cmpint(GST_MESSAGE_TYPE(message), ==, GST_MESSAGE_EOS);
+    gst_message_unref(message);
+    gst_object_unref(bus);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+
+    // The SEIs carried the secondary bytes of their own channel and frame
+    for (i = 0; i < N_CHANNELS; i++) {
+        Channel *channel = &channels[i];
+
+        g_assert_cmpuint(channel->base_out->len, ==, N_FRAMES);
+        g_assert_cmpuint(channel->secondary_out->len, ==, N_FRAMES);
+        for (j = 0; j < N_FRAMES; j++) {
+            GstBuffer *base = g_ptr_array_index(channel->base_out, j);
+            GstBuffer *recovered = g_ptr_array_index(channel->secondary_out, j);
+
+            g_assert_cmpuint(GST_BUFFER_PTS(base), ==, j * FRAME_DURATION);
+            assert_buffer_equals(base, g_ptr_array_index(channel->main_in, j));
+            g_assert_cmpuint(GST_BUFFER_PTS(recovered), ==, j * FRAME_DURATION);
+            assert_buffer_equals(recovered, g_ptr_array_index(channel->secondary_in, j));
+        }
+
+        g_ptr_array_unref(channel->main_in);
+        g_ptr_array_unref(channel->secondary_in);
+        g_ptr_array_unref(channel->base_out);
+        g_ptr_array_unref(channel->secondary_out);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    gst_init(&argc, &argv);
+    g_test_init(&argc, &argv, NULL);
+
+    // Elements built into the test, no registry needed for them
+    gst_element_register(NULL, "lvmulticompositor", GST_RANK_NONE, GST_TYPE_LV_MULTI_COMPOSITOR);
+    gst_element_register(NULL, "lvextractor", GST_RANK_NONE, GST_TYPE_LV_EXTRACTOR);
+
+    g_test_add_func("/multicompositor/channels", test_channels);
+
+    return g_test_run();
+}
@@ -0,0 +1,143 @@
+/*
+ * The vector start code and emulation prevention scanners against their
+ * scalar reference, on random zero-heavy input. Run once per LV_NAL_SIMD
+ * value so every implementation the CPU has is compared.
+ */
+#include <glib.h>
+#include <string.h>
+
+#include "nal_utils.h"
+
+#define MAX_SIZE 4096
+#define N_ROUNDS 2000
+
+/* Mostly 00, some 01/02/03 and a few random bytes: start codes and EPB
+ * candidates everywhere, including across vector lanes */
+static void
+fill_zero_heavy(GRand *rand, guint8 *data, gsize size)
+{
+    gsize i;
+
+    for (i = 0; i < size; i++) {
+        guint32 r = g_rand_int_range(rand, 0, 16);
+
+        data[i] = r < 10 ? 0x00 : r < 14 ? (guint8)(r - 9) : (guint8)g_rand_int(rand);
+    }
+}
+
+static gsize
+random_size(GRand *rand)
+{
+    // Small sizes hit the scalar tails of the vector loops
+    return g_rand_boolean(rand) ? (gsize)g_rand_int_range(rand, 0, 80)
+                                : (gsize)g_rand_int_range(rand, 0, MAX_SIZE);
+}
+
+static void
+test_impl_name(void)
+{
+    const gchar *forced = g_getenv("LV_NAL_SIMD");
+    const gchar *name = nal_simd_impl_name();
+
+    g_test_message("LV_NAL_SIMD=%s, using %s", forced ? forced : "(unset)", name);
+    if (g_strcmp0(forced, "scalar") == 0) {
+        g_assert_cmpstr(name, ==, "scalar");
+    } else if (g_strcmp0(forced, "sse2") == 0) {
+        g_assert_cmpstr(name, !=, "avx2");
+    }
+}
+
+static void
+test_find_start_code(void)
+{
+    GRand *rand = g_rand_new_with_seed(1);
+    guint8 *data = g_malloc(MAX_SIZE + 32);
+    guint round;
+
+    for (round = 0; round < N_ROUNDS; round++) {
+        // Unaligned start too, the vector loads must not care
+        guint8 *input = data + g_rand_int_range(rand, 0, 32);
+        gsize size = random_size(rand);
+        gsize offset = size ? (gsize)g_rand_int_range(rand, 0, (gint32)size + 1) : 0;
+
+        fill_zero_heavy(rand, input, size);
+        while (offset <= size) {
+            gsize expected = nal_find_start_code_scalar(input, size, offset);
+
+            g_assert_cmpuint(nal_find_start_code(input, size, offset), ==, expected);
+            offset = expected + 1;
+        }
+    }
+
+    g_free(data);
+    g_rand_free(rand);
+}
+
+static void
+test_epb_find(void)
+{
+    GRand *rand = g_rand_new_with_seed(2);
+    guint8 *data = g_malloc(MAX_SIZE + 32);
+    guint round;
+
+    for (round = 0; round < N_ROUNDS; round++) {
+        guint8 *input = data + g_rand_int_range(rand, 0, 32);
+        gsize size = random_size(rand);
+        guint start_run = (guint)g_rand_int_range(rand, 0, 3);
+        guint zero_run = start_run;
+        guint expected_run = start_run;
+        gsize expected;
+
+        fill_zero_heavy(rand, input, size);
+        expected = nal_epb_find_scalar(input, size, &expected_run);
+        g_assert_cmpuint(nal_epb_find(input, size, &zero_run), ==, expected);
+        g_assert_cmpuint(zero_run, ==, expected_run);
+    }
+
+    g_free(data);
+    g_rand_free(rand);
+}
+
+static void
+test_epb_escape(void)
+{
+    GRand *rand = g_rand_new_with_seed(3);
+    guint8 *input = g_malloc(MAX_SIZE);
+    guint8 *output = g_malloc(NAL_EPB_MAX_SIZE(MAX_SIZE));
+    guint8 *expected = g_malloc(NAL_EPB_MAX_SIZE(MAX_SIZE));
+    guint round;
+
+    for (round = 0; round < N_ROUNDS; round++) {
+        gsize size = random_size(rand);
+        guint start_run = (guint)g_rand_int_range(rand, 0, 3);
+        guint zero_run = start_run;
+        guint expected_run = start_run;
+        gsize expected_size;
+        gsize output_size;
+
+        fill_zero_heavy(rand, input, size);
+        expected_size = nal_epb_escape_scalar(expected, input, size, &expected_run);
+        output_size = nal_epb_escape(output, input, size, &zero_run);
+        g_assert_cmpuint(output_size, ==, expected_size);
+        g_assert_cmpuint(zero_run, ==, expected_run);
+        g_assert_cmpmem(output, output_size, expected, expected_size);
+    }
+
+    g_free(expected);
+    g_free(output);
+    g_free(input);
+    g_rand_free(rand);
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/nal-simd/impl-name", test_impl_name);
+    g_test_add_func("/nal-simd/find-start-code", test_find_start_code);
+    g_test_add_func("/nal-simd/epb-find", test_epb_find);
+    g_test_add_func("/nal-simd/epb-escape", test_epb_escape);
+
+    return g_test_run();
+}
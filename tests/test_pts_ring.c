@@ -0,0 +1,191 @@
+/*
+ * PTS pairing through a reorder window: secondary buffers are pulled in
+ * arrival order, kept while the match is missing, dropped once they are
+ * behind the DTS horizon.
+ */
+#include <gst/gst.h>
+
+#include "pts_ring.h"
+
+#define MS(ms) ((GstClockTime)(ms) * GST_MSECOND)
+#define END G_MAXINT
+#define NO_MATCH -1
+#define UNTIMED -2
+
+static GstBuffer *
+make_buffer(GstClockTime pts)
+{
+    GstBuffer *buffer = gst_buffer_new();
+
+    GST_BUFFER_PTS(buffer) = pts;
+
+    return buffer;
+}
+
+/* Secondary stream in arrival order, what the pad queue gives */
+static GstBuffer *
+pull_queue(gpointer user_data)
+{
+    return pts_ring_pop(user_data);
+}
+
+/* Queues secondary buffers, PTS in ms or UNTIMED */
+static void
+queue_buffers(GstLvPtsRing *queue, const gint *pts_ms)
+{
+    guint i;
+
+    for (i = 0; pts_ms[i] != END; i++) {
+        pts_ring_push(queue, make_buffer(pts_ms[i] == UNTIMED ? GST_CLOCK_TIME_NONE : MS(pts_ms[i])));
+    }
+}
+
+/* Pairs one access unit and checks the PTS (ms) of the buffer found */
+static void
+check_pair(GstLvPtsRing *ring, GstLvPtsRing *queue, GstClockTime pts, GstClockTime dts,
+           GstClockTime tolerance, guint window, gint expected, guint expected_dropped)
+{
+    GstBuffer *buffer;
+    guint dropped;
+
+    buffer = pts_ring_pair(ring, pull_queue, queue, pts, dts, tolerance, window, &dropped);
+    if (expected == NO_MATCH) {
+        g_assert_null(buffer);
+    } else {
+        g_assert_nonnull(buffer);
+        g_assert_cmpuint(GST_BUFFER_PTS(buffer), ==,
+                         expected == UNTIMED ? GST_CLOCK_TIME_NONE : MS(expected));
+        gst_buffer_unref(buffer);
+    }
+    g_assert_cmpuint(dropped, ==, expected_dropped);
+}
+
+static void
+test_reordered(void)
+{
+    // Secondary in display order, main in decode order with B-frames
+    static const gint secondary[] = { 40, 80, 120, 160, END };
+    GstLvPtsRing ring;
+    GstLvPtsRing queue;
+
+    pts_ring_init(&ring);
+    pts_ring_init(&queue);
+    queue_buffers(&queue, secondary);
+
+    check_pair(&ring, &queue, MS(40), MS(0), MS(1), 16, 40, 0);
+    check_pair(&ring, &queue, MS(120), MS(40), MS(1), 16, 120, 0);
+    g_assert_cmpuint(pts_ring_length(&ring), ==, 1);
+    check_pair(&ring, &queue, MS(80), MS(80), MS(1), 16, 80, 0);
+    check_pair(&ring, &queue, MS(160), MS(120), MS(1), 16, 160, 0);
+    g_assert_cmpuint(pts_ring_length(&ring), ==, 0);
+    g_assert_cmpuint(pts_ring_length(&queue), ==, 0);
+
+    pts_ring_clear(&ring);
+}
+
+static void
+test_tolerance_edge(void)
+{
+    static const gint secondary[] = { 42, 81, END };
+    GstLvPtsRing ring;
+    GstLvPtsRing queue;
+
+    pts_ring_init(&ring);
+    pts_ring_init(&queue);
+    queue_buffers(&queue, secondary);
+
+    // 2 ms away: kept while tolerance is 1 ms, paired once it is 2 ms
+    check_pair(&ring, &queue, MS(40), MS(40), MS(1), 16, NO_MATCH, 0);
+    g_assert_cmpuint(pts_ring_length(&ring), ==, 2);
+    check_pair(&ring, &queue, MS(40), MS(40), MS(2), 16, 42, 0);
+    check_pair(&ring, &queue, MS(80), MS(80), MS(1), 16, 81, 0);
+
+    pts_ring_clear(&ring);
+    pts_ring_clear(&queue);
+}
+
+static void
+test_stale_dropped(void)
+{
+    // Secondary stream behind: everything before DTS - tolerance goes
+    static const gint secondary[] = { 0, 40, 79, 80, 120, END };
+    GstLvPtsRing ring;
+    GstLvPtsRing queue;
+
+    pts_ring_init(&ring);
+    pts_ring_init(&queue);
+    queue_buffers(&queue, secondary);
+
+    check_pair(&ring, &queue, MS(120), MS(80), MS(1), 16, 120, 2);
+    g_assert_cmpuint(pts_ring_length(&ring), ==, 2);
+
+    // Window entries are dropped too once the horizon passes them
+    check_pair(&ring, &queue, MS(160), MS(120), MS(1), 16, NO_MATCH, 2);
+    g_assert_cmpuint(pts_ring_length(&ring), ==, 0);
+
+    pts_ring_clear(&ring);
+    pts_ring_clear(&queue);
+}
+
+static void
+test_window_full(void)
+{
+    static const gint secondary[] = { 200, 240, 280, END };
+    GstLvPtsRing ring;
+    GstLvPtsRing queue;
+
+    pts_ring_init(&ring);
+    pts_ring_init(&queue);
+    queue_buffers(&queue, secondary);
+
+    // Stops pulling once the window is full, the caller gives up
+    check_pair(&ring, &queue, MS(40), MS(0), MS(1), 2, NO_MATCH, 0);
+    g_assert_cmpuint(pts_ring_length(&ring), ==, 2);
+    g_assert_cmpuint(pts_ring_length(&queue), ==, 1);
+
+    // Still found once the main stream catches up
+    check_pair(&ring, &queue, MS(240), MS(200), MS(1), 2, 240, 0);
+    check_pair(&ring, &queue, MS(280), MS(240), MS(1), 2, 280, 1);
+
+    pts_ring_clear(&ring);
+    pts_ring_clear(&queue);
+}
+
+static void
+test_untimestamped(void)
+{
+    static const gint secondary[] = { 100, UNTIMED, 140, END };
+    GstLvPtsRing ring;
+    GstLvPtsRing queue;
+
+    pts_ring_init(&ring);
+    pts_ring_init(&queue);
+    queue_buffers(&queue, secondary);
+
+    // An untimestamped secondary goes with the current access unit
+    check_pair(&ring, &queue, MS(40), MS(40), MS(1), 16, UNTIMED, 0);
+    g_assert_cmpuint(pts_ring_length(&ring), ==, 1);
+
+    // An untimestamped access unit pairs in arrival order, window first
+    check_pair(&ring, &queue, GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, MS(1), 16, 100, 0);
+    check_pair(&ring, &queue, GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, MS(1), 16, 140, 0);
+    check_pair(&ring, &queue, GST_CLOCK_TIME_NONE, GST_CLOCK_TIME_NONE, MS(1), 16, NO_MATCH, 0);
+
+    pts_ring_clear(&ring);
+    pts_ring_clear(&queue);
+}
+
+int
+main(int argc, char **argv)
+{
+    gst_init(&argc, &argv);
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/pts-ring/reordered", test_reordered);
+    g_test_add_func("/pts-ring/tolerance-edge", test_tolerance_edge);
+    g_test_add_func("/pts-ring/stale-dropped", test_stale_dropped);
+    g_test_add_func("/pts-ring/window-full", test_window_full);
+    g_test_add_func("/pts-ring/untimestamped", test_untimestamped);
+
+    return g_test_run();
+}
@@ -0,0 +1,950 @@
+/*
+ * lvcompositor -> lvextractor round trip: the base stream and every
+ * secondary payload must come back byte for byte, whatever the SEI layout
+ * (fragments spread over later access units, SEI NAL units cut by
+ * max-sei-nal-size, compact payloads, emulation prevention, escaped first
+ * bytes). Damaged SEIs must neither crash the extractor nor produce a
+ * payload.
+ */
+#include <gst/gst.h>
+#include <gst/check/gstharness.h>
+#include <string.h>
+
+#include "gstlvcompositor.h"
+#include "gstlvextractor.h"
+#include "codec_desc.h"
+#include "sei_merge.h"
+
+#define FRAME_DURATION (40 * GST_MSECOND)
+#define N_FRAMES 40
+
+#define RAW_CAPS "application/octet-stream"
+#define EVC_CAPS "video/x-evc, stream-format=(string)byte-stream, alignment=(string)au"
+
+typedef struct {
+    const gchar *secondary_caps;
+    guint spread_budget;
+    guint spread_au_count;
+    guint max_sei_nal_size;
+    gboolean compact;
+} RoundtripParams;
+
+/* Synthetic bitstream, as in bench/bench_sei_merge.c */
+
+static void
+write_nal_header(const GstLvCodecDesc *desc, guint8 type, guint8 *data)
+{
+    switch (desc->codec) {
+        case CODEC_H264:
+            data[0] = 0x60 | type;
+            break;
+        case CODEC_H265:
+            data[0] = type << 1;
+            data[1] = 0x01;
+            break;
+        case CODEC_H266:
+            data[0] = 0x00;
+            data[1] = (type << 3) | 0x01;
+            break;
+        default:
+            data[0] = (guint8)((type + 1) << 1);
+            data[1] = 0x00;
+            break;
+    }
+}
+
+/* NAL unit with a 4 bytes start code and a body without any 00 byte */
+static void
+append_nal(GByteArray *au, const GstLvCodecDesc *desc, guint8 type, gsize body_size, GRand *rand)
+{
+    static const guint8 start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
+    guint8 header[2];
+    guint offset;
+    gsize i;
+
+    write_nal_header(desc, type, header);
+    g_byte_array_append(au, start_code, sizeof(start_code));
+    g_byte_array_append(au, header, desc->nal_header_size);
+
+    offset = au->len;
+    g_byte_array_set_size(au, au->len + body_size);
+    for (i = 0; i < body_size; i++) {
+        au->data[offset + i] = (guint8)g_rand_int_range(rand, 4, 256);
+    }
+    if (codec_desc_is_vcl(desc, type) && body_size > 0) {
+        au->data[offset] |= desc->first_slice_mask;
+    }
+}
+
+static GBytes *
+make_main_au(const GstLvCodecDesc *desc, GRand *rand)
+{
+    GByteArray *au = g_byte_array_new();
+    guint8 type;
+
+    if (desc->aud_type != NAL_TYPE_NONE) {
+        append_nal(au, desc, desc->aud_type, 1, rand);
+    }
+    for (type = 0; type < 64; type++) {
+        if (codec_desc_is_type(desc->parameter_set_types, type)) {
+            append_nal(au, desc, type, 16, rand);
+        }
+    }
+    append_nal(au, desc, desc->vcl_first, g_rand_int_range(rand, 100, 2000), rand);
+
+    return g_byte_array_free_to_bytes(au);
+}
+
+/* Mostly 00 and 01..03: emulation prevention bytes everywhere. first_byte
+ * >= 0 forces the byte the extractor dispatches on */
+static GBytes *
+make_zero_heavy_payload(gsize size, gint first_byte, GRand *rand)
+{
+    guint8 *data = g_malloc(size);
+    gsize i;
+
+    for (i = 0; i < size; i++) {
+        guint32 r = g_rand_int_range(rand, 0, 16);
+
+        data[i] = r < 10 ? 0x00 : r < 14 ? (guint8)(r - 9) : (guint8)g_rand_int(rand);
+    }
+    if (first_byte >= 0) {
+        data[0] = (guint8)first_byte;
+    }
+
+    return g_bytes_new_take(data, size);
+}
+
+/* EVC access unit with 4 bytes start codes, what compact payloads give back */
+static GBytes *
+make_evc_payload(GRand *rand)
+{
+    const GstLvCodecDesc *desc = codec_desc_lookup(CODEC_EVC);
+    GByteArray *au = g_byte_array_new();
+
+    append_nal(au, desc, 24, 12, rand);
+    append_nal(au, desc, 25, 6, rand);
+    append_nal(au, desc, 1, g_rand_int_range(rand, 1, 3000), rand);
+
+    return g_byte_array_free_to_bytes(au);
+}
+
+/* The buffer takes its own reference to bytes */
+static GstBuffer *
+wrap_bytes(GBytes *bytes, guint frame)
+{
+    GstBuffer *buffer = gst_buffer_new_wrapped_bytes(bytes);
+
+    GST_BUFFER_PTS(buffer) = GST_BUFFER_DTS(buffer) = frame * FRAME_DURATION;
+    GST_BUFFER_DURATION(buffer) = FRAME_DURATION;
+
+    return buffer;
+}
+
+/* Main access unit in one memory with free space in front of it, as an
+ * upstream element honouring the proposed allocation gives it */
+static GstBuffer *
+wrap_with_headroom(GBytes *bytes, guint frame, gsize headroom)
+{
+    GstBuffer *buffer = gst_buffer_new();
+    GstAllocationParams params;
+    gsize size;
+    const guint8 *data = g_bytes_get_data(bytes, &size);
+
+    gst_allocation_params_init(&params);
+    params.prefix = headroom;
+    gst_buffer_append_memory(buffer, gst_allocator_alloc(NULL, size, &params));
+    gst_buffer_fill(buffer, 0, data, size);
+
+    GST_BUFFER_PTS(buffer) = GST_BUFFER_DTS(buffer) = frame * FRAME_DURATION;
+    GST_BUFFER_DURATION(buffer) = FRAME_DURATION;
+
+    return buffer;
+}
+
+static void
+assert_buffer_equals(GstBuffer *buffer, GBytes *expected)
+{
+    GstMapInfo map;
+
+    g_assert_true(gst_buffer_map(buffer, &map, GST_MAP_READ));
+    g_assert_cmpmem(map.data, map.size, g_bytes_get_data(expected, NULL), g_bytes_get_size(expected));
+    gst_buffer_unmap(buffer, &map);
+}
+
+/*
+ * Muxes one payload per main access unit, extracts the result and checks
+ * both streams. Payloads of the first complete frames must all come back,
+ * the later ones may still be waiting for fragments when the test stops.
+ * @return Largest number of bytes the SEIs added to one access unit
+ */
+static gsize
+roundtrip(GstLvCompositorCodec codec, const RoundtripParams *params, GPtrArray *payloads,
+          guint complete, GRand *rand)
+{
+    const GstLvCodecDesc *desc = codec_desc_lookup(codec);
+    GstHarness *main_harness = gst_harness_new_with_padnames("lvcompositor", "sink_main", "src");
+    GstHarness *secondary_harness = gst_harness_new_with_element(main_harness->element,
+                                                                 "sink_secondary", NULL);
+    GstHarness *input_harness = gst_harness_new_with_padnames("lvextractor", "sink", "src_main");
+    GstHarness *recovered_harness = gst_harness_new_with_element(input_harness->element, NULL,
+                                                                 "src_secondary");
+    GstCaps *secondary_caps = gst_caps_from_string(params->secondary_caps);
+    gboolean *recovered = g_new0(gboolean, payloads->len);
+    gchar *caps = g_strdup_printf("%s, stream-format=(string)byte-stream, alignment=(string)au",
+                                  desc->caps_name);
+    GstCaps *current_caps;
+    GstBuffer *buffer;
+    gsize max_overhead = 0;
+    guint i;
+
+    g_object_set(main_harness->element, "spread-budget", params->spread_budget,
+                 "spread-au-count", params->spread_au_count,
+                 "max-sei-nal-size", params->max_sei_nal_size,
+                 "compact-payload", params->compact, NULL);
+    g_object_set(input_harness->element, "secondary-caps", secondary_caps, NULL);
+
+    gst_harness_set_src_caps_str(main_harness, caps);
+    gst_harness_set_src_caps_str(secondary_harness, params->secondary_caps);
+    gst_harness_set_src_caps_str(input_harness, caps);
+    g_free(caps);
+
+    for (i = 0; i < payloads->len; i++) {
+        GBytes *main_au = make_main_au(desc, rand);
+        GstBuffer *merged;
+        GstBuffer *base;
+
+        g_assert_cmpint(gst_harness_push(main_harness, wrap_bytes(main_au, i)), ==,
+                        GST_FLOW_OK);
+        g_assert_cmpint(gst_harness_push(secondary_harness,
+                                         wrap_bytes(g_ptr_array_index(payloads, i), i)),
+                        ==, GST_FLOW_OK);
+        merged = gst_harness_pull(main_harness);
+        g_assert_nonnull(merged);
+        max_overhead = MAX(max_overhead, gst_buffer_get_size(merged) - g_bytes_get_size(main_au));
+
+        g_assert_cmpint(gst_harness_push(input_harness, merged), ==, GST_FLOW_OK);
+        base = gst_harness_pull(input_harness);
+        g_assert_nonnull(base);
+        assert_buffer_equals(base, main_au);
+        gst_buffer_unref(base);
+        g_bytes_unref(main_au);
+    }
+
+    current_caps = gst_pad_get_current_caps(recovered_harness->sinkpad);
+    g_assert_true(gst_caps_is_equal(current_caps, secondary_caps));
+    gst_caps_unref(current_caps);
+
+    /* Late payloads come first, the frame is found from the PTS */
+    while ((buffer = gst_harness_try_pull(recovered_harness))) {
+        guint frame = (guint)(GST_BUFFER_PTS(buffer) / FRAME_DURATION);
+
+        g_assert_cmpuint(frame, <, payloads->len);
+        g_assert_false(recovered[frame]);
+        recovered[frame] = TRUE;
+        assert_buffer_equals(buffer, g_ptr_array_index(payloads, frame));
+        gst_buffer_unref(buffer);
+    }
+    for (i = 0; i < complete; i++) {
+        g_assert_true(recovered[i]);
+    }
+
+    g_free(recovered);
+    gst_caps_unref(secondary_caps);
+    gst_harness_teardown(recovered_harness);
+    gst_harness_teardown(input_harness);
+    gst_harness_teardown(secondary_harness);
+    gst_harness_teardown(main_harness);
+
+    return max_overhead;
+}
+
+static void
+test_escaped_payloads(void)
+{
+    static const GstLvCompositorCodec codecs[] = { CODEC_H264, CODEC_H265, CODEC_H266, CODEC_EVC };
+    static const RoundtripParams params = { RAW_CAPS, 0, 4, 0, FALSE };
+    GRand *rand = g_rand_new_with_seed(1);
+    guint c;
+
+    for (c = 0; c < G_N_ELEMENTS(codecs); c++) {
+        GPtrArray *payloads = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+        guint i;
+
+        for (i = 0; i < N_FRAMES; i++) {
+            // First bytes the extractor reads as escape, compact or fragment markers
+            gint first_byte = i % 4 != 3 ? SEI_RAW_MARKER + (gint)(i % 4) : -1;
+
+            g_ptr_array_add(payloads, make_zero_heavy_payload(g_rand_int_range(rand, 1, 2000),
+                                                              first_byte, rand));
+        }
+        roundtrip(codecs[c], &params, payloads, N_FRAMES, rand);
+        g_ptr_array_unref(payloads);
+    }
+
+    g_rand_free(rand);
+}
+
+static void
+test_spread_fragments(void)
+{
+    static const RoundtripParams params = { RAW_CAPS, 500, 4, 0, FALSE };
+    GRand *rand = g_rand_new_with_seed(2);
+    GPtrArray *payloads = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+    gsize overhead;
+    guint i;
+
+    for (i = 0; i < N_FRAMES; i++) {
+        // One large payload out of four, spread over the next access units
+        gsize size = i % 4 == 0 ? 1200 : (gsize)g_rand_int_range(rand, 1, 100);
+
+        g_ptr_array_add(payloads, make_zero_heavy_payload(size, i % 5 == 0 ? SEI_FRAGMENT_MARKER : -1,
+                                                          rand));
+    }
+
+    // The last spread-au-count - 1 payloads may not be complete yet
+    overhead = roundtrip(CODEC_H265, &params, payloads, N_FRAMES - params.spread_au_count + 1, rand);
+    g_assert_cmpuint(overhead, <, 1200);
+
+    g_ptr_array_unref(payloads);
+    g_rand_free(rand);
+}
+
+static void
+test_max_sei_nal_size(void)
+{
+    static const RoundtripParams params = { RAW_CAPS, 0, 4, 300, FALSE };
+    GRand *rand = g_rand_new_with_seed(3);
+    GPtrArray *payloads = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+    guint i;
+
+    for (i = 0; i < N_FRAMES; i++) {
+        g_ptr_array_add(payloads, make_zero_heavy_payload(g_rand_int_range(rand, 1, 3000), -1, rand));
+    }
+    roundtrip(CODEC_H264, &params, payloads, N_FRAMES, rand);
+
+    g_ptr_array_unref(payloads);
+    g_rand_free(rand);
+}
+
+static void
+test_compact_payloads(void)
+{
+    static const RoundtripParams params = { EVC_CAPS, 0, 4, 0, TRUE };
+    static const RoundtripParams spread = { EVC_CAPS, 800, 3, 0, TRUE };
+    GRand *rand = g_rand_new_with_seed(4);
+    GPtrArray *payloads = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+    guint i;
+
+    for (i = 0; i < N_FRAMES; i++) {
+        g_ptr_array_add(payloads, make_evc_payload(rand));
+    }
+    roundtrip(CODEC_H266, &params, payloads, N_FRAMES, rand);
+    // Reassembled fragments are expanded too
+    roundtrip(CODEC_H265, &spread, payloads, N_FRAMES - spread.spread_au_count + 1, rand);
+
+    g_ptr_array_unref(payloads);
+    g_rand_free(rand);
+}
+
+/* Same access units through the shared memory merge and through the SEI
+ * written in place in the headroom: the bytes must be the same */
+static void
+test_in_place(void)
+{
+    static const GstLvCompositorCodec codecs[] = { CODEC_H264, CODEC_H265, CODEC_H266, CODEC_EVC };
+    const guint headroom = 4096;
+    GRand *rand = g_rand_new_with_seed(5);
+    guint c;
+
+    for (c = 0; c < G_N_ELEMENTS(codecs); c++) {
+        const GstLvCodecDesc *desc = codec_desc_lookup(codecs[c]);
+        GstHarness *shared = gst_harness_new_with_padnames("lvcompositor", "sink_main", "src");
+        GstHarness *shared_secondary = gst_harness_new_with_element(shared->element,
+                                                                    "sink_secondary", NULL);
+        GstHarness *in_place = gst_harness_new_with_padnames("lvcompositor", "sink_main", "src");
+        GstHarness *in_place_secondary = gst_harness_new_with_element(in_place->element,
+                                                                      "sink_secondary", NULL);
+        gchar *caps = g_strdup_printf("%s, stream-format=(string)byte-stream, alignment=(string)au",
+                                      desc->caps_name);
+        guint i;
+
+        g_object_set(in_place->element, "sei-headroom", headroom, NULL);
+        gst_harness_set_src_caps_str(shared, caps);
+        gst_harness_set_src_caps_str(in_place, caps);
+        gst_harness_set_src_caps_str(shared_secondary, RAW_CAPS);
+        gst_harness_set_src_caps_str(in_place_secondary, RAW_CAPS);
+        g_free(caps);
+
+        for (i = 0; i < N_FRAMES; i++) {
+            GBytes *main_au = make_main_au(desc, rand);
+            GBytes *payload = make_zero_heavy_payload(g_rand_int_range(rand, 1, 2000), -1, rand);
+            GstBuffer *expected;
+            GstBuffer *merged;
+            GstMapInfo map;
+
+            g_assert_cmpint(gst_harness_push(shared, wrap_bytes(main_au, i)), ==, GST_FLOW_OK);
+            g_assert_cmpint(gst_harness_push(shared_secondary, wrap_bytes(payload, i)), ==,
+                            GST_FLOW_OK);
+            g_assert_cmpint(gst_harness_push(in_place, wrap_with_headroom(main_au, i, headroom)), ==,
+                            GST_FLOW_OK);
+            g_assert_cmpint(gst_harness_push(in_place_secondary, wrap_bytes(payload, i)), ==,
+                            GST_FLOW_OK);
+
+            expected = gst_harness_pull(shared);
+            merged = gst_harness_pull(in_place);
+            g_assert_nonnull(expected);
+            g_assert_nonnull(merged);
+            g_assert_cmpuint(gst_buffer_get_size(expected), >, g_bytes_get_size(main_au));
+            // AUD and parameter sets moved into the headroom, no memory added
+            g_assert_cmpuint(gst_buffer_n_memory(merged), ==, 1);
+
+            g_assert_true(gst_buffer_map(expected, &map, GST_MAP_READ));
+            g_assert_cmpuint(gst_buffer_get_size(merged), ==, map.size);
+            g_assert_cmpint(gst_buffer_memcmp(merged, 0, map.data, map.size), ==, 0);
+            gst_buffer_unmap(expected, &map);
+
+            gst_buffer_unref(expected);
+            gst_buffer_unref(merged);
+            g_bytes_unref(payload);
+            g_bytes_unref(main_au);
+        }
+
+        gst_harness_teardown(in_place_secondary);
+        gst_harness_teardown(in_place);
+        gst_harness_teardown(shared_secondary);
+        gst_harness_teardown(shared);
+    }
+
+    g_rand_free(rand);
+}
+
+/* Length-prefixed streams (avc, hvc1, vvc1) */
+
+/* Decoder configuration record, only lengthSizeMinusOne is filled in */
+static GstBuffer *
+make_codec_data(const GstLvCodecDesc *desc, guint length_size)
+{
+    guint8 *data = g_malloc0(32);
+
+    data[desc->length_size_offset] = (guint8)((length_size - 1) << desc->length_size_shift);
+
+    return gst_buffer_new_wrapped(data, 32);
+}
+
+static void
+append_length(GByteArray *au, gsize length, guint length_size)
+{
+    guint i;
+
+    for (i = 0; i < length_size; i++) {
+        guint8 byte = (guint8)(length >> (8 * (length_size - 1 - i)));
+
+        g_byte_array_append(au, &byte, 1);
+    }
+}
+
+/*
+ * Access unit as length-prefixed NAL units, small enough for 1 byte
+ * lengths. *annex_b gets the same NAL units with 4 bytes start codes, what
+ * the extractor gives back.
+ */
+static GBytes *
+make_length_prefixed_au(const GstLvCodecDesc *desc, guint length_size, GRand *rand,
+                        GBytes **annex_b)
+{
+    GByteArray *au = g_byte_array_new();
+    GByteArray *units = g_byte_array_new();
+    guint8 types[66];
+    guint n_types = 0;
+    guint i;
+
+    if (desc->aud_type != NAL_TYPE_NONE) {
+        types[n_types++] = desc->aud_type;
+    }
+    for (i = 0; i < 64; i++) {
+        if (codec_desc_is_type(desc->parameter_set_types, (guint8)i)) {
+            types[n_types++] = (guint8)i;
+        }
+    }
+    types[n_types++] = desc->vcl_first;
+
+    for (i = 0; i < n_types; i++) {
+        guint start = units->len;
+        gsize body_size = codec_desc_is_vcl(desc, types[i]) ? (gsize)g_rand_int_range(rand, 100, 240)
+                                                             : 16;
+
+        append_nal(units, desc, types[i], body_size, rand);
+        append_length(au, units->len - start - 4, length_size);
+        g_byte_array_append(au, units->data + start + 4, units->len - start - 4);
+    }
+
+    *annex_b = g_byte_array_free_to_bytes(units);
+
+    return g_byte_array_free_to_bytes(au);
+}
+
+/*
+ * Walks the length fields of an access unit, they must end exactly with
+ * the buffer. Returns the NAL units with 4 bytes start codes and appends
+ * their types to types.
+ */
+static GstBuffer *
+length_prefixed_to_annex_b(GstBuffer *buffer, const GstLvCodecDesc *desc, guint length_size,
+                           GArray *types)
+{
+    static const guint8 start_code[4] = { 0x00, 0x00, 0x00, 0x01 };
+    GByteArray *units = g_byte_array_new();
+    GstBuffer *out;
+    GstMapInfo map;
+    gsize pos = 0;
+
+    g_assert_true(gst_buffer_map(buffer, &map, GST_MAP_READ));
+    while (pos < map.size) {
+        gsize length = 0;
+        guint8 type;
+        guint i;
+
+        g_assert_cmpuint(pos + length_size + desc->nal_header_size, <=, map.size);
+        for (i = 0; i < length_size; i++) {
+            length = (length << 8) | map.data[pos + i];
+        }
+        pos += length_size;
+        g_assert_cmpuint(length, >=, desc->nal_header_size);
+        g_assert_cmpuint(pos + length, <=, map.size);
+
+        type = desc->nal_type(map.data + pos);
+        g_array_append_val(types, type);
+        g_byte_array_append(units, start_code, sizeof(start_code));
+        g_byte_array_append(units, map.data + pos, length);
+        pos += length;
+    }
+    gst_buffer_unmap(buffer, &map);
+
+    out = gst_buffer_new_wrapped_bytes(g_byte_array_free_to_bytes(units));
+    gst_buffer_copy_into(out, buffer, GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+
+    return out;
+}
+
+/* The SEI NAL units follow each other between the parameter sets and the
+ * first NAL unit of the picture */
+static void
+assert_sei_before_picture(const GstLvCodecDesc *desc, GArray *types, guint min_sei)
+{
+    guint first = types->len;
+    guint n_sei = 0;
+    guint i;
+
+    for (i = 0; i < types->len; i++) {
+        if (g_array_index(types, guint8, i) == desc->prefix_sei_type) {
+            if (n_sei == 0) {
+                first = i;
+            }
+            g_assert_cmpuint(i, ==, first + n_sei);
+            n_sei++;
+        }
+    }
+    g_assert_cmpuint(n_sei, >=, min_sei);
+    g_assert_cmpuint(first + n_sei, <, types->len);
+    g_assert_true(codec_desc_starts_picture(desc, g_array_index(types, guint8, first + n_sei)));
+    for (i = 0; i < first; i++) {
+        g_assert_false(codec_desc_starts_picture(desc, g_array_index(types, guint8, i)));
+    }
+}
+
+/*
+ * avc, hvc1 and vvc1 with 1, 2 and 4 bytes lengths read from codec_data.
+ * With 1 and 2 bytes lengths the SEI is cut to what the length field can
+ * code; odd frames have headroom, 4 bytes lengths then write in place.
+ */
+static void
+test_length_prefixed(void)
+{
+    static const struct {
+        GstLvCompositorCodec codec;
+        const gchar *stream_format;
+    } formats[] = {
+        { CODEC_H264, "avc" },
+        { CODEC_H265, "hvc1" },
+        { CODEC_H266, "vvc1" },
+    };
+    static const guint length_sizes[] = { 1, 2, 4 };
+    static const gsize payload_sizes[] = { 700, 70000, 1500 };
+    static const guint min_sei[] = { 3, 2, 1 };
+    const guint n_frames = 10;
+    GRand *rand = g_rand_new_with_seed(6);
+    guint f;
+    guint l;
+
+    for (f = 0; f < G_N_ELEMENTS(formats); f++) {
+        for (l = 0; l < G_N_ELEMENTS(length_sizes); l++) {
+            const GstLvCodecDesc *desc = codec_desc_lookup(formats[f].codec);
+            guint length_size = length_sizes[l];
+            GstHarness *main_harness = gst_harness_new_with_padnames("lvcompositor", "sink_main",
+                                                                     "src");
+            GstHarness *secondary_harness = gst_harness_new_with_element(main_harness->element,
+                                                                         "sink_secondary", NULL);
+            GstHarness *input_harness = gst_harness_new_with_padnames("lvextractor", "sink",
+                                                                      "src_main");
+            GstHarness *recovered_harness = gst_harness_new_with_element(input_harness->element,
+                                                                         NULL, "src_secondary");
+            GstCaps *secondary_caps = gst_caps_from_string(RAW_CAPS);
+            GstBuffer *codec_data = make_codec_data(desc, length_size);
+            GPtrArray *payloads = g_ptr_array_new_with_free_func((GDestroyNotify)g_bytes_unref);
+            gchar *caps = g_strdup_printf("%s, stream-format=(string)byte-stream, "
+                                          "alignment=(string)au", desc->caps_name);
+            GstBuffer *buffer;
+            guint recovered = 0;
+            guint i;
+
+            gst_harness_set_src_caps(main_harness,
+                                     gst_caps_new_simple(desc->caps_name,
+                                                         "stream-format", G_TYPE_STRING,
+                                                         formats[f].stream_format,
+                                                         "alignment", G_TYPE_STRING, "au",
+                                                         "codec_data", GST_TYPE_BUFFER, codec_data,
+                                                         NULL));
+            gst_buffer_unref(codec_data);
+            gst_harness_set_src_caps_str(secondary_harness, RAW_CAPS);
+            g_object_set(input_harness->element, "secondary-caps", secondary_caps, NULL);
+            gst_harness_set_src_caps_str(input_harness, caps);
+            g_free(caps);
+
+            for (i = 0; i < n_frames; i++) {
+                GBytes *annex_b;
+                GBytes *main_au = make_length_prefixed_au(desc, length_size, rand, &annex_b);
+                GBytes *payload = make_zero_heavy_payload(payload_sizes[l], -1, rand);
+                GArray *types = g_array_new(FALSE, FALSE, sizeof(guint8));
+                GstBuffer *merged;
+                GstBuffer *base;
+
+                g_ptr_array_add(payloads, payload);
+                g_assert_cmpint(gst_harness_push(main_harness,
+                                                 i % 2 ? wrap_with_headroom(main_au, i, 4096)
+                                                       : wrap_bytes(main_au, i)),
+                                ==, GST_FLOW_OK);
+                g_assert_cmpint(gst_harness_push(secondary_harness, wrap_bytes(payload, i)), ==,
+                                GST_FLOW_OK);
+                merged = gst_harness_pull(main_harness);
+                g_assert_nonnull(merged);
+                if (i % 2 && length_size == 4) {
+                    g_assert_cmpuint(gst_buffer_n_memory(merged), ==, 1);
+                }
+
+                buffer = length_prefixed_to_annex_b(merged, desc, length_size, types);
+                assert_sei_before_picture(desc, types, min_sei[l]);
+                gst_buffer_unref(merged);
+
+                g_assert_cmpint(gst_harness_push(input_harness, buffer), ==, GST_FLOW_OK);
+                base = gst_harness_pull(input_harness);
+                g_assert_nonnull(base);
+                assert_buffer_equals(base, annex_b);
+
+                gst_buffer_unref(base);
+                g_array_unref(types);
+                g_bytes_unref(annex_b);
+                g_bytes_unref(main_au);
+            }
+
+            while ((buffer = gst_harness_try_pull(recovered_harness))) {
+                guint frame = (guint)(GST_BUFFER_PTS(buffer) / FRAME_DURATION);
+
+                g_assert_cmpuint(frame, <, n_frames);
+                assert_buffer_equals(buffer, g_ptr_array_index(payloads, frame));
+                gst_buffer_unref(buffer);
+                recovered++;
+            }
+            g_assert_cmpuint(recovered, ==, n_frames);
+
+            g_ptr_array_unref(payloads);
+            gst_caps_unref(secondary_caps);
+            gst_harness_teardown(recovered_harness);
+            gst_harness_teardown(input_harness);
+            gst_harness_teardown(secondary_harness);
+            gst_harness_teardown(main_harness);
+        }
+    }
+
+    g_rand_free(rand);
+}
+
+/* Damaged input, written by hand */
+
+#define H265_SEI_TYPE 39
+#define H265_SLICE_TYPE 1
+
+/* Extractor fed directly, the recovered payloads are pulled from the second harness */
+typedef struct {
+    GstHarness *input;
+    GstHarness *recovered;
+    guint frame;
+} Extractor;
+
+static void
+extractor_init(Extractor *extractor, const gchar *sei_type)
+{
+    extractor->input = gst_harness_new_with_padnames("lvextractor", "sink", "src_main");
+    extractor->recovered = gst_harness_new_with_element(extractor->input->element, NULL,
+                                                        "src_secondary");
+    gst_util_set_object_arg(G_OBJECT(extractor->input->element), "sei-type", sei_type);
+    gst_harness_set_src_caps_str(extractor->input, "video/x-h265, stream-format=(string)byte-stream, "
+                                 "alignment=(string)au");
+    extractor->frame = 0;
+}
+
+static void
+extractor_clear(Extractor *extractor)
+{
+    gst_harness_teardown(extractor->recovered);
+    gst_harness_teardown(extractor->input);
+}
+
+/*
+ * Pushes an access unit and checks the base stream: expected_base is the
+ * input without the removed SEIs, NULL when the input must go through
+ * untouched
+ */
+static void
+extractor_push(Extractor *extractor, GByteArray *au, GByteArray *expected_base)
+{
+    GBytes *input = g_bytes_new(au->data, au->len);
+    GBytes *expected = expected_base ? g_bytes_new(expected_base->data, expected_base->len)
+                                     : g_bytes_ref(input);
+    GstBuffer *base;
+
+    g_assert_cmpint(gst_harness_push(extractor->input, wrap_bytes(input, extractor->frame++)), ==,
+                    GST_FLOW_OK);
+    base = gst_harness_pull(extractor->input);
+    g_assert_nonnull(base);
+    assert_buffer_equals(base, expected);
+    gst_buffer_unref(base);
+    g_bytes_unref(expected);
+    g_bytes_unref(input);
+}
+
+static void
+assert_nothing_recovered(Extractor *extractor)
+{
+    GstBuffer *buffer = gst_harness_try_pull(extractor->recovered);
+
+    if (buffer) {
+        gst_buffer_unref(buffer);
+        g_assert_not_reached();
+    }
+}
+
+static void
+append_bytes(GByteArray *au, const guint8 *data, gsize size)
+{
+    g_byte_array_append(au, data, (guint)size);
+}
+
+/* Base picture: one slice, no byte the SEIs could be confused with */
+static void
+append_slice(GByteArray *au)
+{
+    static const guint8 slice[] = {
+        0x00, 0x00, 0x00, 0x01, H265_SLICE_TYPE << 1, 0x01, 0xAF, 0x12, 0x34, 0x56, 0x78, 0x9A
+    };
+
+    append_bytes(au, slice, sizeof(slice));
+}
+
+/*
+ * Prefix SEI NAL unit with one user_data_unregistered message: the first
+ * uuid_size bytes of the LCEVC UUID and data, payloadSize payload_size
+ * whatever is really there
+ */
+static void
+append_sei(GByteArray *au, gsize uuid_size, const guint8 *data, gsize data_size, gsize payload_size)
+{
+    static const guint8 header[] = {
+        0x00, 0x00, 0x00, 0x01, H265_SEI_TYPE << 1, 0x01, SEI_PAYLOAD_TYPE_USER_DATA_UNREGISTERED
+    };
+    static const guint8 trailing_bits = 0x80;
+    guint8 uuid[SEI_UUID_SIZE];
+    guint8 byte = 0xFF;
+
+    sei_uuid_resolve("lcevc", uuid);
+    append_bytes(au, header, sizeof(header));
+    for (; payload_size >= 255; payload_size -= 255) {
+        append_bytes(au, &byte, 1);
+    }
+    byte = (guint8)payload_size;
+    append_bytes(au, &byte, 1);
+    append_bytes(au, uuid, uuid_size);
+    append_bytes(au, data, data_size);
+    append_bytes(au, &trailing_bits, 1);
+}
+
+/* Well-formed SEI carrying data */
+static void
+append_user_data(GByteArray *au, const guint8 *data, gsize size)
+{
+    append_sei(au, SEI_UUID_SIZE, data, size, SEI_UUID_SIZE + size);
+}
+
+/* Prefix SEI NAL unit with one user_data_registered_itu_t_t35 message with
+ * the LCEVC codes, data under 252 bytes */
+static void
+append_t35_user_data(GByteArray *au, const guint8 *data, gsize size)
+{
+    static const guint8 header[] = {
+        0x00, 0x00, 0x00, 0x01, H265_SEI_TYPE << 1, 0x01,
+        SEI_PAYLOAD_TYPE_USER_DATA_REGISTERED_ITU_T_T35
+    };
+    static const guint8 t35_header[SEI_T35_HEADER_SIZE] = SEI_T35_LCEVC_HEADER;
+    static const guint8 trailing_bits = 0x80;
+    guint8 byte = (guint8)(SEI_T35_HEADER_SIZE + size);
+
+    append_bytes(au, header, sizeof(header));
+    append_bytes(au, &byte, 1);
+    append_bytes(au, t35_header, sizeof(t35_header));
+    append_bytes(au, data, size);
+    append_bytes(au, &trailing_bits, 1);
+}
+
+static void
+test_truncated_and_invalid(void)
+{
+    static const guint8 data[] = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88 };
+    static const guint8 start_code_only[] = { 0x00, 0x00, 0x00, 0x01 };
+    // Fragment 1 of 2 without fragment 0, and fragment 0 of 2 never completed
+    static const guint8 orphan_fragment[] = { SEI_FRAGMENT_MARKER, 0x00, 0x07, 1, 2, 0, 0xAA };
+    static const guint8 first_fragment[] = { SEI_FRAGMENT_MARKER, 0x00, 0x08, 0, 2, 0, 0xBB };
+    // Complete, but for an access unit 200 units ago
+    static const guint8 early_fragment[] = { SEI_FRAGMENT_MARKER, 0x00, 0x09, 0, 1, 200, 0xCC };
+    // Compact format byte with a NAL unit size past the end: output as carried
+    static const guint8 bad_compact[] = { 0xFE, 0x05, 0x12 };
+    Extractor extractor;
+    GByteArray *au = g_byte_array_new();
+    GByteArray *base = g_byte_array_new();
+    GstBuffer *buffer;
+
+    extractor_init(&extractor, "unregistered");
+
+    // Message size past the end of the NAL unit: not ours, the SEI stays
+    g_byte_array_set_size(au, 0);
+    append_sei(au, SEI_UUID_SIZE, data, sizeof(data), SEI_UUID_SIZE + sizeof(data) + 40);
+    append_slice(au);
+    extractor_push(&extractor, au, NULL);
+
+    // Message shorter than the UUID
+    g_byte_array_set_size(au, 0);
+    append_sei(au, 8, NULL, 0, 8);
+    append_slice(au);
+    extractor_push(&extractor, au, NULL);
+
+    // Start code cut from its NAL unit header, or alone
+    g_byte_array_set_size(au, 0);
+    append_slice(au);
+    append_bytes(au, start_code_only, sizeof(start_code_only));
+    extractor_push(&extractor, au, NULL);
+    g_byte_array_set_size(au, 0);
+    append_bytes(au, start_code_only, 3);
+    extractor_push(&extractor, au, NULL);
+    assert_nothing_recovered(&extractor);
+
+    // Our SEIs leave the base stream even when their data is dropped
+    append_slice(base);
+    g_byte_array_set_size(au, 0);
+    append_user_data(au, NULL, 0);
+    append_user_data(au, orphan_fragment, sizeof(orphan_fragment));
+    append_slice(au);
+    extractor_push(&extractor, au, base);
+    g_byte_array_set_size(au, 0);
+    append_user_data(au, first_fragment, sizeof(first_fragment));
+    append_slice(au);
+    extractor_push(&extractor, au, base);
+    g_byte_array_set_size(au, 0);
+    append_user_data(au, early_fragment, sizeof(early_fragment));
+    append_slice(au);
+    extractor_push(&extractor, au, base);
+    assert_nothing_recovered(&extractor);
+
+    g_byte_array_set_size(au, 0);
+    append_user_data(au, bad_compact, sizeof(bad_compact));
+    append_slice(au);
+    extractor_push(&extractor, au, base);
+    buffer = gst_harness_pull(extractor.recovered);
+    g_assert_nonnull(buffer);
+    g_assert_cmpuint(gst_buffer_get_size(buffer), ==, sizeof(bad_compact));
+    g_assert_cmpint(gst_buffer_memcmp(buffer, 0, bad_compact, sizeof(bad_compact)), ==, 0);
+    gst_buffer_unref(buffer);
+    assert_nothing_recovered(&extractor);
+
+    g_byte_array_unref(base);
+    g_byte_array_unref(au);
+    extractor_clear(&extractor);
+}
+
+/* Only the configured message type is extracted, the other one stays in
+ * the base stream even with the LCEVC UUID or codes */
+static void
+test_sei_type_filter(void)
+{
+    static const guint8 uuid_data[] = { 0x21, 0x22, 0x23, 0x24 };
+    static const guint8 t35_data[] = { 0x31, 0x32, 0x33 };
+    const gchar *sei_types[] = { "unregistered", "registered-t35" };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(sei_types); i++) {
+        gboolean t35 = i == 1;
+        Extractor extractor;
+        GByteArray *au = g_byte_array_new();
+        GByteArray *base = g_byte_array_new();
+        GstBuffer *buffer;
+
+        extractor_init(&extractor, sei_types[i]);
+
+        if (t35) {
+            append_user_data(base, uuid_data, sizeof(uuid_data));
+        } else {
+            append_t35_user_data(base, t35_data, sizeof(t35_data));
+        }
+        append_slice(base);
+        append_user_data(au, uuid_data, sizeof(uuid_data));
+        append_t35_user_data(au, t35_data, sizeof(t35_data));
+        append_slice(au);
+        extractor_push(&extractor, au, base);
+
+        buffer = gst_harness_pull(extractor.recovered);
+        g_assert_nonnull(buffer);
+        if (t35) {
+            g_assert_cmpuint(gst_buffer_get_size(buffer), ==, sizeof(t35_data));
+            g_assert_cmpint(gst_buffer_memcmp(buffer, 0, t35_data, sizeof(t35_data)), ==, 0);
+        } else {
+            g_assert_cmpuint(gst_buffer_get_size(buffer), ==, sizeof(uuid_data));
+            g_assert_cmpint(gst_buffer_memcmp(buffer, 0, uuid_data, sizeof(uuid_data)), ==, 0);
+        }
+        gst_buffer_unref(buffer);
+        assert_nothing_recovered(&extractor);
+
+        g_byte_array_unref(base);
+        g_byte_array_unref(au);
+        extractor_clear(&extractor);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    gst_init(&argc, &argv);
+    g_test_init(&argc, &argv, NULL);
+
+    // Elements built into the test, no registry needed
+    gst_element_register(NULL, "lvcompositor", GST_RANK_NONE, GST_TYPE_LV_COMPOSITOR);
+    gst_element_register(NULL, "lvextractor", GST_RANK_NONE, GST_TYPE_LV_EXTRACTOR);
+
+    g_test_add_func("/sei-roundtrip/escaped-payloads", test_escaped_payloads);
+    g_test_add_func("/sei-roundtrip/spread-fragments", test_spread_fragments);
+    g_test_add_func("/sei-roundtrip/max-sei-nal-size", test_max_sei_nal_size);
+    g_test_add_func("/sei-roundtrip/compact-payloads", test_compact_payloads);
+    g_test_add_func("/sei-roundtrip/in-place", test_in_place);
+    g_test_add_func("/sei-roundtrip/length-prefixed", test_length_prefixed);
+    g_test_add_func("/sei-roundtrip/truncated-and-invalid", test_truncated_and_invalid);
+    g_test_add_func("/sei-roundtrip/sei-type-filter", test_sei_type_filter);
+
+    return g_test_run();
+}